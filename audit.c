@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "audit.h"
+
+#define AUDIT_BATCH 256                         // records appended with one write()
+
+AuditSlot *auditRing = NULL;        // NULL unless the flusher is running
+uint64_t auditHead = 0;             // the next position to be written, taken with compare-and-swap
+uint64_t auditTail = 0;             // the next position the flusher reads
+uint32_t auditLost = 0;             // records dropped since the flusher last logged it
+int auditFd = -1;                   // the log, -1 if auditing is off
+int auditWakeFd = -1;               // eventfd: the ring is half full, or the shell is exiting
+int auditStopping = 0;
+volatile sig_atomic_t auditDirect = 0;  // records go straight to the file, as in a forked copy
+pid_t auditShellPid = 0;
+pthread_t auditFlusher;
+int auditFlusherRunning = 0;        // "auditFlusher" is a thread of this process, to be joined
+int auditHandlers = 0;              // the exit and fork handlers are registered
+AuditRecord auditBatch[AUDIT_BATCH];
+
+// append "n" bytes to the log; a failed write loses them, the command goes on
+//
+void writeAuditLog(const void *data, size_t n)
+{
+    for (size_t done = 0; done < n; )
+    {
+        ssize_t written = write(auditFd, (const char *)data + done, n - done);
+
+        if (written == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (written <= 0)
+        {
+            return;
+        }
+
+        done += (size_t)written;
+    }
+}
+
+uint64_t auditClock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+// put a record in the ring, or drop it if the ring is full
+//
+// note: the slot is claimed by moving "auditHead" on with compare-and-swap, then
+// filled and published by its sequence; a signal handler logging in between
+// takes the next slot, and the flusher waits for this one to be published
+//
+void putAuditRecord(const AuditRecord *rp)
+{
+    int savedErrno = errno;
+
+    if (auditDirect)
+    {
+        writeAuditLog(rp, sizeof(AuditRecord));
+        errno = savedErrno;
+        return;
+    }
+
+    uint64_t position = __atomic_load_n(&auditHead, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        AuditSlot *sp = &auditRing[position & (AUDIT_RING_SIZE - 1)];
+        int64_t ahead = (int64_t)(__atomic_load_n(&sp->sequence, __ATOMIC_ACQUIRE) - position);
+
+        if (ahead < 0)
+        {
+            // a whole ring behind: the flusher cannot keep up, and no command waits for it
+            __atomic_fetch_add(&auditLost, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        if (ahead > 0)
+        {
+            position = __atomic_load_n(&auditHead, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(&auditHead, &position, position + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            sp->record = *rp;
+            __atomic_store_n(&sp->sequence, position + 1, __ATOMIC_RELEASE);
+
+            // else the flusher's timer is soon enough
+            if ((position & (AUDIT_RING_SIZE / 2 - 1)) == AUDIT_RING_SIZE / 2 - 1)
+            {
+                uint64_t one = 1;
+                write(auditWakeFd, &one, sizeof(one));
+            }
+            break;
+        }
+    }
+
+    errno = savedErrno;
+}
+
+// move the published records from the ring to the file
+//
+void flushAudit(void)
+{
+    int n = 0;
+    uint32_t lost = __atomic_exchange_n(&auditLost, 0, __ATOMIC_RELAXED);
+
+    if (lost)
+    {
+        memset(&auditBatch[n], 0, sizeof(AuditRecord));
+        auditBatch[n].time = auditClock();
+        auditBatch[n].type = AUDIT_LOST;
+        auditBatch[n++].value = (int32_t)lost;
+    }
+
+    for (;;)
+    {
+        AuditSlot *sp = &auditRing[auditTail & (AUDIT_RING_SIZE - 1)];
+
+        if (__atomic_load_n(&sp->sequence, __ATOMIC_ACQUIRE) != auditTail + 1)
+        {
+            break;
+        }
+
+        auditBatch[n++] = sp->record;
+
+        // the slot is free for the next time round the ring
+        __atomic_store_n(&sp->sequence, auditTail + AUDIT_RING_SIZE, __ATOMIC_RELEASE);
+        auditTail++;
+
+        if (n == AUDIT_BATCH)
+        {
+            writeAuditLog(auditBatch, sizeof(AuditRecord) * (size_t)n);
+            n = 0;
+        }
+    }
+
+    if (n > 0)
+    {
+        writeAuditLog(auditBatch, sizeof(AuditRecord) * (size_t)n);
+    }
+}
+
+void *runAuditFlusher(void *unused)
+{
+    (void)unused;
+
+    for (;;)
+    {
+        int stopping = __atomic_load_n(&auditStopping, __ATOMIC_ACQUIRE);
+        struct pollfd pfd = { auditWakeFd, POLLIN, 0 };
+
+        if (!stopping && poll(&pfd, 1, AUDIT_FLUSH_MILLIS) > 0)
+        {
+            uint64_t count;
+            read(auditWakeFd, &count, sizeof(count));
+        }
+
+        flushAudit();
+
+        if (stopping)
+        {
+            return NULL;
+        }
+    }
+}
+
+// the flusher is a thread of the shell alone: a forked copy writes for itself
+//
+void auditForked(void)
+{
+    auditDirect = 1;
+    auditFlusherRunning = 0;
+    auditShellPid = getpid();
+}
+
+void stopAudit(void)
+{
+    if (auditFd == -1)
+    {
+        return;
+    }
+
+    // the SIGCHLD handler logs, and must not find the ring half released
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, &oldMask);
+
+    // let the flusher empty the ring
+    if (auditFlusherRunning)
+    {
+        uint64_t one = 1;
+
+        __atomic_store_n(&auditStopping, 1, __ATOMIC_RELEASE);
+        write(auditWakeFd, &one, sizeof(one));
+        pthread_join(auditFlusher, NULL);
+    }
+
+    close(auditFd);
+
+    if (auditWakeFd != -1)
+    {
+        close(auditWakeFd);
+    }
+
+    free(auditRing);
+    auditRing = NULL;
+    auditFd = -1;
+    auditWakeFd = -1;
+    auditHead = 0;
+    auditTail = 0;
+    auditLost = 0;
+    auditStopping = 0;
+    auditDirect = 0;
+    auditFlusherRunning = 0;
+
+    pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+}
+
+void startAudit(void)
+{
+    const char *file = getenv(AUDIT_VARIABLE);
+
+    if (file == NULL || *file == '\0' || auditFd != -1)
+    {
+        return;
+    }
+
+    // only the shell that creates the file writes its header
+    int fd = open(file, O_WRONLY | O_APPEND | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    int created = (fd != -1);
+
+    if (fd == -1 && errno == EEXIST)
+    {
+        fd = open(file, O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+
+    if (fd == -1)
+    {
+        perror(file);
+        return;
+    }
+
+    auditFd = fd;
+    auditShellPid = getpid();
+
+    if (created)
+    {
+        writeAuditLog(AUDIT_MAGIC, strlen(AUDIT_MAGIC));
+    }
+
+    if (!auditHandlers)
+    {
+        pthread_atfork(NULL, NULL, auditForked);
+        atexit(stopAudit);
+        auditHandlers = 1;
+    }
+
+    AuditSlot *ring = malloc(sizeof(AuditSlot) * AUDIT_RING_SIZE);
+    auditWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (ring == NULL || auditWakeFd == -1)
+    {
+        // no ring: each record is written as it is made
+        free(ring);
+        auditDirect = 1;
+        return;
+    }
+
+    for (uint64_t i = 0; i < AUDIT_RING_SIZE; i++)
+    {
+        ring[i].sequence = i;
+    }
+
+    auditRing = ring;
+
+    // the shell's signals, SIGCHLD above all, must not go to the thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int error = pthread_create(&auditFlusher, NULL, runAuditFlusher, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (error != 0)
+    {
+        fprintf(stderr, "audit: %s\n", strerror(error));
+        auditDirect = 1;
+        return;
+    }
+
+    auditFlusherRunning = 1;
+}
+
+void auditStart(pid_t pid, const char *command)
+{
+    if (auditFd == -1)
+    {
+        return;
+    }
+
+    AuditRecord record;
+    size_t length = strnlen(command, AUDIT_COMMAND_MAX);
+
+    record.time = auditClock();
+    record.pid = (int32_t)pid;
+    record.value = (int32_t)auditShellPid;
+    record.type = AUDIT_START;
+
+    // a long command goes on in AUDIT_TEXT_MORE records
+    do
+    {
+        record.length = (uint8_t)(length < AUDIT_TEXT ? length : AUDIT_TEXT);
+        memcpy(record.text, command, record.length);
+        memset(record.text + record.length, 0, AUDIT_TEXT - record.length);
+        putAuditRecord(&record);
+
+        command += record.length;
+        length -= record.length;
+        record.type = AUDIT_TEXT_MORE;
+    } while (length > 0);
+}
+
+void auditStartWords(pid_t pid, char *const words[], int count)
+{
+    char command[AUDIT_COMMAND_MAX];
+    size_t at = 0;
+
+    if (auditFd == -1)
+    {
+        return;
+    }
+
+    for (int i = 0; i < count && at < sizeof(command) - 1; i++)
+    {
+        size_t n = strnlen(words[i], sizeof(command) - 1 - at - (i > 0));
+
+        if (i > 0)
+        {
+            command[at++] = ' ';
+        }
+
+        memcpy(command + at, words[i], n);
+        at += n;
+    }
+
+    command[at] = '\0';
+    auditStart(pid, command);
+}
+
+void auditEnd(pid_t pid, int status)
+{
+    if (auditFd == -1)
+    {
+        return;
+    }
+
+    AuditRecord record;
+
+    memset(&record, 0, sizeof(record));
+    record.time = auditClock();
+    record.pid = (int32_t)pid;
+    record.value = status;
+    record.type = AUDIT_END;
+    putAuditRecord(&record);
+}
@@ -0,0 +1,76 @@
+#ifndef AUDIT_H
+#define AUDIT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define AUDIT_VARIABLE "AUDIT_LOG"              // the log file; no auditing if it is not set
+#define AUDIT_MAGIC "SSHAUDT1"                  // at the start of the file
+#define AUDIT_RING_SIZE 4096                    // records waiting for the flusher, must be a power of two
+#define AUDIT_FLUSH_MILLIS 100                  // longest time a record waits in the ring
+#define AUDIT_TEXT 46                           // bytes of the command in each record
+#define AUDIT_COMMAND_MAX 1024                  // longest command logged, the rest is cut
+
+// record types
+#define AUDIT_START 1                           // a process started; "value" is the shell's pid
+#define AUDIT_TEXT_MORE 2                       // more of the command of the last AUDIT_START of "pid"
+#define AUDIT_END   3                           // a process was reaped; "value" is its wait status
+#define AUDIT_LOST  4                           // "value" records were dropped, the ring being full
+
+struct AuditRecordStruct
+{
+    uint64_t time;                  // nanoseconds since the epoch
+    int32_t pid;                    // the process started or reaped
+    int32_t value;                  // as given by the type
+    uint8_t type;                   // one of the record types above
+    uint8_t length;                 // bytes of "text" used
+    char text[AUDIT_TEXT];          // the command, for AUDIT_START and AUDIT_TEXT_MORE
+};
+
+typedef struct AuditRecordStruct AuditRecord;  // 64 byte log record type
+
+struct AuditSlotStruct
+{
+    uint64_t sequence;              // the position the slot can next be written at, plus one once it is full
+    AuditRecord record;
+};
+
+typedef struct AuditSlotStruct AuditSlot;  // ring slot type
+
+
+// purpose:
+//		start auditing to the file named by AUDIT_VARIABLE, if it is set
+//
+// note:
+//		records are put in a lock-free ring and a background thread appends them
+//		to the file in batches; a record costs the command that logs it a clock
+//		read, one compare-and-swap and a copy. A forked copy of the shell writes
+//		its records to the file itself, it has no flusher.
+//
+void startAudit(void);
+
+// purpose:
+//		stop auditing: the flusher empties the ring into the file and is joined,
+//		and the file, the ring and the flusher's descriptor are released, so
+//		startAudit() can start again
+//
+// note:
+//		called at exit too
+//
+void stopAudit(void);
+
+// purpose:
+//		log the start of process "pid" running "command", or the words of one
+//
+void auditStart(pid_t pid, const char *command);
+void auditStartWords(pid_t pid, char *const words[], int count);
+
+// purpose:
+//		log that process "pid" has been reaped with wait status "status"
+//
+// note:
+//		safe to call from the SIGCHLD handler
+//
+void auditEnd(pid_t pid, int status);
+
+#endif
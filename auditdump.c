@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "audit.h"
+
+// auditdump - print an audit log, one line per command once it has been reaped:
+//
+//		start time, run time, pid, the shell's pid, how it ended, the command
+//
+// usage: auditdump [file], the file being AUDIT_LOG if it is not given
+
+struct StartedStruct
+{
+    int32_t pid;
+    int32_t shellPid;
+    uint64_t time;
+    char command[AUDIT_COMMAND_MAX];
+    size_t length;
+};
+
+typedef struct StartedStruct Started;  // command not yet reaped type
+
+Started *started = NULL;
+int nStarted = 0;
+int startedSize = 0;
+
+// the command started as "pid", NULL if its start is not in the log
+//
+Started *findStarted(int32_t pid)
+{
+    for (int i = nStarted - 1; i >= 0; i--)
+    {
+        if (started[i].pid == pid)
+        {
+            return &started[i];
+        }
+    }
+
+    return NULL;
+}
+
+void printTime(uint64_t nanos)
+{
+    time_t seconds = (time_t)(nanos / 1000000000);
+    struct tm tm;
+    char text[32];
+
+    localtime_r(&seconds, &tm);
+    strftime(text, sizeof(text), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%06lu", text, (unsigned long)(nanos % 1000000000 / 1000));
+}
+
+void printCommand(const Started *sp, uint64_t end, int status, int ended)
+{
+    char how[32];
+
+    if (!ended)
+    {
+        snprintf(how, sizeof(how), "running");
+    }
+    else if (WIFSIGNALED(status))
+    {
+        snprintf(how, sizeof(how), "signal %d", WTERMSIG(status));
+    }
+    else
+    {
+        snprintf(how, sizeof(how), "exit %d", WEXITSTATUS(status));
+    }
+
+    printTime(sp->time);
+
+    if (ended && end >= sp->time)
+    {
+        printf(" %12.6f s", (end - sp->time) / 1e9);
+    }
+    else
+    {
+        printf(" %14s", "-");
+    }
+
+    printf(" %7d %7d  %-10s %.*s\n", sp->pid, sp->shellPid, how, (int)sp->length, sp->command);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *file = (argc > 1) ? argv[1] : getenv(AUDIT_VARIABLE);
+    char magic[sizeof(AUDIT_MAGIC) - 1];
+    AuditRecord record;
+
+    if (file == NULL || argc > 2)
+    {
+        fprintf(stderr, "usage: auditdump [file]\n");
+        return 2;
+    }
+
+    FILE *fp = fopen(file, "rb");
+
+    if (fp == NULL)
+    {
+        perror(file);
+        return 1;
+    }
+
+    if (fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, AUDIT_MAGIC, sizeof(magic)) != 0)
+    {
+        fprintf(stderr, "%s: not an audit log\n", file);
+        return 1;
+    }
+
+    while (fread(&record, sizeof(record), 1, fp) == 1)
+    {
+        Started *sp = findStarted(record.pid);
+        size_t length = record.length < AUDIT_TEXT ? record.length : AUDIT_TEXT;
+
+        switch (record.type)
+        {
+            case AUDIT_START:
+                if (nStarted == startedSize)
+                {
+                    startedSize = startedSize ? startedSize * 2 : 64;
+                    started = realloc(started, sizeof(Started) * (size_t)startedSize);
+
+                    if (started == NULL)
+                    {
+                        perror("realloc()");
+                        return 1;
+                    }
+                }
+
+                sp = &started[nStarted++];
+                sp->pid = record.pid;
+                sp->shellPid = record.value;
+                sp->time = record.time;
+                sp->length = 0;
+                // the text follows, as for AUDIT_TEXT_MORE
+                // fall through
+            case AUDIT_TEXT_MORE:
+                if (sp != NULL && sp->length + length <= sizeof(sp->command))
+                {
+                    memcpy(sp->command + sp->length, record.text, length);
+                    sp->length += length;
+                }
+                break;
+
+            case AUDIT_END:
+                if (sp == NULL)
+                {
+                    Started unknown = { record.pid, 0, record.time, "?", 1 };
+                    printCommand(&unknown, record.time, record.value, 1);
+                }
+                else
+                {
+                    printCommand(sp, record.time, record.value, 1);
+                    *sp = started[--nStarted];
+                }
+                break;
+
+            case AUDIT_LOST:
+                printTime(record.time);
+                printf(" %d records lost, the log could not keep up\n", record.value);
+                break;
+
+            default:
+                fprintf(stderr, "%s: unknown record type %d\n", file, record.type);
+                break;
+        }
+    }
+
+    // still running when the log ends, or the shell was killed before reaping them
+    for (int i = 0; i < nStarted; i++)
+    {
+        printCommand(&started[i], 0, 0, 0);
+    }
+
+    fclose(fp);
+    free(started);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/sh
+# Benchmark: command launch latency as the shell's resident set grows, with
+# and without the fork server.
+# Each run first grows the shell by storing a large variable, then launches
+# /bin/true N times; a run without the launches is subtracted so that only
+# the launches are timed.
+#
+# usage: bench/forkserver.sh [shell] [launches]
+
+SHELL_UNDER_TEST=${1:-./simpleShell}
+N=${2:-1000}
+
+# the fastest of three runs, in nanoseconds
+elapsed()
+{
+    best=
+    for run in 1 2 3
+    do
+        start=$(date +%s%N)
+        printf '%s\n' "$1" | FORK_SERVER=$2 "$SHELL_UNDER_TEST" > /dev/null
+        end=$(date +%s%N)
+        if [ -z "$best" ] || [ $((end - start)) -lt "$best" ]; then best=$((end - start)); fi
+    done
+    echo $best
+}
+
+printf '%-10s %18s %18s\n' "grown by" "fork() us/launch" "server us/launch"
+
+for mb in 0 16 64 128
+do
+    grow="BIG=\$(head -c ${mb}000000 /dev/zero | tr -c x x)"
+    loop="for i in \$(seq $N); do /bin/true; done"
+
+    for server in 0 1
+    do
+        base=$(elapsed "$grow" $server)
+        total=$(elapsed "$grow; $loop" $server)
+        eval "us$server=$(( (total - base) / N / 1000 ))"
+    done
+
+    printf '%-10s %18s %18s\n' "${mb} MB" "$us0" "$us1"
+done
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Benchmark: a 1,000,000 iteration for loop with a builtin body.
+# The loop is parsed once and its body runs in-process, so the time is all
+# word expansion and builtin dispatch - no lexing and no fork per iteration.
+#
+# usage: bench/loop.sh [shell] [iterations]
+
+SHELL_UNDER_TEST=${1:-./simpleShell}
+N=${2:-1000000}
+LOOP='for i in $(seq '$N'); do : $i; done'
+
+run()
+{
+    start=$(date +%s%N)
+    echo "$LOOP" | "$@" > /dev/null
+    end=$(date +%s%N)
+    echo "$(( (end - start) / 1000000 )) ms"
+}
+
+echo "$N iterations"
+printf '%-16s' "$SHELL_UNDER_TEST:"; run "$SHELL_UNDER_TEST"
+printf '%-16s' "/bin/sh:"; run /bin/sh
@@ -0,0 +1,28 @@
+#!/bin/sh
+# Benchmark: record a session of N lines - builtins, variable changes, cd and
+# external commands - then replay it with no waiting between lines and print
+# the replay's latency report against the recording.
+#
+# usage: bench/replay.sh [shell] [lines]
+
+SHELL_UNDER_TEST=${1:-./simpleShell}
+N=${2:-2000}
+TRACE=$(mktemp)
+
+i=0
+while [ $i -lt $N ]
+do
+    case $((i % 5)) in
+        0) echo ": $i" ;;
+        1) echo "export STEP=$i" ;;
+        2) echo "cd /tmp" ;;
+        3) echo "/bin/true" ;;
+        4) echo "echo \$STEP > /dev/null" ;;
+    esac
+    i=$((i + 1))
+done | "$SHELL_UNDER_TEST" --record "$TRACE" > /dev/null
+
+echo "trace: $N lines, $(wc -c < "$TRACE") bytes"
+"$SHELL_UNDER_TEST" --replay "$TRACE" max < /dev/null 2>&1 > /dev/null | sed 's/^replay: //'
+
+rm -f "$TRACE"
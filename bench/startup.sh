@@ -0,0 +1,90 @@
+#!/bin/sh
+# Benchmark: time from starting an interactive shell to its first prompt, and from
+# the first ^R to the search prompt, with a history file of N lines indexed on that
+# ^R, in four cases:
+#
+#   none         no snapshot (SNAPSHOT=0), the file is indexed at every first ^R
+#   cold         no snapshot yet, the file is indexed and the snapshot written
+#   warm         the snapshot is current and is mapped instead
+#   invalidated  the history file was replaced, so it is indexed and saved again
+#
+# The shell runs on a pseudo-terminal, which needs python3.
+#
+# usage: bench/startup.sh [shell] [lines] [runs]
+
+SHELL_UNDER_TEST=${1:-./simpleShell}
+N=${2:-200000}
+RUNS=${3:-9}
+DIR=$(mktemp -d)
+
+export HISTFILE="$DIR/history"
+export TERM=xterm
+
+# lines repeat, as typed commands do: N lines, N/5 of them distinct
+awk -v n="$N" 'BEGIN { for (i = 0; i < n; i++) { j = i % int(n / 5 + 1); printf "make -C src/module%d target%d && echo built %d\n", j, j % 7, j } }' > "$HISTFILE"
+
+cat > "$DIR/ready.py" <<'PY'
+import os, pty, select, sys, time
+
+# read until "text" has been seen
+def wait(fd, text):
+    seen = b""
+    while text not in seen and select.select([fd], [], [], 30)[0]:
+        seen += os.read(fd, 4096)
+
+start = time.monotonic()
+pid, fd = pty.fork()
+
+if pid == 0:
+    os.execv(sys.argv[1], [sys.argv[1]])
+
+wait(fd, b"%")
+ready = time.monotonic()
+
+os.write(fd, b"\x12")
+wait(fd, b"reverse-i-search")
+searching = time.monotonic()
+
+os.write(fd, b"\x07exit\r")
+
+try:
+    while os.read(fd, 4096):
+        pass
+except OSError:
+    pass
+
+os.waitpid(pid, 0)
+print("%.2f %.2f" % ((ready - start) * 1000, (searching - ready) * 1000))
+PY
+
+# the median of column "$1" of "$DIR/times"
+median()
+{
+    cut -d' ' -f"$1" "$DIR/times" | sort -n | awk '{ t[NR] = $1 } END { printf "%8.2f", t[int((NR + 1) / 2)] }'
+}
+
+# run the shell RUNS times after "$2", printing the medians of both times
+measure()
+{
+    i=0
+    : > "$DIR/times"
+    while [ $i -lt $RUNS ]
+    do
+        eval "$2"
+        python3 "$DIR/ready.py" "$SHELL_UNDER_TEST" >> "$DIR/times"
+        i=$((i + 1))
+    done
+    printf "%-12s prompt %s ms   first ^R %s ms\n" "$1" "$(median 1)" "$(median 2)"
+}
+
+echo "history: $N lines, $(wc -c < "$HISTFILE") bytes"
+
+SNAPSHOT=0 measure none ":"
+
+export SNAPSHOT="$DIR/snapshot"
+measure cold "rm -f '$SNAPSHOT'"
+echo "snapshot: $(wc -c < "$SNAPSHOT") bytes"
+measure warm ":"
+measure invalidated "cp '$HISTFILE' '$HISTFILE.new' && mv '$HISTFILE.new' '$HISTFILE'"
+
+rm -rf "$DIR"
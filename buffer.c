@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "buffer.h"
+
+void bufferInit(Buffer *bp)
+{
+    bp->data = NULL;
+    bp->len = 0;
+    bp->cap = 0;
+}
+
+void bufferFree(Buffer *bp)
+{
+    free(bp->data);
+    bufferInit(bp);
+}
+
+int bufferReserve(Buffer *bp, size_t extra)
+{
+    size_t needed = bp->len + extra + 1;
+
+    if (needed <= bp->cap)
+    {
+        return 0;
+    }
+
+    // grow geometrically so a long stream of appends stays linear
+    size_t cap = bp->cap ? bp->cap : BUFFER_INITIAL_SIZE;
+
+    while (cap < needed)
+    {
+        cap *= 2;
+    }
+
+    char *data = realloc(bp->data, cap);
+
+    if (data == NULL)
+    {
+        return -1;
+    }
+
+    bp->data = data;
+    bp->cap = cap;
+    bp->data[bp->len] = '\0';
+
+    return 0;
+}
+
+int bufferAppend(Buffer *bp, const char *data, size_t n)
+{
+    if (bufferReserve(bp, n) == -1)
+    {
+        return -1;
+    }
+
+    memcpy(bp->data + bp->len, data, n);
+    bp->len += n;
+    bp->data[bp->len] = '\0';
+
+    return 0;
+}
+
+int bufferAppendString(Buffer *bp, const char *str)
+{
+    return bufferAppend(bp, str, strlen(str));
+}
+
+int bufferAppendChar(Buffer *bp, char c)
+{
+    return bufferAppend(bp, &c, 1);
+}
+
+long bufferReadFd(Buffer *bp, int fd)
+{
+    long total = 0;
+
+    for (;;)
+    {
+        if (bufferReserve(bp, BUFFER_READ_SIZE) == -1)
+        {
+            return -1;
+        }
+
+        // read directly into the unused tail of the buffer
+        ssize_t n = read(fd, bp->data + bp->len, bp->cap - bp->len - 1);
+
+        if (n == 0)
+        {
+            break;
+        }
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        bp->len += n;
+        total += n;
+    }
+
+    bp->data[bp->len] = '\0';
+
+    return total;
+}
+
+void bufferChompNewlines(Buffer *bp)
+{
+    while (bp->len > 0 && bp->data[bp->len - 1] == '\n')
+    {
+        bp->len--;
+    }
+
+    if (bp->data)
+    {
+        bp->data[bp->len] = '\0';
+    }
+}
+
+char *bufferRelease(Buffer *bp)
+{
+    char *data = bp->data;
+
+    if (data == NULL)
+    {
+        data = strdup("");
+    }
+
+    bufferInit(bp);
+
+    return data;
+}
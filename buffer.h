@@ -0,0 +1,71 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+
+#define BUFFER_INITIAL_SIZE 4096
+#define BUFFER_READ_SIZE 65536          // minimum free space offered to each read()
+
+struct BufferStruct
+{
+    char *data;         // the bytes held by the buffer, always NUL terminated when data != NULL
+    size_t len;         // number of bytes in use, not counting the terminating NUL
+    size_t cap;         // number of bytes allocated for "data"
+};
+
+typedef struct BufferStruct Buffer;    // growing byte buffer type
+
+
+// purpose:
+//		initialise an empty buffer, no memory is allocated until the first append
+//
+void bufferInit(Buffer *bp);
+
+// purpose:
+//		release the memory held by the buffer and make it empty again
+//
+void bufferFree(Buffer *bp);
+
+// purpose:
+//		make sure at least "extra" more bytes (plus the NUL) fit in the buffer
+//
+// return:
+//		0 if successful, -1 if the memory cannot be allocated
+//
+int bufferReserve(Buffer *bp, size_t extra);
+
+// purpose:
+//		append "n" bytes from "data", or a NUL terminated string, to the buffer
+//
+// return:
+//		0 if successful, -1 if the memory cannot be allocated
+//
+int bufferAppend(Buffer *bp, const char *data, size_t n);
+int bufferAppendString(Buffer *bp, const char *str);
+int bufferAppendChar(Buffer *bp, char c);
+
+// purpose:
+//		read from "fd" until end of file, straight into the free space of the buffer
+//
+// return:
+//		the number of bytes read, or -1 on a read or allocation error
+//
+// note:
+//		every read() is offered at least BUFFER_READ_SIZE bytes, so large outputs
+//		are drained with few system calls and no intermediate copies
+//
+long bufferReadFd(Buffer *bp, int fd);
+
+// purpose:
+//		drop the trailing newlines, as command substitution requires; only the
+//		length is adjusted, nothing is copied
+//
+void bufferChompNewlines(Buffer *bp);
+
+// purpose:
+//		hand the contents over to the caller as a NUL terminated string and leave
+//		the buffer empty; the caller frees the string
+//
+char *bufferRelease(Buffer *bp);
+
+#endif
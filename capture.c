@@ -0,0 +1,514 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+
+#include "jobs.h"
+#include "capture.h"
+#include "memtags.h"
+
+Capture captures[MAX_JOBS];
+int nCaptures = 0;
+size_t ringSize = 0;                // bytes kept per job, 0 when capture mode is off
+int epollFd = -1;                   // the pipes of the jobs still writing
+int nOpen = 0;                      // number of those pipes
+pid_t captureOwner = 0;             // the process the pipes belong to
+
+// parse a number of bytes with an optional K or M suffix
+//
+int parseRingSize(const char *text, size_t *size)
+{
+    char *end;
+    unsigned long value = strtoul(text, &end, 10);
+
+    if (end == text)
+    {
+        return -1;
+    }
+
+    if (*end == 'K' || *end == 'k')
+    {
+        value *= 1024;
+        end++;
+    }
+    else if (*end == 'M' || *end == 'm')
+    {
+        value *= 1024 * 1024;
+        end++;
+    }
+
+    if (*end != '\0' || value > CAPTURE_MAX_SIZE)
+    {
+        return -1;
+    }
+
+    *size = value;
+    return 0;
+}
+
+void initialiseCapture(void)
+{
+    const char *size = getenv(CAPTURE_VARIABLE);
+
+    captureOwner = getpid();
+
+    if (size && parseRingSize(size, &ringSize) == -1)
+    {
+        fprintf(stderr, "%s: %s: not a size\n", CAPTURE_VARIABLE, size);
+        ringSize = 0;
+    }
+}
+
+// a forked copy of the shell inherits the pipes, but the output is the parent's
+//
+void forgetInheritedCaptures(void)
+{
+    pid_t self = getpid();
+
+    if (captureOwner != self)
+    {
+        for (int i = 0; i < nCaptures; i++)
+        {
+            if (captures[i].fd != -1)
+            {
+                close(captures[i].fd);
+            }
+            tagFree(MEM_JOBS, captures[i].ring);
+        }
+
+        if (epollFd != -1)
+        {
+            close(epollFd);
+        }
+
+        nCaptures = 0;
+        nOpen = 0;
+        epollFd = -1;
+        captureOwner = self;
+    }
+}
+
+int openCapture(int fds[2])
+{
+    fds[0] = fds[1] = -1;
+
+    if (ringSize == 0)
+    {
+        return -1;
+    }
+
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+        perror("joblog: pipe");
+        fds[0] = fds[1] = -1;
+        return -1;
+    }
+
+    // only the shell's end: the job's writes must block as usual
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    return 0;
+}
+
+void redirectToCapture(int fds[2], int output)
+{
+    if (fds[1] == -1)
+    {
+        return;
+    }
+
+    if (output)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+    }
+
+    dup2(fds[1], STDERR_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void discardCapture(int fds[2])
+{
+    if (fds[0] != -1)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        fds[0] = fds[1] = -1;
+    }
+}
+
+// the capture to use for a new job: a free one, one with the same job
+// number, or else the oldest finished one
+//
+Capture *newCapture(int jobId)
+{
+    Capture *finished = NULL;
+
+    for (int i = 0; i < nCaptures; i++)
+    {
+        if (captures[i].jobId == jobId && jobId != -1)
+        {
+            return &captures[i];
+        }
+
+        if (finished == NULL && captures[i].fd == -1)
+        {
+            finished = &captures[i];
+        }
+    }
+
+    if (nCaptures < MAX_JOBS)
+    {
+        memset(&captures[nCaptures], 0, sizeof(Capture));
+        captures[nCaptures].fd = -1;
+        return &captures[nCaptures++];
+    }
+
+    return finished;
+}
+
+// stop collecting from a pipe that has reached end of file
+//
+void closeCapture(Capture *cp)
+{
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, cp->fd, NULL);
+    close(cp->fd);
+    cp->fd = -1;
+    nOpen--;
+}
+
+void addCapture(pid_t pid, int jobId, int fds[2], const char *command)
+{
+    forgetInheritedCaptures();
+
+    if (fds[0] == -1)
+    {
+        return;
+    }
+
+    close(fds[1]);
+
+    Capture *cp = newCapture(jobId);
+
+    if (cp != NULL && cp->fd != -1)
+    {
+        // the job that had this number is gone, its pipe with it
+        closeCapture(cp);
+    }
+
+    if (epollFd == -1)
+    {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fds[0];
+
+    char *ring = tagMalloc(MEM_JOBS, ringSize);
+
+    if (cp == NULL || ring == NULL || epollFd == -1 || epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[0], &event) == -1)
+    {
+        // the job's output is lost rather than left to block it
+        fprintf(stderr, "joblog: cannot capture the output of %s\n", command);
+        tagFree(MEM_JOBS, ring);
+        close(fds[0]);
+        return;
+    }
+
+    tagFree(MEM_JOBS, cp->ring);
+    cp->jobId = jobId;
+    cp->pid = pid;
+    cp->fd = fds[0];
+    cp->ring = ring;
+    cp->size = ringSize;
+    cp->start = 0;
+    cp->length = 0;
+    cp->total = 0;
+    snprintf(cp->command, sizeof(cp->command), "%s", command);
+    nOpen++;
+}
+
+void attachCapture(pid_t pid, int jobId)
+{
+    forgetInheritedCaptures();
+
+    for (int i = 0; i < nCaptures; i++)
+    {
+        if (captures[i].jobId == -1 && captures[i].pid == pid)
+        {
+            // an older capture with the same number belongs to a job that is gone
+            for (int k = 0; k < nCaptures; k++)
+            {
+                if (k != i && captures[k].jobId == jobId)
+                {
+                    captures[k].jobId = 0;
+                }
+            }
+
+            captures[i].jobId = jobId;
+            return;
+        }
+    }
+}
+
+int captureActive(void)
+{
+    forgetInheritedCaptures();
+    return nOpen > 0;
+}
+
+int captureFd(void)
+{
+    forgetInheritedCaptures();
+    return nOpen > 0 ? epollFd : -1;
+}
+
+// keep the most recent bytes, overwriting the oldest once the ring is full
+//
+void appendToRing(Capture *cp, const char *data, size_t n)
+{
+    cp->total += n;
+
+    // only the tail of a read larger than the ring can survive
+    if (n > cp->size)
+    {
+        data += n - cp->size;
+        n = cp->size;
+    }
+
+    size_t at = (cp->start + cp->length) % cp->size;
+    size_t first = (n < cp->size - at) ? n : cp->size - at;
+
+    memcpy(cp->ring + at, data, first);
+    memcpy(cp->ring, data + first, n - first);
+
+    if (cp->length + n >= cp->size)
+    {
+        cp->start = (at + n) % cp->size;
+        cp->length = cp->size;
+    }
+    else
+    {
+        cp->length += n;
+    }
+}
+
+// read everything waiting in one job's pipe
+//
+void drainCapture(Capture *cp)
+{
+    char buffer[CAPTURE_READ_SIZE];
+    ssize_t n;
+
+    while ((n = read(cp->fd, buffer, sizeof(buffer))) > 0)
+    {
+        appendToRing(cp, buffer, (size_t)n);
+    }
+
+    if (n == 0 || (errno != EAGAIN && errno != EINTR))
+    {
+        closeCapture(cp);
+    }
+}
+
+void drainCaptures(void)
+{
+    struct epoll_event events[16];
+    int n;
+
+    forgetInheritedCaptures();
+
+    if (nOpen == 0)
+    {
+        return;
+    }
+
+    int savedErrno = errno;
+
+    // one pass, a job that never stops writing must not hold up the shell
+    if ((n = epoll_wait(epollFd, events, 16, 0)) > 0)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            for (int k = 0; k < nCaptures; k++)
+            {
+                if (captures[k].fd != -1 && captures[k].fd == events[i].data.fd)
+                {
+                    drainCapture(&captures[k]);
+                    break;
+                }
+            }
+        }
+    }
+
+    errno = savedErrno;
+}
+
+// find the capture of %n or n
+//
+Capture *findCapture(const char *text)
+{
+    const char *number = (*text == '%') ? text + 1 : text;
+    char *end;
+    long id = strtol(number, &end, 10);
+
+    if (*number == '\0' || *end != '\0')
+    {
+        return NULL;
+    }
+
+    for (int i = 0; i < nCaptures; i++)
+    {
+        if (captures[i].jobId == id && captures[i].ring != NULL)
+        {
+            return &captures[i];
+        }
+    }
+
+    return NULL;
+}
+
+// write the ring's contents, oldest first
+//
+int writeRing(int fd, const Capture *cp)
+{
+    size_t first = cp->size - cp->start;
+
+    if (first > cp->length)
+    {
+        first = cp->length;
+    }
+
+    const char *parts[2] = { cp->ring + cp->start, cp->ring };
+    size_t lengths[2] = { first, cp->length - first };
+
+    for (int i = 0; i < 2; i++)
+    {
+        size_t done = 0;
+
+        while (done < lengths[i])
+        {
+            ssize_t n = write(fd, parts[i] + done, lengths[i] - done);
+
+            if (n == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n == -1)
+            {
+                return -1;
+            }
+            done += (size_t)n;
+        }
+    }
+
+    return 0;
+}
+
+int showJobLog(int argc, char *argv[])
+{
+    const char *file = NULL;
+    int first = 1;
+
+    forgetInheritedCaptures();
+
+    for (; first + 1 < argc && argv[first][0] == '-'; first += 2)
+    {
+        if (strcmp(argv[first], "-s") == 0)
+        {
+            if (parseRingSize(argv[first + 1], &ringSize) == -1)
+            {
+                fprintf(stderr, "joblog: %s: not a size\n", argv[first + 1]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[first], "-o") == 0)
+        {
+            file = argv[first + 1];
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (first < argc && argv[first][0] == '-')
+    {
+        fprintf(stderr, "usage: joblog [-s size] [-o file] [%%job ...]\n");
+        return 1;
+    }
+
+    drainCaptures();
+
+    if (first == argc)
+    {
+        if (ringSize)
+        {
+            printf("capturing %zu bytes per background job\n", ringSize);
+        }
+        else
+        {
+            printf("capture off\n");
+        }
+
+        for (int i = 0; i < nCaptures; i++)
+        {
+            Capture *cp = &captures[i];
+
+            if (cp->jobId > 0 && cp->ring != NULL)
+            {
+                printf("[%d] %-8s %zu bytes, %llu dropped\t%s\n", cp->jobId, cp->fd != -1 ? "Writing" : "Closed",
+                       cp->length, cp->total - cp->length, cp->command);
+            }
+        }
+
+        return 0;
+    }
+
+    int status = 0;
+    int fd = STDOUT_FILENO;
+
+    fflush(stdout);
+
+    // spilled to disk only when asked to
+    if (file && (fd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+    {
+        perror(file);
+        return 1;
+    }
+
+    for (int i = first; i < argc; i++)
+    {
+        Capture *cp = findCapture(argv[i]);
+
+        if (cp == NULL)
+        {
+            fprintf(stderr, "joblog: %s: no captured output\n", argv[i]);
+            status = 1;
+        }
+        else if (writeRing(fd, cp) == -1)
+        {
+            perror(file ? file : "joblog");
+            status = 1;
+        }
+        else if (cp->total > cp->length)
+        {
+            fprintf(stderr, "joblog: %s: the first %llu bytes were dropped\n", argv[i], cp->total - cp->length);
+        }
+    }
+
+    if (file)
+    {
+        close(fd);
+    }
+
+    return status;
+}
@@ -0,0 +1,99 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "jobs.h"
+
+#define CAPTURE_VARIABLE "BG_CAPTURE"           // ring size per job, e.g. 64K, to capture from the start
+#define CAPTURE_MAX_SIZE (64 * 1024 * 1024)     // largest ring accepted
+#define CAPTURE_READ_SIZE 4096                  // bytes read from a job's pipe at once
+
+struct CaptureStruct
+{
+    int jobId;                      // the job number, -1 while the job is queued
+    pid_t pid;                      // the job's first process, to find a queued job once it starts
+    int fd;                         // read end of the job's output pipe, -1 after end of file
+    char *ring;                     // the most recent output, "size" bytes at most
+    size_t size;                    // capacity of "ring"
+    size_t start;                   // index of the oldest byte in "ring"
+    size_t length;                  // bytes in "ring"
+    unsigned long long total;       // bytes read in all, the ones overwritten included
+    char command[MAX_JOB_COMMAND];  // the command line, for joblog
+};
+
+typedef struct CaptureStruct Capture;  // captured job output type
+
+
+// purpose:
+//		set up capture mode from BG_CAPTURE in the environment
+//
+void initialiseCapture(void);
+
+// purpose:
+//		create the pipe for a new background job's output, if capture mode is on
+//
+// return:
+//		0 with the pipe in "fds", or -1 with both set to -1 if output is not captured
+//
+int openCapture(int fds[2]);
+
+// purpose:
+//		in the forked child: send stderr, and stdout if "output" is set, into the pipe
+//		from openCapture(), then close the pipe's own descriptors
+//
+void redirectToCapture(int fds[2], int output);
+
+// purpose:
+//		close the pipe from openCapture() when the job could not be started
+//
+void discardCapture(int fds[2]);
+
+// purpose:
+//		in the shell: start collecting the output of the job whose first process is
+//		"pid", and close the write end
+//
+// note:
+//		"jobId" is -1 for a job that is queued, and set by attachCapture() when it starts
+//
+void addCapture(pid_t pid, int jobId, int fds[2], const char *command);
+
+// purpose:
+//		give a queued job's capture the job number it got when it started
+//
+void attachCapture(pid_t pid, int jobId);
+
+// purpose:
+//		check whether any job's output is still being collected
+//
+int captureActive(void);
+
+// purpose:
+//		a descriptor that polls readable while captured output is waiting, -1 if none
+//
+int captureFd(void);
+
+// purpose:
+//		read the output waiting in the jobs' pipes into their rings, without blocking
+//
+// note:
+//		called from the event loop and after each command, so that a job never
+//		blocks on a full pipe for long; a ring overwrites its oldest bytes
+//
+void drainCaptures(void);
+
+// purpose:
+//		the joblog builtin - joblog [-s size] [-o file] [%job ...]
+//
+// note:
+//		"-s" sets the ring size for new background jobs, 0 to write to the terminal
+//		again. With job numbers, prints each job's recent output, or writes it to
+//		"file" with -o. Without, lists the captured jobs.
+//
+// return:
+//		0 if successful, 1 otherwise
+//
+int showJobLog(int argc, char *argv[]);
+
+#endif
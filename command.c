@@ -6,6 +6,7 @@
 #include <sys/wait.h>
 
 #include "command.h"
+#include "memtags.h"
 
 // return 1 if the token is a command separator
 // return 0 otherwise
@@ -18,31 +19,27 @@ void initialiseCommand(Command *cp)
     cp->sep = NULL;
     cp-> stdin_file = NULL;
     cp->stdout_file = NULL;
-    cp-> argv = malloc(sizeof(char*)*MAX_TOKENS);
+    cp->stderr_file = NULL;
+    cp->stdout_append = 0;
 
-    int i;
-    for (int i = 0; i < MAX_TOKENS; ++i)
-    {
-        cp->argv[i] = malloc(sizeof(char) * MAX_TOKEN_LENGTH);
-    }
+    // the argument vector points into the tokens, buildCommandArgumentArray()
+    // allocates it at its size
+    cp->argv = NULL;
 }
 
 void freeCommand(Command *cp)
 {
-    for (int i = 0; i < MAX_TOKENS; ++i)
-    {
-        free(cp->argv[i]);
-    }
-
-    free(cp->argv);
+    tagFree(MEM_PARSER, cp->argv);
 
     cp->argv = NULL;
 
-    cp->first = NULL;
-    cp->last = NULL;
+    cp->first = 0;
+    cp->last = 0;
     cp->sep = NULL;
     cp->stdin_file = NULL;
     cp->stdout_file = NULL;
+    cp->stderr_file = NULL;
+    cp->stdout_append = 0;
 }
 
 
@@ -63,6 +60,15 @@ int separator(char *token)
     return 0;
 }
 
+// return 1 if the token is a redirection operator
+// return 0 otherwise
+//
+int redirection(char *token)
+{
+    return strcmp(token, "<") == 0 || strcmp(token, ">") == 0 ||
+           strcmp(token, ">>") == 0 || strcmp(token, "2>") == 0;
+}
+
 // fill one command structure with the details
 //
 void fillCommandStructure(Command *cp, int first, int last, char *sep)
@@ -85,10 +91,17 @@ void searchRedirection(char *token[], Command *cp)
             cp->stdin_file = token[i+1];
             ++i;
         }
-        else if (strcmp(token[i], ">") == 0)
+        else if (strcmp(token[i], ">") == 0 || strcmp(token[i], ">>") == 0)
         {
-            // standard output redirection
+            // standard output redirection, ">>" appends
             cp->stdout_file = token[i+1];
+            cp->stdout_append = (token[i][1] == '>');
+            ++i;
+        }
+        else if (strcmp(token[i], "2>") == 0)
+        {
+            // standard error redirection
+            cp->stderr_file = token[i+1];
             ++i;
         }
     }
@@ -97,22 +110,24 @@ void searchRedirection(char *token[], Command *cp)
 // build command line argument vector for execvp function
 void buildCommandArgumentArray(char *token[], Command *cp)
 {
-    int n = (cp->last - cp->first + 1); // the number of tokens in the command
-
-    if (cp->stdin_file != NULL)  // remove 2 tokens for stdin redirection
-    {
-        n -= 2;
-    }
+    int n = 0; // the number of tokens in the command, less the redirections
 
-    if (cp->stdout_file != NULL) // remove 2 tokens for stdout redirection
+    for (int j = cp->first; j <= cp->last; ++j)
     {
-        n -=2;
+        if (redirection(token[j]))
+        {
+            ++j;    // remove 2 tokens for each redirection
+        }
+        else
+        {
+            ++n;
+        }
     }
 
     n = n + 1; // the last element in argv must be a NULL
 
     // re-allocate memory for argument vector
-    cp->argv = (char **) realloc(cp->argv, sizeof(char *) * n);
+    cp->argv = (char **) tagRealloc(MEM_PARSER, cp->argv, sizeof(char *) * n);
 
     if (cp->argv == NULL)
     {
@@ -126,9 +141,9 @@ void buildCommandArgumentArray(char *token[], Command *cp)
 
     for (i=cp->first; i<= cp->last; ++i )
     {
-        if (strcmp(token[i], ">") == 0 || strcmp(token[i], "<") == 0)
+        if (redirection(token[i]))
         {
-            ++i;    // skip off the std in/out redirection
+            ++i;    // skip off the std in/out/err redirection
         }
         else
         {
@@ -139,6 +154,15 @@ void buildCommandArgumentArray(char *token[], Command *cp)
     cp->argv[k] = NULL;
 }
 
+// fill one command structure, its redirections and its argument vector
+//
+void buildCommand(char *token[], int first, int last, char *sep, Command *cp)
+{
+    fillCommandStructure(cp, first, last, sep);
+    searchRedirection(token, cp);
+    buildCommandArgumentArray(token, cp);
+}
+
 int separateCommands(char *token[], Command command[])
 {
     int i;
@@ -182,6 +206,9 @@ int separateCommands(char *token[], Command command[])
             if (first==last)  // two consecutive separators
                 return -2;
 
+            if (redirection(token[last-1]))  // redirection without a file name
+                return -5;
+
             fillCommandStructure(&(command[c]), first, last, sep);
             ++c;
 
@@ -1,3 +1,6 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
 #define MAX_NUM_COMMANDS  1000
 #define MAX_TOKENS 100
 #define MAX_TOKEN_LENGTH 100
@@ -7,6 +10,10 @@
 #define conSep   "&"                            // concurrent execution separator "&"
 #define seqSep   ";"                            // sequential execution separator ";"
 
+// conditional operators, handled by parseTree() rather than separateCommands()
+#define andSep   "&&"                           // run the next pipeline if this one succeeds
+#define orSep    "||"                           // run the next pipeline if this one fails
+
 struct CommandStruct
 {
     int first;          // index to the first token in the array "token" of the command
@@ -15,6 +22,8 @@ struct CommandStruct
     char **argv;       // an array of tokens that forms a command
     char *stdin_file;   // if not NULL, points to the file name for stdin redirection
     char *stdout_file;  // if not NULL, points to the file name for stdout redirection
+    char *stderr_file;  // if not NULL, points to the file name for stderr redirection
+    int stdout_append;  // 1 if stdout redirection appends (">>") rather than truncates (">")
 };
 
 typedef struct CommandStruct Command;  // command type
@@ -31,13 +40,37 @@ typedef struct CommandStruct Command;  // command type
 //			a) -2, if any two successive commands are separated by more than one command separator
 //			b) -3, the first token is a command separator
 //			c) -4, the last command is followed by command separator "|"
+//			d) -5, a redirection "<", ">", ">>" or "2>" is not followed by a file name
 //
 // assume:
-//		the array "command" must have at least MAX_NUM_COMMANDS number of elements
+//		the array "command" must have at least MAX_NUM_COMMANDS number of elements, or at
+//		least one more than the number of command separators in "token"
 //
 //  note:
 //		1) the last command may be followed by "&", or ";", or nothing. If nothing is
 //		   followed by the last command, we assume it is followed by ";".
 //		2) if return value, nCommands >=0, set command[nCommands] to NULL,
+//		3) the array "token" must have room for one more token after its last
+//		   token, for the ";" added at the end of the command line
 //
 int separateCommands(char *token[], Command command[]);
+
+// purpose:
+//		fill "cp" with the simple command formed by token[first] .. token[last - 1],
+//		followed by "sep": its redirections and its argument vector
+//
+// assume:
+//		"cp" is zeroed, or its argv was allocated by tagMalloc(MEM_PARSER, ...)
+//
+void buildCommand(char *token[], int first, int last, char *sep, Command *cp);
+
+// purpose:
+//		check whether a token is a command separator or a redirection operator
+//
+// return:
+//		1 if it is, 0 otherwise
+//
+int separator(char *token);
+int redirection(char *token);
+
+#endif
@@ -0,0 +1,584 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+#include "completion.h"
+#include "memtags.h"
+#include "variables.h"
+
+#define WATCHED_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+
+DirectoryCache *listings = NULL;    // every listing, guarded by "cacheLock"
+int nListings = 0;
+unsigned long useCounter = 0;
+pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_t scanner;
+int scannerStarted = 0;
+int requestFd = -1;                 // wakes the scanner for a queued listing
+int readyFd = -1;                   // wakes the line editor when a listing is made
+int inotifyFd = -1;
+
+char **extraCommands = NULL;        // builtins and the like
+int nExtraCommands = 0;
+
+void addCompletionCommand(const char *name)
+{
+    char **grown = tagRealloc(MEM_COMPLETION, extraCommands, sizeof(char *) * (nExtraCommands + 1));
+
+    if (grown != NULL && (grown[nExtraCommands] = tagStrdup(MEM_COMPLETION, name)) != NULL)
+    {
+        extraCommands = grown;
+        nExtraCommands++;
+    }
+    else if (grown != NULL)
+    {
+        extraCommands = grown;
+    }
+}
+
+// add one to an eventfd's counter
+//
+void signalFd(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    {
+        perror("completion");
+    }
+}
+
+// list one directory: only the scanner thread calls this, and without the lock
+//
+char **listDirectory(const char *path, int executablesOnly, int *n)
+{
+    DIR *dir = opendir(path);
+    char **names = NULL;
+    int count = 0, capacity = 0;
+    struct dirent *entry;
+
+    *n = 0;
+
+    if (dir == NULL)
+    {
+        // an empty listing, so nobody waits for it again
+        return tagCalloc(MEM_COMPLETION, 1, sizeof(char *));
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        {
+            continue;
+        }
+
+        int isDir = (entry->d_type == DT_DIR);
+        struct stat st;
+
+        // symbolic links and file systems without d_type need a stat
+        if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN)
+        {
+            isDir = (fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode));
+        }
+
+        if (executablesOnly && (isDir || faccessat(dirfd(dir), entry->d_name, X_OK, 0) != 0))
+        {
+            continue;
+        }
+
+        if (count + 1 >= capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = tagRealloc(MEM_COMPLETION, names, sizeof(char *) * capacity);
+
+            if (grown == NULL)
+            {
+                break;
+            }
+            names = grown;
+        }
+
+        size_t length = strlen(entry->d_name);
+        char *name = tagMalloc(MEM_COMPLETION, length + 2);
+
+        if (name == NULL)
+        {
+            break;
+        }
+
+        memcpy(name, entry->d_name, length);
+        strcpy(name + length, isDir ? "/" : "");
+        names[count++] = name;
+    }
+
+    closedir(dir);
+
+    if (names == NULL)
+    {
+        names = tagCalloc(MEM_COMPLETION, 1, sizeof(char *));
+    }
+
+    *n = count;
+    return names;
+}
+
+// find the listing of "path", the lock held
+//
+DirectoryCache *findListing(const char *path)
+{
+    for (DirectoryCache *dc = listings; dc != NULL; dc = dc->next)
+    {
+        if (strcmp(dc->path, path) == 0)
+        {
+            return dc;
+        }
+    }
+
+    return NULL;
+}
+
+void freeNames(char **names, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        tagFree(MEM_COMPLETION, names[i]);
+    }
+    tagFree(MEM_COMPLETION, names);
+}
+
+// handle the inotify events waiting: a changed directory is listed again
+//
+void readWatchEvents(void)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+
+    while ((n = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+    {
+        pthread_mutex_lock(&cacheLock);
+
+        for (char *p = buffer; p < buffer + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+
+            for (DirectoryCache *dc = listings; dc != NULL; dc = dc->next)
+            {
+                if (dc->watch != event->wd)
+                {
+                    continue;
+                }
+
+                if (event->mask & IN_IGNORED)
+                {
+                    dc->watch = -1;
+                }
+
+                if (dc->state == COMPLETION_READY)
+                {
+                    dc->state = COMPLETION_STALE;
+                }
+            }
+        }
+
+        pthread_mutex_unlock(&cacheLock);
+    }
+}
+
+// list the queued and stale directories, one at a time
+//
+void scanQueued(void)
+{
+    for (;;)
+    {
+        DirectoryCache *dc;
+        char *path = NULL;
+        int executablesOnly = 0;
+
+        pthread_mutex_lock(&cacheLock);
+
+        for (dc = listings; dc != NULL; dc = dc->next)
+        {
+            if (dc->state == COMPLETION_QUEUED || dc->state == COMPLETION_STALE)
+            {
+                dc->state = COMPLETION_SCANNING;
+                path = tagStrdup(MEM_COMPLETION, dc->path);
+                executablesOnly = dc->executablesOnly;
+                break;
+            }
+        }
+
+        pthread_mutex_unlock(&cacheLock);
+
+        if (dc == NULL)
+        {
+            return;
+        }
+
+        int n = 0;
+        char **names = path ? listDirectory(path, executablesOnly, &n) : NULL;
+
+        pthread_mutex_lock(&cacheLock);
+
+        // the listing may have been evicted while the directory was read
+        dc = path ? findListing(path) : NULL;
+
+        if (dc != NULL && dc->state == COMPLETION_SCANNING)
+        {
+            freeNames(dc->names, dc->nNames);
+            dc->names = names;
+            dc->nNames = n;
+            dc->state = COMPLETION_READY;
+            names = NULL;
+            n = 0;
+
+            // watched from now on: changes make the listing stale again
+            if (dc->watch == -1)
+            {
+                dc->watch = inotify_add_watch(inotifyFd, dc->path, WATCHED_EVENTS | IN_ONLYDIR);
+            }
+        }
+
+        pthread_mutex_unlock(&cacheLock);
+
+        freeNames(names, n);
+        tagFree(MEM_COMPLETION, path);
+        signalFd(readyFd);
+    }
+}
+
+// the scanner thread: wait for requests and inotify events
+//
+void *runScanner(void *argument)
+{
+    struct pollfd fds[2] = { { requestFd, POLLIN, 0 }, { inotifyFd, POLLIN, 0 } };
+
+    for (;;)
+    {
+        scanQueued();
+
+        if (poll(fds, 2, -1) == -1 && errno != EINTR)
+        {
+            return NULL;
+        }
+
+        if (fds[0].revents)
+        {
+            uint64_t count;
+            if (read(requestFd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+            {
+                return NULL;
+            }
+        }
+
+        if (fds[1].revents)
+        {
+            readWatchEvents();
+        }
+    }
+
+    return NULL;
+}
+
+// the listing of "path", created and queued if there is none; the lock held
+//
+DirectoryCache *requestListing(const char *path, int executablesOnly)
+{
+    DirectoryCache *dc = findListing(path);
+
+    if (dc == NULL)
+    {
+        // evict the least recently used listing that is not being read
+        if (nListings >= COMPLETION_MAX_DIRECTORIES)
+        {
+            DirectoryCache **oldest = NULL;
+
+            for (DirectoryCache **link = &listings; *link != NULL; link = &(*link)->next)
+            {
+                if ((*link)->state != COMPLETION_SCANNING && !(*link)->executablesOnly &&
+                    (oldest == NULL || (*link)->lastUsed < (*oldest)->lastUsed))
+                {
+                    oldest = link;
+                }
+            }
+
+            if (oldest == NULL)
+            {
+                return NULL;
+            }
+
+            DirectoryCache *evicted = *oldest;
+            *oldest = evicted->next;
+
+            if (evicted->watch != -1)
+            {
+                inotify_rm_watch(inotifyFd, evicted->watch);
+            }
+
+            freeNames(evicted->names, evicted->nNames);
+            tagFree(MEM_COMPLETION, evicted->path);
+            tagFree(MEM_COMPLETION, evicted);
+            nListings--;
+        }
+
+        dc = tagCalloc(MEM_COMPLETION, 1, sizeof(DirectoryCache));
+
+        if (dc == NULL || (dc->path = tagStrdup(MEM_COMPLETION, path)) == NULL)
+        {
+            tagFree(MEM_COMPLETION, dc);
+            return NULL;
+        }
+
+        dc->watch = -1;
+        dc->state = COMPLETION_QUEUED;
+        dc->executablesOnly = executablesOnly;
+        dc->next = listings;
+        listings = dc;
+        nListings++;
+        signalFd(requestFd);
+    }
+
+    dc->lastUsed = ++useCounter;
+    return dc;
+}
+
+int startCompletion(void)
+{
+    if (scannerStarted)
+    {
+        return 0;
+    }
+
+    requestFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    readyFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    inotifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+
+    if (requestFd == -1 || readyFd == -1 || inotifyFd == -1)
+    {
+        perror("completion");
+        return -1;
+    }
+
+    // the shell's signals, SIGCHLD above all, must not go to the thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int error = pthread_create(&scanner, NULL, runScanner, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (error != 0)
+    {
+        fprintf(stderr, "completion: %s\n", strerror(error));
+        return -1;
+    }
+
+    pthread_detach(scanner);
+    scannerStarted = 1;
+
+    // the command index is wanted first, list it straight away
+    const char *path = getVariable("PATH");
+    char *copy = tagStrdup(MEM_COMPLETION, path ? path : "");
+
+    pthread_mutex_lock(&cacheLock);
+
+    for (char *save = NULL, *dir = strtok_r(copy, ":", &save); dir != NULL; dir = strtok_r(NULL, ":", &save))
+    {
+        requestListing(dir, 1);
+    }
+
+    pthread_mutex_unlock(&cacheLock);
+    tagFree(MEM_COMPLETION, copy);
+
+    return 0;
+}
+
+// add the names of "dc" starting with "prefix" to the matches, each after "lead"
+//
+void addMatches(const DirectoryCache *dc, const char *lead, const char *prefix, char **matches, int *n)
+{
+    size_t prefixLength = strlen(prefix);
+
+    for (int i = 0; i < dc->nNames && *n < COMPLETION_MAX_MATCHES; i++)
+    {
+        // hidden files only when asked for
+        if (strncmp(dc->names[i], prefix, prefixLength) != 0 || (dc->names[i][0] == '.' && prefix[0] != '.'))
+        {
+            continue;
+        }
+
+        char *match = tagMalloc(MEM_COMPLETION, strlen(lead) + strlen(dc->names[i]) + 1);
+
+        if (match != NULL)
+        {
+            strcpy(match, lead);
+            strcat(match, dc->names[i]);
+            matches[(*n)++] = match;
+        }
+    }
+}
+
+int compareMatches(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// sort the matches and drop duplicates, e.g. a command in two PATH directories
+//
+int uniqueMatches(char **matches, int n)
+{
+    int kept = 0;
+
+    qsort(matches, n, sizeof(char *), compareMatches);
+
+    for (int i = 0; i < n; i++)
+    {
+        if (kept > 0 && strcmp(matches[kept - 1], matches[i]) == 0)
+        {
+            tagFree(MEM_COMPLETION, matches[i]);
+        }
+        else
+        {
+            matches[kept++] = matches[i];
+        }
+    }
+
+    return kept;
+}
+
+int completeWord(const char *word, int command, char ***result)
+{
+    if (startCompletion() == -1)
+    {
+        return -1;
+    }
+
+    char **matches = tagMalloc(MEM_COMPLETION, sizeof(char *) * COMPLETION_MAX_MATCHES);
+    int n = 0, pending = 0;
+
+    if (matches == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_lock(&cacheLock);
+
+    if (command && strchr(word, '/') == NULL)
+    {
+        const char *path = getVariable("PATH");
+        char *copy = tagStrdup(MEM_COMPLETION, path ? path : "");
+
+        for (char *save = NULL, *dir = copy ? strtok_r(copy, ":", &save) : NULL; dir != NULL; dir = strtok_r(NULL, ":", &save))
+        {
+            DirectoryCache *dc = requestListing(dir, 1);
+
+            if (dc != NULL && dc->names != NULL)
+            {
+                addMatches(dc, "", word, matches, &n);
+            }
+            else
+            {
+                pending = 1;
+            }
+        }
+
+        tagFree(MEM_COMPLETION, copy);
+
+        for (int i = 0; i < nExtraCommands && n < COMPLETION_MAX_MATCHES; i++)
+        {
+            if (strncmp(extraCommands[i], word, strlen(word)) == 0)
+            {
+                matches[n++] = tagStrdup(MEM_COMPLETION, extraCommands[i]);
+            }
+        }
+    }
+    else
+    {
+        // the directory part is kept as typed, ~/ is looked up in HOME
+        const char *slash = strrchr(word, '/');
+        size_t leadLength = slash ? (size_t)(slash - word) + 1 : 0;
+        char lead[4096], directory[4096];
+
+        snprintf(lead, sizeof(lead), "%.*s", (int)leadLength, word);
+
+        if (leadLength == 0)
+        {
+            strcpy(directory, ".");
+        }
+        else if (strncmp(lead, "~/", 2) == 0 && getVariable("HOME"))
+        {
+            snprintf(directory, sizeof(directory), "%s/%s", getVariable("HOME"), lead + 2);
+        }
+        else
+        {
+            snprintf(directory, sizeof(directory), "%s", lead);
+        }
+
+        // relative directories are cached by their absolute path
+        char absolute[8192];
+        char cwd[4096];
+
+        if (directory[0] != '/' && getcwd(cwd, sizeof(cwd)) != NULL)
+        {
+            snprintf(absolute, sizeof(absolute), "%s/%s", cwd, directory);
+        }
+        else
+        {
+            snprintf(absolute, sizeof(absolute), "%s", directory);
+        }
+
+        DirectoryCache *dc = requestListing(absolute, 0);
+
+        if (dc != NULL && dc->names != NULL)
+        {
+            addMatches(dc, lead, word + leadLength, matches, &n);
+        }
+        else
+        {
+            pending = (dc != NULL);
+        }
+    }
+
+    pthread_mutex_unlock(&cacheLock);
+
+    if (pending && n == 0)
+    {
+        tagFree(MEM_COMPLETION, matches);
+        return -1;
+    }
+
+    *result = matches;
+    return uniqueMatches(matches, n);
+}
+
+void freeMatches(char **matches, int n)
+{
+    freeNames(matches, n);
+}
+
+int completionFd(void)
+{
+    return readyFd;
+}
+
+void acknowledgeCompletion(void)
+{
+    uint64_t count;
+
+    if (readyFd != -1 && read(readyFd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+    {
+        perror("completion");
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#define COMPLETION_MAX_DIRECTORIES 256          // directory listings kept, PATH included
+#define COMPLETION_MAX_MATCHES 4096             // matches returned for one word
+
+// directory listing states
+#define COMPLETION_QUEUED   0                   // waiting for the scanner thread
+#define COMPLETION_SCANNING 1
+#define COMPLETION_READY    2                   // the listing is up to date
+#define COMPLETION_STALE    3                   // changed on disk, queued for a rescan
+
+struct DirectoryCacheStruct
+{
+    char *path;                         // the directory, as the listing is looked up
+    int watch;                          // its inotify watch, -1 if there is none
+    int state;                          // one of the listing states above
+    int executablesOnly;                // a PATH directory: only executable files are listed
+    char **names;                       // the entries, directories with a trailing /; NULL before the first scan
+    int nNames;                         // number of entries in "names"
+    unsigned long lastUsed;             // for evicting the least recently used listing
+    struct DirectoryCacheStruct *next;
+};
+
+typedef struct DirectoryCacheStruct DirectoryCache;  // cached directory listing type
+
+
+// purpose:
+//		add a name that command completion offers besides the PATH executables,
+//		e.g. a builtin
+//
+void addCompletionCommand(const char *name);
+
+// purpose:
+//		start the scanner thread, which lists directories and watches them with
+//		inotify, and queue the PATH directories for listing
+//
+// note:
+//		called on the first completion. Only the thread reads directories, so a
+//		completion never waits for a slow or very large directory: it gets -1
+//		and completionFd() polls readable once the listing is there.
+//
+// return:
+//		0 if successful, -1 otherwise
+//
+int startCompletion(void);
+
+// purpose:
+//		complete "word", as a command name if "command" is set and the word has no /,
+//		or else as a file name
+//
+// note:
+//		the matches are whole words, directories ending with /, sorted; free them
+//		with freeMatches()
+//
+// return:
+//		the number of matches, or -1 if a listing needed is not ready yet
+//
+int completeWord(const char *word, int command, char ***matches);
+
+// purpose:
+//		free the matches returned by completeWord()
+//
+void freeMatches(char **matches, int n);
+
+// purpose:
+//		a descriptor that polls readable when a listing has been made, -1 before
+//		startCompletion()
+//
+int completionFd(void);
+
+// purpose:
+//		reset completionFd() after it has polled readable
+//
+void acknowledgeCompletion(void);
+
+#endif
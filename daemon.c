@@ -0,0 +1,472 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "buffer.h"
+#include "daemon.h"
+
+extern char **environ;
+
+// write all "len" bytes
+//
+int writeFully(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+// read exactly "len" bytes, 0 at a clean end of file before the first byte
+//
+int readFully(int fd, void *data, size_t len)
+{
+    char *p = data;
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t n = read(fd, p + done, len - done);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == 0 && done == 0)
+            return 0;
+        if (n <= 0)
+            return -1;
+
+        done += n;
+    }
+
+    return 1;
+}
+
+int writeFrame(int fd, uint32_t type, const void *data, size_t len)
+{
+    FrameHeader header = { type, (uint32_t)len };
+
+    if (writeFully(fd, &header, sizeof(header)) == -1)
+    {
+        return -1;
+    }
+
+    return writeFully(fd, data, len);
+}
+
+// read one frame into "payload", which is NUL terminated
+// return 1 for a frame, 0 at end of file and -1 on an error
+//
+int readFrame(int fd, uint32_t *type, Buffer *payload)
+{
+    FrameHeader header;
+    int result = readFully(fd, &header, sizeof(header));
+
+    if (result <= 0)
+    {
+        return result;
+    }
+
+    payload->len = 0;
+
+    if (header.length > FRAME_MAX_LENGTH || bufferReserve(payload, header.length) == -1)
+    {
+        return -1;
+    }
+
+    if (header.length > 0 && readFully(fd, payload->data, header.length) != 1)
+    {
+        return -1;
+    }
+
+    payload->len = header.length;
+    payload->data[payload->len] = '\0';
+    *type = header.type;
+
+    return 1;
+}
+
+// pass everything that can be read from "fd" now to the client as frames of "type"
+// return 0 once "fd" has reached end of file
+//
+int relayOutput(int fd, int client, uint32_t type)
+{
+    char data[BUFFER_READ_SIZE];
+
+    for (;;)
+    {
+        ssize_t n = read(fd, data, sizeof(data));
+
+        if (n > 0)
+        {
+            writeFrame(client, type, data, n);
+            continue;
+        }
+
+        if (n == -1 && errno == EINTR)
+            continue;
+
+        return n == 0 ? 0 : 1;
+    }
+}
+
+// the copy of the shell serving one client: batches come in on "commands",
+// statuses go out on "control", output goes to its stdout and stderr
+//
+void executeBatches(int commands, int control, DaemonSetup setup, DaemonExecute execute, void *context)
+{
+    Buffer frame;
+    bufferInit(&frame);
+
+    uint32_t type;
+    int stop = 0;
+
+    while (!stop && readFrame(commands, &type, &frame) == 1)
+    {
+        if (type == FRAME_HELLO)
+        {
+            // the working directory, then the environment
+            char **envp = malloc(sizeof(char *) * (frame.len / 2 + 2));
+            int n = 0;
+
+            if (envp == NULL)
+            {
+                break;
+            }
+
+            for (char *p = frame.data + strlen(frame.data) + 1; p < frame.data + frame.len; p += strlen(p) + 1)
+            {
+                envp[n++] = p;
+            }
+            envp[n] = NULL;
+
+            setup(context, frame.data, envp);
+            free(envp);
+            continue;
+        }
+
+        if (type != FRAME_BATCH)
+        {
+            continue;
+        }
+
+        int32_t status = 0;
+        char *line = frame.data;
+
+        while (!stop && line < frame.data + frame.len)
+        {
+            char *end = strchr(line, '\n');
+
+            if (end)
+            {
+                *end = '\0';
+            }
+
+            if (*line)
+            {
+                status = execute(context, line, &stop);
+                fflush(stdout);
+                fflush(stderr);
+                writeFrame(control, FRAME_STATUS, &status, sizeof(status));
+            }
+
+            line += strlen(line) + 1;
+        }
+
+        writeFrame(control, FRAME_END, &status, sizeof(status));
+    }
+
+    bufferFree(&frame);
+}
+
+// one connection: relay frames between the client and a copy of the shell
+//
+void serveConnection(int client, DaemonSetup setup, DaemonExecute execute, void *context)
+{
+    int commands[2], control[2], out[2], err[2];
+
+    if (pipe2(commands, O_CLOEXEC) == -1 || pipe2(control, O_CLOEXEC) == -1 ||
+        pipe2(out, O_CLOEXEC) == -1 || pipe2(err, O_CLOEXEC) == -1)
+    {
+        perror("pipe");
+        _exit(1);
+    }
+
+    pid_t pid = fork();
+
+    if (pid == -1)
+    {
+        perror("fork");
+        _exit(1);
+    }
+
+    if (pid == 0)
+    {
+        // the shell copy: input from /dev/null, output into the relay's pipes
+        int null = open("/dev/null", O_RDONLY);
+
+        dup2(null, STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(err[1], STDERR_FILENO);
+        close(null);
+        close(client);
+        close(commands[1]);
+        close(control[0]);
+        close(out[0]);
+        close(err[0]);
+
+        executeBatches(commands[0], control[1], setup, execute, context);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(0);
+    }
+
+    close(commands[0]);
+    close(control[1]);
+    close(out[1]);
+    close(err[1]);
+    fcntl(out[0], F_SETFL, O_NONBLOCK);
+    fcntl(err[0], F_SETFL, O_NONBLOCK);
+
+    Buffer frame;
+    bufferInit(&frame);
+
+    struct pollfd fds[4] =
+    {
+        { client, POLLIN, 0 },
+        { out[0], POLLIN, 0 },
+        { err[0], POLLIN, 0 },
+        { control[0], POLLIN, 0 },
+    };
+
+    while (fds[3].fd != -1)
+    {
+        if (poll(fds, 4, -1) == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (fds[0].revents)
+        {
+            uint32_t type;
+
+            // a client that hangs up ends its shell once the current batch is done
+            if (readFrame(client, &type, &frame) != 1)
+            {
+                close(commands[1]);
+                fds[0].fd = -1;
+            }
+            else if (writeFrame(commands[1], type, frame.data, frame.len) == -1)
+            {
+                break;
+            }
+        }
+
+        for (int i = 1; i <= 2; i++)
+        {
+            if (fds[i].revents && relayOutput(fds[i].fd, client, i == 1 ? FRAME_STDOUT : FRAME_STDERR) == 0)
+            {
+                fds[i].fd = -1;
+            }
+        }
+
+        if (fds[3].revents)
+        {
+            uint32_t type;
+
+            if (readFrame(control[0], &type, &frame) != 1)
+            {
+                fds[3].fd = -1;
+            }
+            else
+            {
+                // output written before the status goes out before it
+                relayOutput(out[0], client, FRAME_STDOUT);
+                relayOutput(err[0], client, FRAME_STDERR);
+                writeFrame(client, type, frame.data, frame.len);
+            }
+        }
+    }
+
+    // the shell copy has finished, pass on its last output
+    relayOutput(out[0], client, FRAME_STDOUT);
+    relayOutput(err[0], client, FRAME_STDERR);
+
+    while (waitpid(pid, NULL, 0) == -1 && errno == EINTR)
+        ;
+
+    bufferFree(&frame);
+    _exit(0);
+}
+
+int runDaemon(const char *path, DaemonSetup setup, DaemonExecute execute, void *context)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (listener == -1)
+    {
+        perror("socket");
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // a socket left behind by an earlier daemon is replaced
+    struct stat st;
+
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
+
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(listener, DAEMON_BACKLOG) == -1)
+    {
+        perror(path);
+        close(listener);
+        return -1;
+    }
+
+    // the daemon is stopped with a signal, not kept alive like the interactive shell
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGPIPE, SIG_IGN);
+
+    for (;;)
+    {
+        int client = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+
+        // reap the connections that have finished
+        while (waitpid(-1, NULL, WNOHANG) > 0)
+            ;
+
+        if (client == -1)
+        {
+            if (errno != EINTR && errno != ECONNABORTED)
+            {
+                perror("accept");
+            }
+            continue;
+        }
+
+        pid_t pid = fork();
+
+        if (pid == -1)
+        {
+            perror("fork");
+        }
+        else if (pid == 0)
+        {
+            close(listener);
+            serveConnection(client, setup, execute, context);
+        }
+
+        close(client);
+    }
+}
+
+int runDaemonClient(const char *path)
+{
+    struct sockaddr_un addr;
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    if (sock == -1 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+    {
+        perror(path);
+        return 2;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // the client's working directory and environment
+    Buffer frame;
+    bufferInit(&frame);
+
+    char cwd[4096];
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        strcpy(cwd, "/");
+    }
+
+    bufferAppend(&frame, cwd, strlen(cwd) + 1);
+
+    for (int i = 0; environ[i] != NULL; i++)
+    {
+        bufferAppend(&frame, environ[i], strlen(environ[i]) + 1);
+    }
+
+    writeFrame(sock, FRAME_HELLO, frame.data, frame.len);
+
+    // the batch
+    frame.len = 0;
+
+    if (bufferReadFd(&frame, STDIN_FILENO) == -1 || writeFrame(sock, FRAME_BATCH, frame.data, frame.len) == -1)
+    {
+        perror("batch");
+        bufferFree(&frame);
+        return 2;
+    }
+
+    int32_t status = 2;
+    uint32_t type;
+
+    while (readFrame(sock, &type, &frame) == 1)
+    {
+        if (type == FRAME_STDOUT || type == FRAME_STDERR)
+        {
+            writeFully(type == FRAME_STDOUT ? STDOUT_FILENO : STDERR_FILENO, frame.data, frame.len);
+        }
+        else if (type == FRAME_END && frame.len == sizeof(status))
+        {
+            memcpy(&status, frame.data, sizeof(status));
+            break;
+        }
+    }
+
+    bufferFree(&frame);
+    close(sock);
+
+    return status;
+}
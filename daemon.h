@@ -0,0 +1,55 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>
+
+// frame types
+#define FRAME_HELLO   1                         // client: working directory, then NAME=value strings, NUL separated
+#define FRAME_BATCH   2                         // client: command lines separated by newlines
+#define FRAME_STDOUT  3                         // server: output of the batch
+#define FRAME_STDERR  4                         // server: error output of the batch
+#define FRAME_STATUS  5                         // server: exit status of one line, a 4 byte int
+#define FRAME_END     6                         // server: the batch is complete, a 4 byte int with the last status
+
+#define FRAME_MAX_LENGTH (16 * 1024 * 1024)     // larger frames are a protocol error
+#define DAEMON_BACKLOG 64                       // pending connections
+
+struct FrameHeaderStruct
+{
+    uint32_t type;          // one of the frame types above
+    uint32_t length;        // bytes of payload following the header
+};
+
+typedef struct FrameHeaderStruct FrameHeader;  // frame header type
+
+// set up a fresh shell for a client from its working directory and environment
+typedef void (*DaemonSetup)(void *context, const char *cwd, char **envp);
+
+// run one command line, returning its status; "*stop" is set when the shell should exit
+typedef int (*DaemonExecute)(void *context, const char *line, int *stop);
+
+
+// purpose:
+//		serve command batches on the UNIX domain socket "path" until killed
+//
+// note:
+//		every connection gets a forked copy of the warm shell, so each client has
+//		its own working directory, variables and job table, and clients run
+//		concurrently. The copy's output is streamed back in STDOUT and STDERR
+//		frames, ordered before the STATUS frame of the line that produced it.
+//
+// return:
+//		-1 if the socket cannot be set up, otherwise it does not return
+//
+int runDaemon(const char *path, DaemonSetup setup, DaemonExecute execute, void *context);
+
+// purpose:
+//		send standard input as one batch to the daemon at "path", along with the
+//		current directory and environment, and copy the output back
+//
+// return:
+//		the status of the last line, or 2 if the daemon cannot be reached
+//
+int runDaemonClient(const char *path);
+
+#endif
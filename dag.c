@@ -0,0 +1,534 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "parallel.h"
+#include "jobserver.h"
+#include "dag.h"
+
+char *skipBlanks(char *p)
+{
+    while (*p == ' ' || *p == '\t')
+    {
+        p++;
+    }
+
+    return p;
+}
+
+void trimEnd(char *p)
+{
+    size_t len = strlen(p);
+
+    while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t' || p[len - 1] == '\r'))
+    {
+        p[--len] = '\0';
+    }
+}
+
+int findStep(DagStep *steps, int nSteps, const char *name)
+{
+    for (int i = 0; i < nSteps; i++)
+    {
+        if (strcmp(steps[i].name, name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// split the script into steps; the strings stay in "text"
+// return the number of steps, or -1 for a syntax error
+//
+int parseSteps(char *text, DagStep *steps)
+{
+    int nSteps = 0;
+    int lineNumber = 0;
+
+    for (char *line = text; line != NULL; )
+    {
+        char *end = strchr(line, '\n');
+
+        if (end)
+        {
+            *end = '\0';
+        }
+
+        lineNumber++;
+        trimEnd(line);
+
+        char *p = skipBlanks(line);
+        DagStep *sp = &steps[nSteps];
+
+        line = end ? end + 1 : NULL;
+
+        if (*p == '\0' || *p == '#')
+        {
+            continue;
+        }
+
+        memset(sp, 0, sizeof(DagStep));
+        sp->via = -1;
+
+        if (*p != '@')
+        {
+            // a plain line runs after the line before it
+            snprintf(sp->name, sizeof(sp->name), "%d", lineNumber);
+            sp->after = (nSteps > 0) ? steps[nSteps - 1].name : NULL;
+            sp->job.command = p;
+            nSteps++;
+            continue;
+        }
+
+        size_t len = strcspn(++p, " \t:");
+
+        if (len == 0 || len >= DAG_MAX_NAME)
+        {
+            fprintf(stderr, "dag: line %d: a step needs a name of at most %d characters\n", lineNumber, DAG_MAX_NAME - 1);
+            return -1;
+        }
+
+        memcpy(sp->name, p, len);
+        p = skipBlanks(p + len);
+
+        if (strncmp(p, DAG_AFTER, strlen(DAG_AFTER)) == 0 && (p[strlen(DAG_AFTER)] == ' ' || p[strlen(DAG_AFTER)] == '\t'))
+        {
+            sp->after = skipBlanks(p + strlen(DAG_AFTER));
+            p = strchr(sp->after, ':');
+        }
+
+        if (p == NULL || *p != ':')
+        {
+            fprintf(stderr, "dag: line %d: expected @name [after a,b]: command\n", lineNumber);
+            return -1;
+        }
+
+        *p = '\0';
+        sp->job.command = skipBlanks(p + 1);
+
+        if (findStep(steps, nSteps, sp->name) != -1)
+        {
+            fprintf(stderr, "dag: line %d: step %s is defined twice\n", lineNumber, sp->name);
+            return -1;
+        }
+
+        nSteps++;
+    }
+
+    return nSteps;
+}
+
+// turn the dependency names into step indices
+//
+int resolveDependencies(DagStep *steps, int nSteps)
+{
+    for (int i = 0; i < nSteps; i++)
+    {
+        DagStep *sp = &steps[i];
+        int count = 0;
+
+        if (sp->after == NULL)
+        {
+            continue;
+        }
+
+        for (const char *p = sp->after; p; p = strchr(p + 1, ','))
+        {
+            count++;
+        }
+
+        sp->deps = malloc(sizeof(int) * count);
+
+        if (sp->deps == NULL)
+        {
+            return -1;
+        }
+
+        for (char *name = sp->after; name != NULL; )
+        {
+            char *comma = strchr(name, ',');
+
+            if (comma)
+            {
+                *comma = '\0';
+            }
+
+            name = skipBlanks(name);
+            trimEnd(name);
+
+            if (*name)
+            {
+                int dep = findStep(steps, nSteps, name);
+
+                if (dep == -1)
+                {
+                    fprintf(stderr, "dag: step %s: no step named %s\n", sp->name, name);
+                    return -1;
+                }
+
+                sp->deps[sp->nDeps++] = dep;
+            }
+
+            name = comma ? comma + 1 : NULL;
+        }
+
+        sp->waiting = sp->nDeps;
+    }
+
+    return 0;
+}
+
+// check that the steps can be ordered, i.e. there is no cycle
+//
+int checkCycles(DagStep *steps, int nSteps)
+{
+    int *waiting = malloc(sizeof(int) * (nSteps ? nSteps : 1));
+    int *order = malloc(sizeof(int) * (nSteps ? nSteps : 1));
+    int head = 0, tail = 0;
+
+    if (waiting == NULL || order == NULL)
+    {
+        free(waiting);
+        free(order);
+        return -1;
+    }
+
+    for (int i = 0; i < nSteps; i++)
+    {
+        waiting[i] = steps[i].nDeps;
+
+        if (waiting[i] == 0)
+        {
+            order[tail++] = i;
+        }
+    }
+
+    while (head < tail)
+    {
+        int done = order[head++];
+
+        for (int i = 0; i < nSteps; i++)
+        {
+            for (int k = 0; k < steps[i].nDeps; k++)
+            {
+                if (steps[i].deps[k] == done && --waiting[i] == 0)
+                {
+                    order[tail++] = i;
+                }
+            }
+        }
+    }
+
+    for (int i = 0; tail < nSteps && i < nSteps; i++)
+    {
+        if (waiting[i] > 0)
+        {
+            fprintf(stderr, "dag: step %s is part of a dependency cycle\n", steps[i].name);
+            break;
+        }
+    }
+
+    free(waiting);
+    free(order);
+
+    return (tail == nSteps) ? 0 : -1;
+}
+
+// a step has failed or been skipped: skip everything that depends on it
+//
+void skipDependents(DagStep *steps, int nSteps, int failed)
+{
+    for (int i = 0; i < nSteps; i++)
+    {
+        for (int k = 0; k < steps[i].nDeps; k++)
+        {
+            if (steps[i].deps[k] == failed && steps[i].state == DAG_PENDING)
+            {
+                steps[i].state = DAG_SKIPPED;
+                skipDependents(steps, nSteps, i);
+            }
+        }
+    }
+}
+
+// a step has finished: record its place on the critical path and release its dependents
+//
+void finishStep(DagStep *steps, int nSteps, int done, int keepGoing, int verbose, int *stopping)
+{
+    DagStep *sp = &steps[done];
+    char name[DAG_MAX_NAME + 8];
+
+    sp->state = (sp->job.status == 0) ? DAG_DONE : DAG_FAILED;
+    sp->path = sp->job.elapsed;
+
+    for (int k = 0; k < sp->nDeps; k++)
+    {
+        DagStep *dep = &steps[sp->deps[k]];
+
+        if (dep->path + sp->job.elapsed > sp->path)
+        {
+            sp->path = dep->path + sp->job.elapsed;
+            sp->via = sp->deps[k];
+        }
+    }
+
+    snprintf(name, sizeof(name), "dag: %s:", sp->name);
+    printJob(&sp->job, name, verbose);
+
+    if (sp->state == DAG_FAILED)
+    {
+        skipDependents(steps, nSteps, done);
+        *stopping |= !keepGoing;
+        return;
+    }
+
+    for (int i = 0; i < nSteps; i++)
+    {
+        for (int k = 0; k < steps[i].nDeps; k++)
+        {
+            steps[i].waiting -= (steps[i].deps[k] == done);
+        }
+    }
+}
+
+void printDagSummary(DagStep *steps, int nSteps, double total)
+{
+    int failed = 0, skipped = 0, last = -1;
+
+    for (int i = 0; i < nSteps; i++)
+    {
+        failed += (steps[i].state == DAG_FAILED);
+        skipped += (steps[i].state == DAG_SKIPPED || steps[i].state == DAG_PENDING);
+
+        if ((steps[i].state == DAG_DONE || steps[i].state == DAG_FAILED) && (last == -1 || steps[i].path > steps[last].path))
+        {
+            last = i;
+        }
+    }
+
+    fprintf(stderr, "dag: %d steps, %d failed, %d skipped, %.3f s", nSteps, failed, skipped, total / 1000);
+
+    if (last == -1)
+    {
+        fprintf(stderr, "\n");
+        return;
+    }
+
+    // the chain is recorded backwards, from its last step
+    int chain[nSteps];
+    int length = 0;
+
+    for (int i = last; i != -1; i = steps[i].via)
+    {
+        chain[length++] = i;
+    }
+
+    fprintf(stderr, ", critical path %.3f s:", steps[last].path / 1000);
+
+    for (int i = length - 1; i >= 0; i--)
+    {
+        fprintf(stderr, " %s%s", steps[chain[i]].name, i > 0 ? " ->" : "\n");
+    }
+}
+
+int runDag(int argc, char *argv[], ParallelExecute execute, void *context)
+{
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int keepGoing = 0;
+    int verbose = 0;
+    int first = 1;
+
+    for (; first < argc && argv[first][0] == '-' && argv[first][1]; first++)
+    {
+        if (strcmp(argv[first], "-j") == 0 && first + 1 < argc)
+        {
+            workers = atol(argv[++first]);
+        }
+        else if (strncmp(argv[first], "-j", 2) == 0 && argv[first][2])
+        {
+            workers = atol(argv[first] + 2);
+        }
+        else if (strcmp(argv[first], "-k") == 0)
+        {
+            keepGoing = 1;
+        }
+        else if (strcmp(argv[first], "-v") == 0)
+        {
+            verbose = 1;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (first < argc - 1 || (first < argc && argv[first][0] == '-' && argv[first][1]))
+    {
+        fprintf(stderr, "usage: dag [-j N] [-k] [-v] [file]\n");
+        return 2;
+    }
+
+    if (workers < 1)
+    {
+        workers = 1;
+    }
+
+    // the script, from the file or standard input
+    Buffer text;
+    bufferInit(&text);
+
+    int fd = (first < argc) ? open(argv[first], O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+
+    fflush(stdout);
+
+    if (fd == -1 || bufferReadFd(&text, fd) == -1)
+    {
+        perror(first < argc ? argv[first] : "dag");
+        bufferFree(&text);
+        return 2;
+    }
+
+    if (fd != STDIN_FILENO)
+    {
+        close(fd);
+    }
+
+    bufferAppendString(&text, "");
+
+    size_t lines = 1;
+
+    for (size_t i = 0; i < text.len; i++)
+    {
+        lines += (text.data[i] == '\n');
+    }
+
+    DagStep *steps = calloc(lines, sizeof(DagStep));
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * (workers + 1));
+    int *running = malloc(sizeof(int) * workers);
+    int nSteps = (steps && fds && running) ? parseSteps(text.data, steps) : -1;
+    int result = 2;
+
+    if (nSteps >= 0 && resolveDependencies(steps, nSteps) == 0 && checkCycles(steps, nSteps) == 0)
+    {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        fflush(stderr);
+
+        int nRunning = 0;
+        int tokens = 0;         // jobserver tokens held, one for every running step but the first
+        int stopping = 0;
+
+        for (;;)
+        {
+            // start the steps whose dependencies have all finished, in script order
+            for (int i = 0; i < nSteps && nRunning < workers && !stopping; i++)
+            {
+                DagStep *sp = &steps[i];
+
+                if (sp->state != DAG_PENDING || sp->waiting > 0)
+                {
+                    continue;
+                }
+
+                if (nRunning > tokens && jobserverActive())
+                {
+                    if (!jobserverAcquire())
+                    {
+                        break;
+                    }
+                    tokens++;
+                }
+
+                if (startJob(&sp->job, execute, context) == -1)
+                {
+                    sp->job.status = 127;
+                    finishStep(steps, nSteps, i, keepGoing, verbose, &stopping);
+                    continue;
+                }
+
+                sp->state = DAG_RUNNING;
+                running[nRunning++] = i;
+            }
+
+            if (nRunning == 0)
+            {
+                break;
+            }
+
+            for (int i = 0; i < nRunning; i++)
+            {
+                fds[i].fd = steps[running[i]].job.fd;
+                fds[i].events = POLLIN;
+            }
+
+            // a worker is free, maybe waiting for a jobserver token
+            int waiting = (nRunning < workers && !stopping && jobserverActive());
+
+            fds[nRunning].fd = jobserverFd();
+            fds[nRunning].events = POLLIN;
+
+            if (poll(fds, nRunning + waiting, -1) == -1 && errno != EINTR)
+            {
+                perror("poll");
+                break;
+            }
+
+            for (int i = nRunning - 1; i >= 0; i--)
+            {
+                int done = running[i];
+
+                if (fds[i].revents && collectJob(&steps[done].job))
+                {
+                    running[i] = running[--nRunning];
+                    finishStep(steps, nSteps, done, keepGoing, verbose, &stopping);
+
+                    if (tokens > 0 && tokens >= nRunning)
+                    {
+                        jobserverRelease();
+                        tokens--;
+                    }
+                }
+            }
+        }
+
+        // whatever has not run was stopped by a failure
+        for (int i = 0; i < nSteps; i++)
+        {
+            if (steps[i].state == DAG_PENDING)
+            {
+                steps[i].state = DAG_SKIPPED;
+            }
+        }
+
+        printDagSummary(steps, nSteps, millisecondsSince(&start));
+
+        result = 0;
+
+        for (int i = 0; i < nSteps; i++)
+        {
+            result |= (steps[i].state != DAG_DONE);
+        }
+    }
+
+    for (int i = 0; steps && i < nSteps; i++)
+    {
+        free(steps[i].deps);
+        bufferFree(&steps[i].job.output);
+    }
+
+    free(steps);
+    free(fds);
+    free(running);
+    bufferFree(&text);
+
+    return result;
+}
@@ -0,0 +1,55 @@
+#ifndef DAG_H
+#define DAG_H
+
+#include "parallel.h"
+
+#define DAG_MAX_NAME 64                         // longest step name
+#define DAG_AFTER "after"                       // introduces the dependencies of a step
+
+// step states
+#define DAG_PENDING 0                           // waiting for its dependencies
+#define DAG_RUNNING 1
+#define DAG_DONE    2                           // finished successfully
+#define DAG_FAILED  3                           // finished with a non-zero status
+#define DAG_SKIPPED 4                           // never run, a dependency failed or the run stopped
+
+struct DagStepStruct
+{
+    char name[DAG_MAX_NAME];    // the step's name, or its line number for a plain line
+    char *after;                // the dependency names, separated by commas
+    int *deps;                  // indices of the steps this one runs after
+    int nDeps;                  // number of entries in "deps"
+    int waiting;                // dependencies that have not finished yet
+    int state;                  // one of the step states above
+    ParallelJob job;            // the command line and the process running it
+    double path;                // milliseconds of the longest chain of steps ending with this one
+    int via;                    // the dependency on that chain, or -1
+};
+
+typedef struct DagStepStruct DagStep;  // script step type
+
+
+// purpose:
+//		the dag builtin - dag [-j N] [-k] [-v] [file]
+//
+// note:
+//		runs a script whose steps declare what they depend on:
+//
+//			@name: command
+//			@name after a,b: command
+//
+//		A line without @ is a step after the line before it, as with ;, and blank
+//		lines and # comments are skipped. Steps whose dependencies have finished
+//		run concurrently on at most N workers (default: the number of processors),
+//		each in a forked copy of the shell, and their output is printed as they
+//		finish. The first failure stops new steps from starting; with -k only the
+//		steps depending on it are skipped. The summary gives the wall time and the
+//		critical path, the longest chain of dependent steps.
+//
+// return:
+//		0 if every step succeeded, 1 if a step failed or was skipped, 2 for an
+//		invalid script
+//
+int runDag(int argc, char *argv[], ParallelExecute execute, void *context);
+
+#endif
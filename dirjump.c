@@ -0,0 +1,475 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dirjump.h"
+#include "variables.h"
+
+DirDatabase *database = NULL;       // the mapped file, NULL until it is first needed
+int databaseFd = -1;                // kept open for flock()
+int databaseTried = 0;
+uint32_t indexedGeneration = 0;
+int indexValid = 0;
+int *byName = NULL;                 // record numbers sorted by the last part of the path
+int *bestRanked = NULL;             // tree over "byName": each node the best ranked record below it
+int nIndexed = 0;
+
+char *directoryStack[DIR_STACK_MAX];  // under the current directory, the most recent last
+int nStacked = 0;
+
+int canonicalPath(const char *cwd, const char *path, char *out, size_t size)
+{
+    char joined[8192];
+    size_t length = 1;
+
+    if (snprintf(joined, sizeof(joined), "%s/%s", path[0] == '/' ? "" : cwd, path) >= (int)sizeof(joined) || size < 2)
+    {
+        return -1;
+    }
+
+    strcpy(out, "/");
+
+    for (char *save = NULL, *part = strtok_r(joined, "/", &save); part != NULL; part = strtok_r(NULL, "/", &save))
+    {
+        if (strcmp(part, ".") == 0)
+        {
+            continue;
+        }
+
+        if (strcmp(part, "..") == 0)
+        {
+            // back to the / before the last part, the root staying
+            while (length > 1 && out[--length] != '/')
+            {
+            }
+            out[length] = '\0';
+            continue;
+        }
+
+        size_t n = strlen(part);
+
+        if (length + (length > 1) + n >= size)
+        {
+            return -1;
+        }
+
+        if (length > 1)
+        {
+            out[length++] = '/';
+        }
+
+        memcpy(out + length, part, n + 1);
+        length += n;
+    }
+
+    return 0;
+}
+
+// map the database, created if there is none; NULL if it cannot be had
+//
+DirDatabase *openDatabase(void)
+{
+    char path[4096];
+    const char *file = getenv(DIR_JUMP_VARIABLE);
+    const char *home = getenv("HOME");
+    struct stat st;
+
+    if (databaseTried)
+    {
+        return database;
+    }
+
+    databaseTried = 1;
+
+    if (file == NULL || *file == '\0')
+    {
+        if (home == NULL || snprintf(path, sizeof(path), "%s/%s", home, DIR_JUMP_FILE_NAME) >= (int)sizeof(path))
+        {
+            return NULL;
+        }
+        file = path;
+    }
+
+    int fd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    if (fd == -1)
+    {
+        perror(file);
+        return NULL;
+    }
+
+    flock(fd, LOCK_EX);
+
+    // a new file is sized here; its unused records take no disk space
+    if (fstat(fd, &st) == 0 && st.st_size == 0 && ftruncate(fd, sizeof(DirDatabase)) == -1)
+    {
+        perror(file);
+    }
+
+    if (fstat(fd, &st) == 0 && st.st_size == sizeof(DirDatabase))
+    {
+        database = mmap(NULL, sizeof(DirDatabase), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        database = (database == MAP_FAILED) ? NULL : database;
+    }
+
+    if (database != NULL && database->magic[0] == '\0')
+    {
+        memcpy(database->magic, DIR_JUMP_MAGIC, sizeof(database->magic));
+    }
+
+    if (database != NULL && (memcmp(database->magic, DIR_JUMP_MAGIC, sizeof(database->magic)) != 0 ||
+                             database->count > DIR_JUMP_MAX))
+    {
+        munmap(database, sizeof(DirDatabase));
+        database = NULL;
+    }
+
+    if (database == NULL)
+    {
+        fprintf(stderr, "%s: not a directory database\n", file);
+    }
+
+    flock(fd, LOCK_UN);
+
+    // the lock is taken on the file again for each update
+    if (database == NULL)
+    {
+        close(fd);
+    }
+    else
+    {
+        indexValid = 0;
+        databaseFd = fd;
+    }
+
+    return database;
+}
+
+uint64_t directoryRank(const DirRecord *rp)
+{
+    int doublings = rp->visits ? 63 - __builtin_clzll((unsigned long long)rp->visits) : 0;
+
+    return (uint64_t)rp->lastVisit + (uint64_t)doublings * DIR_JUMP_FREQUENCY_WEIGHT;
+}
+
+// the last part of a record's path
+//
+const char *lastPart(int record)
+{
+    const char *slash = strrchr(database->records[record].path, '/');
+
+    return slash ? slash + 1 : database->records[record].path;
+}
+
+int compareByName(const void *a, const void *b)
+{
+    int result = strcmp(lastPart(*(const int *)a), lastPart(*(const int *)b));
+
+    return result ? result : strcmp(database->records[*(const int *)a].path, database->records[*(const int *)b].path);
+}
+
+// the better ranked of two records, -1 being none
+//
+int betterRanked(int a, int b)
+{
+    if (a == -1 || b == -1)
+    {
+        return (a == -1) ? b : a;
+    }
+
+    return directoryRank(&database->records[b]) > directoryRank(&database->records[a]) ? b : a;
+}
+
+// sort the records by name and build the tree of best ranks, if the database
+// has changed since; called with the file locked
+//
+int buildIndex(void)
+{
+    if (indexValid && indexedGeneration == database->generation)
+    {
+        return 0;
+    }
+
+    int n = (int)database->count;
+    int *names = malloc(sizeof(int) * (size_t)(n + 1));
+    int *tree = malloc(sizeof(int) * (size_t)(2 * n + 1));
+
+    if (names == NULL || tree == NULL)
+    {
+        free(names);
+        free(tree);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        names[i] = i;
+    }
+
+    qsort(names, (size_t)n, sizeof(int), compareByName);
+
+    // leaves at n..2n-1, node i the better of 2i and 2i+1
+    for (int i = 0; i < n; i++)
+    {
+        tree[n + i] = names[i];
+    }
+    for (int i = n - 1; i >= 1; i--)
+    {
+        tree[i] = betterRanked(tree[2 * i], tree[2 * i + 1]);
+    }
+
+    free(byName);
+    free(bestRanked);
+    byName = names;
+    bestRanked = tree;
+    nIndexed = n;
+    indexedGeneration = database->generation;
+    indexValid = 1;
+    return 0;
+}
+
+// a record's rank has gone up: mend the tree above its leaf
+//
+void raiseRank(int record)
+{
+    int low = 0, high = nIndexed;
+
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+
+        if (compareByName(&byName[middle], &record) < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    for (int node = (low + nIndexed) / 2; low < nIndexed && node >= 1; node /= 2)
+    {
+        bestRanked[node] = betterRanked(bestRanked[2 * node], bestRanked[2 * node + 1]);
+    }
+}
+
+void recordDirectory(const char *path)
+{
+    DirDatabase *db = openDatabase();
+
+    if (db == NULL || strlen(path) >= DIR_JUMP_PATH)
+    {
+        return;
+    }
+
+    flock(databaseFd, LOCK_EX);
+
+    DirRecord *rp = NULL;
+    DirRecord *lowest = NULL;
+    int known = 1;
+
+    for (uint32_t i = 0; i < db->count && rp == NULL; i++)
+    {
+        if (strcmp(db->records[i].path, path) == 0)
+        {
+            rp = &db->records[i];
+        }
+        else if (lowest == NULL || directoryRank(&db->records[i]) < directoryRank(lowest))
+        {
+            lowest = &db->records[i];
+        }
+    }
+
+    if (rp == NULL)
+    {
+        // a full database gives up its lowest ranked directory
+        rp = (db->count < DIR_JUMP_MAX) ? &db->records[db->count++] : lowest;
+        known = 0;
+        memset(rp, 0, sizeof(DirRecord));
+        snprintf(rp->path, sizeof(rp->path), "%s", path);
+    }
+
+    rp->visits++;
+    rp->lastVisit = (uint32_t)(time(NULL) / 60);
+    db->generation++;
+
+    // the index stays as it is if nobody else has changed the database
+    if (known && indexValid && indexedGeneration + 1 == db->generation)
+    {
+        raiseRank((int)(rp - db->records));
+        indexedGeneration = db->generation;
+    }
+
+    flock(databaseFd, LOCK_UN);
+}
+
+// the first place in "byName" whose name is not below "pattern", or with
+// "length" set, whose first "length" bytes are above it
+//
+int searchNames(const char *pattern, size_t length)
+{
+    int low = 0, high = nIndexed;
+
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        const char *name = lastPart(byName[middle]);
+        int below = length ? strncmp(name, pattern, length) <= 0 : strcmp(name, pattern) < 0;
+
+        if (below)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// the best ranked record of byName[from..to), -1 if the range is empty
+//
+int bestInRange(int from, int to)
+{
+    int best = -1;
+
+    for (from += nIndexed, to += nIndexed; from < to; from /= 2, to /= 2)
+    {
+        if (from & 1)
+        {
+            best = betterRanked(best, bestRanked[from++]);
+        }
+        if (to & 1)
+        {
+            best = betterRanked(best, bestRanked[--to]);
+        }
+    }
+    return best;
+}
+
+int jumpTarget(const char *pattern, char *out, size_t size)
+{
+    DirDatabase *db = openDatabase();
+    int best = -1;
+
+    if (db == NULL || *pattern == '\0')
+    {
+        return -1;
+    }
+
+    flock(databaseFd, LOCK_SH);
+
+    if (buildIndex() == 0 && strchr(pattern, '/') == NULL)
+    {
+        // the names starting with the pattern are next to each other
+        best = bestInRange(searchNames(pattern, 0), searchNames(pattern, strlen(pattern)));
+    }
+
+    // else anywhere in the path, looking at every directory
+    if (best == -1)
+    {
+        for (uint32_t i = 0; i < db->count; i++)
+        {
+            if (strstr(db->records[i].path, pattern) != NULL)
+            {
+                best = betterRanked(best, (int)i);
+            }
+        }
+    }
+
+    if (best != -1)
+    {
+        snprintf(out, size, "%s", db->records[best].path);
+    }
+
+    flock(databaseFd, LOCK_UN);
+
+    return (best == -1) ? -1 : 0;
+}
+
+int pushDirectory(const char *cwd)
+{
+    if (nStacked == DIR_STACK_MAX)
+    {
+        fprintf(stderr, "pushd: directory stack full\n");
+        return -1;
+    }
+
+    if ((directoryStack[nStacked] = strdup(cwd)) == NULL)
+    {
+        return -1;
+    }
+
+    nStacked++;
+    return 0;
+}
+
+int popDirectory(char *out, size_t size)
+{
+    if (nStacked == 0)
+    {
+        fprintf(stderr, "popd: directory stack empty\n");
+        return -1;
+    }
+
+    snprintf(out, size, "%s", directoryStack[--nStacked]);
+    free(directoryStack[nStacked]);
+    return 0;
+}
+
+int swapDirectory(const char *cwd, char *out, size_t size)
+{
+    char *top;
+
+    if (nStacked == 0 || (top = strdup(cwd)) == NULL)
+    {
+        fprintf(stderr, "pushd: no other directory\n");
+        return -1;
+    }
+
+    snprintf(out, size, "%s", directoryStack[nStacked - 1]);
+    free(directoryStack[nStacked - 1]);
+    directoryStack[nStacked - 1] = top;
+    return 0;
+}
+
+// print a directory with HOME as ~
+//
+void printDirectory(const char *path, const char *home, size_t homeLength)
+{
+    if (homeLength > 1 && strncmp(path, home, homeLength) == 0 && (path[homeLength] == '/' || path[homeLength] == '\0'))
+    {
+        printf("~%s", path + homeLength);
+    }
+    else
+    {
+        printf("%s", path);
+    }
+}
+
+void printDirectories(const char *cwd)
+{
+    const char *home = getVariable("HOME");
+    size_t homeLength = home ? strlen(home) : 0;
+
+    printDirectory(cwd, home, homeLength);
+
+    for (int i = nStacked - 1; i >= 0; i--)
+    {
+        putchar(' ');
+        printDirectory(directoryStack[i], home, homeLength);
+    }
+
+    putchar('\n');
+}
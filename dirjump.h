@@ -0,0 +1,88 @@
+#ifndef DIRJUMP_H
+#define DIRJUMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DIR_JUMP_VARIABLE "CDDB"                // the database file, else DIR_JUMP_FILE_NAME in HOME
+#define DIR_JUMP_FILE_NAME ".simpleShell_dirs"
+#define DIR_JUMP_MAGIC "SSHDIRS1"
+#define DIR_JUMP_MAX 4096                       // directories remembered, the lowest ranked is replaced
+#define DIR_JUMP_PATH 248                       // longest path remembered, the terminating null included
+#define DIR_JUMP_FREQUENCY_WEIGHT 1440          // minutes of recency that each doubling of visits is worth
+#define DIR_STACK_MAX 64                        // directories pushd keeps
+
+struct DirRecordStruct
+{
+    uint32_t visits;                // times the directory was changed to
+    uint32_t lastVisit;             // minutes since the epoch
+    char path[DIR_JUMP_PATH];       // canonical, absolute
+};
+
+typedef struct DirRecordStruct DirRecord;  // remembered directory type
+
+struct DirDatabaseStruct
+{
+    char magic[8];                  // DIR_JUMP_MAGIC
+    uint32_t count;                 // records in use
+    uint32_t generation;            // changed by every update, so other shells see their index is out of date
+    DirRecord records[DIR_JUMP_MAX];
+};
+
+typedef struct DirDatabaseStruct DirDatabase;  // mapped database file type
+
+
+// purpose:
+//		make "path" absolute against "cwd" and drop its ".", ".." and repeated /
+//		without looking at the file system, the way cd treats a logical path
+//
+// return:
+//		0 with the path in "out", or -1 if it does not fit
+//
+int canonicalPath(const char *cwd, const char *path, char *out, size_t size);
+
+// purpose:
+//		count a visit to the canonical directory "path" in the database
+//
+// note:
+//		the database is a file mapped shared, so every shell sees the visits of
+//		the others; updates are made under flock()
+//
+void recordDirectory(const char *path);
+
+// purpose:
+//		find the best ranked directory for "pattern": one whose last part starts
+//		with it, else one whose path contains it
+//
+// note:
+//		a directory's rank is its last visit, in minutes, plus
+//		DIR_JUMP_FREQUENCY_WEIGHT for each doubling of its visits. The last parts
+//		are kept sorted with a tree of the best rank over each range of them, so
+//		the first kind of match takes O(log n).
+//
+// return:
+//		0 with the directory in "out", or -1 if nothing matches
+//
+int jumpTarget(const char *pattern, char *out, size_t size);
+
+// purpose:
+//		the pushd, popd and dirs builtins' stack: "cwd" is its top
+//
+// note:
+//		pushDirectory() remembers "cwd" under the top; popDirectory() takes the
+//		directory under the top back off, and swapDirectory() exchanges the two,
+//		giving in "out" the directory to change to
+//
+// return:
+//		0 if successful, -1 if the stack is full or empty
+//
+int pushDirectory(const char *cwd);
+int popDirectory(char *out, size_t size);
+int swapDirectory(const char *cwd, char *out, size_t size);
+
+// purpose:
+//		print the stack, top first, HOME shown as ~
+//
+void printDirectories(const char *cwd);
+
+#endif
@@ -0,0 +1,406 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+
+#include "forkserver.h"
+
+extern char **environ;
+
+int serverSocket = -1;        // the shell's end of the socket, -1 if there is no server
+pid_t serverPid = -1;
+pid_t serverOwner = 0;        // the process the socket belongs to
+
+long serverLaunches = 0;
+long serverFallbacks = 0;
+
+// send "len" bytes, with "fds" attached to the first of them
+//
+int sendWithFds(int sock, const void *data, size_t len, const int fds[], int nfds)
+{
+    char control[CMSG_SPACE(sizeof(int) * FORK_SERVER_FDS)];
+    struct iovec iov = { (void *)data, len };
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (nfds > 0)
+    {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+
+    while (len > 0)
+    {
+        ssize_t n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        // the descriptors went with the first bytes
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+        iov.iov_base = (char *)iov.iov_base + n;
+        iov.iov_len -= n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+// receive exactly "len" bytes, collecting any descriptors attached to them
+//
+int receiveWithFds(int sock, void *data, size_t len, int fds[], int *nfds)
+{
+    char control[CMSG_SPACE(sizeof(int) * FORK_SERVER_FDS)];
+    struct iovec iov = { data, len };
+    struct msghdr msg;
+
+    if (nfds)
+    {
+        *nfds = 0;
+    }
+
+    while (iov.iov_len > 0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            {
+                int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+                for (int i = 0; i < count; ++i)
+                {
+                    int fd;
+                    memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+
+                    if (nfds && *nfds < FORK_SERVER_FDS)
+                        fds[(*nfds)++] = fd;
+                    else
+                        close(fd);
+                }
+            }
+        }
+
+        iov.iov_base = (char *)iov.iov_base + n;
+        iov.iov_len -= n;
+    }
+
+    return 0;
+}
+
+// the child side of a launch: wire up the descriptors and exec
+//
+void execRequest(char *argv[], char *envp[], int fds[])
+{
+    // back to the default dispositions the shell's own children get from execve()
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+
+    if (fchdir(fds[3]) == -1)
+    {
+        perror("fchdir");
+        _exit(1);
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        // the received descriptors are close-on-exec, the copies on 0, 1 and 2 are not
+        if (fds[i] == i ? fcntl(i, F_SETFD, 0) == -1 : dup2(fds[i], i) == -1)
+        {
+            _exit(1);
+        }
+    }
+
+    environ = envp;
+    execvp(argv[0], argv);
+
+    // error handling - execution failed
+    if (errno == ENOENT)
+    {
+        fprintf(stderr, "Unknown command: %s\n", argv[0]);
+    }
+    else
+    {
+        perror(argv[0]);
+    }
+    _exit(127);
+}
+
+// the server loop: one request, one clone, one reply
+//
+void serveRequests(int sock)
+{
+    // keyboard signals are for the shell and its commands, not the server
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGCHLD, SIG_DFL);
+
+    for (;;)
+    {
+        ForkRequest request;
+        int fds[FORK_SERVER_FDS];
+        int nfds = 0;
+
+        if (receiveWithFds(sock, &request, sizeof(request), fds, &nfds) == -1)
+        {
+            // the shell has gone
+            _exit(0);
+        }
+
+        char *strings = malloc(request.length + 1);
+        char **vector = malloc(sizeof(char *) * (request.argc + request.envc + 2));
+
+        if (strings == NULL || vector == NULL || nfds != FORK_SERVER_FDS ||
+            receiveWithFds(sock, strings, request.length, NULL, NULL) == -1)
+        {
+            _exit(1);
+        }
+
+        // NUL separated strings: the arguments, then the environment
+        char **argv = vector;
+        char **envp = vector + request.argc + 1;
+        char *p = strings;
+
+        strings[request.length] = '\0';
+
+        for (int i = 0; i < request.argc; ++i)
+        {
+            argv[i] = p;
+            p += strlen(p) + 1;
+        }
+        argv[request.argc] = NULL;
+
+        for (int i = 0; i < request.envc; ++i)
+        {
+            envp[i] = p;
+            p += strlen(p) + 1;
+        }
+        envp[request.envc] = NULL;
+
+        // the new process is a child of the shell, not of the server
+        int pidfd = -1;
+        struct clone_args args;
+
+        memset(&args, 0, sizeof(args));
+        args.flags = CLONE_PARENT | CLONE_PIDFD;
+        args.pidfd = (uint64_t)(uintptr_t)&pidfd;
+        // with CLONE_PARENT the exit signal is the server's own, SIGCHLD, and
+        // clone3() insists on exit_signal being 0
+        args.exit_signal = 0;
+
+        ForkReply reply;
+        reply.pid = syscall(SYS_clone3, &args, sizeof(args));
+        reply.error = (reply.pid == -1) ? errno : 0;
+
+        if (reply.pid == 0)
+        {
+            execRequest(argv, envp, fds);
+        }
+
+        sendWithFds(sock, &reply, sizeof(reply), &pidfd, pidfd != -1);
+
+        if (pidfd != -1)
+        {
+            close(pidfd);
+        }
+
+        for (int i = 0; i < nfds; ++i)
+        {
+            close(fds[i]);
+        }
+
+        free(strings);
+        free(vector);
+    }
+}
+
+int startForkServer(void)
+{
+    int sv[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1)
+    {
+        perror("socketpair");
+        return -1;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == -1)
+    {
+        perror("fork");
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+
+    if (pid == 0)
+    {
+        close(sv[0]);
+        serveRequests(sv[1]);
+    }
+
+    close(sv[1]);
+    serverSocket = sv[0];
+    serverPid = pid;
+    serverOwner = getpid();
+
+    return 0;
+}
+
+int forkServerRunning(void)
+{
+    // a forked copy of the shell would share the socket with the shell, and its
+    // commands would become the shell's children
+    return serverSocket != -1 && serverOwner == getpid();
+}
+
+pid_t forkServerSpawn(char *argv[], char *envp[], const int fds[3], int *pidfd)
+{
+    if (!forkServerRunning())
+    {
+        return -1;
+    }
+
+    // the request: header, then NUL separated strings
+    ForkRequest request = { 0, 0, 0 };
+
+    for (; argv[request.argc] != NULL; request.argc++)
+    {
+        request.length += strlen(argv[request.argc]) + 1;
+    }
+
+    for (; envp[request.envc] != NULL; request.envc++)
+    {
+        request.length += strlen(envp[request.envc]) + 1;
+    }
+
+    char *strings = malloc(request.length);
+
+    if (strings == NULL)
+    {
+        serverFallbacks++;
+        return -1;
+    }
+
+    char *p = strings;
+
+    for (int i = 0; i < request.argc; ++i)
+    {
+        p = stpcpy(p, argv[i]) + 1;
+    }
+
+    for (int i = 0; i < request.envc; ++i)
+    {
+        p = stpcpy(p, envp[i]) + 1;
+    }
+
+    int sendFds[FORK_SERVER_FDS] = { fds[0], fds[1], fds[2], open(".", O_PATH | O_DIRECTORY | O_CLOEXEC) };
+    ForkReply reply;
+    int received[FORK_SERVER_FDS];
+    int nfds = 0;
+    int ok = sendFds[3] != -1 &&
+             sendWithFds(serverSocket, &request, sizeof(request), sendFds, FORK_SERVER_FDS) == 0 &&
+             sendWithFds(serverSocket, strings, request.length, NULL, 0) == 0 &&
+             receiveWithFds(serverSocket, &reply, sizeof(reply), received, &nfds) == 0;
+
+    if (sendFds[3] != -1)
+    {
+        close(sendFds[3]);
+    }
+    free(strings);
+
+    if (!ok)
+    {
+        // error handling - the server is gone, launch everything directly from now on
+        stopForkServer();
+        serverFallbacks++;
+        return -1;
+    }
+
+    if (reply.pid == -1)
+    {
+        // e.g. no clone3() in this kernel
+        if (reply.error == ENOSYS || reply.error == EINVAL)
+        {
+            stopForkServer();
+        }
+        serverFallbacks++;
+        return -1;
+    }
+
+    *pidfd = (nfds > 0) ? received[0] : -1;
+    serverLaunches++;
+
+    return reply.pid;
+}
+
+void stopForkServer(void)
+{
+    if (serverSocket == -1)
+    {
+        return;
+    }
+
+    // closing the socket ends the server's loop
+    close(serverSocket);
+    serverSocket = -1;
+
+    while (waitpid(serverPid, NULL, 0) == -1 && errno == EINTR)
+        ;
+
+    serverPid = -1;
+}
+
+void printForkServerStats(void)
+{
+    if (serverSocket == -1 && serverLaunches == 0)
+    {
+        printf("fork server: off (set %s=1 to start it)\n", FORK_SERVER_VARIABLE);
+        return;
+    }
+
+    printf("fork server: %s, %ld launches, %ld fallbacks to fork()\n",
+           serverSocket != -1 ? "running" : "stopped", serverLaunches, serverFallbacks);
+}
@@ -0,0 +1,71 @@
+#ifndef FORKSERVER_H
+#define FORKSERVER_H
+
+#include <sys/types.h>
+
+#define FORK_SERVER_VARIABLE "FORK_SERVER"      // set to 1 in the environment to start the fork server
+#define FORK_SERVER_FDS 4                       // stdin, stdout, stderr and the working directory
+
+struct ForkRequestStruct
+{
+    unsigned int length;    // bytes of strings following the request
+    int argc;               // number of argument strings
+    int envc;               // number of environment strings
+};
+
+typedef struct ForkRequestStruct ForkRequest;  // spawn request header
+
+struct ForkReplyStruct
+{
+    pid_t pid;              // the new process, or -1
+    int error;              // errno of a failed clone
+};
+
+typedef struct ForkReplyStruct ForkReply;  // spawn reply, a pidfd is attached when pid != -1
+
+
+// purpose:
+//		start the fork server, a helper process forked while the shell is still
+//		small that launches commands on the shell's behalf
+//
+// return:
+//		0 if successful, -1 otherwise
+//
+// note:
+//		commands launched by the server are children of the shell (CLONE_PARENT),
+//		so they are waited for and reported exactly like commands the shell forks
+//		itself; only the cost of copying the address space is moved to the server
+//
+int startForkServer(void);
+
+// purpose:
+//		check whether the fork server is running and may be used by the calling
+//		process, which forked copies of the shell may not
+//
+int forkServerRunning(void);
+
+// purpose:
+//		launch a command through the fork server
+//
+// note:
+//		"fds" holds the descriptors for the command's stdin, stdout and stderr;
+//		it runs in the shell's current directory with the environment "envp".
+//		On success "*pidfd" is a pidfd for the new process, to be closed by the caller.
+//
+// return:
+//		the process id, or -1 if the server cannot launch it, in which case the
+//		caller forks the command itself
+//
+pid_t forkServerSpawn(char *argv[], char *envp[], const int fds[3], int *pidfd);
+
+// purpose:
+//		stop the fork server
+//
+void stopForkServer(void);
+
+// purpose:
+//		print the fork server counters
+//
+void printForkServerStats(void);
+
+#endif
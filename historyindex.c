@@ -0,0 +1,733 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "historyindex.h"
+#include "memtags.h"
+#include "snapshot.h"
+
+HistoryEntry *historyEntries = NULL;  // each distinct line once
+int nEntries = 0;
+int entryCapacity = 0;
+int *rankOrder = NULL;              // entry numbers, best ranked first
+int *lineTable = NULL;              // open addressing on the text: entry number + 1, 0 if free
+size_t lineTableSize = 0;
+unsigned long historySequence = 0;  // lines recorded, the file's included
+int historyLoaded = 0;
+
+// the history file: HISTFILE, else a file in HOME; NULL if there is neither
+//
+const char *historyFile(void)
+{
+    static char path[4096];
+    const char *file = getenv(HISTORY_FILE_VARIABLE);
+    const char *home = getenv("HOME");
+
+    if (file != NULL && *file != '\0')
+    {
+        return file;
+    }
+
+    if (home == NULL || snprintf(path, sizeof(path), "%s/%s", home, HISTORY_FILE_NAME) >= (int)sizeof(path))
+    {
+        return NULL;
+    }
+
+    return path;
+}
+
+uint64_t hashHistoryLine(const char *text)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (; *text; text++)
+    {
+        hash = (hash ^ (unsigned char)*text) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t byteMask(const char *text)
+{
+    uint64_t mask = 0;
+
+    for (; *text; text++)
+    {
+        mask |= 1ULL << ((unsigned char)*text % 64);
+    }
+    return mask;
+}
+
+// the rank of a line: recency, plus a fixed amount for each doubling of its use
+//
+unsigned long rankKey(const HistoryEntry *ep)
+{
+    int doublings = 63 - __builtin_clzll((unsigned long long)ep->count);
+
+    return ep->last + (unsigned long)doublings * HISTORY_FREQUENCY_WEIGHT;
+}
+
+// double the line table and put the historyEntries back in it
+//
+int growLineTable(void)
+{
+    size_t size = lineTableSize ? lineTableSize * 2 : 1024;
+    int *table = tagCalloc(MEM_HISTORY, size, sizeof(int));
+
+    if (table == NULL)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < nEntries; i++)
+    {
+        size_t slot = hashHistoryLine(historyEntries[i].text) & (size - 1);
+
+        while (table[slot] != 0)
+        {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = i + 1;
+    }
+
+    tagFree(MEM_HISTORY, lineTable);
+    lineTable = table;
+    lineTableSize = size;
+    return 0;
+}
+
+// the slot of "text" in the line table, or of the free slot it would go in
+//
+size_t findLine(const char *text)
+{
+    size_t slot = hashHistoryLine(text) & (lineTableSize - 1);
+
+    while (lineTable[slot] != 0 && strcmp(historyEntries[lineTable[slot] - 1].text, text) != 0)
+    {
+        slot = (slot + 1) & (lineTableSize - 1);
+    }
+    return slot;
+}
+
+// the first of "count" places in the rank order whose key is not above "key"
+//
+int rankPosition(unsigned long key, int count)
+{
+    int low = 0, high = count;
+
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+
+        if (historyEntries[rankOrder[middle]].key > key)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// take entry "e" out of the rank order, which holds "count" historyEntries
+//
+void removeRanked(int e, int count)
+{
+    int at = rankPosition(historyEntries[e].key, count);
+
+    while (at < count && rankOrder[at] != e)
+    {
+        at++;
+    }
+
+    if (at < count)
+    {
+        memmove(rankOrder + at, rankOrder + at + 1, sizeof(int) * (size_t)(count - at - 1));
+    }
+}
+
+// add a line to the index; "sorted" keeps the rank order sorted as it goes,
+// otherwise the caller sorts it afterwards
+//
+int indexLine(const char *text, int sorted)
+{
+    if ((size_t)(nEntries + 1) * 2 > lineTableSize && growLineTable() == -1)
+    {
+        return -1;
+    }
+
+    size_t slot = findLine(text);
+    int e = lineTable[slot] - 1;
+
+    if (e == -1)
+    {
+        if (nEntries == entryCapacity)
+        {
+            int capacity = entryCapacity ? entryCapacity * 2 : 1024;
+            HistoryEntry *grownEntries = tagRealloc(MEM_HISTORY, historyEntries, sizeof(HistoryEntry) * (size_t)capacity);
+            int *grownOrder = grownEntries ? tagRealloc(MEM_HISTORY, rankOrder, sizeof(int) * (size_t)capacity) : NULL;
+
+            historyEntries = grownEntries ? grownEntries : historyEntries;
+            rankOrder = grownOrder ? grownOrder : rankOrder;
+
+            if (grownOrder == NULL)
+            {
+                return -1;
+            }
+            entryCapacity = capacity;
+        }
+
+        e = nEntries;
+        memset(&historyEntries[e], 0, sizeof(HistoryEntry));
+
+        if ((historyEntries[e].text = tagStrdup(MEM_HISTORY, text)) == NULL)
+        {
+            return -1;
+        }
+
+        historyEntries[e].mask = byteMask(text);
+        lineTable[slot] = e + 1;
+
+        // a new entry is placed below, as if it were the worst ranked so far
+        rankOrder[nEntries++] = e;
+    }
+
+    if (sorted)
+    {
+        removeRanked(e, nEntries);
+    }
+
+    historyEntries[e].count++;
+    historyEntries[e].last = ++historySequence;
+    historyEntries[e].key = rankKey(&historyEntries[e]);
+
+    if (sorted)
+    {
+        // a use only raises a key, the other historyEntries keep their order
+        int at = rankPosition(historyEntries[e].key, nEntries - 1);
+
+        memmove(rankOrder + at + 1, rankOrder + at, sizeof(int) * (size_t)(nEntries - 1 - at));
+        rankOrder[at] = e;
+    }
+
+    return 0;
+}
+
+int compareRank(const void *a, const void *b)
+{
+    unsigned long keyA = historyEntries[*(const int *)a].key, keyB = historyEntries[*(const int *)b].key;
+
+    return (keyA < keyB) - (keyA > keyB);
+}
+
+// take the index from the snapshot section "section"; its lines are left in the
+// mapping rather than copied, the rest is checked as it is copied
+//
+// return: 0 if successful, -1 if the section is not a valid index
+//
+int adoptHistorySnapshot(const char *section, size_t length)
+{
+    const HistorySnapshot *hp = (const HistorySnapshot *)section;
+
+    if (length < sizeof(HistorySnapshot) || hp->nEntries > INT32_MAX / 2 || hp->lineTableSize < hp->nEntries * 2 ||
+        (hp->lineTableSize & (hp->lineTableSize - 1)) != 0 || hp->lineTableSize > INT32_MAX ||
+        hp->entries > length || hp->nEntries > (length - hp->entries) / sizeof(HistorySnapshotEntry) ||
+        hp->rankOrder > length || hp->nEntries > (length - hp->rankOrder) / sizeof(int32_t) ||
+        hp->lineTable > length || hp->lineTableSize > (length - hp->lineTable) / sizeof(int32_t) ||
+        hp->text > length || hp->textLength > length - hp->text || hp->entries % 8 != 0 ||
+        hp->rankOrder % 8 != 0 || hp->lineTable % 8 != 0 || hp->checkLength > HISTORY_SNAPSHOT_CHECK ||
+        (hp->nEntries > 0 && (hp->textLength == 0 || section[hp->text + hp->textLength - 1] != '\0')))
+    {
+        return -1;
+    }
+
+    int n = (int)hp->nEntries;
+    int capacity = 1024;
+
+    while (capacity < n)
+    {
+        capacity *= 2;
+    }
+
+    const HistorySnapshotEntry *entries = (const HistorySnapshotEntry *)(section + hp->entries);
+    const int32_t *order = (const int32_t *)(section + hp->rankOrder);
+    const int32_t *table = (const int32_t *)(section + hp->lineTable);
+
+    historyEntries = tagMalloc(MEM_HISTORY, sizeof(HistoryEntry) * (size_t)capacity);
+    rankOrder = tagMalloc(MEM_HISTORY, sizeof(int) * (size_t)capacity);
+    lineTable = tagMalloc(MEM_HISTORY, sizeof(int) * (size_t)hp->lineTableSize);
+
+    int valid = (historyEntries != NULL && rankOrder != NULL && lineTable != NULL);
+
+    for (int i = 0; valid && i < n; i++)
+    {
+        valid = (entries[i].text < hp->textLength && entries[i].count > 0 && order[i] >= 0 && order[i] < n);
+
+        historyEntries[i].text = (char *)(section + hp->text + entries[i].text);
+        historyEntries[i].count = (unsigned long)entries[i].count;
+        historyEntries[i].last = (unsigned long)entries[i].last;
+        historyEntries[i].key = (unsigned long)entries[i].key;
+        historyEntries[i].mask = entries[i].mask;
+        rankOrder[i] = order[i];
+    }
+
+    // at most one slot an entry, so a probe always reaches a free slot
+    size_t used = 0;
+
+    for (size_t i = 0; valid && i < hp->lineTableSize; i++)
+    {
+        valid = (table[i] >= 0 && table[i] <= n && (used += (table[i] != 0)) <= (size_t)n);
+        lineTable[i] = table[i];
+    }
+
+    if (!valid)
+    {
+        tagFree(MEM_HISTORY, historyEntries);
+        tagFree(MEM_HISTORY, rankOrder);
+        tagFree(MEM_HISTORY, lineTable);
+        historyEntries = NULL;
+        rankOrder = NULL;
+        lineTable = NULL;
+        return -1;
+    }
+
+    nEntries = n;
+    entryCapacity = capacity;
+    lineTableSize = (size_t)hp->lineTableSize;
+    historySequence = (unsigned long)hp->sequence;
+
+    return 0;
+}
+
+// the last bytes of the first "size" of the history file, to tell later that they are unchanged
+//
+size_t readHistoryCheck(int fd, uint64_t size, char check[HISTORY_SNAPSHOT_CHECK])
+{
+    size_t length = size < HISTORY_SNAPSHOT_CHECK ? (size_t)size : HISTORY_SNAPSHOT_CHECK;
+
+    return pread(fd, check, length, (off_t)(size - length)) == (ssize_t)length ? length : 0;
+}
+
+// start the index from the snapshot if it was made from the history file "fd",
+// as it is now or with lines appended since
+//
+// return: the bytes of the file the snapshot has indexed, 0 if it is not used
+//
+uint64_t loadHistorySnapshot(int fd, const struct stat *st)
+{
+    SnapshotSource then, now;
+    size_t length;
+    const char *section = findSnapshotSection(SNAPSHOT_HISTORY, &length, &then);
+
+    snapshotSource(st, &now);
+
+    if (section == NULL || length < sizeof(HistorySnapshot) || then.device != now.device || then.inode != now.inode ||
+        then.size == 0 || now.size < then.size || now.size - then.size > HISTORY_SNAPSHOT_TAIL)
+    {
+        return 0;
+    }
+
+    // the same size with another time is a file written again, not appended to
+    if (now.size == then.size && (now.mtime != then.mtime || now.mtimeNanoseconds != then.mtimeNanoseconds))
+    {
+        return 0;
+    }
+
+    const HistorySnapshot *hp = (const HistorySnapshot *)section;
+    char check[HISTORY_SNAPSHOT_CHECK];
+
+    if (now.size > then.size &&
+        (readHistoryCheck(fd, then.size, check) != hp->checkLength || memcmp(check, hp->check, hp->checkLength) != 0))
+    {
+        return 0;
+    }
+
+    return adoptHistorySnapshot(section, length) == 0 ? then.size : 0;
+}
+
+// save the index, made from the first "size" bytes of the history file "fd"
+//
+void saveHistorySnapshot(int fd, const struct stat *st, uint64_t size)
+{
+    SnapshotSource source;
+    HistorySnapshot header;
+    uint64_t textLength = 0;
+
+    snapshotSource(st, &source);
+    source.size = size;
+
+    FILE *fp = beginSnapshotSection(SNAPSHOT_HISTORY, &source);
+
+    if (fp == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < nEntries; i++)
+    {
+        textLength += strlen(historyEntries[i].text) + 1;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.nEntries = (uint64_t)nEntries;
+    header.sequence = historySequence;
+    header.lineTableSize = lineTableSize;
+    header.entries = (sizeof(HistorySnapshot) + 7) & ~(uint64_t)7;
+    header.rankOrder = header.entries + sizeof(HistorySnapshotEntry) * (uint64_t)nEntries;
+    header.lineTable = (header.rankOrder + sizeof(int32_t) * (uint64_t)nEntries + 7) & ~(uint64_t)7;
+    header.text = header.lineTable + sizeof(int32_t) * (uint64_t)lineTableSize;
+    header.textLength = textLength;
+    header.checkLength = readHistoryCheck(fd, size, header.check);
+
+    fwrite(&header, sizeof(header), 1, fp);
+
+    for (uint64_t at = sizeof(header); at < header.entries; at++)
+    {
+        fputc(0, fp);
+    }
+
+    uint64_t text = 0;
+
+    for (int i = 0; i < nEntries; i++)
+    {
+        HistorySnapshotEntry entry = { text, historyEntries[i].count, historyEntries[i].last,
+                                       historyEntries[i].key, historyEntries[i].mask };
+
+        fwrite(&entry, sizeof(entry), 1, fp);
+        text += strlen(historyEntries[i].text) + 1;
+    }
+
+    for (int i = 0; i < nEntries; i++)
+    {
+        int32_t e = rankOrder[i];
+        fwrite(&e, sizeof(e), 1, fp);
+    }
+
+    if (nEntries % 2 != 0)
+    {
+        int32_t padding = 0;
+        fwrite(&padding, sizeof(padding), 1, fp);
+    }
+
+    for (size_t i = 0; i < lineTableSize; i++)
+    {
+        int32_t e = lineTable[i];
+        fwrite(&e, sizeof(e), 1, fp);
+    }
+
+    for (int i = 0; i < nEntries; i++)
+    {
+        fwrite(historyEntries[i].text, 1, strlen(historyEntries[i].text) + 1, fp);
+    }
+
+    saveSnapshotSection(fp);
+}
+
+int loadHistory(void)
+{
+    if (historyLoaded)
+    {
+        return 0;
+    }
+
+    historyLoaded = 1;
+
+    const char *path = historyFile();
+    int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+    struct stat st;
+
+    if (fd == -1)
+    {
+        return (path == NULL || errno == ENOENT) ? 0 : -1;
+    }
+
+    FILE *file = (fstat(fd, &st) == 0) ? fdopen(fd, "r") : NULL;
+
+    if (file == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // only what was appended after the snapshot's part of the file is read
+    uint64_t indexed = loadHistorySnapshot(fd, &st);
+
+    if (indexed > 0)
+    {
+        fseeko(file, (off_t)indexed, SEEK_SET);
+    }
+
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t n;
+    int status = 0;
+
+    while ((n = getline(&line, &size, file)) != -1)
+    {
+        if (n > 0 && line[n - 1] == '\n')
+        {
+            line[n - 1] = '\0';
+        }
+
+        if (line[0] != '\0' && indexLine(line, indexed > 0) == -1)
+        {
+            status = -1;
+            break;
+        }
+    }
+
+    free(line);
+
+    if (indexed == 0)
+    {
+        qsort(rankOrder, (size_t)nEntries, sizeof(int), compareRank);
+    }
+
+    // the snapshot is saved from a file that did not change while it was read
+    off_t end = ftello(file);
+
+    if (status == 0 && (indexed == 0 || (uint64_t)end - indexed > HISTORY_SNAPSHOT_RESAVE) &&
+        fstat(fd, &st) == 0 && st.st_size == end)
+    {
+        saveHistorySnapshot(fd, &st, (uint64_t)end);
+    }
+
+    fclose(file);
+
+    return status;
+}
+
+void recordHistory(const char *line)
+{
+    const char *path = historyFile();
+
+    if (line[0] == '\0')
+    {
+        return;
+    }
+
+    if (path != NULL)
+    {
+        size_t length = strlen(line);
+        char *record = tagMalloc(MEM_HISTORY, length + 1);
+        int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+
+        // one write, so shells sharing the file do not interleave their lines
+        if (record != NULL && fd != -1)
+        {
+            memcpy(record, line, length);
+            record[length] = '\n';
+
+            if (write(fd, record, length + 1) == -1)
+            {
+                perror(path);
+            }
+        }
+
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        tagFree(MEM_HISTORY, record);
+    }
+
+    if (historyLoaded)
+    {
+        indexLine(line, 1);
+    }
+}
+
+HistorySearch *beginHistorySearch(void)
+{
+    if (loadHistory() == -1)
+    {
+        perror("history");
+    }
+
+    HistorySearch *hs = tagCalloc(MEM_HISTORY, 1, sizeof(HistorySearch));
+
+    if (hs != NULL)
+    {
+        // the whole index, already in rank order
+        hs->levels[0].matches = rankOrder;
+        hs->levels[0].nMatches = nEntries;
+        hs->levels[0].complete = 1;
+        hs->nLevels = 1;
+    }
+
+    return hs;
+}
+
+void freeLevel(HistoryLevel *level)
+{
+    tagFree(MEM_HISTORY, level->matches);
+    tagFree(MEM_HISTORY, level->exact);
+    memset(level, 0, sizeof(HistoryLevel));
+}
+
+void endHistorySearch(HistorySearch *hs)
+{
+    if (hs == NULL)
+    {
+        return;
+    }
+
+    for (int i = 1; i < hs->nLevels; i++)
+    {
+        freeLevel(&hs->levels[i]);
+    }
+    tagFree(MEM_HISTORY, hs);
+}
+
+void setHistoryQuery(HistorySearch *hs, const char *query)
+{
+    int common = 0;
+    int length = (int)strnlen(query, HISTORY_SEARCH_MAX_QUERY - 1);
+
+    while (common < length && hs->query[common] == query[common])
+    {
+        common++;
+    }
+
+    // results for a longer query, or unfinished ones, are no use as a start
+    while (hs->nLevels > 1 && (hs->levels[hs->nLevels - 1].length > common || !hs->levels[hs->nLevels - 1].complete))
+    {
+        freeLevel(&hs->levels[--hs->nLevels]);
+    }
+
+    memcpy(hs->query, query, (size_t)length);
+    hs->query[length] = '\0';
+
+    if (length > hs->levels[hs->nLevels - 1].length)
+    {
+        hs->levels[hs->nLevels++].length = length;
+    }
+}
+
+// whether the bytes of "query" appear in "text" in order
+//
+int isSubsequence(const char *text, const char *query)
+{
+    for (; *query; query++, text++)
+    {
+        if ((text = strchr(text, *query)) == NULL)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+long elapsedMicroseconds(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+int runHistorySearch(HistorySearch *hs, long budget)
+{
+    HistoryLevel *level = &hs->levels[hs->nLevels - 1];
+    const HistoryLevel *below = &hs->levels[hs->nLevels - 2];
+    struct timespec start;
+
+    if (level->complete)
+    {
+        return 1;
+    }
+
+    // at most every entry of the level below matches
+    if (level->matches == NULL)
+    {
+        level->matches = tagMalloc(MEM_HISTORY, sizeof(int) * (size_t)(below->nMatches + 1));
+        level->exact = tagMalloc(MEM_HISTORY, (size_t)below->nMatches + 1);
+
+        if (level->matches == NULL || level->exact == NULL)
+        {
+            freeLevel(level);
+            level->length = (int)strlen(hs->query);
+            level->complete = 1;
+            return 1;
+        }
+    }
+
+    uint64_t mask = byteMask(hs->query);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (level->scanned < below->nMatches)
+    {
+        int end = level->scanned + HISTORY_SEARCH_CHUNK;
+        end = (end < below->nMatches) ? end : below->nMatches;
+
+        for (int i = level->scanned; i < end; i++)
+        {
+            const HistoryEntry *ep = &historyEntries[below->matches[i]];
+
+            if ((ep->mask & mask) != mask)
+            {
+                continue;
+            }
+
+            // a line without a prefix of the query cannot contain the query
+            int exact = (below->exact == NULL || below->exact[i]) && strstr(ep->text, hs->query) != NULL;
+
+            if (exact || isSubsequence(ep->text, hs->query))
+            {
+                level->matches[level->nMatches] = below->matches[i];
+                level->exact[level->nMatches++] = (unsigned char)exact;
+                level->nExact += exact;
+            }
+        }
+
+        level->scanned = end;
+
+        if (elapsedMicroseconds(&start) >= budget)
+        {
+            break;
+        }
+    }
+
+    level->complete = (level->scanned == below->nMatches);
+    return level->complete;
+}
+
+const char *historyResult(const HistorySearch *hs, int n, int *offset)
+{
+    const HistoryLevel *level = &hs->levels[hs->nLevels - 1];
+
+    if (level->length == 0 || level->matches == NULL || n < 0 || n >= level->nMatches)
+    {
+        return NULL;
+    }
+
+    // the lines containing the query first, then the others
+    int exact = (n < level->nExact);
+    int skip = exact ? n : n - level->nExact;
+
+    for (int i = 0; i < level->nMatches; i++)
+    {
+        if (level->exact[i] != exact || skip-- > 0)
+        {
+            continue;
+        }
+
+        const char *text = historyEntries[level->matches[i]].text;
+        const char *at = exact ? strstr(text, hs->query) : strchr(text, hs->query[0]);
+
+        *offset = (int)(at - text);
+        return text;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,131 @@
+#ifndef HISTORYINDEX_H
+#define HISTORYINDEX_H
+
+#include <stdint.h>
+
+#define HISTORY_FILE_VARIABLE "HISTFILE"        // the history file, else HISTORY_FILE_NAME in HOME
+#define HISTORY_FILE_NAME ".simpleShell_history"
+#define HISTORY_FREQUENCY_WEIGHT 64             // commands of recency that each doubling of use is worth
+#define HISTORY_SEARCH_MAX_QUERY 128            // longest query, the terminating null included
+#define HISTORY_SEARCH_CHUNK 1024               // entries filtered between looks at the clock
+#define HISTORY_SNAPSHOT_TAIL 8192              // bytes appended since the snapshot indexed on top of it, more and the file is read again
+#define HISTORY_SNAPSHOT_RESAVE 2048            // bytes appended over which the snapshot is brought up to date
+#define HISTORY_SNAPSHOT_CHECK 64               // bytes of the file kept to tell that what was indexed is unchanged
+
+struct HistoryEntryStruct
+{
+    char *text;                 // the command line, stored once however often it was entered
+    unsigned long count;        // times it was entered
+    unsigned long last;         // sequence number of the last time
+    unsigned long key;          // rank: "last" plus HISTORY_FREQUENCY_WEIGHT per doubling of "count"
+    uint64_t mask;              // bit (c % 64) set for each byte c, to rule lines out cheaply
+};
+
+typedef struct HistoryEntryStruct HistoryEntry;  // indexed history line type
+
+struct HistoryLevelStruct
+{
+    int length;                 // the query length the matches are for
+    int *matches;               // matching entries, best ranked first
+    unsigned char *exact;       // 1 where the query is a substring, 0 for a subsequence only
+    int nMatches;
+    int nExact;                 // number of 1s in "exact"
+    int scanned;                // entries of the level below filtered so far
+    int complete;               // the level below has been filtered to its end
+};
+
+typedef struct HistoryLevelStruct HistoryLevel;  // search results for one query length type
+
+struct HistorySearchStruct
+{
+    char query[HISTORY_SEARCH_MAX_QUERY];
+    HistoryLevel levels[HISTORY_SEARCH_MAX_QUERY];  // levels[0] is every entry in rank order
+    int nLevels;
+};
+
+typedef struct HistorySearchStruct HistorySearch;  // incremental history search type
+
+// the index in the snapshot: this header, then at the offsets it gives, each a
+// multiple of 8 from the start of the section, the entries, the rank order and
+// the line table as 32 bit entry numbers, and the lines, each NUL terminated
+struct HistorySnapshotStruct
+{
+    uint64_t nEntries;
+    uint64_t sequence;          // lines recorded
+    uint64_t lineTableSize;
+    uint64_t entries;           // offset of "nEntries" HistorySnapshotEntry
+    uint64_t rankOrder;
+    uint64_t lineTable;
+    uint64_t text;
+    uint64_t textLength;
+    uint64_t checkLength;
+    char check[HISTORY_SNAPSHOT_CHECK];  // the last bytes of the file that was indexed
+};
+
+typedef struct HistorySnapshotStruct HistorySnapshot;  // snapshot history section header type
+
+struct HistorySnapshotEntryStruct
+{
+    uint64_t text;              // offset of the line from the start of the lines
+    uint64_t count;
+    uint64_t last;
+    uint64_t key;
+    uint64_t mask;
+};
+
+typedef struct HistorySnapshotEntryStruct HistorySnapshotEntry;  // snapshot history entry type
+
+
+// purpose:
+//		read the history file into the index, once, when the first search begins
+//
+// note:
+//		each distinct line is one entry, ranked by recency and frequency; the
+//		rank order is kept sorted as lines are recorded, so a search never sorts.
+//		The index is taken from the snapshot while the file is as it was
+//		indexed, or has only had a few lines appended, and is saved to it
+//		when the file has been read.
+//
+// return:
+//		0 if successful, -1 otherwise
+//
+int loadHistory(void);
+
+// purpose:
+//		append an entered line to the history file, and to the index if it is loaded
+//
+void recordHistory(const char *line);
+
+// purpose:
+//		start a search over the whole history, or end it
+//
+HistorySearch *beginHistorySearch(void);
+void endHistorySearch(HistorySearch *hs);
+
+// purpose:
+//		change the query: results kept for a prefix of it are filtered further
+//		rather than searched again
+//
+void setHistoryQuery(HistorySearch *hs, const char *query);
+
+// purpose:
+//		filter for the current query for at most "budget" microseconds
+//
+// note:
+//		lines containing the query come first, then lines containing its bytes in
+//		order with others between them; each group best ranked first
+//
+// return:
+//		1 once the search is complete, 0 if there is more to do
+//
+int runHistorySearch(HistorySearch *hs, long budget);
+
+// purpose:
+//		the result "n" places down from the best found so far
+//
+// return:
+//		the line with the offset of the match in "offset", or NULL if there is none
+//
+const char *historyResult(const HistorySearch *hs, int n, int *offset);
+
+#endif
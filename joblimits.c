@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+#include "jobs.h"
+#include "joblimits.h"
+
+JobLimits jobLimits = { 0, 0, 0, 0.0, JOB_LIMITS_DEFAULT_GRACE };  // given to newly launched jobs
+WatchedJob watched[JOB_LIMITS_MAX_WATCHED];
+int nWatched = 0;
+pid_t watchOwner = 0;               // the process the watched jobs belong to
+
+void getJobLimits(JobLimits *limits)
+{
+    *limits = jobLimits;
+}
+
+void setJobLimits(const JobLimits *limits)
+{
+    jobLimits = *limits;
+}
+
+int jobLimitsActive(void)
+{
+    return jobLimits.memory || jobLimits.cpu || jobLimits.files || jobLimits.wall > 0;
+}
+
+// parse a number of bytes with an optional K, M or G suffix
+//
+int parseSize(const char *text, rlim_t *size)
+{
+    char *end;
+    double value = strtod(text, &end);
+
+    if (end == text || value < 0)
+    {
+        return -1;
+    }
+
+    switch (*end)
+    {
+        case 'G': case 'g': value *= 1024;      // fall through
+        case 'M': case 'm': value *= 1024;      // fall through
+        case 'K': case 'k': value *= 1024; end++; break;
+        default: break;
+    }
+
+    if (*end != '\0')
+    {
+        return -1;
+    }
+
+    *size = (rlim_t)value;
+    return 0;
+}
+
+// parse a number of seconds, fractions allowed
+//
+int parseSeconds(const char *text, double *seconds)
+{
+    char *end;
+    double value = strtod(text, &end);
+
+    if (end == text || *end != '\0' || value < 0 || value > JOB_LIMITS_MAX_SECONDS)
+    {
+        return -1;
+    }
+
+    *seconds = value;
+    return 0;
+}
+
+// seconds rounded up, as RLIMIT_CPU counts them
+//
+rlim_t wholeSeconds(double seconds)
+{
+    rlim_t whole = (rlim_t)seconds;
+
+    return whole + ((double)whole < seconds);
+}
+
+int parseJobLimits(int argc, char *argv[], JobLimits *limits)
+{
+    int first = 1;
+
+    for (; first + 1 < argc && argv[first][0] == '-' && argv[first][1] && !argv[first][2]; first += 2)
+    {
+        const char *value = argv[first + 1];
+        double seconds = 0;
+        int valid = 1;
+
+        switch (argv[first][1])
+        {
+            case 'm':
+                valid = (parseSize(value, &limits->memory) == 0);
+                break;
+            case 't':
+                valid = (parseSeconds(value, &seconds) == 0);
+                limits->cpu = wholeSeconds(seconds);
+                break;
+            case 'n':
+                valid = (parseSize(value, &limits->files) == 0);
+                break;
+            case 'w':
+                valid = (parseSeconds(value, &limits->wall) == 0);
+                break;
+            case 'g':
+                valid = (parseSeconds(value, &limits->grace) == 0);
+                break;
+            default:
+                return -1;
+        }
+
+        if (!valid)
+        {
+            return -1;
+        }
+    }
+
+    return (first < argc && argv[first][0] == '-') ? -1 : first;
+}
+
+void printJobLimits(const JobLimits *limits)
+{
+    char memory[32] = "unlimited", cpu[32] = "unlimited", files[32] = "unlimited", wall[32] = "none";
+
+    if (limits->memory)
+    {
+        snprintf(memory, sizeof(memory), "%lluK", (unsigned long long)limits->memory / 1024);
+    }
+    if (limits->cpu)
+    {
+        snprintf(cpu, sizeof(cpu), "%llus", (unsigned long long)limits->cpu);
+    }
+    if (limits->files)
+    {
+        snprintf(files, sizeof(files), "%llu", (unsigned long long)limits->files);
+    }
+    if (limits->wall > 0)
+    {
+        snprintf(wall, sizeof(wall), "%gs", limits->wall);
+    }
+
+    printf("memory %s, cpu %s, files %s, timeout %s, grace %gs\n", memory, cpu, files, wall, limits->grace);
+}
+
+// lower one resource limit, keeping a lower hard limit already in place
+//
+void lowerLimit(int resource, rlim_t soft, rlim_t hard)
+{
+    struct rlimit current;
+
+    if (getrlimit(resource, &current) == 0 && current.rlim_max != RLIM_INFINITY && current.rlim_max < hard)
+    {
+        hard = current.rlim_max;
+        soft = (soft < hard) ? soft : hard;
+    }
+
+    struct rlimit limit = { soft, hard };
+
+    if (setrlimit(resource, &limit) == -1)
+    {
+        perror("limit");
+    }
+}
+
+void applyJobLimits(void)
+{
+    if (jobLimits.memory)
+    {
+        lowerLimit(RLIMIT_AS, jobLimits.memory, jobLimits.memory);
+    }
+
+    if (jobLimits.cpu)
+    {
+        // SIGXCPU at the limit, SIGKILL once the grace period is used up as well
+        lowerLimit(RLIMIT_CPU, jobLimits.cpu, jobLimits.cpu + wholeSeconds(jobLimits.grace));
+    }
+
+    if (jobLimits.files)
+    {
+        lowerLimit(RLIMIT_NOFILE, jobLimits.files, jobLimits.files);
+    }
+
+    jobLimits.memory = jobLimits.cpu = jobLimits.files = 0;
+    jobLimits.wall = 0;
+}
+
+// a forked copy of the shell inherits the watched jobs, but they are the parent's
+//
+void forgetInheritedWatches(void)
+{
+    pid_t self = getpid();
+
+    if (watchOwner != self)
+    {
+        for (int i = 0; i < nWatched; i++)
+        {
+            for (int k = 0; k < watched[i].nPids; k++)
+            {
+                if (watched[i].pidfds[k] != -1)
+                {
+                    close(watched[i].pidfds[k]);
+                }
+            }
+            close(watched[i].timerfd);
+        }
+
+        nWatched = 0;
+        watchOwner = self;
+    }
+}
+
+// arm a timer to expire once, "seconds" from now
+//
+int armTimer(int timerfd, double seconds)
+{
+    struct itimerspec when = { { 0, 0 }, { 0, 0 } };
+
+    when.it_value.tv_sec = (time_t)seconds;
+    when.it_value.tv_nsec = (long)((seconds - (double)when.it_value.tv_sec) * 1e9);
+
+    // zero would disarm the timer
+    if (when.it_value.tv_sec == 0 && when.it_value.tv_nsec == 0)
+    {
+        when.it_value.tv_nsec = 1;
+    }
+
+    return timerfd_settime(timerfd, 0, &when, NULL);
+}
+
+void watchJob(const pid_t *pids, int nPids, int jobId, const char *command)
+{
+    forgetInheritedWatches();
+
+    if (jobLimits.wall <= 0 || nPids == 0)
+    {
+        return;
+    }
+
+    if (nWatched == JOB_LIMITS_MAX_WATCHED)
+    {
+        fprintf(stderr, "limit: too many jobs with a timeout, %s runs without one\n", command);
+        return;
+    }
+
+    WatchedJob *wj = &watched[nWatched];
+    wj->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if (wj->timerfd == -1 || armTimer(wj->timerfd, jobLimits.wall) == -1)
+    {
+        perror("limit: timerfd");
+
+        if (wj->timerfd != -1)
+        {
+            close(wj->timerfd);
+        }
+        return;
+    }
+
+    wj->nPids = (nPids < MAX_JOB_PROCESSES) ? nPids : MAX_JOB_PROCESSES;
+
+    for (int i = 0; i < wj->nPids; i++)
+    {
+        wj->pids[i] = pids[i];
+        wj->pidfds[i] = (int)syscall(SYS_pidfd_open, pids[i], 0);
+    }
+
+    wj->jobId = jobId;
+    snprintf(wj->command, sizeof(wj->command), "%s", command);
+    wj->signalled = 0;
+    wj->wall = jobLimits.wall;
+    wj->grace = jobLimits.grace;
+    nWatched++;
+}
+
+int watchedJobs(void)
+{
+    forgetInheritedWatches();
+    return nWatched;
+}
+
+int watchFds(struct pollfd *fds, int max)
+{
+    int n = 0;
+
+    forgetInheritedWatches();
+
+    for (int i = 0; i < nWatched; i++)
+    {
+        if (n < max)
+        {
+            fds[n++] = (struct pollfd){ watched[i].timerfd, POLLIN, 0 };
+        }
+
+        // a pidfd polls readable once its process has exited
+        for (int k = 0; k < watched[i].nPids && n < max; k++)
+        {
+            if (watched[i].pidfds[k] != -1)
+            {
+                fds[n++] = (struct pollfd){ watched[i].pidfds[k], POLLIN, 0 };
+            }
+        }
+    }
+
+    return n;
+}
+
+// send "signum" to a watched job and everything it has started
+//
+void signalWatchedJob(WatchedJob *wj, int signum)
+{
+    pid_t pids[MAX_JOB_PROCESSES * 64];
+    int n = 0;
+
+    for (int i = 0; i < wj->nPids; i++)
+    {
+        if (wj->pidfds[i] != -1)
+        {
+            pids[n++] = wj->pids[i];
+        }
+    }
+
+    // the descendants first, a job's shell copy would otherwise leave them behind
+    int total = addDescendants(pids, n, sizeof(pids) / sizeof(pids[0]));
+
+    for (int i = n; i < total; i++)
+    {
+        kill(pids[i], signum);
+    }
+
+    for (int i = 0; i < wj->nPids; i++)
+    {
+        if (wj->pidfds[i] != -1)
+        {
+            syscall(SYS_pidfd_send_signal, wj->pidfds[i], signum, NULL, 0);
+        }
+    }
+
+    wj->signalled = signum;
+}
+
+// escalate an expired timeout: SIGTERM first, SIGKILL after the grace period
+//
+void expireTimeout(WatchedJob *wj)
+{
+    char reason[MAX_JOB_REASON];
+
+    if (wj->signalled == 0)
+    {
+        snprintf(reason, sizeof(reason), "timed out after %gs", wj->wall);
+        signalWatchedJob(wj, SIGTERM);
+        armTimer(wj->timerfd, wj->grace);
+    }
+    else if (wj->signalled == SIGTERM)
+    {
+        snprintf(reason, sizeof(reason), "timed out after %gs, killed after %gs more", wj->wall, wj->grace);
+        signalWatchedJob(wj, SIGKILL);
+    }
+    else
+    {
+        return;
+    }
+
+    if (wj->jobId != -1)
+    {
+        setJobReason(wj->jobId, reason);
+    }
+    else
+    {
+        fprintf(stderr, "%s: %s\n", wj->command, reason);
+    }
+}
+
+void checkTimeouts(void)
+{
+    forgetInheritedWatches();
+
+    for (int i = 0; i < nWatched; i++)
+    {
+        WatchedJob *wj = &watched[i];
+        struct pollfd fd = { wj->timerfd, POLLIN, 0 };
+        uint64_t expirations;
+        int running = 0;
+
+        for (int k = 0; k < wj->nPids; k++)
+        {
+            struct pollfd exited = { wj->pidfds[k], POLLIN, 0 };
+
+            if (wj->pidfds[k] != -1 && poll(&exited, 1, 0) == 1)
+            {
+                close(wj->pidfds[k]);
+                wj->pidfds[k] = -1;
+            }
+
+            running += (wj->pidfds[k] != -1);
+        }
+
+        if (running && poll(&fd, 1, 0) == 1 && read(wj->timerfd, &expirations, sizeof(expirations)) > 0)
+        {
+            expireTimeout(wj);
+        }
+
+        if (!running)
+        {
+            close(wj->timerfd);
+            watched[i--] = watched[--nWatched];
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef JOBLIMITS_H
+#define JOBLIMITS_H
+
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+#include "jobs.h"
+
+#define JOB_LIMITS_MAX_WATCHED 64               // jobs with a wall-clock timeout at once
+#define JOB_LIMITS_DEFAULT_GRACE 5.0            // seconds between SIGTERM and SIGKILL
+#define JOB_LIMITS_MAX_SECONDS 1e9              // longest time limit accepted
+
+struct JobLimitsStruct
+{
+    rlim_t memory;              // RLIMIT_AS in bytes, 0 for none
+    rlim_t cpu;                 // RLIMIT_CPU in seconds, 0 for none
+    rlim_t files;               // RLIMIT_NOFILE, 0 for none
+    double wall;                // wall-clock seconds before SIGTERM, 0 for none
+    double grace;               // seconds from SIGTERM to SIGKILL
+};
+
+typedef struct JobLimitsStruct JobLimits;  // resource limits type
+
+struct WatchedJobStruct
+{
+    pid_t pids[MAX_JOB_PROCESSES];  // the job's processes
+    int pidfds[MAX_JOB_PROCESSES];  // a pidfd for each, -1 once it has exited
+    int nPids;                      // number of entries in "pids"
+    int timerfd;                    // expires at the timeout, then at the end of the grace period
+    int jobId;                      // the job number, or -1 for a foreground command
+    char command[MAX_JOB_COMMAND];  // for the message about a foreground command
+    int signalled;                  // 0, or the last signal sent
+    double wall, grace;             // the limits the job was started with
+};
+
+typedef struct WatchedJobStruct WatchedJob;  // job with a timeout type
+
+
+// purpose:
+//		get or change the limits given to jobs launched from now on
+//
+void getJobLimits(JobLimits *limits);
+void setJobLimits(const JobLimits *limits);
+
+// purpose:
+//		check whether any limit is set
+//
+int jobLimitsActive(void);
+
+// purpose:
+//		parse limit options into "limits":
+//		-m bytes (with K, M or G), -t cpu-seconds, -n files, -w seconds, -g seconds
+//
+// return:
+//		the index of the first argument that is not an option, or -1 for an invalid one
+//
+int parseJobLimits(int argc, char *argv[], JobLimits *limits);
+
+// purpose:
+//		print limits the way the limit builtin shows them
+//
+void printJobLimits(const JobLimits *limits);
+
+// purpose:
+//		set the resource limits in a forked child before it runs the job
+//
+// note:
+//		the limits are inherited from here on, and the wall-clock timeout is left
+//		to the shell that launched the child, so the child clears its own copy of
+//		the limits: a forked copy of the shell does not watch its commands again
+//
+void applyJobLimits(void);
+
+// purpose:
+//		start the wall-clock timeout of a launched job, if one is set
+//
+// note:
+//		the timeout is a timerfd, and each process has a pidfd so the job is
+//		signalled without a race against its process id being reused. When the
+//		timer expires the job and everything it has started get SIGTERM, and
+//		SIGKILL if they are still running after the grace period. The reason
+//		is recorded in the job table, or printed for a foreground command.
+//
+void watchJob(const pid_t *pids, int nPids, int jobId, const char *command);
+
+// purpose:
+//		the number of jobs being watched
+//
+int watchedJobs(void);
+
+// purpose:
+//		fill "fds" with the descriptors to poll for the watched jobs, at most "max"
+//
+// return:
+//		the number of descriptors filled in
+//
+int watchFds(struct pollfd *fds, int max);
+
+// purpose:
+//		handle expired timeouts and forget jobs that have exited, without blocking
+//
+// note:
+//		called from the event loop after polling the descriptors of watchFds(),
+//		and after each command
+//
+void checkTimeouts(void);
+
+#endif
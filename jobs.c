@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "jobs.h"
+#include "audit.h"
+#include "probes.h"
+#include "memtags.h"
+
+Job jobTable[MAX_JOBS];
+int nextJobId = 1;
+
+int addJob(pid_t pid, int kind, const char *command)
+{
+    for (int i = 0; i < MAX_JOBS; ++i)
+    {
+        Job *jp = &jobTable[i];
+
+        if (jp->state == JOB_FREE)
+        {
+            jp->id = nextJobId++;
+            jp->pid = pid;
+            jp->pids[0] = pid;
+            jp->total_pids = 1;
+            jp->running = 1;
+            jp->kind = kind;
+            jp->status = 0;
+            jp->reason[0] = '\0';
+            snprintf(jp->command, sizeof(jp->command), "%s", command);
+            jp->state = JOB_RUNNING;
+
+            return jp->id;
+        }
+    }
+
+    return -1;
+}
+
+int addJobProcess(int id, pid_t pid)
+{
+    Job *jp = findJob(id);
+
+    if (jp == NULL || jp->total_pids >= MAX_JOB_PROCESSES)
+    {
+        return -1;
+    }
+
+    jp->pids[jp->total_pids++] = pid;
+    jp->pid = pid;
+    jp->running++;
+
+    return 0;
+}
+
+void setJobReason(int id, const char *reason)
+{
+    Job *jp = findJob(id);
+
+    if (jp != NULL)
+    {
+        snprintf(jp->reason, sizeof(jp->reason), "%s", reason);
+    }
+}
+
+Job *findJob(int id)
+{
+    for (int i = 0; i < MAX_JOBS; ++i)
+    {
+        if (jobTable[i].state != JOB_FREE && jobTable[i].id == id)
+        {
+            return &jobTable[i];
+        }
+    }
+
+    return NULL;
+}
+
+void reapJobs(void)
+{
+    int savedErrno = errno;
+
+    for (int i = 0; i < MAX_JOBS; ++i)
+    {
+        Job *jp = &jobTable[i];
+
+        if (jp->state != JOB_RUNNING)
+        {
+            continue;
+        }
+
+        for (int k = 0; k < jp->total_pids; ++k)
+        {
+            int status;
+
+            if (jp->pids[k] == 0 || waitpid(jp->pids[k], &status, WNOHANG) != jp->pids[k])
+            {
+                continue;
+            }
+
+            auditEnd(jp->pids[k], status);
+            PROBE2(child__reap, jp->pids[k], status);
+
+            // the job's status is that of its last process
+            if (jp->pids[k] == jp->pid)
+            {
+                jp->status = status;
+            }
+
+            jp->pids[k] = 0;
+            jp->running--;
+        }
+
+        if (jp->running == 0)
+        {
+            jp->state = JOB_DONE;
+        }
+    }
+
+    errno = savedErrno;
+}
+
+void reportJobs(void)
+{
+    // the handler runs reapJobs() too, and must not interrupt this one halfway through a job
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+    // pick up anything whose SIGCHLD raced with addJob()
+    reapJobs();
+
+    for (int i = 0; i < MAX_JOBS; ++i)
+    {
+        Job *jp = &jobTable[i];
+
+        if (jp->state != JOB_DONE)
+        {
+            continue;
+        }
+
+        if (jp->kind == JOB_BACKGROUND)
+        {
+            printf("[%d] Done (%d)\t%s%s%s%s\n", jp->id, WIFEXITED(jp->status) ? WEXITSTATUS(jp->status) : -1, jp->command,
+                   jp->reason[0] ? " (" : "", jp->reason, jp->reason[0] ? ")" : "");
+        }
+
+        jp->state = JOB_FREE;
+    }
+
+    // restart numbering once the table is empty, as other shells do
+    int empty = 1;
+
+    for (int i = 0; i < MAX_JOBS; ++i)
+    {
+        empty = empty && (jobTable[i].state == JOB_FREE);
+    }
+
+    if (empty)
+    {
+        nextJobId = 1;
+    }
+
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+}
+
+int runningJobs(int kind)
+{
+    int n = 0;
+
+    for (int i = 0; i < MAX_JOBS; ++i)
+    {
+        n += (jobTable[i].state == JOB_RUNNING && jobTable[i].kind == kind);
+    }
+
+    return n;
+}
+
+void listJobs(void)
+{
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+    reapJobs();
+
+    for (int i = 0; i < MAX_JOBS; ++i)
+    {
+        Job *jp = &jobTable[i];
+
+        if (jp->state == JOB_FREE || jp->kind != JOB_BACKGROUND)
+        {
+            continue;
+        }
+
+        printf("[%d] %-8s %d\t%s%s%s%s\n", jp->id, jp->state == JOB_RUNNING ? "Running" : "Done", jp->pid, jp->command,
+               jp->reason[0] ? " (" : "", jp->reason, jp->reason[0] ? ")" : "");
+    }
+
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+}
+
+void clearJobs(void)
+{
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+    memset(jobTable, 0, sizeof(jobTable));
+    nextJobId = 1;
+
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+}
+
+// the parent of a process, from /proc/PID/stat, or -1
+//
+pid_t parentOf(pid_t pid)
+{
+    char path[64], stat[512];
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    size_t length = fread(stat, 1, sizeof(stat) - 1, file);
+    fclose(file);
+    stat[length] = '\0';
+
+    // the command name in parentheses may itself contain spaces and parentheses
+    char *close = strrchr(stat, ')');
+    int ppid;
+
+    if (close == NULL || sscanf(close + 1, " %*c %d", &ppid) != 1)
+    {
+        return -1;
+    }
+
+    return ppid;
+}
+
+int addDescendants(pid_t *pids, int n, int size)
+{
+    DIR *proc = opendir("/proc");
+    struct dirent *entry;
+    pid_t *all = NULL, *parents = NULL;
+    int nAll = 0, capacity = 0;
+
+    if (proc == NULL)
+    {
+        return n;
+    }
+
+    // one pass over /proc, then the tree is walked in memory
+    while ((entry = readdir(proc)) != NULL)
+    {
+        if (!isdigit((unsigned char)entry->d_name[0]))
+        {
+            continue;
+        }
+
+        if (nAll == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 256;
+            pid_t *grownAll = tagRealloc(MEM_JOBS, all, sizeof(pid_t) * capacity);
+            pid_t *grownParents = grownAll ? tagRealloc(MEM_JOBS, parents, sizeof(pid_t) * capacity) : NULL;
+
+            if (grownAll)
+            {
+                all = grownAll;
+            }
+            if (grownParents == NULL)
+            {
+                break;
+            }
+            parents = grownParents;
+        }
+
+        all[nAll] = (pid_t)atoi(entry->d_name);
+        parents[nAll] = parentOf(all[nAll]);
+        nAll++;
+    }
+
+    closedir(proc);
+
+    for (int i = 0; i < n && n < size; i++)
+    {
+        for (int k = 0; k < nAll && n < size; k++)
+        {
+            if (parents[k] == pids[i])
+            {
+                pids[n++] = all[k];
+            }
+        }
+    }
+
+    tagFree(MEM_JOBS, all);
+    tagFree(MEM_JOBS, parents);
+
+    return n;
+}
@@ -0,0 +1,118 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <signal.h>
+#include <sys/types.h>
+
+#define MAX_JOBS 100
+#define MAX_JOB_COMMAND 100
+#define MAX_JOB_PROCESSES 16                    // processes in one job, e.g. a pipeline
+#define MAX_JOB_REASON 64                       // why the shell ended a job, e.g. a timeout
+
+// job states
+#define JOB_FREE     0                          // the slot in the job table is unused
+#define JOB_RUNNING  1                          // the process has been started and not yet reaped
+#define JOB_DONE     2                          // the process has been reaped, not yet reported
+
+// job kinds
+#define JOB_BACKGROUND 0                        // started with "&"
+#define JOB_PROCSUB    1                        // the process behind a <(...) or >(...)
+
+struct JobStruct
+{
+    int id;                          // job number, as used by %n
+    pid_t pid;                       // process id of the last process, whose status is the job's status
+    pid_t pids[MAX_JOB_PROCESSES];   // every process of the job, 0 once reaped
+    int total_pids;                  // number of processes in "pids"
+    volatile sig_atomic_t running;   // number of processes not yet reaped
+    int kind;                        // one of the job kinds above
+    volatile sig_atomic_t state;     // one of the job states above, changed by the SIGCHLD handler
+    int status;                      // wait status, valid once the state is JOB_DONE
+    char command[MAX_JOB_COMMAND];   // the command line, for reporting
+    char reason[MAX_JOB_REASON];     // why the shell signalled the job, empty if it did not
+};
+
+typedef struct JobStruct Job;  // job type
+
+
+// purpose:
+//		record a newly forked process in the job table
+//
+// return:
+//		the job number, or -1 if the job table is full
+//
+// note:
+//		SIGCHLD should be blocked between fork() and addJob(), so that the
+//		process cannot be missed by reapJobs()
+//
+int addJob(pid_t pid, int kind, const char *command);
+
+// purpose:
+//		add another process, e.g. the next stage of a pipeline, to a job
+//
+// return:
+//		0 if successful, -1 if there is no such job or it has too many processes
+//
+int addJobProcess(int id, pid_t pid);
+
+// purpose:
+//		record why the shell signalled a job, reported with its status
+//
+void setJobReason(int id, const char *reason);
+
+// purpose:
+//		find a job by its job number
+//
+// return:
+//		the job, or NULL if there is no such job
+//
+Job *findJob(int id);
+
+// purpose:
+//		reap every finished process in the job table without blocking
+//
+// note:
+//		only processes recorded in the job table are waited for, so foreground
+//		commands keep their exit status. Safe to call from a signal handler.
+//
+void reapJobs(void);
+
+// purpose:
+//		report finished background jobs and release the slots of all finished jobs
+//
+// note:
+//		called from the main loop, never from a signal handler
+//
+void reportJobs(void);
+
+// purpose:
+//		count the jobs of "kind" that are still running
+//
+int runningJobs(int kind);
+
+// purpose:
+//		print the jobs in the job table - jobs
+//
+void listJobs(void);
+
+// purpose:
+//		empty the job table, for a shell that is closed
+//
+// note:
+//		jobs still running are forgotten, not waited for
+//
+void clearJobs(void);
+
+// purpose:
+//		add the descendants of the processes in pids[0..n) to the list, which has
+//		room for "size" entries, e.g. to signal everything a job has started
+//
+// note:
+//		jobs have no process group of their own, so the tree is read from /proc
+//
+// return:
+//		the new number of entries
+//
+int addDescendants(pid_t *pids, int n, int size);
+
+#endif
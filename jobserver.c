@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "jobserver.h"
+
+int tokenRead = -1;                         // the shell's own non-blocking read end
+int tokenWrite = -1;                        // where tokens are given back
+char heldTokens[JOBSERVER_MAX_TOKENS];      // the bytes taken, written back as they were
+volatile sig_atomic_t nHeld = 0;
+pid_t holder = 0;                           // the process the held tokens belong to
+char serverFlags[64];                       // MAKEFLAGS words for a jobserver created here
+int serverRead = -1;                        // the read end of a token pipe created here
+int ownWrite = 0;                           // "tokenWrite" was opened here, rather than inherited from make
+
+// a read end of the token pipe of its own, so that O_NONBLOCK does not change
+// the blocking descriptor shared with make
+//
+int openNonBlocking(const char *path)
+{
+    return open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+// join the jobserver named by --jobserver-auth=R,W or --jobserver-auth=fifo:PATH
+//
+int joinJobserver(const char *makeflags)
+{
+    const char *auth = makeflags ? strstr(makeflags, JOBSERVER_AUTH) : NULL;
+    char path[4096];
+
+    if (auth == NULL)
+    {
+        return -1;
+    }
+
+    auth += strlen(JOBSERVER_AUTH);
+
+    if (strncmp(auth, "fifo:", 5) == 0)
+    {
+        snprintf(path, sizeof(path), "%.*s", (int)strcspn(auth + 5, " "), auth + 5);
+        tokenRead = openNonBlocking(path);
+        tokenWrite = open(path, O_WRONLY | O_CLOEXEC);
+        ownWrite = 1;
+    }
+    else
+    {
+        int r, w;
+
+        if (sscanf(auth, "%d,%d", &r, &w) != 2 || fcntl(r, F_GETFD) == -1 || fcntl(w, F_GETFD) == -1)
+        {
+            // make did not pass the pipe on, e.g. the command was not marked with +
+            return -1;
+        }
+
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", r);
+        tokenRead = openNonBlocking(path);
+        tokenWrite = w;
+    }
+
+    if (tokenRead == -1 || tokenWrite == -1)
+    {
+        perror("jobserver");
+        stopJobserver();
+        return -1;
+    }
+
+    return 0;
+}
+
+// create a token pipe with slots - 1 tokens
+//
+int createJobserver(int slots)
+{
+    int fds[2];
+    char path[64];
+
+    if (pipe(fds) == -1)
+    {
+        perror("jobserver");
+        return -1;
+    }
+
+    // out of the way of the descriptors commands use
+    int r = fcntl(fds[0], F_DUPFD, JOBSERVER_FD_BASE);
+    int w = fcntl(fds[1], F_DUPFD, JOBSERVER_FD_BASE);
+
+    close(fds[0]);
+    close(fds[1]);
+
+    if (r == -1 || w == -1)
+    {
+        perror("jobserver");
+
+        if (r != -1)
+        {
+            close(r);
+        }
+        if (w != -1)
+        {
+            close(w);
+        }
+        return -1;
+    }
+
+    for (int i = 1; i < slots; i++)
+    {
+        if (write(w, "+", 1) != 1)
+        {
+            perror("jobserver");
+            break;
+        }
+    }
+
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", r);
+    tokenRead = openNonBlocking(path);
+    tokenWrite = w;
+    serverRead = r;
+    ownWrite = 1;
+
+    if (tokenRead == -1)
+    {
+        perror("jobserver");
+        stopJobserver();
+        return -1;
+    }
+
+    snprintf(serverFlags, sizeof(serverFlags), "-j%d %s%d,%d", slots, JOBSERVER_AUTH, r, w);
+
+    return 0;
+}
+
+int startJobserver(const char *makeflags, int slots)
+{
+    if (joinJobserver(makeflags) == 0)
+    {
+        return 0;
+    }
+
+    return (slots > 0) ? createJobserver(slots) : -1;
+}
+
+int jobserverActive(void)
+{
+    return tokenRead != -1;
+}
+
+const char *jobserverFlags(void)
+{
+    return serverFlags[0] ? serverFlags : NULL;
+}
+
+// a forked copy of the shell inherits the list of held tokens, but the tokens are the parent's
+//
+void forgetInheritedTokens(void)
+{
+    pid_t self = getpid();
+
+    if (holder != self)
+    {
+        nHeld = 0;
+        holder = self;
+    }
+}
+
+void stopJobserver(void)
+{
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+    forgetInheritedTokens();
+
+    while (nHeld > 0 && tokenWrite != -1)
+    {
+        char token = heldTokens[--nHeld];
+
+        while (write(tokenWrite, &token, 1) == -1 && errno == EINTR)
+            ;
+    }
+
+    nHeld = 0;
+
+    if (tokenRead != -1)
+    {
+        close(tokenRead);
+    }
+
+    // make's own write end stays open, it is make's
+    if (tokenWrite != -1 && ownWrite)
+    {
+        close(tokenWrite);
+    }
+
+    if (serverRead != -1)
+    {
+        close(serverRead);
+    }
+
+    tokenRead = -1;
+    tokenWrite = -1;
+    serverRead = -1;
+    ownWrite = 0;
+    serverFlags[0] = '\0';
+
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+}
+
+int jobserverAcquire(void)
+{
+    char token;
+
+    if (tokenRead == -1 || nHeld >= JOBSERVER_MAX_TOKENS)
+    {
+        return 0;
+    }
+
+    // the SIGCHLD handler gives tokens back
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+    forgetInheritedTokens();
+
+    int taken = (read(tokenRead, &token, 1) == 1);
+
+    if (taken)
+    {
+        heldTokens[nHeld++] = token;
+    }
+
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+    return taken;
+}
+
+void jobserverRelease(void)
+{
+    int savedErrno = errno;
+
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+    forgetInheritedTokens();
+
+    if (nHeld > 0)
+    {
+        char token = heldTokens[--nHeld];
+
+        while (write(tokenWrite, &token, 1) == -1 && errno == EINTR)
+            ;
+    }
+
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    errno = savedErrno;
+}
+
+int jobserverFd(void)
+{
+    return tokenRead;
+}
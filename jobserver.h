@@ -0,0 +1,67 @@
+#ifndef JOBSERVER_H
+#define JOBSERVER_H
+
+#define JOBSERVER_VARIABLE "JOBSERVER"          // set to N in the environment to serve N job slots
+#define JOBSERVER_AUTH "--jobserver-auth="      // how GNU make finds the token pipe in MAKEFLAGS
+#define JOBSERVER_MAX_TOKENS 256                // tokens one process can hold at once
+#define JOBSERVER_FD_BASE 10                    // the token pipe is kept at or above this descriptor
+
+
+// purpose:
+//		set up the jobserver: join the one named in "makeflags" when the shell runs
+//		under make, or else create a token pipe with "slots" job slots if "slots" > 0
+//
+// note:
+//		as with make, every process owns one implicit slot, so the pipe holds
+//		slots - 1 tokens; a process that starts a second concurrent job first takes
+//		a token, and writes it back when the job has finished. The pipe is left open
+//		across exec so commands such as make -j find it through MAKEFLAGS.
+//
+// return:
+//		0 if a jobserver is in use, -1 otherwise
+//
+int startJobserver(const char *makeflags, int slots);
+
+// purpose:
+//		leave the jobserver: give back the tokens held, close the descriptors
+//		opened for it and forget a pipe created here; startJobserver() can then
+//		be called again
+//
+// note:
+//		the write end inherited from make is left open
+//
+void stopJobserver(void);
+
+// purpose:
+//		check whether a jobserver is in use
+//
+int jobserverActive(void);
+
+// purpose:
+//		the MAKEFLAGS words that pass the jobserver on, e.g. "-j8 --jobserver-auth=10,11",
+//		or NULL when the shell joined an existing jobserver and MAKEFLAGS is already right
+//
+const char *jobserverFlags(void);
+
+// purpose:
+//		take a token without blocking
+//
+// return:
+//		1 if a token was taken, 0 if there is none free (or no jobserver)
+//
+int jobserverAcquire(void);
+
+// purpose:
+//		give back a token taken by jobserverAcquire()
+//
+// note:
+//		safe to call from a signal handler
+//
+void jobserverRelease(void);
+
+// purpose:
+//		a descriptor that polls readable while a token may be free, -1 without a jobserver
+//
+int jobserverFd(void);
+
+#endif
@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "libshell.h"
+#include "buffer.h"
+
+// the embedding side of simpleShell.c
+void *openShellContext(void);
+void closeShellContext(void *context);
+int executeEmbedded(void *context, const char *line, int *exited);
+
+struct LibShellStruct
+{
+    void *shell;                    // the Shell of simpleShell.c
+    struct sigaction hostSigchld;   // the program's SIGCHLD handling, put back by shellClose()
+};
+
+LibShell *openLibShell = NULL;      // the context, at most one being open
+
+// send descriptor "fd" to a new memory file, keeping what it was in "*saved"
+// (-1 if it was closed)
+//
+// return: the memory file, or -1
+//
+int redirectToMemory(int fd, int *saved)
+{
+    int file = memfd_create("libshell", MFD_CLOEXEC);
+
+    if (file == -1)
+    {
+        return -1;
+    }
+
+    *saved = fcntl(fd, F_DUPFD_CLOEXEC, 3);
+
+    if ((*saved == -1 && errno != EBADF) || dup2(file, fd) == -1)
+    {
+        if (*saved != -1)
+        {
+            close(*saved);
+        }
+        close(file);
+        return -1;
+    }
+
+    return file;
+}
+
+// put "fd" back as it was, and take what was written to the memory file "file"
+//
+void collectMemory(int fd, int saved, int file, char **text, size_t *length)
+{
+    Buffer buffer;
+
+    bufferInit(&buffer);
+
+    if (saved == -1)
+    {
+        close(fd);
+    }
+    else
+    {
+        dup2(saved, fd);
+        close(saved);
+    }
+
+    if (lseek(file, 0, SEEK_SET) == 0)
+    {
+        bufferReadFd(&buffer, file);
+    }
+
+    close(file);
+    *length = buffer.len;
+    *text = bufferRelease(&buffer);
+}
+
+// run the newline separated "lines", which are cut up in place, until one runs exit
+//
+int runLines(LibShell *sh, char *lines, ShellResult *result)
+{
+    int status = 0;
+    int exited = 0;
+    int capacity = 0;
+
+    for (char *line = lines; line != NULL && !exited; )
+    {
+        char *next = strchr(line, '\n');
+
+        if (next != NULL)
+        {
+            *next++ = '\0';
+        }
+
+        if (*line != '\0')
+        {
+            status = executeEmbedded(sh->shell, line, &exited);
+
+            if (result != NULL)
+            {
+                if (result->nStatuses == capacity)
+                {
+                    int *grown = realloc(result->statuses, sizeof(int) * (size_t)(capacity ? capacity * 2 : 16));
+
+                    if (grown != NULL)
+                    {
+                        result->statuses = grown;
+                        capacity = capacity ? capacity * 2 : 16;
+                    }
+                }
+
+                if (result->nStatuses < capacity)
+                {
+                    result->statuses[result->nStatuses++] = status;
+                }
+            }
+        }
+
+        line = next;
+    }
+
+    if (result != NULL)
+    {
+        result->status = status;
+        result->exited = exited;
+    }
+
+    return status;
+}
+
+LibShell *shellOpen(void)
+{
+    if (openLibShell != NULL)
+    {
+        errno = EBUSY;
+        return NULL;
+    }
+
+    LibShell *sh = malloc(sizeof(LibShell));
+
+    if (sh == NULL)
+    {
+        return NULL;
+    }
+
+    sigaction(SIGCHLD, NULL, &sh->hostSigchld);
+    sh->shell = openShellContext();
+
+    if (sh->shell == NULL)
+    {
+        sigaction(SIGCHLD, &sh->hostSigchld, NULL);
+        free(sh);
+        return NULL;
+    }
+
+    openLibShell = sh;
+
+    return sh;
+}
+
+int shellRun(LibShell *sh, const char *lines, ShellResult *result)
+{
+    char *copy = strdup(lines);
+    int savedOut = -1;
+    int savedErr = -1;
+    int out = -1;
+    int err = -1;
+
+    if (copy == NULL)
+    {
+        return -1;
+    }
+
+    if (result != NULL)
+    {
+        memset(result, 0, sizeof(ShellResult));
+
+        // what the program has buffered is not part of the output
+        fflush(stdout);
+        fflush(stderr);
+
+        out = redirectToMemory(STDOUT_FILENO, &savedOut);
+        err = (out == -1) ? -1 : redirectToMemory(STDERR_FILENO, &savedErr);
+
+        if (err == -1)
+        {
+            if (out != -1)
+            {
+                collectMemory(STDOUT_FILENO, savedOut, out, &result->output, &result->outputLength);
+                shellFreeResult(result);
+            }
+            free(copy);
+            return -1;
+        }
+    }
+
+    int status = runLines(sh, copy, result);
+
+    if (result != NULL)
+    {
+        fflush(stdout);
+        fflush(stderr);
+        collectMemory(STDOUT_FILENO, savedOut, out, &result->output, &result->outputLength);
+        collectMemory(STDERR_FILENO, savedErr, err, &result->errors, &result->errorsLength);
+    }
+
+    free(copy);
+
+    return status;
+}
+
+int shellRunScript(LibShell *sh, const char *path, ShellResult *result)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    Buffer script;
+
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    // read whole: the commands' forked copies of the shell would share a stream's offset
+    bufferInit(&script);
+    long n = bufferReadFd(&script, fd);
+    close(fd);
+
+    int status = (n < 0) ? -1 : shellRun(sh, script.data ? script.data : "", result);
+
+    bufferFree(&script);
+
+    return status;
+}
+
+void shellFreeResult(ShellResult *result)
+{
+    free(result->statuses);
+    free(result->output);
+    free(result->errors);
+    memset(result, 0, sizeof(ShellResult));
+}
+
+void shellClose(LibShell *sh)
+{
+    if (sh == NULL)
+    {
+        return;
+    }
+
+    closeShellContext(sh->shell);
+    sigaction(SIGCHLD, &sh->hostSigchld, NULL);
+    openLibShell = NULL;
+    free(sh);
+}
@@ -0,0 +1,108 @@
+#ifndef LIBSHELL_H
+#define LIBSHELL_H
+
+#include <stddef.h>
+
+// the shell's core as a library, "make -f makefile.unknown libshell.a libshell.so",
+// for programs that run shell lines in-process instead of exec'ing simpleShell;
+// libshell.so exports only the functions below
+
+#if defined(__GNUC__)
+#define LIBSHELL_API __attribute__((visibility("default")))
+#else
+#define LIBSHELL_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ShellResultStruct
+{
+    int status;             // exit status of the last line run
+    int exited;             // the exit builtin was run, and the lines after it were not
+    int *statuses;          // exit status of each line run, in order
+    int nStatuses;
+    char *output;           // standard output of the lines, NUL terminated
+    size_t outputLength;
+    char *errors;           // standard error of the lines, NUL terminated
+    size_t errorsLength;
+};
+
+typedef struct ShellResultStruct ShellResult;  // outcome of running lines type
+
+typedef struct LibShellStruct LibShell;  // shell context type, opaque
+
+
+// purpose:
+//		create a shell context: the variables are imported from the environment
+//		and the directory is the process's own
+//
+// note:
+//		the shell keeps its variables, job table and directory in the process, so
+//		only one context can be open at a time and it must be used from one
+//		thread at a time. It installs a SIGCHLD handler, which only reaps the
+//		shell's own background jobs, and puts the program's one back when closed.
+//
+// return:
+//		the context, or NULL with errno EBUSY if one is open already
+//
+LIBSHELL_API LibShell *shellOpen(void);
+
+// purpose:
+//		run "lines", one or more command lines separated by newlines, in order,
+//		as if they were typed at the prompt
+//
+// note:
+//		with "result" not NULL standard output and error are collected into it,
+//		including those of the commands started, instead of going to the
+//		program's descriptors 1 and 2; output written by background jobs after
+//		the call returns is lost. Free the result with shellFreeResult().
+//
+//		subshells, command and process substitution, background compound
+//		commands and builtins in a pipeline run in a forked copy of the program
+//		that does not exec; it ends with _exit(), so the program's atexit
+//		handlers and destructors do not run in it. After fork() only the calling
+//		thread exists in the copy, so in a multithreaded program, e.g. one in Go
+//		or C++ with threads, the copy can deadlock on a lock another thread held,
+//		in malloc() or stdio for instance. Such programs should keep to lines
+//		that only exec commands, or run the shell in a process of its own.
+//
+// return:
+//		the status of the last line, or -1 if the output cannot be collected
+//
+LIBSHELL_API int shellRun(LibShell *sh, const char *lines, ShellResult *result);
+
+// purpose:
+//		run the lines of the file "path", as shellRun()
+//
+// return:
+//		the status of the last line, or -1 if the file cannot be read
+//
+LIBSHELL_API int shellRunScript(LibShell *sh, const char *path, ShellResult *result);
+
+// purpose:
+//		release what shellRun() or shellRunScript() put into "result"
+//
+LIBSHELL_API void shellFreeResult(ShellResult *result);
+
+// purpose:
+//		wait for the queued background jobs and release the context; jobs still
+//		running are left to the program
+//
+LIBSHELL_API void shellClose(LibShell *sh);
+
+// purpose:
+//		run the shell as the simpleShell program, reading lines from standard
+//		input, with the command line options of simpleShell
+//
+// return:
+//		the program's exit status
+//
+LIBSHELL_API int shellMain(int argc, char *argv[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
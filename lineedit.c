@@ -0,0 +1,903 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "buffer.h"
+#include "completion.h"
+#include "historyindex.h"
+#include "lineedit.h"
+
+// keys that arrive as escape sequences
+#define KEY_UP     1000
+#define KEY_DOWN   1001
+#define KEY_RIGHT  1002
+#define KEY_LEFT   1003
+#define KEY_HOME   1004
+#define KEY_END    1005
+#define KEY_DELETE 1006
+#define KEY_WORD_LEFT  1007
+#define KEY_WORD_RIGHT 1008
+#define KEY_NONE   1009                 // an escape sequence that is not bound
+#define KEY_COMPLETION 1010             // not a key: a directory listing has been made
+#define KEY_IDLE   1011                 // not a key: nothing was typed while a search is unfinished
+#define KEY_PROMPT 1012                 // not a key: the prompt may have changed
+
+#define CONTROL(c) ((c) & 0x1f)
+
+// the line being edited
+typedef struct
+{
+    const char *prompt;
+    char *line;
+    size_t size;                    // capacity of "line"
+    size_t length;
+    size_t cursor;                  // byte offset of the cursor
+    int historyBack;                // history line shown, 0 for the one being typed
+    char typed[LINE_EDIT_MAX];      // the line being typed while the history is shown
+    int lastWasTab;                 // a second Tab lists the matches
+    int pendingTab;                 // completing once the listing needed is made
+    const char *shellPrompt;        // the prompt given, "prompt" being the search's during a search
+    HistorySearch *search;          // the ^R search going on, or NULL
+    char query[HISTORY_SEARCH_MAX_QUERY];
+    int result;                     // the result shown, 0 being the best
+    char searchPrompt[HISTORY_SEARCH_MAX_QUERY + 32];
+    char beforeSearch[LINE_EDIT_MAX];  // the line to go back to if the search is abandoned
+} LineState;
+
+LineHistory historyHook = NULL;
+LineWait waitHook = NULL;
+void *hookContext = NULL;
+LinePromptFd promptFdHook = NULL;
+LinePromptUpdate promptUpdateHook = NULL;
+char killBuffer[LINE_EDIT_MAX];     // the text ^K, ^U and ^W removed last
+
+void setLineEditorHooks(LineHistory history, LineWait wait, void *context)
+{
+    historyHook = history;
+    waitHook = wait;
+    hookContext = context;
+}
+
+void setLinePromptHooks(LinePromptFd fd, LinePromptUpdate update)
+{
+    promptFdHook = fd;
+    promptUpdateHook = update;
+}
+
+int lineEditorUsable(void)
+{
+    const char *term = getenv("TERM");
+
+    return isatty(STDIN_FILENO) && isatty(STDOUT_FILENO) && term != NULL && strcmp(term, "dumb") != 0;
+}
+
+// write to the terminal, unbuffered so it keeps in step with the raw input
+//
+void writeTerminal(const char *data, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t written = write(STDOUT_FILENO, data, n);
+
+        if (written == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written <= 0)
+        {
+            return;
+        }
+        data += written;
+        n -= (size_t)written;
+    }
+}
+
+// the offset of the UTF-8 character before or after "at"
+//
+size_t previousCharacter(const char *line, size_t at)
+{
+    while (at > 0 && ((unsigned char)line[--at] & 0xc0) == 0x80)
+    {
+    }
+    return at;
+}
+
+size_t nextCharacter(const char *line, size_t length, size_t at)
+{
+    while (at < length && ((unsigned char)line[++at] & 0xc0) == 0x80)
+    {
+    }
+    return at;
+}
+
+// the columns "n" bytes of UTF-8 take up, one per character
+//
+size_t textColumns(const char *text, size_t n)
+{
+    size_t columns = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        columns += (((unsigned char)text[i] & 0xc0) != 0x80);
+    }
+    return columns;
+}
+
+size_t terminalColumns(void)
+{
+    struct winsize ws;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
+    {
+        return 80;
+    }
+    return ws.ws_col;
+}
+
+// redraw the prompt and line, scrolled sideways if the line is wider than the terminal
+//
+void refreshLine(LineState *ls)
+{
+    size_t promptColumns = textColumns(ls->prompt, strlen(ls->prompt));
+    size_t width = terminalColumns();
+    size_t available = (width > promptColumns + 1) ? width - promptColumns - 1 : 1;
+    size_t start = 0, end;
+
+    while (textColumns(ls->line + start, ls->cursor - start) > available)
+    {
+        start = nextCharacter(ls->line, ls->length, start);
+    }
+
+    for (end = start; end < ls->length; )
+    {
+        size_t next = nextCharacter(ls->line, ls->length, end);
+
+        if (textColumns(ls->line + start, next - start) > available)
+        {
+            break;
+        }
+        end = next;
+    }
+
+    Buffer out;
+    char move[32];
+
+    bufferInit(&out);
+    bufferAppendChar(&out, '\r');
+    bufferAppendString(&out, ls->prompt);
+    bufferAppend(&out, ls->line + start, end - start);
+    bufferAppendString(&out, "\x1b[K\r");
+
+    size_t column = promptColumns + textColumns(ls->line + start, ls->cursor - start);
+
+    if (column > 0)
+    {
+        snprintf(move, sizeof(move), "\x1b[%zuC", column);
+        bufferAppendString(&out, move);
+    }
+
+    writeTerminal(out.data, out.len);
+    bufferFree(&out);
+}
+
+// replace the line with "text", the cursor at its end
+//
+void setLine(LineState *ls, const char *text)
+{
+    snprintf(ls->line, ls->size, "%s", text);
+    ls->length = strlen(ls->line);
+    ls->cursor = ls->length;
+}
+
+void insertText(LineState *ls, const char *text, size_t n)
+{
+    if (ls->length + n >= ls->size)
+    {
+        writeTerminal("\a", 1);
+        return;
+    }
+
+    memmove(ls->line + ls->cursor + n, ls->line + ls->cursor, ls->length - ls->cursor + 1);
+    memcpy(ls->line + ls->cursor, text, n);
+    ls->length += n;
+    ls->cursor += n;
+}
+
+// remove the bytes from "from" to "to", into the kill buffer if "kill" is set
+//
+void deleteText(LineState *ls, size_t from, size_t to, int kill)
+{
+    if (from >= to)
+    {
+        return;
+    }
+
+    if (kill)
+    {
+        snprintf(killBuffer, sizeof(killBuffer), "%.*s", (int)(to - from), ls->line + from);
+    }
+
+    memmove(ls->line + from, ls->line + to, ls->length - to + 1);
+    ls->length -= to - from;
+    ls->cursor = from;
+}
+
+// the start of the word before the cursor, or the end of the one after it
+//
+size_t wordLeft(const LineState *ls)
+{
+    size_t at = ls->cursor;
+
+    while (at > 0 && ls->line[at - 1] == ' ')
+    {
+        at--;
+    }
+    while (at > 0 && ls->line[at - 1] != ' ')
+    {
+        at--;
+    }
+    return at;
+}
+
+size_t wordRight(const LineState *ls)
+{
+    size_t at = ls->cursor;
+
+    while (at < ls->length && ls->line[at] == ' ')
+    {
+        at++;
+    }
+    while (at < ls->length && ls->line[at] != ' ')
+    {
+        at++;
+    }
+    return at;
+}
+
+// show history line "back", 0 being the line that was being typed
+//
+void showHistory(LineState *ls, int back)
+{
+    const char *text = (back == 0) ? ls->typed : (historyHook ? historyHook(hookContext, back) : NULL);
+
+    if (text == NULL)
+    {
+        writeTerminal("\a", 1);
+        return;
+    }
+
+    if (ls->historyBack == 0)
+    {
+        snprintf(ls->typed, sizeof(ls->typed), "%s", ls->line);
+    }
+
+    ls->historyBack = back;
+    setLine(ls, text);
+}
+
+// print the matches in columns below the line
+//
+void listMatches(char **matches, int n, size_t skip)
+{
+    size_t widest = 1;
+
+    for (int i = 0; i < n; i++)
+    {
+        size_t columns = textColumns(matches[i] + skip, strlen(matches[i] + skip));
+        widest = (columns > widest) ? columns : widest;
+    }
+
+    int perRow = (int)(terminalColumns() / (widest + 2));
+    perRow = (perRow > 0) ? perRow : 1;
+    int rows = (n + perRow - 1) / perRow;
+
+    Buffer out;
+    bufferInit(&out);
+    bufferAppendString(&out, "\n");
+
+    // down the columns, as ls lists
+    for (int row = 0; row < rows; row++)
+    {
+        for (int i = row; i < n; i += rows)
+        {
+            const char *name = matches[i] + skip;
+            size_t columns = textColumns(name, strlen(name));
+
+            bufferAppendString(&out, name);
+
+            for (size_t pad = columns; i + rows < n && pad < widest + 2; pad++)
+            {
+                bufferAppendChar(&out, ' ');
+            }
+        }
+        bufferAppendString(&out, "\n");
+    }
+
+    writeTerminal(out.data, out.len);
+    bufferFree(&out);
+}
+
+// complete the word before the cursor: a command name at the start of a
+// command, a file name anywhere else
+//
+void completeLine(LineState *ls)
+{
+    const char *separators = " \t;|&<>()";
+    size_t start = ls->cursor;
+
+    while (start > 0 && strchr(separators, ls->line[start - 1]) == NULL)
+    {
+        start--;
+    }
+
+    size_t before = start;
+
+    while (before > 0 && (ls->line[before - 1] == ' ' || ls->line[before - 1] == '\t'))
+    {
+        before--;
+    }
+
+    int command = (before == 0 || strchr(";|&(", ls->line[before - 1]) != NULL);
+    char word[LINE_EDIT_MAX];
+    char **matches;
+
+    snprintf(word, sizeof(word), "%.*s", (int)(ls->cursor - start), ls->line + start);
+
+    int n = completeWord(word, command, &matches);
+
+    // the listing is being made, completed when it is there
+    ls->pendingTab = (n == -1);
+
+    if (n <= 0)
+    {
+        if (n == 0)
+        {
+            writeTerminal("\a", 1);
+        }
+        return;
+    }
+
+    size_t wordLength = strlen(word);
+    size_t common = strlen(matches[0]);
+
+    for (int i = 1; i < n; i++)
+    {
+        size_t k = 0;
+
+        while (k < common && matches[i][k] == matches[0][k])
+        {
+            k++;
+        }
+        common = k;
+    }
+
+    // never part of a character
+    while (common > wordLength && ((unsigned char)matches[0][common] & 0xc0) == 0x80)
+    {
+        common--;
+    }
+
+    if (n == 1)
+    {
+        insertText(ls, matches[0] + wordLength, common - wordLength);
+
+        if (common > 0 && matches[0][common - 1] != '/')
+        {
+            insertText(ls, " ", 1);
+        }
+    }
+    else if (common > wordLength)
+    {
+        insertText(ls, matches[0] + wordLength, common - wordLength);
+    }
+    else if (ls->lastWasTab)
+    {
+        const char *slash = strrchr(word, '/');
+        listMatches(matches, n, command || slash == NULL ? 0 : (size_t)(slash - word) + 1);
+    }
+    else
+    {
+        writeTerminal("\a", 1);
+    }
+
+    freeMatches(matches, n);
+}
+
+// wait in the shell's event loop for a byte of input, or with "idle" set only
+// look for one
+//
+// return: the byte, KEY_COMPLETION when a listing has been made, KEY_IDLE if
+// there is nothing to read with "idle" set, or -1 at end of file
+//
+int readByte(int idle)
+{
+    for (;;)
+    {
+        if (waitHook && !idle)
+        {
+            waitHook();
+        }
+
+        struct pollfd fds[3] = { { STDIN_FILENO, POLLIN, 0 }, { completionFd(), POLLIN, 0 },
+                                 { promptFdHook ? promptFdHook() : -1, POLLIN, 0 } };
+        int ready = poll(fds, 3, idle ? 0 : -1);
+
+        if (ready == 0)
+        {
+            return KEY_IDLE;
+        }
+
+        if (ready == -1)
+        {
+            // SIGCHLD from a background job
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        if (fds[1].revents & POLLIN)
+        {
+            acknowledgeCompletion();
+            return KEY_COMPLETION;
+        }
+
+        if (fds[2].revents)
+        {
+            return KEY_PROMPT;
+        }
+
+        unsigned char c;
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+
+        if (n == 1)
+        {
+            return c;
+        }
+        if (n == 0 || errno != EINTR)
+        {
+            return -1;
+        }
+    }
+}
+
+// read one byte of an escape sequence, -1 if none follows soon
+//
+int readEscapeByte(void)
+{
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    unsigned char c;
+
+    if (poll(&pfd, 1, LINE_EDIT_ESCAPE_WAIT) <= 0 || read(STDIN_FILENO, &c, 1) != 1)
+    {
+        return -1;
+    }
+    return c;
+}
+
+// turn an escape sequence into a key
+//
+int readEscape(void)
+{
+    int c = readEscapeByte();
+
+    if (c == 'b')
+    {
+        return KEY_WORD_LEFT;
+    }
+    if (c == 'f')
+    {
+        return KEY_WORD_RIGHT;
+    }
+    if (c != '[' && c != 'O')
+    {
+        return KEY_NONE;
+    }
+
+    int final = readEscapeByte();
+    int number = 0;
+
+    while (final >= '0' && final <= '9')
+    {
+        number = number * 10 + (final - '0');
+        final = readEscapeByte();
+    }
+
+    // modifiers, e.g. ESC [ 1 ; 5 C, are read and ignored
+    while (final == ';' || (final >= '0' && final <= '9'))
+    {
+        final = readEscapeByte();
+    }
+
+    switch (final)
+    {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return KEY_RIGHT;
+        case 'D': return KEY_LEFT;
+        case 'H': return KEY_HOME;
+        case 'F': return KEY_END;
+        case '~':
+            if (number == 1 || number == 7)
+            {
+                return KEY_HOME;
+            }
+            if (number == 4 || number == 8)
+            {
+                return KEY_END;
+            }
+            if (number == 3)
+            {
+                return KEY_DELETE;
+            }
+            return KEY_NONE;
+        default:
+            return KEY_NONE;
+    }
+}
+
+// read the rest of a UTF-8 character so it is inserted whole
+//
+size_t readCharacter(int first, char *text)
+{
+    size_t n = 1;
+    size_t expected = (first >= 0xf0) ? 4 : (first >= 0xe0) ? 3 : (first >= 0xc0) ? 2 : 1;
+
+    text[0] = (char)first;
+
+    while (n < expected)
+    {
+        int c = readEscapeByte();
+
+        if (c == -1 || (c & 0xc0) != 0x80)
+        {
+            break;
+        }
+        text[n++] = (char)c;
+    }
+
+    return n;
+}
+
+// show the search prompt with the current result, or the last line found if
+// there is none
+//
+void showSearch(LineState *ls)
+{
+    int offset = 0;
+    const char *found = historyResult(ls->search, ls->result, &offset);
+
+    snprintf(ls->searchPrompt, sizeof(ls->searchPrompt), "(%sreverse-i-search)`%s': ",
+             (found == NULL && ls->query[0] != '\0') ? "failed " : "", ls->query);
+    ls->prompt = ls->searchPrompt;
+
+    if (found != NULL)
+    {
+        setLine(ls, found);
+        ls->cursor = (size_t)offset < ls->length ? (size_t)offset : ls->length;
+    }
+
+    refreshLine(ls);
+}
+
+// filter for the query for one frame, and show what has been found
+//
+void updateSearch(LineState *ls)
+{
+    runHistorySearch(ls->search, LINE_EDIT_SEARCH_BUDGET);
+    showSearch(ls);
+}
+
+void startSearch(LineState *ls)
+{
+    if ((ls->search = beginHistorySearch()) == NULL)
+    {
+        writeTerminal("\a", 1);
+        return;
+    }
+
+    snprintf(ls->beforeSearch, sizeof(ls->beforeSearch), "%s", ls->line);
+    ls->query[0] = '\0';
+    ls->result = 0;
+    showSearch(ls);
+}
+
+// leave the search with the line found, or with the line from before it if "abandon" is set
+//
+void endSearch(LineState *ls, int abandon)
+{
+    endHistorySearch(ls->search);
+    ls->search = NULL;
+    ls->prompt = ls->shellPrompt;
+
+    if (abandon)
+    {
+        setLine(ls, ls->beforeSearch);
+    }
+}
+
+// a key typed during a search
+//
+// return: 1 if the search used it, 0 if the search has ended and the key is for the editor
+//
+int searchKey(LineState *ls, int key)
+{
+    size_t length = strlen(ls->query);
+
+    if (key >= 32 && key < 256 && key != 127)
+    {
+        char text[4];
+        size_t n = readCharacter(key, text);
+
+        if (length + n < sizeof(ls->query))
+        {
+            memcpy(ls->query + length, text, n);
+            ls->query[length + n] = '\0';
+        }
+    }
+    else if (key == 127 || key == CONTROL('H'))
+    {
+        ls->query[previousCharacter(ls->query, length)] = '\0';
+    }
+    else if (key == CONTROL('R'))
+    {
+        // the next one down, once it has been found
+        int offset;
+
+        if (historyResult(ls->search, ls->result + 1, &offset) != NULL)
+        {
+            ls->result++;
+        }
+        else
+        {
+            writeTerminal("\a", 1);
+        }
+
+        showSearch(ls);
+        return 1;
+    }
+    else if (key == CONTROL('G') || key == CONTROL('C'))
+    {
+        endSearch(ls, 1);
+        return 1;
+    }
+    else
+    {
+        endSearch(ls, 0);
+        return (key == KEY_NONE);
+    }
+
+    ls->result = 0;
+    setHistoryQuery(ls->search, ls->query);
+    updateSearch(ls);
+    return 1;
+}
+
+int editLine(const char *prompt, char *line, size_t size)
+{
+    struct termios saved, raw;
+
+    fflush(stdout);
+
+    if (tcgetattr(STDIN_FILENO, &saved) == -1)
+    {
+        return -1;
+    }
+
+    raw = saved;
+    raw.c_iflag &= ~(ICRNL | IXON);
+    raw.c_lflag &= ~(ICANON | ECHO | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+
+    // typed ahead input is kept
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+
+    LineState ls;
+    memset(&ls, 0, sizeof(ls));
+    ls.prompt = prompt;
+    ls.shellPrompt = prompt;
+    ls.line = line;
+    ls.size = size;
+    line[0] = '\0';
+
+    refreshLine(&ls);
+
+    int status = 0;
+    int done = 0;
+
+    while (!done)
+    {
+        // an unfinished search goes on while nothing is typed
+        int searching = (ls.search != NULL && !ls.search->levels[ls.search->nLevels - 1].complete);
+        int key = readByte(searching);
+        int wasTab = ls.lastWasTab;
+
+        if (key == KEY_IDLE)
+        {
+            updateSearch(&ls);
+            continue;
+        }
+
+        if (key == KEY_PROMPT)
+        {
+            const char *changed = promptUpdateHook();
+
+            // redrawn in place, the search's prompt stays while there is one
+            if (changed != NULL)
+            {
+                ls.shellPrompt = changed;
+                ls.prompt = ls.search ? ls.prompt : changed;
+                refreshLine(&ls);
+            }
+            continue;
+        }
+
+        ls.lastWasTab = 0;
+
+        if (key == KEY_COMPLETION)
+        {
+            ls.lastWasTab = wasTab;
+
+            // a pending completion goes on where it left off
+            if (ls.pendingTab)
+            {
+                completeLine(&ls);
+                refreshLine(&ls);
+            }
+            continue;
+        }
+
+        // any other key drops a pending completion
+        ls.pendingTab = 0;
+
+        if (key == 27)
+        {
+            key = readEscape();
+        }
+
+        if (ls.search != NULL && searchKey(&ls, key))
+        {
+            if (ls.search == NULL)
+            {
+                refreshLine(&ls);
+            }
+            continue;
+        }
+
+        switch (key)
+        {
+            case -1:
+                status = -1;
+                done = 1;
+                break;
+
+            case '\r':
+            case '\n':
+                ls.cursor = ls.length;
+                refreshLine(&ls);
+                writeTerminal("\n", 1);
+                done = 1;
+                break;
+
+            case '\t':
+                ls.lastWasTab = 1;
+                completeLine(&ls);
+                break;
+
+            case CONTROL('C'):
+                writeTerminal("^C\n", 3);
+                setLine(&ls, "");
+                ls.historyBack = 0;
+                break;
+
+            case CONTROL('D'):
+                if (ls.length == 0)
+                {
+                    status = -1;
+                    done = 1;
+                    break;
+                }
+                /* fall through */
+            case KEY_DELETE:
+                deleteText(&ls, ls.cursor, nextCharacter(line, ls.length, ls.cursor), 0);
+                break;
+
+            case 127:
+            case CONTROL('H'):
+                deleteText(&ls, previousCharacter(line, ls.cursor), ls.cursor, 0);
+                break;
+
+            case CONTROL('A'):
+            case KEY_HOME:
+                ls.cursor = 0;
+                break;
+
+            case CONTROL('E'):
+            case KEY_END:
+                ls.cursor = ls.length;
+                break;
+
+            case CONTROL('B'):
+            case KEY_LEFT:
+                ls.cursor = previousCharacter(line, ls.cursor);
+                break;
+
+            case CONTROL('F'):
+            case KEY_RIGHT:
+                ls.cursor = nextCharacter(line, ls.length, ls.cursor);
+                break;
+
+            case KEY_WORD_LEFT:
+                ls.cursor = wordLeft(&ls);
+                break;
+
+            case KEY_WORD_RIGHT:
+                ls.cursor = wordRight(&ls);
+                break;
+
+            case CONTROL('K'):
+                deleteText(&ls, ls.cursor, ls.length, 1);
+                break;
+
+            case CONTROL('U'):
+                deleteText(&ls, 0, ls.cursor, 1);
+                break;
+
+            case CONTROL('W'):
+                deleteText(&ls, wordLeft(&ls), ls.cursor, 1);
+                break;
+
+            case CONTROL('Y'):
+                insertText(&ls, killBuffer, strlen(killBuffer));
+                break;
+
+            case CONTROL('P'):
+            case KEY_UP:
+                showHistory(&ls, ls.historyBack + 1);
+                break;
+
+            case CONTROL('N'):
+            case KEY_DOWN:
+                if (ls.historyBack > 0)
+                {
+                    showHistory(&ls, ls.historyBack - 1);
+                }
+                break;
+
+            case CONTROL('R'):
+                startSearch(&ls);
+                continue;
+
+            case CONTROL('L'):
+                writeTerminal("\x1b[H\x1b[2J", 7);
+                break;
+
+            default:
+                // printable characters are inserted, other control keys ignored
+                if (key >= 32 && key < 256 && key != 127)
+                {
+                    char text[4];
+                    insertText(&ls, text, readCharacter(key, text));
+                }
+                break;
+        }
+
+        if (!done)
+        {
+            refreshLine(&ls);
+        }
+    }
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &saved);
+
+    return status;
+}
@@ -0,0 +1,65 @@
+#ifndef LINEEDIT_H
+#define LINEEDIT_H
+
+#include <stddef.h>
+
+#define LINE_EDIT_MAX 1024                      // longest line, the terminating null included
+#define LINE_EDIT_ESCAPE_WAIT 50                // milliseconds to tell a lone ESC from an escape sequence
+#define LINE_EDIT_SEARCH_BUDGET 4000            // microseconds of ^R searching between redraws
+
+// purpose:
+//		give the editor history line "back", 1 being the most recent, or NULL
+//
+typedef const char *(*LineHistory)(void *context, int back);
+
+// purpose:
+//		wait in the shell's event loop until there is input to read
+//
+typedef void (*LineWait)(void);
+
+// purpose:
+//		a descriptor that polls readable when the prompt may have changed, or -1
+//
+typedef int (*LinePromptFd)(void);
+
+// purpose:
+//		the prompt if it has changed, or NULL
+//
+typedef const char *(*LinePromptUpdate)(void);
+
+
+// purpose:
+//		set the shell's history and event loop for the editor to use
+//
+void setLineEditorHooks(LineHistory history, LineWait wait, void *context);
+
+// purpose:
+//		let the prompt change while a line is being edited: it is redrawn in place
+//
+void setLinePromptHooks(LinePromptFd fd, LinePromptUpdate update);
+
+// purpose:
+//		check whether standard input and output are a terminal the editor can drive
+//
+int lineEditorUsable(void);
+
+// purpose:
+//		print "prompt" and read a line, edited in raw mode
+//
+// note:
+//		keys: ^A ^E Home End ^B ^F and the arrows move, Alt-b and Alt-f move by words,
+//		^K ^U ^W kill into the kill buffer and ^Y yanks it back, ^P ^N and the
+//		arrows walk the history, ^L clears the screen, ^C drops the line, ^D at the
+//		start of an empty line is end of file. ^R searches the whole history file,
+//		see historyindex.h: typing narrows the search, ^R again shows the next
+//		result, ^G gives up and any other key takes the line found. Tab completes from completion.h and a
+//		second Tab lists the matches; while a listing is being made the editor keeps
+//		reading keys, and completes once it is there. The terminal mode is put back
+//		before returning.
+//
+// return:
+//		0 with the line, without a newline, in "line", or -1 at end of file
+//
+int editLine(const char *prompt, char *line, size_t size);
+
+#endif
@@ -0,0 +1,10 @@
+#define _GNU_SOURCE
+
+#include "libshell.h"
+
+// simpleShell - the shell's core from libshell, reading lines from standard input
+
+int main(int argc, char* argv[])
+{
+    return shellMain(argc, argv);
+}
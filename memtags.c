@@ -0,0 +1,115 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+
+#include "memtags.h"
+
+MemTag memTags[MEM_TAGS] =
+{
+    { "parser", 0, 0, 0, 0 },
+    { "history", 0, 0, 0, 0 },
+    { "glob", 0, 0, 0, 0 },
+    { "jobs", 0, 0, 0, 0 },
+    { "completion", 0, 0, 0, 0 },
+};
+
+// count a new block of "bytes" against "tag"
+//
+void countAllocation(int tag, size_t bytes)
+{
+    MemTag *mt = &memTags[tag];
+    size_t live = __atomic_add_fetch(&mt->live, bytes, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&mt->peak, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&mt->allocations, 1, __ATOMIC_RELAXED);
+
+    while (live > peak && !__atomic_compare_exchange_n(&mt->peak, &peak, live, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+void countFree(int tag, size_t bytes)
+{
+    __atomic_sub_fetch(&memTags[tag].live, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&memTags[tag].frees, 1, __ATOMIC_RELAXED);
+}
+
+void *tagAdopt(int tag, void *p)
+{
+    if (p != NULL)
+    {
+        countAllocation(tag, malloc_usable_size(p));
+    }
+
+    return p;
+}
+
+void *tagMalloc(int tag, size_t size)
+{
+    return tagAdopt(tag, malloc(size));
+}
+
+void *tagCalloc(int tag, size_t n, size_t size)
+{
+    return tagAdopt(tag, calloc(n, size));
+}
+
+void *tagRealloc(int tag, void *p, size_t size)
+{
+    size_t before = p ? malloc_usable_size(p) : 0;
+    void *grown = realloc(p, size);
+
+    // a failed realloc() leaves the block as it was
+    if (grown != NULL || size == 0)
+    {
+        if (p != NULL)
+        {
+            countFree(tag, before);
+        }
+        tagAdopt(tag, grown);
+    }
+
+    return grown;
+}
+
+char *tagStrdup(int tag, const char *s)
+{
+    return tagAdopt(tag, strdup(s));
+}
+
+char *tagStrndup(int tag, const char *s, size_t n)
+{
+    return tagAdopt(tag, strndup(s, n));
+}
+
+void tagFree(int tag, void *p)
+{
+    if (p != NULL)
+    {
+        countFree(tag, malloc_usable_size(p));
+        free(p);
+    }
+}
+
+void printMemStats(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+
+    printf("%-12s %12s %12s %12s %12s\n", "tag", "live bytes", "peak bytes", "allocations", "live blocks");
+
+    for (int i = 0; i < MEM_TAGS; i++)
+    {
+        MemTag *mt = &memTags[i];
+        unsigned long allocations = __atomic_load_n(&mt->allocations, __ATOMIC_RELAXED);
+
+        printf("%-12s %12zu %12zu %12lu %12lu\n", mt->name, __atomic_load_n(&mt->live, __ATOMIC_RELAXED),
+               __atomic_load_n(&mt->peak, __ATOMIC_RELAXED), allocations,
+               allocations - __atomic_load_n(&mt->frees, __ATOMIC_RELAXED));
+    }
+
+    // what no tag covers shows as the difference
+    printf("%-12s %12zu %12s %12s %12s\n", "heap", mi.uordblks + mi.hblkhd, "", "", "");
+}
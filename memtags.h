@@ -0,0 +1,59 @@
+#ifndef MEMTAGS_H
+#define MEMTAGS_H
+
+#include <stddef.h>
+
+// allocation tags, the subsystem a block is counted against
+#define MEM_PARSER     0                        // tokens, syntax trees and the parse cache
+#define MEM_HISTORY    1                        // the ^R history index and its searches
+#define MEM_GLOB       2                        // expanded words: wildcard matches, fields and assignments
+#define MEM_JOBS       3                        // queued jobs and pipelines, reaping and output capture
+#define MEM_COMPLETION 4                        // the completion scanner's listings and matches
+#define MEM_TAGS       5
+
+struct MemTagStruct
+{
+    const char *name;
+    size_t live;                    // bytes allocated and not yet freed
+    size_t peak;                    // the most "live" has been
+    unsigned long allocations;      // blocks allocated, each realloc() counting as a free and an allocation
+    unsigned long frees;            // blocks freed
+};
+
+typedef struct MemTagStruct MemTag;  // per subsystem allocation counters type
+
+
+// purpose:
+//		malloc(), calloc(), realloc(), strdup(), strndup() and free(), with the
+//		block counted against "tag"
+//
+// note:
+//		a block is counted at its usable size, as malloc_usable_size() gives it,
+//		so nothing is stored beside it and a block from one of these can be
+//		given to free() and the other way round without harm; only the counts
+//		are then wrong. The counters are updated atomically, the completion
+//		scanner allocating on its own thread.
+//
+void *tagMalloc(int tag, size_t size);
+void *tagCalloc(int tag, size_t n, size_t size);
+void *tagRealloc(int tag, void *p, size_t size);
+char *tagStrdup(int tag, const char *s);
+char *tagStrndup(int tag, const char *s, size_t n);
+void tagFree(int tag, void *p);
+
+// purpose:
+//		count a block that came from plain malloc() against "tag", when it is
+//		taken over by a subsystem that frees with tagFree()
+//
+// return:
+//		"p"
+//
+void *tagAdopt(int tag, void *p);
+
+// purpose:
+//		print the live bytes, peak and allocation counts of each tag, and the
+//		heap in use by the whole shell
+//
+void printMemStats(void);
+
+#endif
@@ -0,0 +1,539 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "buffer.h"
+#include "parallel.h"
+#include "jobserver.h"
+#include "audit.h"
+#include "probes.h"
+
+#define PARALLEL_READ_SIZE 4096
+#define PARALLEL_PLAIN "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-+=.,:/@%"  // never quoted
+
+double millisecondsSince(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// append "word" to the command, quoted if the shell would otherwise split or expand it
+//
+void appendQuoted(Buffer *command, const char *word)
+{
+    if (*word && strspn(word, PARALLEL_PLAIN) == strlen(word))
+    {
+        bufferAppendString(command, word);
+        return;
+    }
+
+    bufferAppendChar(command, '\'');
+
+    for (const char *p = word; *p; p++)
+    {
+        if (*p == '\'')
+        {
+            bufferAppendString(command, "'\\''");
+        }
+        else
+        {
+            bufferAppendChar(command, *p);
+        }
+    }
+
+    bufferAppendChar(command, '\'');
+}
+
+// the command line for one input: the template with {} replaced, or the input appended,
+// each word quoted so that it reaches the command as a single argument; a template of
+// one word is a command line of its own, e.g. 'echo got {}', and only the input is quoted
+//
+char *buildJobCommand(char *words[], int nWords, const char *input)
+{
+    Buffer command;
+    bufferInit(&command);
+
+    if (nWords == 0)
+    {
+        bufferAppendString(&command, input);
+        return bufferRelease(&command);
+    }
+
+    int replaced = 0;
+
+    if (nWords == 1)
+    {
+        const char *p = words[0];
+        const char *hole;
+
+        while ((hole = strstr(p, PARALLEL_PLACEHOLDER)) != NULL)
+        {
+            bufferAppend(&command, p, hole - p);
+            appendQuoted(&command, input);
+            p = hole + strlen(PARALLEL_PLACEHOLDER);
+            replaced = 1;
+        }
+
+        bufferAppendString(&command, p);
+        nWords = 0;
+    }
+
+    for (int i = 0; i < nWords; i++)
+    {
+        Buffer word;
+        bufferInit(&word);
+        bufferAppendString(&word, "");
+
+        const char *p = words[i];
+        const char *hole;
+
+        while ((hole = strstr(p, PARALLEL_PLACEHOLDER)) != NULL)
+        {
+            bufferAppend(&word, p, hole - p);
+            bufferAppendString(&word, input);
+            p = hole + strlen(PARALLEL_PLACEHOLDER);
+            replaced = 1;
+        }
+
+        bufferAppendString(&word, p);
+
+        if (i > 0)
+        {
+            bufferAppendChar(&command, ' ');
+        }
+
+        appendQuoted(&command, word.data);
+        bufferFree(&word);
+    }
+
+    if (!replaced)
+    {
+        bufferAppendChar(&command, ' ');
+        appendQuoted(&command, input);
+    }
+
+    return bufferRelease(&command);
+}
+
+int startJob(ParallelJob *job, ParallelExecute execute, void *context)
+{
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &job->started);
+    PROBE2(spawn__start, "(parallel job)", 0);
+    job->pid = fork();
+
+    if (job->pid == -1)
+    {
+        perror("fork");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    if (job->pid == 0)
+    {
+        int null = open("/dev/null", O_RDONLY);
+
+        dup2(null, STDIN_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(null);
+        close(fds[0]);
+        close(fds[1]);
+
+        int status = execute(context, job->command);
+
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status & 0xff);
+    }
+
+    PROBE3(spawn__end, job->pid, "(parallel job)", 0);
+    auditStart(job->pid, job->command);
+    close(fds[1]);
+    job->fd = fds[0];
+    job->state = PARALLEL_RUNNING;
+
+    return 0;
+}
+
+int collectJob(ParallelJob *job)
+{
+    if (bufferReserve(&job->output, PARALLEL_READ_SIZE) == -1)
+    {
+        return 0;
+    }
+
+    ssize_t n = read(job->fd, job->output.data + job->output.len, job->output.cap - job->output.len - 1);
+
+    if (n > 0)
+    {
+        job->output.len += n;
+        return 0;
+    }
+
+    if (n == -1 && errno == EINTR)
+    {
+        return 0;
+    }
+
+    int status = 0;
+
+    close(job->fd);
+    job->fd = -1;
+
+    while (waitpid(job->pid, &status, 0) == -1 && errno == EINTR)
+        ;
+
+    auditEnd(job->pid, status);
+
+    job->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    job->elapsed = millisecondsSince(&job->started);
+    job->state = PARALLEL_DONE;
+
+    return 1;
+}
+
+void printJob(ParallelJob *job, const char *name, int verbose)
+{
+    for (size_t done = 0; done < job->output.len; )
+    {
+        ssize_t n = write(STDOUT_FILENO, job->output.data + done, job->output.len - done);
+
+        if (n == -1 && errno != EINTR)
+        {
+            break;
+        }
+
+        done += (n > 0) ? n : 0;
+    }
+
+    if (verbose || job->status != 0)
+    {
+        fprintf(stderr, "%s exit %d, %.1f ms: %s\n", name, job->status, job->elapsed, job->command);
+    }
+
+    bufferFree(&job->output);
+    job->state = PARALLEL_PRINTED;
+}
+
+// print a job of the parallel builtin, reported by its input number
+//
+void printJobNumber(ParallelJob *job, int id, int verbose)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "parallel: [%d]", id);
+    printJob(job, name, verbose);
+}
+
+int compareLatencies(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// the "p"th percentile of "n" sorted latencies
+//
+double percentile(const double *sorted, int n, double p)
+{
+    int i = (int)(p * n + 0.999999) - 1;
+
+    return sorted[i < 0 ? 0 : i];
+}
+
+void printParallelSummary(ParallelJob *jobs, int nJobs, int workers, int failed, double total)
+{
+    double *latencies = malloc(sizeof(double) * (nJobs ? nJobs : 1));
+
+    if (latencies == NULL)
+    {
+        return;
+    }
+
+    for (int i = 0; i < nJobs; i++)
+    {
+        latencies[i] = jobs[i].elapsed;
+    }
+
+    qsort(latencies, nJobs, sizeof(double), compareLatencies);
+
+    fprintf(stderr, "parallel: %d jobs, %d failed, %d workers, %.3f s, %.1f jobs/s\n",
+            nJobs, failed, workers, total / 1000, total > 0 ? nJobs * 1000 / total : 0.0);
+
+    if (nJobs > 0)
+    {
+        fprintf(stderr, "parallel: latency p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+                percentile(latencies, nJobs, 0.50), percentile(latencies, nJobs, 0.90),
+                percentile(latencies, nJobs, 0.99), latencies[nJobs - 1]);
+    }
+
+    free(latencies);
+}
+
+// the inputs: the arguments after :::, or the lines of standard input
+//
+char **readInputs(int argc, char *argv[], int arguments, int *nInputs, Buffer *lines)
+{
+    char **inputs;
+    int n = 0;
+
+    if (arguments >= 0)
+    {
+        inputs = malloc(sizeof(char *) * (argc - arguments + 1));
+
+        for (int i = arguments + 1; inputs && i < argc; i++)
+        {
+            inputs[n++] = argv[i];
+        }
+    }
+    else
+    {
+        fflush(stdout);
+
+        if (bufferReadFd(lines, STDIN_FILENO) == -1)
+        {
+            perror("parallel");
+            return NULL;
+        }
+
+        size_t count = 1;
+
+        for (size_t i = 0; i < lines->len; i++)
+        {
+            count += (lines->data[i] == '\n');
+        }
+
+        inputs = malloc(sizeof(char *) * count);
+
+        for (char *line = lines->data; inputs && line && line < lines->data + lines->len; )
+        {
+            char *end = strchr(line, '\n');
+
+            if (end)
+            {
+                *end = '\0';
+            }
+
+            if (*line)
+            {
+                inputs[n++] = line;
+            }
+
+            line = end ? end + 1 : NULL;
+        }
+    }
+
+    *nInputs = n;
+
+    return inputs;
+}
+
+int runParallel(int argc, char *argv[], ParallelExecute execute, void *context)
+{
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int unordered = 0;
+    int verbose = 0;
+    int first = 1;
+
+    for (; first < argc && argv[first][0] == '-' && argv[first][1]; first++)
+    {
+        if (strcmp(argv[first], "-j") == 0 && first + 1 < argc)
+        {
+            workers = atol(argv[++first]);
+        }
+        else if (strncmp(argv[first], "-j", 2) == 0 && argv[first][2])
+        {
+            workers = atol(argv[first] + 2);
+        }
+        else if (strcmp(argv[first], "-u") == 0)
+        {
+            unordered = 1;
+        }
+        else if (strcmp(argv[first], "-v") == 0)
+        {
+            verbose = 1;
+        }
+        else
+        {
+            fprintf(stderr, "usage: parallel [-j N] [-u] [-v] [command ...] [::: argument ...]\n");
+            return 255;
+        }
+    }
+
+    if (workers < 1)
+    {
+        workers = 1;
+    }
+
+    int arguments = -1;
+
+    for (int i = first; i < argc; i++)
+    {
+        if (strcmp(argv[i], PARALLEL_ARGUMENTS) == 0)
+        {
+            arguments = i;
+            break;
+        }
+    }
+
+    Buffer lines;
+    bufferInit(&lines);
+
+    int nJobs = 0;
+    char **inputs = readInputs(argc, argv, arguments, &nJobs, &lines);
+    ParallelJob *jobs = calloc(nJobs ? nJobs : 1, sizeof(ParallelJob));
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * (workers + 1));
+    int *running = malloc(sizeof(int) * workers);
+
+    if (inputs == NULL || jobs == NULL || fds == NULL || running == NULL)
+    {
+        free(inputs);
+        free(jobs);
+        free(fds);
+        free(running);
+        bufferFree(&lines);
+        return PARALLEL_MAX_FAILED;
+    }
+
+    int nWords = (arguments >= 0 ? arguments : argc) - first;
+
+    for (int i = 0; i < nJobs; i++)
+    {
+        jobs[i].command = buildJobCommand(argv + first, nWords, inputs[i]);
+        jobs[i].fd = -1;
+        bufferInit(&jobs[i].output);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fflush(stdout);
+    fflush(stderr);
+
+    int next = 0;           // next job to start
+    int printed = 0;        // jobs printed so far; in input order, the next one to print
+    int nRunning = 0;
+    int failed = 0;
+    int tokens = 0;         // jobserver tokens held, one for every running job but the first
+
+    while (printed < nJobs)
+    {
+        // keep every worker busy
+        while (nRunning < workers && next < nJobs)
+        {
+            if (nRunning > tokens && jobserverActive())
+            {
+                if (!jobserverAcquire())
+                {
+                    break;
+                }
+                tokens++;
+            }
+
+            if (startJob(&jobs[next], execute, context) == -1)
+            {
+                jobs[next].status = 127;
+                jobs[next].state = PARALLEL_DONE;
+                failed++;
+
+                if (unordered)
+                {
+                    printJobNumber(&jobs[next], next + 1, verbose);
+                    printed++;
+                }
+            }
+            else
+            {
+                running[nRunning++] = next;
+            }
+            next++;
+        }
+
+        if (nRunning > 0)
+        {
+            for (int i = 0; i < nRunning; i++)
+            {
+                fds[i].fd = jobs[running[i]].fd;
+                fds[i].events = POLLIN;
+            }
+
+            // a worker is free but waits for a jobserver token
+            int waiting = (nRunning < workers && next < nJobs && jobserverActive());
+
+            fds[nRunning].fd = jobserverFd();
+            fds[nRunning].events = POLLIN;
+            fds[nRunning].revents = 0;
+
+            if (poll(fds, nRunning + waiting, -1) == -1 && errno != EINTR)
+            {
+                perror("poll");
+                break;
+            }
+
+            for (int i = nRunning - 1; i >= 0; i--)
+            {
+                ParallelJob *job = &jobs[running[i]];
+
+                if (fds[i].revents && collectJob(job))
+                {
+                    running[i] = running[--nRunning];
+                    failed += (job->status != 0);
+
+                    if (tokens > 0 && tokens >= nRunning)
+                    {
+                        jobserverRelease();
+                        tokens--;
+                    }
+
+                    if (unordered)
+                    {
+                        printJobNumber(job, job - jobs + 1, verbose);
+                        printed++;
+                    }
+                }
+            }
+        }
+
+        // in input order, print every finished job up to the first one still running
+        while (!unordered && printed < nJobs && jobs[printed].state == PARALLEL_DONE)
+        {
+            printJobNumber(&jobs[printed], printed + 1, verbose);
+            printed++;
+        }
+    }
+
+    printParallelSummary(jobs, nJobs, (int)workers, failed, millisecondsSince(&start));
+
+    for (int i = 0; i < nJobs; i++)
+    {
+        free(jobs[i].command);
+        bufferFree(&jobs[i].output);
+    }
+
+    free(inputs);
+    free(jobs);
+    free(fds);
+    free(running);
+    bufferFree(&lines);
+
+    return failed < PARALLEL_MAX_FAILED ? failed : PARALLEL_MAX_FAILED;
+}
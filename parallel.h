@@ -0,0 +1,85 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "buffer.h"
+
+#define PARALLEL_ARGUMENTS ":::"                // arguments that follow are the inputs, instead of standard input
+#define PARALLEL_PLACEHOLDER "{}"               // replaced by the input in the command template
+#define PARALLEL_MAX_FAILED 101                 // highest exit status, for that many failed jobs or more
+
+// job states
+#define PARALLEL_WAITING 0
+#define PARALLEL_RUNNING 1
+#define PARALLEL_DONE    2
+#define PARALLEL_PRINTED 3
+
+struct ParallelJobStruct
+{
+    char *command;              // the command line run by the job
+    pid_t pid;                  // the process running it
+    int fd;                     // read end of the pipe collecting its output
+    Buffer output;              // output collected so far, released once printed
+    int status;                 // exit status
+    int state;                  // one of the job states above
+    struct timespec started;    // when the job was started
+    double elapsed;             // milliseconds from start to exit
+};
+
+typedef struct ParallelJobStruct ParallelJob;  // parallel job type
+
+// run one command line in a child copy of the shell and return its exit status
+typedef int (*ParallelExecute)(void *context, const char *line);
+
+
+// purpose:
+//		start "job->command" in a forked copy of the shell, its stdout and stderr
+//		going into a pipe that collectJob() reads
+//
+// return:
+//		0 if successful, -1 if the pipe or the process cannot be created
+//
+int startJob(ParallelJob *job, ParallelExecute execute, void *context);
+
+// purpose:
+//		read what a running job has written since the last call, once its pipe is
+//		readable; at end of file the job is waited for and its status recorded
+//
+// return:
+//		1 when the job has finished, 0 otherwise
+//
+int collectJob(ParallelJob *job);
+
+// purpose:
+//		print a finished job's output, report its status under "name" if it failed
+//		(or always, with "verbose") and release the output
+//
+void printJob(ParallelJob *job, const char *name, int verbose);
+
+// purpose:
+//		milliseconds elapsed since "start", on the monotonic clock
+//
+double millisecondsSince(const struct timespec *start);
+
+// purpose:
+//		the parallel builtin - parallel [-j N] [-u] [-v] [command ...] [::: argument ...]
+//
+// note:
+//		every input (a line of standard input, or an argument after :::) becomes one
+//		job: the input replaces {} in the command, is appended to it when there is
+//		no {}, or is the whole command line when no command is given. At most N jobs
+//		(default: the number of processors) run at once, each in a forked copy of the
+//		shell with its stdout and stderr collected in a buffer. Output is printed in
+//		input order, each buffer being released as soon as it is printed, or in the
+//		order the jobs finish with -u. Failed jobs are reported, all jobs with -v,
+//		followed by a summary of throughput and latency on stderr. Under a
+//		jobserver every job but the first also waits for a token.
+//
+// return:
+//		the number of failed jobs, up to PARALLEL_MAX_FAILED; 255 for a usage error
+//
+int runParallel(int argc, char *argv[], ParallelExecute execute, void *context);
+
+#endif
@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "parsecache.h"
+#include "memtags.h"
+
+ParsedLine *cacheBuckets[PARSE_CACHE_BUCKETS];
+ParsedLine *cacheHead = NULL;    // most recently used
+ParsedLine *cacheTail = NULL;    // least recently used, evicted first
+int cacheEntries = 0;
+
+long parseCacheHits = 0;
+long parseCacheMisses = 0;
+long parseCacheEvictions = 0;
+
+// FNV-1a over the whole line
+//
+unsigned int hashLine(const char *line)
+{
+    unsigned int h = 2166136261u;
+
+    while (*line)
+    {
+        h ^= (unsigned char)*line++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+void unlinkLRU(ParsedLine *pl)
+{
+    if (pl->prev)
+        pl->prev->next = pl->next;
+    else
+        cacheHead = pl->next;
+
+    if (pl->next)
+        pl->next->prev = pl->prev;
+    else
+        cacheTail = pl->prev;
+
+    pl->prev = pl->next = NULL;
+}
+
+void pushFrontLRU(ParsedLine *pl)
+{
+    pl->prev = NULL;
+    pl->next = cacheHead;
+
+    if (cacheHead)
+        cacheHead->prev = pl;
+    else
+        cacheTail = pl;
+
+    cacheHead = pl;
+}
+
+void freeParsedLine(ParsedLine *pl)
+{
+    // argument vectors in the tree point into "token", only the vectors are owned
+    freeTree(pl->tree);
+
+    for (int i = 0; i < pl->nTokens; ++i)
+    {
+        tagFree(MEM_PARSER, pl->token[i]);
+    }
+
+    tagFree(MEM_PARSER, pl->token);
+    tagFree(MEM_PARSER, pl->line);
+    tagFree(MEM_PARSER, pl);
+}
+
+void evictParsedLine(ParsedLine *pl)
+{
+    ParsedLine **link = &cacheBuckets[pl->hash & (PARSE_CACHE_BUCKETS - 1)];
+
+    while (*link != pl)
+    {
+        link = &(*link)->chain;
+    }
+
+    *link = pl->chain;
+    unlinkLRU(pl);
+
+    pl->cached = 0;
+    cacheEntries--;
+    parseCacheEvictions++;
+
+    // still being executed, freed by the last releaseParsedLine()
+    if (pl->refs == 0)
+    {
+        freeParsedLine(pl);
+    }
+}
+
+ParsedLine *lookupParsedLine(const char *line)
+{
+    unsigned int hash = hashLine(line);
+    ParsedLine *pl = cacheBuckets[hash & (PARSE_CACHE_BUCKETS - 1)];
+
+    while (pl && (pl->hash != hash || strcmp(pl->line, line) != 0))
+    {
+        pl = pl->chain;
+    }
+
+    if (pl == NULL)
+    {
+        parseCacheMisses++;
+        return NULL;
+    }
+
+    parseCacheHits++;
+
+    unlinkLRU(pl);
+    pushFrontLRU(pl);
+    pl->refs++;
+
+    return pl;
+}
+
+void insertParsedLine(ParsedLine *pl)
+{
+    if (cacheEntries >= PARSE_CACHE_SIZE)
+    {
+        evictParsedLine(cacheTail);
+    }
+
+    pl->hash = hashLine(pl->line);
+
+    ParsedLine **bucket = &cacheBuckets[pl->hash & (PARSE_CACHE_BUCKETS - 1)];
+    pl->chain = *bucket;
+    *bucket = pl;
+
+    pushFrontLRU(pl);
+    pl->cached = 1;
+    pl->refs++;
+    cacheEntries++;
+}
+
+void releaseParsedLine(ParsedLine *pl)
+{
+    if (--pl->refs == 0 && !pl->cached)
+    {
+        freeParsedLine(pl);
+    }
+}
+
+void printParseCacheStats(void)
+{
+    long lookups = parseCacheHits + parseCacheMisses;
+
+    printf("parse cache: %d/%d entries, %ld hits, %ld misses, %ld evictions (%.1f%% hit rate)\n",
+           cacheEntries, PARSE_CACHE_SIZE, parseCacheHits, parseCacheMisses, parseCacheEvictions,
+           lookups ? 100.0 * parseCacheHits / lookups : 0.0);
+}
@@ -0,0 +1,64 @@
+#ifndef PARSECACHE_H
+#define PARSECACHE_H
+
+#include "syntax.h"
+
+#define PARSE_CACHE_SIZE 64                     // number of parsed lines kept
+#define PARSE_CACHE_BUCKETS 128                 // hash buckets, a power of two
+
+struct ParsedLineStruct
+{
+    char *line;                 // the input line this was parsed from, the cache key
+    unsigned int hash;          // hash of "line"
+    char **token;               // the tokens of the line, as produced by the lexer
+    int nTokens;                // number of tokens owned by "token"
+    Node *tree;                 // the syntax tree built by parseTree(), run as often as needed
+    int error;                  // the parseTree() error code, 0 if the line parsed
+    int delegate;               // 1 if the line uses syntax that is handed to /bin/sh as a whole
+    int refs;                   // number of executions currently using this entry
+    int cached;                 // 1 while the entry is linked into the cache
+    struct ParsedLineStruct *prev, *next;   // LRU list, most recently used first
+    struct ParsedLineStruct *chain;         // next entry in the same hash bucket
+};
+
+typedef struct ParsedLineStruct ParsedLine;  // parsed line type
+
+
+// purpose:
+//		look up a line in the cache; a hit makes the entry the most recently used
+//		one and takes a reference to it
+//
+// return:
+//		the parsed line, or NULL on a miss
+//
+ParsedLine *lookupParsedLine(const char *line);
+
+// purpose:
+//		add a freshly parsed line to the cache, evicting the least recently used
+//		entry if the cache is full, and take a reference to it
+//
+// note:
+//		"pl->line" must already be set; the cache computes the hash
+//
+void insertParsedLine(ParsedLine *pl);
+
+// purpose:
+//		drop a reference taken by lookupParsedLine() or insertParsedLine()
+//
+// note:
+//		entries are never modified once parsed; an evicted entry is freed when its
+//		last reference is dropped
+//
+void releaseParsedLine(ParsedLine *pl);
+
+// purpose:
+//		free a parsed line and everything it owns
+//
+void freeParsedLine(ParsedLine *pl);
+
+// purpose:
+//		print the hit and miss counters of the cache
+//
+void printParseCacheStats(void);
+
+#endif
@@ -0,0 +1,404 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "jobs.h"
+#include "priority.h"
+
+#define IOPRIO_WHO_PROCESS 1                    // ioprio_set(2) has no glibc wrapper
+#define IOPRIO_CLASS_SHIFT 13
+
+Priority backgroundPolicy;          // applied to every new background job
+int baseNice = 0;                   // the shell's own niceness, kept by the foreground
+
+const char *ioClassNames[] = { "none", "realtime", "best-effort", "idle" };
+
+// parse a niceness, -20 to 19
+//
+int parseNice(const char *text, int *nice)
+{
+    char *end;
+    long value = strtol(text, &end, 10);
+
+    if (*text == '\0' || *end != '\0' || value < -20 || value > 19)
+    {
+        return -1;
+    }
+
+    *nice = (int)value;
+    return 0;
+}
+
+// parse an I/O class: none, realtime, best-effort or idle (or rt, be), with an
+// optional :level from 0 to 7
+//
+int parseIoClass(const char *text, int *ioClass, int *ioLevel)
+{
+    size_t length = strcspn(text, ":");
+    int found = -1;
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (strlen(ioClassNames[i]) == length && strncmp(text, ioClassNames[i], length) == 0)
+        {
+            found = i;
+        }
+    }
+
+    if (length == 2 && strncmp(text, "rt", 2) == 0)
+    {
+        found = PRIORITY_IO_REALTIME;
+    }
+    else if (length == 2 && strncmp(text, "be", 2) == 0)
+    {
+        found = PRIORITY_IO_BEST_EFFORT;
+    }
+
+    int level = 4;
+
+    if (text[length] == ':')
+    {
+        char *end;
+        level = (int)strtol(text + length + 1, &end, 10);
+
+        if (end == text + length + 1 || *end != '\0' || level < 0 || level > 7)
+        {
+            return -1;
+        }
+    }
+
+    if (found == -1)
+    {
+        return -1;
+    }
+
+    *ioClass = found;
+    *ioLevel = (found == PRIORITY_IO_IDLE || found == PRIORITY_IO_NONE) ? 0 : level;
+    return 0;
+}
+
+// parse a processor list such as 0-3,6, or all
+//
+int parseCpus(const char *text, cpu_set_t *cpus)
+{
+    long configured = sysconf(_SC_NPROCESSORS_CONF);
+
+    CPU_ZERO(cpus);
+
+    if (strcmp(text, "all") == 0)
+    {
+        for (long i = 0; i < configured && i < CPU_SETSIZE; i++)
+        {
+            CPU_SET(i, cpus);
+        }
+        return 0;
+    }
+
+    const char *p = text;
+
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p || first < 0)
+        {
+            return -1;
+        }
+
+        if (*end == '-')
+        {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+
+            if (end == p || last < first)
+            {
+                return -1;
+            }
+        }
+
+        if (last >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+
+        for (long i = first; i <= last; i++)
+        {
+            CPU_SET(i, cpus);
+        }
+
+        if (*end == ',')
+        {
+            end++;
+        }
+        else if (*end != '\0')
+        {
+            return -1;
+        }
+
+        p = end;
+    }
+
+    return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+// print a processor set as a list of ranges
+//
+void printCpus(const Priority *priority)
+{
+    long configured = sysconf(_SC_NPROCESSORS_CONF);
+
+    if (!priority->hasCpus || CPU_COUNT(&priority->cpus) >= configured)
+    {
+        printf("all");
+        return;
+    }
+
+    const char *separator = "";
+
+    for (int i = 0; i < CPU_SETSIZE; i++)
+    {
+        if (CPU_ISSET(i, &priority->cpus))
+        {
+            int last = i;
+
+            while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &priority->cpus))
+            {
+                last++;
+            }
+
+            printf(last > i ? "%s%d-%d" : "%s%d", separator, i, last);
+            separator = ",";
+            i = last;
+        }
+    }
+}
+
+void initialisePriority(void)
+{
+    const char *nice = getenv(PRIORITY_NICE_VARIABLE);
+    const char *io = getenv(PRIORITY_IO_VARIABLE);
+    const char *cpus = getenv(PRIORITY_CPUS_VARIABLE);
+
+    errno = 0;
+    baseNice = getpriority(PRIO_PROCESS, 0);
+
+    if (errno != 0)
+    {
+        baseNice = 0;
+    }
+
+    memset(&backgroundPolicy, 0, sizeof(backgroundPolicy));
+    backgroundPolicy.nice = PRIORITY_DEFAULT_NICE;
+    parseIoClass(PRIORITY_DEFAULT_IO, &backgroundPolicy.ioClass, &backgroundPolicy.ioLevel);
+
+    if (nice && parseNice(nice, &backgroundPolicy.nice) == -1)
+    {
+        fprintf(stderr, "%s: %s: not a niceness\n", PRIORITY_NICE_VARIABLE, nice);
+    }
+
+    if (io && parseIoClass(io, &backgroundPolicy.ioClass, &backgroundPolicy.ioLevel) == -1)
+    {
+        fprintf(stderr, "%s: %s: not an I/O class\n", PRIORITY_IO_VARIABLE, io);
+    }
+
+    if (cpus && *cpus)
+    {
+        if (parseCpus(cpus, &backgroundPolicy.cpus) == 0)
+        {
+            backgroundPolicy.hasCpus = 1;
+        }
+        else
+        {
+            fprintf(stderr, "%s: %s: not a processor list\n", PRIORITY_CPUS_VARIABLE, cpus);
+        }
+    }
+}
+
+// give one process the fields of "priority" that are set
+//
+int applyPriority(pid_t pid, const Priority *priority)
+{
+    int result = 0;
+
+    if (priority->nice != PRIORITY_UNSET)
+    {
+        int nice = baseNice + priority->nice;
+        nice = (nice < -20) ? -20 : (nice > 19) ? 19 : nice;
+
+        // only root may lower a niceness again
+        if (setpriority(PRIO_PROCESS, pid, nice) == -1)
+        {
+            result = -1;
+        }
+    }
+
+    if (priority->ioClass != PRIORITY_UNSET)
+    {
+        int value = (priority->ioClass << IOPRIO_CLASS_SHIFT) | priority->ioLevel;
+
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, value) == -1)
+        {
+            result = -1;
+        }
+    }
+
+    if (priority->hasCpus && sched_setaffinity(pid, sizeof(cpu_set_t), &priority->cpus) == -1)
+    {
+        result = -1;
+    }
+
+    return result;
+}
+
+void applyBackgroundPriority(pid_t pid)
+{
+    // best effort: a job runs even where the policy is not allowed
+    applyPriority(pid, &backgroundPolicy);
+}
+
+// apply "priority" to a running job and everything it has started
+//
+int changeJobPriority(const char *text, const Priority *priority)
+{
+    const char *number = (*text == '%') ? text + 1 : text;
+    char *end;
+    long id = strtol(number, &end, 10);
+    Job *job = (*number && *end == '\0') ? findJob((int)id) : NULL;
+
+    if (job == NULL || job->state != JOB_RUNNING || job->kind != JOB_BACKGROUND)
+    {
+        fprintf(stderr, "bgprio: %s: no such job\n", text);
+        return 1;
+    }
+
+    pid_t pids[MAX_JOB_PROCESSES * 64];
+    int n = 0;
+
+    for (int i = 0; i < job->total_pids; i++)
+    {
+        if (job->pids[i] > 0)
+        {
+            pids[n++] = job->pids[i];
+        }
+    }
+
+    n = addDescendants(pids, n, sizeof(pids) / sizeof(pids[0]));
+
+    int failed = 0;
+
+    for (int i = 0; i < n; i++)
+    {
+        // processes that have exited in the meantime do not count
+        if (applyPriority(pids[i], priority) == -1 && errno != ESRCH)
+        {
+            failed = errno;
+        }
+    }
+
+    if (failed)
+    {
+        fprintf(stderr, "bgprio: %s: %s\n", text, strerror(failed));
+        return 1;
+    }
+
+    return 0;
+}
+
+int changePriority(int argc, char *argv[])
+{
+    Priority given;
+    memset(&given, 0, sizeof(given));
+    given.nice = PRIORITY_UNSET;
+    given.ioClass = PRIORITY_UNSET;
+
+    int first = 1;
+
+    for (; first + 1 < argc && argv[first][0] == '-'; first += 2)
+    {
+        const char *value = argv[first + 1];
+        int valid;
+
+        if (strcmp(argv[first], "-n") == 0)
+        {
+            valid = (parseNice(value, &given.nice) == 0);
+        }
+        else if (strcmp(argv[first], "-c") == 0)
+        {
+            valid = (parseIoClass(value, &given.ioClass, &given.ioLevel) == 0);
+        }
+        else if (strcmp(argv[first], "-a") == 0)
+        {
+            valid = (parseCpus(value, &given.cpus) == 0);
+            given.hasCpus = 1;
+        }
+        else
+        {
+            break;
+        }
+
+        if (!valid)
+        {
+            fprintf(stderr, "bgprio: %s %s: invalid value\n", argv[first], value);
+            return 1;
+        }
+    }
+
+    if (first < argc && argv[first][0] == '-')
+    {
+        fprintf(stderr, "usage: bgprio [-n nice] [-c class[:level]] [-a cpus] [%%job ...]\n");
+        return 1;
+    }
+
+    // job numbers: change those jobs, not the policy
+    if (first < argc)
+    {
+        int status = 0;
+
+        for (int i = first; i < argc; i++)
+        {
+            status |= changeJobPriority(argv[i], &given);
+        }
+
+        return status;
+    }
+
+    if (given.nice != PRIORITY_UNSET)
+    {
+        backgroundPolicy.nice = given.nice;
+    }
+
+    if (given.ioClass != PRIORITY_UNSET)
+    {
+        backgroundPolicy.ioClass = given.ioClass;
+        backgroundPolicy.ioLevel = given.ioLevel;
+    }
+
+    if (given.hasCpus)
+    {
+        backgroundPolicy.hasCpus = 1;
+        backgroundPolicy.cpus = given.cpus;
+    }
+
+    printf("nice %+d, io %s", backgroundPolicy.nice, ioClassNames[backgroundPolicy.ioClass]);
+
+    if (backgroundPolicy.ioClass == PRIORITY_IO_REALTIME || backgroundPolicy.ioClass == PRIORITY_IO_BEST_EFFORT)
+    {
+        printf(":%d", backgroundPolicy.ioLevel);
+    }
+
+    printf(", cpus ");
+    printCpus(&backgroundPolicy);
+    printf("\n");
+
+    return 0;
+}
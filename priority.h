@@ -0,0 +1,66 @@
+#ifndef PRIORITY_H
+#define PRIORITY_H
+
+#include <sched.h>
+#include <sys/types.h>
+
+#define PRIORITY_NICE_VARIABLE "BG_NICE"        // niceness added for background jobs
+#define PRIORITY_IO_VARIABLE "BG_IOCLASS"       // I/O class of background jobs, e.g. idle or best-effort:7
+#define PRIORITY_CPUS_VARIABLE "BG_CPUS"        // processors background jobs may run on, e.g. 0-3,6
+#define PRIORITY_DEFAULT_NICE 10
+#define PRIORITY_DEFAULT_IO "best-effort:7"
+#define PRIORITY_UNSET -1                       // a field the policy leaves alone
+
+// I/O scheduling classes, as for ioprio_set(2)
+#define PRIORITY_IO_NONE        0
+#define PRIORITY_IO_REALTIME    1
+#define PRIORITY_IO_BEST_EFFORT 2
+#define PRIORITY_IO_IDLE        3
+
+struct PriorityStruct
+{
+    int nice;                   // niceness added to the shell's own, or PRIORITY_UNSET
+    int ioClass;                // one of the I/O classes above, or PRIORITY_UNSET
+    int ioLevel;                // 0 (highest) to 7 within the class
+    int hasCpus;                // 1 if "cpus" restricts the processors
+    cpu_set_t cpus;             // the processors allowed
+};
+
+typedef struct PriorityStruct Priority;  // scheduling policy type
+
+
+// purpose:
+//		set up the background policy from BG_NICE, BG_IOCLASS and BG_CPUS in the
+//		environment, with defaults of nice 10 and best-effort:7 on every processor
+//
+// note:
+//		the foreground keeps the shell's own priority; the niceness is added to
+//		the shell's niceness at this point
+//
+void initialisePriority(void);
+
+// purpose:
+//		give a background job's process the background policy, 0 meaning the
+//		calling process itself
+//
+// note:
+//		called in the forked child before it runs anything, so that the processes
+//		it starts inherit the policy, and by the shell for processes spawned on
+//		its behalf by the fork server
+//
+void applyBackgroundPriority(pid_t pid);
+
+// purpose:
+//		the bgprio builtin - bgprio [-n nice] [-c class[:level]] [-a cpus] [%job ...]
+//
+// note:
+//		without jobs, changes and prints the policy for new background jobs. With
+//		job numbers, applies the options given to every process of those running
+//		jobs and the processes they have started.
+//
+// return:
+//		0 if successful, 1 otherwise
+//
+int changePriority(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+// USDT probes for perf and bpftrace, provider "simpleShell"; built with
+// "make -f makefile.unknown PROBES=1" they are compiled in from <sys/sdt.h>
+// (systemtap-sdt-dev), otherwise they are nothing and cost nothing
+//
+//		line__read(line, length)                a line has been read, before it is run
+//		line__parsed(line, cached, delegated, error)
+//		                                        the line is parsed, or taken from the parse cache;
+//		                                        delegated lines go to /bin/sh, error is parseTree()'s
+//		pipeline__create(commands, background)  the pipes of a pipeline are open
+//		spawn__start(command, stage)            about to fork, or launch through the fork server;
+//		                                        a copy of the shell that runs a subshell, a command
+//		                                        or process substitution, a background compound
+//		                                        command or a parallel job is named in parentheses
+//		spawn__end(pid, command, stage)         the process exists
+//		exec__fail(command, errno)              in the child: exec failed
+//		child__reap(pid, status)                a process was reaped; status as from waitpid()
+
+#if defined(SHELL_PROBES) && SHELL_PROBES && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SHELL_PROBES_ENABLED 1
+#else
+#warning "<sys/sdt.h> not found, the probes are compiled out"
+#endif
+#endif
+
+#ifdef SHELL_PROBES_ENABLED
+#define PROBE2(name, a, b) DTRACE_PROBE2(simpleShell, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(simpleShell, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(simpleShell, name, a, b, c, d)
+#else
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#define PROBE4(name, a, b, c, d) do { } while (0)
+#endif
+
+#endif
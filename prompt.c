@@ -0,0 +1,392 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "buffer.h"
+#include "prompt.h"
+#include "variables.h"
+
+GitState gitStates[PROMPT_GIT_CACHE];
+int nGitStates = 0;
+unsigned long gitUses = 0;
+
+pid_t gitPid = 0;                   // the git status worker, 0 if none is running
+int gitFd = -1;                     // read end of its output
+char gitDirectory[4096];            // where it runs
+Buffer gitOutput;
+int gitRerun = 0;                   // the prompt was drawn again while it ran
+pid_t promptOwner = 0;              // the process the worker belongs to
+
+int lastStatus = 0;
+long lastMilliseconds = 0;
+char promptTemplate[PROMPT_MAX_LENGTH];
+char expanded[PROMPT_MAX_LENGTH];
+
+void setPromptStatus(int status, long milliseconds)
+{
+    lastStatus = status;
+    lastMilliseconds = milliseconds;
+}
+
+// a forked copy of the shell inherits the worker's pipe, but not the worker
+//
+void forgetInheritedWorker(void)
+{
+    pid_t self = getpid();
+
+    if (promptOwner != self)
+    {
+        if (promptOwner != 0 && gitFd != -1)
+        {
+            close(gitFd);
+            bufferFree(&gitOutput);
+        }
+
+        gitPid = 0;
+        gitFd = -1;
+        promptOwner = self;
+    }
+}
+
+// the cached state of "directory", or NULL
+//
+GitState *findGitState(const char *directory)
+{
+    for (int i = 0; i < nGitStates; i++)
+    {
+        if (strcmp(gitStates[i].directory, directory) == 0)
+        {
+            gitStates[i].lastUsed = ++gitUses;
+            return &gitStates[i];
+        }
+    }
+
+    return NULL;
+}
+
+// the entry for "directory", the least recently used one taken if it is new
+//
+GitState *newGitState(const char *directory)
+{
+    GitState *gs = findGitState(directory);
+
+    if (gs == NULL)
+    {
+        gs = &gitStates[0];
+
+        if (nGitStates < PROMPT_GIT_CACHE)
+        {
+            gs = &gitStates[nGitStates++];
+        }
+        else
+        {
+            for (int i = 1; i < nGitStates; i++)
+            {
+                gs = (gitStates[i].lastUsed < gs->lastUsed) ? &gitStates[i] : gs;
+            }
+        }
+
+        memset(gs, 0, sizeof(GitState));
+        snprintf(gs->directory, sizeof(gs->directory), "%s", directory);
+        gs->lastUsed = ++gitUses;
+    }
+
+    return gs;
+}
+
+// start git status in the background in "directory"
+//
+void startGitWorker(const char *directory)
+{
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+        return;
+    }
+
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        // its own process group, so ^C at a foreground command leaves it alone
+        setpgid(0, 0);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDERR_FILENO);
+        dup2(fds[1], STDOUT_FILENO);
+
+        // a prompt must not hold the index lock against the user's own git commands
+        execlp("git", "git", "--no-optional-locks", "status", "--porcelain=v2", "--branch", (char *)NULL);
+        _exit(127);
+    }
+
+    close(fds[1]);
+
+    if (pid == -1)
+    {
+        close(fds[0]);
+        return;
+    }
+
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    gitPid = pid;
+    gitFd = fds[0];
+    gitRerun = 0;
+    snprintf(gitDirectory, sizeof(gitDirectory), "%s", directory);
+    bufferInit(&gitOutput);
+}
+
+// take the branch and dirty state from git status --porcelain=v2 --branch
+//
+void parseGitStatus(GitState *gs, char *output)
+{
+    char oid[16] = "";
+
+    gs->branch[0] = '\0';
+    gs->dirty = 0;
+
+    for (char *save = NULL, *line = strtok_r(output, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+    {
+        if (strncmp(line, "# branch.head ", 14) == 0)
+        {
+            snprintf(gs->branch, sizeof(gs->branch), "%s", line + 14);
+        }
+        else if (strncmp(line, "# branch.oid ", 13) == 0)
+        {
+            snprintf(oid, sizeof(oid), "%.7s", line + 13);
+        }
+        else if (line[0] != '#')
+        {
+            gs->dirty = 1;
+        }
+    }
+
+    if (strcmp(gs->branch, "(detached)") == 0)
+    {
+        snprintf(gs->branch, sizeof(gs->branch), "%s", oid);
+    }
+}
+
+// the worker has finished: store what it found
+//
+void finishGitWorker(void)
+{
+    int status;
+
+    close(gitFd);
+    gitFd = -1;
+
+    while (waitpid(gitPid, &status, 0) == -1 && errno == EINTR)
+    {
+    }
+    gitPid = 0;
+
+    GitState *gs = newGitState(gitDirectory);
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+        parseGitStatus(gs, gitOutput.data ? gitOutput.data : (char *)"");
+    }
+    else if (WIFEXITED(status) && WEXITSTATUS(status) == 128)
+    {
+        // not a repository
+        gs->branch[0] = '\0';
+        gs->dirty = 0;
+    }
+
+    // anything else, e.g. no git at all or a killed worker, keeps the state it had
+    bufferFree(&gitOutput);
+}
+
+void appendPromptText(char *out, size_t *at, const char *text)
+{
+    size_t n = strlen(text);
+
+    if (*at + n >= PROMPT_MAX_LENGTH)
+    {
+        n = PROMPT_MAX_LENGTH - 1 - *at;
+    }
+
+    memcpy(out + *at, text, n);
+    *at += n;
+    out[*at] = '\0';
+}
+
+// expand "promptTemplate" into "out" with the values cached
+//
+void expandTemplate(char *out, const char *cwd)
+{
+    const char *home = getVariable("HOME");
+    size_t at = 0;
+    char text[4096 + 16];
+
+    out[0] = '\0';
+
+    for (const char *p = promptTemplate; *p; p++)
+    {
+        if (*p != '\\' || p[1] == '\0')
+        {
+            char c[2] = { *p, '\0' };
+            appendPromptText(out, &at, c);
+            continue;
+        }
+
+        switch (*++p)
+        {
+            case 'w':
+            {
+                size_t length = home ? strlen(home) : 0;
+
+                if (length > 1 && strncmp(cwd, home, length) == 0 && (cwd[length] == '/' || cwd[length] == '\0'))
+                {
+                    snprintf(text, sizeof(text), "~%s", cwd + length);
+                }
+                else
+                {
+                    snprintf(text, sizeof(text), "%s", cwd);
+                }
+                break;
+            }
+            case 'W':
+            {
+                const char *slash = strrchr(cwd, '/');
+                snprintf(text, sizeof(text), "%s", (slash && slash[1]) ? slash + 1 : cwd);
+                break;
+            }
+            case 'g':
+            {
+                GitState *gs = findGitState(cwd);
+                snprintf(text, sizeof(text), "%s%s", gs ? gs->branch : "", (gs && gs->branch[0] && gs->dirty) ? "*" : "");
+                break;
+            }
+            case '?':
+                snprintf(text, sizeof(text), "%d", lastStatus);
+                break;
+            case 'D':
+                if (lastMilliseconds < 1000)
+                {
+                    snprintf(text, sizeof(text), "%ldms", lastMilliseconds);
+                }
+                else if (lastMilliseconds < 60000)
+                {
+                    snprintf(text, sizeof(text), "%ld.%lds", lastMilliseconds / 1000, lastMilliseconds % 1000 / 100);
+                }
+                else
+                {
+                    snprintf(text, sizeof(text), "%ldm%lds", lastMilliseconds / 60000, lastMilliseconds % 60000 / 1000);
+                }
+                break;
+            case '\\':
+                strcpy(text, "\\");
+                break;
+            default:
+                // not a segment, kept as written
+                snprintf(text, sizeof(text), "\\%c", *p);
+                break;
+        }
+
+        appendPromptText(out, &at, text);
+    }
+}
+
+// read the worker's output without waiting
+//
+// return: 1 if it has finished and its result is stored, 0 otherwise
+//
+int collectGitWorker(void)
+{
+    forgetInheritedWorker();
+
+    if (gitFd == -1)
+    {
+        return 0;
+    }
+
+    int savedErrno = errno;
+
+    // read up to end of file, or for now what there is
+    if (bufferReadFd(&gitOutput, gitFd) == -1 && errno == EAGAIN)
+    {
+        errno = savedErrno;
+        return 0;
+    }
+
+    finishGitWorker();
+    errno = savedErrno;
+    return 1;
+}
+
+const char *expandPrompt(const char *template)
+{
+    char cwd[4096];
+
+    collectGitWorker();
+    snprintf(promptTemplate, sizeof(promptTemplate), "%s", template);
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        strcpy(cwd, "?");
+    }
+
+    // the git state may have changed with the last command: look again, in the background
+    if (strstr(promptTemplate, "\\g") != NULL)
+    {
+        if (gitPid == 0)
+        {
+            startGitWorker(cwd);
+        }
+        else
+        {
+            gitRerun = 1;
+        }
+    }
+
+    expandTemplate(expanded, cwd);
+    return expanded;
+}
+
+int promptFd(void)
+{
+    forgetInheritedWorker();
+    return gitFd;
+}
+
+const char *refreshPrompt(void)
+{
+    char cwd[4096];
+    char old[PROMPT_MAX_LENGTH];
+
+    if (!collectGitWorker())
+    {
+        return NULL;
+    }
+
+    if (getcwd(cwd, sizeof(cwd)) == NULL)
+    {
+        strcpy(cwd, "?");
+    }
+
+    // the state looked at may already be out of date
+    if (gitRerun)
+    {
+        startGitWorker(cwd);
+    }
+
+    snprintf(old, sizeof(old), "%s", expanded);
+    expandTemplate(expanded, cwd);
+
+    return strcmp(old, expanded) != 0 ? expanded : NULL;
+}
@@ -0,0 +1,60 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+
+#define PROMPT_MAX_LENGTH 1024                  // longest expanded prompt, the terminating null included
+#define PROMPT_GIT_CACHE 16                     // directories whose git state is remembered
+#define PROMPT_GIT_BRANCH 128                   // longest branch name kept
+
+// prompt segments:
+//		\w  the current directory, HOME shown as ~
+//		\W  the last part of the current directory
+//		\g  the git branch, with * if the work tree has changes; empty outside a repository
+//		\?  the exit status of the last command
+//		\D  how long the last command took
+//		\\  a backslash
+
+struct GitStateStruct
+{
+    char directory[4096];           // where git status was run
+    char branch[PROMPT_GIT_BRANCH]; // the branch, or the short commit when detached; empty outside a repository
+    int dirty;                      // the work tree or index has changes
+    unsigned long lastUsed;         // for replacing the least recently used entry
+};
+
+typedef struct GitStateStruct GitState;  // cached git segment type
+
+
+// purpose:
+//		record the exit status and run time of the command just run, for \? and \D
+//
+void setPromptStatus(int status, long milliseconds);
+
+// purpose:
+//		expand the segments of a prompt template
+//
+// note:
+//		never waits: \g shows what is cached for the directory, stale or empty,
+//		and a git status worker is started in the background to bring it up to
+//		date. Once the worker has finished, refreshPrompt() gives the prompt again.
+//
+// return:
+//		the prompt, in a buffer overwritten by the next call
+//
+const char *expandPrompt(const char *template);
+
+// purpose:
+//		a descriptor that polls readable when a background segment has output,
+//		-1 if none is running
+//
+int promptFd(void);
+
+// purpose:
+//		read the output of the background segments, and expand the last template
+//		again once they have finished
+//
+// return:
+//		the prompt if it has changed, in the buffer of expandPrompt(), or NULL
+//
+const char *refreshPrompt(void);
+
+#endif
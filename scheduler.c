@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "jobs.h"
+#include "scheduler.h"
+#include "jobserver.h"
+#include "joblimits.h"
+#include "capture.h"
+#include "memtags.h"
+
+int jobLimit = 1;                   // background jobs allowed to run at once
+PendingJob *queueHead = NULL;       // the oldest queued job, started first
+PendingJob *queueTail = NULL;
+int queueLength = 0;
+volatile sig_atomic_t tokensHeld = 0;   // jobserver tokens taken for running jobs
+pid_t stateOwner = 0;               // the process the queue and the tokens belong to
+
+SchedulerLaunch launchFunction = NULL;
+void *launchContext = NULL;
+
+void initialiseScheduler(SchedulerLaunch launch, void *context)
+{
+    const char *limit = getenv(SCHEDULER_VARIABLE);
+
+    launchFunction = launch;
+    launchContext = context;
+    stateOwner = getpid();
+
+    // with a jobserver the tokens set the limit, unless one is given
+    setSchedulerLimit(limit ? atoi(limit) : jobserverActive() ? SCHEDULER_MAX_LIMIT : 0);
+}
+
+int schedulerLimit(void)
+{
+    return jobLimit;
+}
+
+void setSchedulerLimit(int limit)
+{
+    if (limit < 1)
+    {
+        limit = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    jobLimit = (limit < 1) ? 1 : (limit > SCHEDULER_MAX_LIMIT) ? SCHEDULER_MAX_LIMIT : limit;
+}
+
+// a forked copy of the shell inherits the queue and the token count, but the
+// jobs and the tokens are the parent's
+//
+void forgetInheritedQueue(void)
+{
+    pid_t self = getpid();
+
+    if (stateOwner != self)
+    {
+        queueHead = NULL;
+        queueTail = NULL;
+        queueLength = 0;
+        tokensHeld = 0;
+        stateOwner = self;
+    }
+}
+
+// take a slot for one more background job: below the limit and, with a
+// jobserver, holding a token for every running job but the first
+//
+int takeSlot(void)
+{
+    int running = runningJobs(JOB_BACKGROUND);
+
+    if (running >= jobLimit)
+    {
+        return 0;
+    }
+
+    if (!jobserverActive() || tokensHeld >= running)
+    {
+        return 1;
+    }
+
+    if (jobserverAcquire())
+    {
+        tokensHeld++;
+        return 1;
+    }
+
+    return 0;
+}
+
+int backgroundSlotFree(void)
+{
+    forgetInheritedQueue();
+
+    return queueHead == NULL && takeSlot();
+}
+
+void releaseJobTokens(void)
+{
+    forgetInheritedQueue();
+
+    int running = runningJobs(JOB_BACKGROUND);
+    int needed = (running > 0) ? running - 1 : 0;
+
+    while (tokensHeld > needed)
+    {
+        jobserverRelease();
+        tokensHeld--;
+    }
+}
+
+void forgetJobTokens(void)
+{
+    forgetInheritedQueue();
+
+    tokensHeld = 0;
+}
+
+int schedulerWaitFd(void)
+{
+    forgetInheritedQueue();
+
+    // a token is only worth waiting for when the limit is not what holds the queue back
+    if (queueHead != NULL && runningJobs(JOB_BACKGROUND) < jobLimit)
+    {
+        return jobserverFd();
+    }
+
+    return -1;
+}
+
+void appendPendingJob(const char *command, void *payload, pid_t pid)
+{
+    PendingJob *pj = tagMalloc(MEM_JOBS, sizeof(PendingJob));
+
+    if (pj == NULL)
+    {
+        perror("malloc");
+        return;
+    }
+
+    snprintf(pj->command, sizeof(pj->command), "%s", command);
+    pj->payload = payload;
+    pj->pid = pid;
+    pj->next = NULL;
+
+    forgetInheritedQueue();
+
+    if (queueTail)
+    {
+        queueTail->next = pj;
+    }
+    else
+    {
+        queueHead = pj;
+    }
+
+    queueTail = pj;
+    queueLength++;
+}
+
+void queueJob(const char *command, void *payload)
+{
+    appendPendingJob(command, payload, 0);
+}
+
+void queueStoppedJob(const char *command, pid_t pid)
+{
+    appendPendingJob(command, NULL, pid);
+}
+
+pid_t forkStoppedJob(void)
+{
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        // wait here, before anything of the job has run
+        raise(SIGSTOP);
+        return 0;
+    }
+
+    if (pid > 0)
+    {
+        // the copy must have stopped before SIGCONT can release it
+        int status;
+
+        while (waitpid(pid, &status, WUNTRACED) == -1 && errno == EINTR)
+            ;
+
+        if (!WIFSTOPPED(status))
+        {
+            return -1;
+        }
+    }
+
+    return pid;
+}
+
+int queuedJobs(void)
+{
+    forgetInheritedQueue();
+
+    return queueLength;
+}
+
+void runQueuedJobs(void)
+{
+    forgetInheritedQueue();
+
+    if (queueHead == NULL)
+    {
+        return;
+    }
+
+    // no job can be reaped while the queue and the job table are being changed
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+    while (queueHead != NULL && takeSlot())
+    {
+        PendingJob *pj = queueHead;
+
+        queueHead = pj->next;
+        queueTail = queueHead ? queueTail : NULL;
+        queueLength--;
+
+        if (pj->payload)
+        {
+            launchFunction(launchContext, pj->payload, pj->command);
+        }
+        else
+        {
+            // the timeout counts from when the job starts, not when it was queued
+            int id = addJob(pj->pid, JOB_BACKGROUND, pj->command);
+            watchJob(&pj->pid, 1, id, pj->command);
+            attachCapture(pj->pid, id);
+            kill(pj->pid, SIGCONT);
+        }
+
+        tagFree(MEM_JOBS, pj);
+    }
+
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+}
+
+void waitForSlot(const sigset_t *oldMask)
+{
+    struct pollfd token = { schedulerWaitFd(), POLLIN, 0 };
+
+    ppoll(&token, token.fd != -1, NULL, oldMask);
+}
+
+void drainQueuedJobs(void)
+{
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+    // every exit of a background job is a chance for the next one to start
+    while (queuedJobs() > 0)
+    {
+        runQueuedJobs();
+
+        if (queuedJobs() > 0)
+        {
+            waitForSlot(&oldMask);
+        }
+    }
+
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+}
+
+void listQueuedJobs(void)
+{
+    forgetInheritedQueue();
+
+    for (PendingJob *pj = queueHead; pj != NULL; pj = pj->next)
+    {
+        printf("[-] %-8s %d\t%s\n", "Queued", pj->pid, pj->command);
+    }
+}
@@ -0,0 +1,127 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <signal.h>
+#include <sys/types.h>
+
+#include "jobs.h"
+
+#define SCHEDULER_VARIABLE "BG_LIMIT"           // the initial limit, instead of the number of processors
+#define SCHEDULER_MAX_LIMIT 64                  // below MAX_JOBS, so the running jobs always fit in the job table
+
+struct PendingJobStruct
+{
+    char command[MAX_JOB_COMMAND];  // the command line, for reporting
+    void *payload;                  // a job to be started by the launch function, or NULL
+    pid_t pid;                      // otherwise the stopped copy of the shell that runs the job
+    struct PendingJobStruct *next;  // the job queued after this one
+};
+
+typedef struct PendingJobStruct PendingJob;  // queued background job type
+
+// start a queued job from its payload and return its job number, or -1
+typedef int (*SchedulerLaunch)(void *context, void *payload, const char *command);
+
+
+// purpose:
+//		set up the background job scheduler; "launch" starts the jobs queued with a payload
+//
+// note:
+//		the limit on concurrent background jobs is taken from BG_LIMIT in the
+//		environment, or else the number of processors
+//
+void initialiseScheduler(SchedulerLaunch launch, void *context);
+
+// purpose:
+//		get or change the limit on concurrent background jobs
+//
+int schedulerLimit(void);
+void setSchedulerLimit(int limit);
+
+// purpose:
+//		check whether a new background job may start now, and take its slot
+//
+// note:
+//		with a jobserver, every background job beyond the first also needs a token.
+//		SIGCHLD must stay blocked until the job is in the job table, or the handler
+//		could give its token back.
+//
+// return:
+//		1 if fewer jobs than the limit are running, a token could be taken if
+//		needed and nobody is queued ahead
+//
+int backgroundSlotFree(void);
+
+// purpose:
+//		give back the jobserver tokens of background jobs that have finished
+//
+// note:
+//		called from the SIGCHLD handler, after the jobs have been reaped
+//
+void releaseJobTokens(void);
+
+// purpose:
+//		forget the jobserver tokens taken for running jobs, for a shell that is
+//		closed; stopJobserver() gives the bytes back
+//
+void forgetJobTokens(void);
+
+// purpose:
+//		a descriptor to poll while jobs wait for a jobserver token, or -1 if
+//		nothing waits for one
+//
+int schedulerWaitFd(void);
+
+// purpose:
+//		wait for a SIGCHLD or a free jobserver token, with SIGCHLD blocked
+//		outside the wait and "oldMask" the mask to wait with
+//
+void waitForSlot(const sigset_t *oldMask);
+
+// purpose:
+//		queue a background job until a slot is free
+//
+// note:
+//		queueJob() takes a payload for the launch function, and is used for jobs
+//		whose words are already expanded. queueStoppedJob() takes a forked copy of
+//		the shell that has stopped itself with SIGSTOP and is continued with SIGCONT
+//		when its turn comes; it is used for jobs that still need the shell to run.
+//
+void queueJob(const char *command, void *payload);
+void queueStoppedJob(const char *command, pid_t pid);
+
+// purpose:
+//		fork a copy of the shell for queueStoppedJob()
+//
+// return:
+//		0 in the copy once it is continued, the copy's process id in the shell, or
+//		-1 if fork() fails
+//
+pid_t forkStoppedJob(void);
+
+// purpose:
+//		the number of jobs in the queue
+//
+int queuedJobs(void);
+
+// purpose:
+//		start queued jobs, oldest first, while slots are free
+//
+// note:
+//		called whenever a background job may have finished: after each command,
+//		while waiting for a foreground command and while waiting for input.
+//		Must be called with SIGCHLD blocked or from the main loop.
+//
+void runQueuedJobs(void);
+
+// purpose:
+//		wait until every queued job has been started, for the shell to exit
+//
+void drainQueuedJobs(void);
+
+// purpose:
+//		print the queued jobs - part of jobs
+//
+void listQueuedJobs(void);
+
+#endif
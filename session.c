@@ -0,0 +1,598 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "buffer.h"
+#include "variables.h"
+#include "session.h"
+
+int traceFd = -1;                   // the trace being recorded, -1 if none
+pid_t traceOwner = 0;               // the process recording it, not a forked copy
+struct timespec traceStart;
+char *tracedCwd = NULL;             // the directory last recorded
+char **tracedEnvironment = NULL;    // the exported variables last recorded, sorted by name
+size_t nTracedEnvironment = 0;
+
+Buffer replayTrace;                 // the whole trace being replayed
+size_t replayAt = 0;                // the next record in it
+int replaying = 0;
+pid_t replayOwner = 0;
+double replaySpeed = 1;             // 0 for no waiting between lines
+struct timespec replayStart;
+double recordedSpan = 0;            // milliseconds from the start of the recording to the end of its last line
+
+ReplayResult *replayResults = NULL;
+int nReplayResults = 0;
+int replayResultsSize = 0;
+ReplayResult pendingResult;         // the line being run
+int pendingStatus;                  // and the exit status it had
+
+// microseconds from "from" to "to"
+//
+uint64_t microsBetween(const struct timespec *from, const struct timespec *to)
+{
+    int64_t micros = (int64_t)(to->tv_sec - from->tv_sec) * 1000000 + (to->tv_nsec - from->tv_nsec) / 1000;
+
+    return micros < 0 ? 0 : (uint64_t)micros;
+}
+
+void putVarint(Buffer *bp, uint64_t value)
+{
+    do
+    {
+        bufferAppendChar(bp, (char)((value & 0x7f) | (value > 0x7f ? 0x80 : 0)));
+        value >>= 7;
+    } while (value);
+}
+
+void putTraceString(Buffer *bp, int type, const char *s, size_t n)
+{
+    bufferAppendChar(bp, (char)type);
+    putVarint(bp, n);
+    bufferAppend(bp, s, n);
+}
+
+// compare "NAME=value" entries by NAME alone
+//
+int compareEntryNames(const char *a, const char *b)
+{
+    while (*a && *a != '=' && *a == *b)
+    {
+        a++;
+        b++;
+    }
+
+    int ca = (*a == '=') ? 0 : (unsigned char)*a;
+    int cb = (*b == '=') ? 0 : (unsigned char)*b;
+
+    return ca - cb;
+}
+
+int compareTracedEntries(const void *a, const void *b)
+{
+    return compareEntryNames(*(char *const *)a, *(char *const *)b);
+}
+
+// add to "bp" the exported variables set, changed or gone since they were
+// last recorded, and remember them as they are now
+//
+void traceEnvironment(Buffer *bp)
+{
+    char **envp = variablesEnvironment();
+    size_t n = 0;
+
+    while (envp && envp[n])
+    {
+        n++;
+    }
+
+    // sort a copy, the cached array is shared with exec
+    char **sorted = malloc(sizeof(char *) * (n + 1));
+
+    if (sorted == NULL)
+    {
+        return;
+    }
+
+    memcpy(sorted, envp, sizeof(char *) * n);
+    qsort(sorted, n, sizeof(char *), compareTracedEntries);
+
+    size_t i = 0, j = 0;
+    int changed = (n != nTracedEnvironment);
+
+    while (i < n || j < nTracedEnvironment)
+    {
+        int order = (i == n) ? 1 : (j == nTracedEnvironment) ? -1 : compareEntryNames(sorted[i], tracedEnvironment[j]);
+
+        if (order < 0)
+        {
+            putTraceString(bp, SESSION_SET, sorted[i], strlen(sorted[i]));
+            changed = 1;
+            i++;
+        }
+        else if (order > 0)
+        {
+            putTraceString(bp, SESSION_UNSET, tracedEnvironment[j], strcspn(tracedEnvironment[j], "="));
+            changed = 1;
+            j++;
+        }
+        else
+        {
+            if (strcmp(sorted[i], tracedEnvironment[j]) != 0)
+            {
+                putTraceString(bp, SESSION_SET, sorted[i], strlen(sorted[i]));
+                changed = 1;
+            }
+            i++;
+            j++;
+        }
+    }
+
+    if (changed)
+    {
+        for (j = 0; j < nTracedEnvironment; j++)
+        {
+            free(tracedEnvironment[j]);
+        }
+        free(tracedEnvironment);
+
+        // a copy, the table's strings change with the variables
+        for (i = 0; i < n; i++)
+        {
+            sorted[i] = strdup(sorted[i]);
+            n = sorted[i] ? n : i;
+        }
+
+        tracedEnvironment = sorted;
+        nTracedEnvironment = n;
+    }
+    else
+    {
+        free(sorted);
+    }
+}
+
+// add the directory to "bp" if it is not the one last recorded
+//
+void traceDirectory(Buffer *bp, const char *cwd)
+{
+    if (tracedCwd == NULL || strcmp(tracedCwd, cwd) != 0)
+    {
+        putTraceString(bp, SESSION_CWD, cwd, strlen(cwd));
+        free(tracedCwd);
+        tracedCwd = strdup(cwd);
+    }
+}
+
+// write out the records in "bp"; a trace that cannot be written is given up
+//
+void writeTrace(Buffer *bp)
+{
+    for (size_t done = 0; done < bp->len; )
+    {
+        ssize_t n = write(traceFd, bp->data + done, bp->len - done);
+
+        if (n == -1 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n <= 0)
+        {
+            perror("record");
+            close(traceFd);
+            traceFd = -1;
+            break;
+        }
+
+        done += (size_t)n;
+    }
+
+    bufferFree(bp);
+}
+
+int startRecording(const char *file, const char *cwd)
+{
+    Buffer records;
+
+    traceFd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (traceFd == -1)
+    {
+        perror(file);
+        return -1;
+    }
+
+    traceOwner = getpid();
+    clock_gettime(CLOCK_MONOTONIC, &traceStart);
+
+    bufferInit(&records);
+    bufferAppend(&records, SESSION_MAGIC, strlen(SESSION_MAGIC));
+    traceDirectory(&records, cwd);
+    traceEnvironment(&records);
+    writeTrace(&records);
+
+    return (traceFd == -1) ? -1 : 0;
+}
+
+void recordSessionLine(const char *line, int status, const struct timespec *started,
+                       const struct timespec *finished, const char *cwd)
+{
+    Buffer records;
+
+    if (traceFd == -1 || getpid() != traceOwner)
+    {
+        return;
+    }
+
+    bufferInit(&records);
+    bufferAppendChar(&records, SESSION_LINE);
+    putVarint(&records, microsBetween(&traceStart, started));
+    putVarint(&records, microsBetween(started, finished));
+    putVarint(&records, (uint32_t)status);
+    putVarint(&records, strlen(line));
+    bufferAppendString(&records, line);
+
+    // what the line changed, for the lines after it
+    traceDirectory(&records, cwd);
+    traceEnvironment(&records);
+    writeTrace(&records);
+}
+
+// take a varint from the trace
+//
+// return: 0 if successful, -1 if the trace ends inside it
+//
+int getVarint(uint64_t *value)
+{
+    *value = 0;
+
+    for (int shift = 0; replayAt < replayTrace.len && shift < 64; shift += 7)
+    {
+        unsigned char byte = (unsigned char)replayTrace.data[replayAt++];
+
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80))
+        {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+int getTraceString(const char **s, size_t *n)
+{
+    uint64_t length;
+
+    if (getVarint(&length) == -1 || length > replayTrace.len - replayAt)
+    {
+        return -1;
+    }
+
+    *s = replayTrace.data + replayAt;
+    *n = (size_t)length;
+    replayAt += *n;
+    return 0;
+}
+
+// the first word of "line", for grouping the report
+//
+void commandName(char *name, const char *line)
+{
+    line += strspn(line, " \t");
+
+    size_t n = strcspn(line, " \t;|&<>()");
+
+    if (n == 0)
+    {
+        snprintf(name, SESSION_NAME_LENGTH, "(blank)");
+    }
+    else
+    {
+        snprintf(name, SESSION_NAME_LENGTH, "%.*s", (int)n, line);
+    }
+}
+
+int compareMillis(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+int compareResultNames(const void *a, const void *b)
+{
+    return strcmp(((const ReplayResult *)a)->name, ((const ReplayResult *)b)->name);
+}
+
+// the "p"th percentile of "n" sorted times
+//
+double millisAt(const double *sorted, int n, double p)
+{
+    int i = (int)(p * n + 0.999999) - 1;
+
+    return sorted[i < 0 ? 0 : i];
+}
+
+// one line of the report, for "n" results
+//
+void reportCommand(const char *name, const ReplayResult *results, int n, double *recorded, double *replayed)
+{
+    for (int i = 0; i < n; i++)
+    {
+        recorded[i] = results[i].recorded;
+        replayed[i] = results[i].replayed;
+    }
+
+    qsort(recorded, (size_t)n, sizeof(double), compareMillis);
+    qsort(replayed, (size_t)n, sizeof(double), compareMillis);
+
+    double before = millisAt(recorded, n, 0.50);
+    double after = millisAt(replayed, n, 0.50);
+
+    fprintf(stderr, "replay: %-16s %6d %8.2f %8.2f %8.2f   %8.2f %8.2f %8.2f %+7.0f%%\n", name, n,
+            before, millisAt(recorded, n, 0.90), millisAt(recorded, n, 0.99),
+            after, millisAt(replayed, n, 0.90), millisAt(replayed, n, 0.99),
+            before > 0 ? (after - before) * 100 / before : 0.0);
+}
+
+// print the latencies of the replay against those of the recording, for all
+// the lines and then for the most frequent commands
+//
+void reportReplay(void)
+{
+    struct timespec now;
+    int differing = 0;
+
+    if (!replaying || getpid() != replayOwner)
+    {
+        return;
+    }
+
+    replaying = 0;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (int i = 0; i < nReplayResults; i++)
+    {
+        differing += replayResults[i].statusChanged;
+    }
+
+    fprintf(stderr, "replay: %d lines in %.3f s, recorded in %.3f s, %d exit statuses differ\n",
+            nReplayResults, microsBetween(&replayStart, &now) / 1e6, recordedSpan / 1000, differing);
+
+    int size = nReplayResults ? nReplayResults : 1;
+    double *recorded = malloc(sizeof(double) * size);
+    double *replayed = malloc(sizeof(double) * size);
+    int *groupStart = malloc(sizeof(int) * size);
+    int *groupCount = malloc(sizeof(int) * size);
+
+    if (nReplayResults > 0 && recorded && replayed && groupStart && groupCount)
+    {
+        fprintf(stderr, "replay: %-16s %6s %8s %8s %8s   %8s %8s %8s %8s\n", "command (ms)", "lines",
+                "rec p50", "rec p90", "rec p99", "run p50", "run p90", "run p99", "p50");
+
+        reportCommand("(all)", replayResults, nReplayResults, recorded, replayed);
+
+        // the lines by command, then the commands by how often they ran
+        qsort(replayResults, (size_t)nReplayResults, sizeof(ReplayResult), compareResultNames);
+
+        int nGroups = 0;
+
+        for (int i = 0; i < nReplayResults; i++)
+        {
+            if (i == 0 || strcmp(replayResults[i].name, replayResults[i - 1].name) != 0)
+            {
+                groupStart[nGroups] = i;
+                groupCount[nGroups++] = 0;
+            }
+            groupCount[nGroups - 1]++;
+        }
+
+        for (int shown = 0; shown < SESSION_REPORT_COMMANDS && shown < nGroups; shown++)
+        {
+            int best = shown;
+
+            for (int g = shown + 1; g < nGroups; g++)
+            {
+                best = (groupCount[g] > groupCount[best]) ? g : best;
+            }
+
+            int start = groupStart[best], count = groupCount[best];
+
+            groupStart[best] = groupStart[shown];
+            groupCount[best] = groupCount[shown];
+            reportCommand(replayResults[start].name, &replayResults[start], count, recorded, replayed);
+        }
+    }
+
+    free(recorded);
+    free(replayed);
+    free(groupStart);
+    free(groupCount);
+}
+
+int startReplay(const char *file, const char *speed)
+{
+    char *end;
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+
+    replaySpeed = (strcmp(speed, "max") == 0) ? 0 : strtod(speed, &end);
+
+    if (strcmp(speed, "max") != 0 && (*speed == '\0' || *end != '\0' || replaySpeed < 0))
+    {
+        fprintf(stderr, "replay: %s: invalid speed\n", speed);
+        return -1;
+    }
+
+    if (fd == -1)
+    {
+        perror(file);
+        return -1;
+    }
+
+    bufferInit(&replayTrace);
+
+    long n = bufferReadFd(&replayTrace, fd);
+    close(fd);
+
+    if (n == -1 || replayTrace.len < strlen(SESSION_MAGIC) ||
+        memcmp(replayTrace.data, SESSION_MAGIC, strlen(SESSION_MAGIC)) != 0)
+    {
+        fprintf(stderr, "%s: not a session trace\n", file);
+        bufferFree(&replayTrace);
+        return -1;
+    }
+
+    replayAt = strlen(SESSION_MAGIC);
+    replaying = 1;
+    replayOwner = getpid();
+    clock_gettime(CLOCK_MONOTONIC, &replayStart);
+
+    // the report is printed however the shell exits
+    atexit(reportReplay);
+    return 0;
+}
+
+int replayingSession(void)
+{
+    return replaying && getpid() == replayOwner;
+}
+
+// wait until "micros" after the start of the replay, scaled by its speed
+//
+void waitForLine(uint64_t micros)
+{
+    if (replaySpeed == 0)
+    {
+        return;
+    }
+
+    uint64_t scaled = (uint64_t)(micros / replaySpeed);
+    struct timespec due = replayStart;
+
+    due.tv_sec += (time_t)(scaled / 1000000);
+    due.tv_nsec += (long)(scaled % 1000000) * 1000;
+
+    if (due.tv_nsec >= 1000000000L)
+    {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000L;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+    {
+    }
+}
+
+char *nextReplayLine(char *line, size_t size, char *cwd, size_t cwdSize)
+{
+    const char *s;
+    size_t n;
+    char text[8192];
+
+    while (replayingSession() && replayAt < replayTrace.len)
+    {
+        int type = (unsigned char)replayTrace.data[replayAt++];
+        uint64_t start, duration, status;
+
+        if (type == SESSION_LINE)
+        {
+            if (getVarint(&start) == -1 || getVarint(&duration) == -1 || getVarint(&status) == -1 ||
+                getTraceString(&s, &n) == -1)
+            {
+                break;
+            }
+
+            snprintf(line, size, "%.*s", (int)n, s);
+            commandName(pendingResult.name, line);
+            pendingResult.recorded = duration / 1000.0;
+            pendingStatus = (int)(uint32_t)status;
+
+            if ((start + duration) / 1000.0 > recordedSpan)
+            {
+                recordedSpan = (start + duration) / 1000.0;
+            }
+
+            waitForLine(start);
+            return line;
+        }
+
+        if ((type != SESSION_CWD && type != SESSION_SET && type != SESSION_UNSET) ||
+            getTraceString(&s, &n) == -1 || n >= sizeof(text))
+        {
+            break;
+        }
+
+        memcpy(text, s, n);
+        text[n] = '\0';
+
+        if (type == SESSION_CWD)
+        {
+            if (chdir(text) == -1)
+            {
+                perror(text);
+            }
+            else
+            {
+                snprintf(cwd, cwdSize, "%s", text);
+            }
+        }
+        else if (type == SESSION_SET)
+        {
+            char *equals = strchr(text, '=');
+
+            if (equals != NULL)
+            {
+                *equals = '\0';
+                setVariable(text, equals + 1, 1);
+            }
+        }
+        else
+        {
+            unsetVariable(text);
+        }
+    }
+
+    if (replayingSession() && replayAt < replayTrace.len)
+    {
+        fprintf(stderr, "replay: the trace is damaged at byte %zu\n", replayAt);
+        replayAt = replayTrace.len;
+    }
+
+    return NULL;
+}
+
+void replayLineDone(int status, const struct timespec *started, const struct timespec *finished)
+{
+    if (!replayingSession())
+    {
+        return;
+    }
+
+    if (nReplayResults == replayResultsSize)
+    {
+        int size = replayResultsSize ? replayResultsSize * 2 : 256;
+        ReplayResult *results = realloc(replayResults, sizeof(ReplayResult) * (size_t)size);
+
+        if (results == NULL)
+        {
+            return;
+        }
+
+        replayResults = results;
+        replayResultsSize = size;
+    }
+
+    pendingResult.statusChanged = (status != pendingStatus);
+    pendingResult.replayed = microsBetween(started, finished) / 1000.0;
+    replayResults[nReplayResults++] = pendingResult;
+}
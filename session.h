@@ -0,0 +1,85 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define SESSION_MAGIC "SSHTRC01"
+#define SESSION_NAME_LENGTH 24                  // longest command name reported apart, the terminating null included
+#define SESSION_REPORT_COMMANDS 20              // command names reported, the most frequent first
+
+// trace records, each a type byte followed by its fields; numbers are
+// unsigned LEB128 varints and strings a varint length and the bytes
+#define SESSION_CWD   1                         // string: the directory the following lines run in
+#define SESSION_SET   2                         // string: "NAME=value", an exported variable set or changed
+#define SESSION_UNSET 3                         // string: NAME, an exported variable gone
+#define SESSION_LINE  4                         // start, duration (us), exit status, string: the line
+
+struct ReplayResultStruct
+{
+    char name[SESSION_NAME_LENGTH]; // the first word of the line
+    double recorded;                // milliseconds the line took when it was recorded
+    double replayed;                // and again now
+    int statusChanged;              // the exit status is not the one recorded
+};
+
+typedef struct ReplayResultStruct ReplayResult;  // replayed line type
+
+
+// purpose:
+//		start recording the lines of the session to "file", in the directory
+//		"cwd" and the current environment
+//
+// return:
+//		0 if successful, -1 if the file cannot be created
+//
+int startRecording(const char *file, const char *cwd);
+
+// purpose:
+//		record a line the shell has run, then whatever it changed of the current
+//		directory and the exported variables
+//
+// note:
+//		"started" and "finished" are CLOCK_MONOTONIC times. The trace is written
+//		as each line finishes, so it is whole up to the last line however the
+//		session ends.
+//
+void recordSessionLine(const char *line, int status, const struct timespec *started,
+                       const struct timespec *finished, const char *cwd);
+
+// purpose:
+//		start replaying the trace in "file"
+//
+// note:
+//		"speed" is "1" for the pace of the recording, "N" for N times as fast,
+//		and "0" or "max" for no waiting between lines. A report of the latencies
+//		against the recorded ones is printed when the shell exits.
+//
+// return:
+//		0 if successful, -1 if the file cannot be read or the speed is invalid
+//
+int startReplay(const char *file, const char *speed);
+
+// purpose:
+//		1 if a trace is being replayed in place of the input
+//
+int replayingSession(void);
+
+// purpose:
+//		the next line of the trace, once its time has come
+//
+// note:
+//		the directory and variable changes recorded before it are made first;
+//		the directory in "cwd" is updated when it changes
+//
+// return:
+//		"line", or NULL at the end of the trace
+//
+char *nextReplayLine(char *line, size_t size, char *cwd, size_t cwdSize);
+
+// purpose:
+//		the line given by nextReplayLine() has been run
+//
+void replayLineDone(int status, const struct timespec *started, const struct timespec *finished);
+
+#endif
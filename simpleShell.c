@@ -1,3 +1,6 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
 #include <glob.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -5,23 +8,52 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
 #include <ctype.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
 #include <errno.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <time.h>
+#include <stdio_ext.h>
 #include "command.h"
+#include "buffer.h"
+#include "jobs.h"
+#include "variables.h"
+#include "syntax.h"
+#include "parsecache.h"
+#include "forkserver.h"
+#include "daemon.h"
+#include "parallel.h"
+#include "dag.h"
+#include "scheduler.h"
+#include "jobserver.h"
+#include "priority.h"
+#include "joblimits.h"
+#include "capture.h"
+#include "completion.h"
+#include "lineedit.h"
+#include "historyindex.h"
+#include "prompt.h"
+#include "dirjump.h"
+#include "session.h"
+#include "audit.h"
+#include "probes.h"
+#include "memtags.h"
+#include "libshell.h"
 
 // ---------------------------------------------------
 
-#define _POSIX_C_SOURCE 200809L
-#define _GNU_SOURCE
-#define MAX_COMMAND_LENGTH 100
+#define MAX_COMMAND_LENGTH 1024
 #define MAX_ARGUMENT_LENGTH 1000
 #define MAX_INPUT_LENGTH 1024
 #define MAX_HISTORY_LENGTH 100
 #define MAX_PATH_LENGTH 4096
 #define MAX_NUM_TOKENS 100
 #define MAX_PROMPT_LENGTH 100
+#define MAX_PROCESS_SUBSTITUTIONS 16
 
 // ---------------------------------------------------
 
@@ -30,9 +62,49 @@ typedef struct
     char prompt[MAX_PROMPT_LENGTH];
     char currentDirectory[MAX_PATH_LENGTH];
     char command_history[MAX_HISTORY_LENGTH][MAX_COMMAND_LENGTH];
+    int procsub_fds[MAX_PROCESS_SUBSTITUTIONS]; // shell ends of the <(...) and >(...) pipes
+    int total_procsub;                          // number of open process substitutions
+    int last_status;                            // exit status of the last command, $?
+    int exit_requested;                         // set by the exit builtin
+    int loop_depth;                             // number of loops being run
+    int breaking;                               // loops still to leave after "break n"
+    int continuing;                             // loops to leave before continuing after "continue n"
 
 } Shell;
 
+// a growable NULL terminated list of words, e.g. an argument vector
+typedef struct
+{
+    char** words;
+    int count;
+    int capacity;
+} WordList;
+
+// one command of a parsed line after word expansion
+typedef struct
+{
+    WordList assignments;   // leading NAME=value words
+    WordList args;          // the argument vector
+    char* files[3];         // expanded redirection targets for stdin, stdout and stderr
+    int append;             // stdout is appended to rather than truncated
+} ExpandedCommand;
+
+// a background pipeline waiting for a free slot, its words already expanded
+typedef struct
+{
+    int nCommands;
+    ExpandedCommand expanded[];
+} PendingPipeline;
+
+// builtin commands run inside the shell
+typedef int (*BuiltinFunction)(Shell* shell, int argc, char* argv[]);
+
+typedef struct
+{
+    const char* name;
+    BuiltinFunction function;
+} Builtin;
+
 // ---------------------------------------------------
 
 int total_history = 0; // total number of commands in command_history
@@ -45,37 +117,155 @@ Shell* createShell();
 void changePrompt(Shell* shell, const char* newPrompt);
 void printCurrentDirectory(Shell* shell);
 int changeDirectory(Shell* shell, const char* path);
-char** expandWildcards(const char* command, int* numExpanded);
-int executeSequentially(Shell* shell, const char* command);
-int handleRedirection(const char* command);
+char** expandWildcards(const char* pattern, int* numExpanded);
+const char* findClosingParen(const char* p);
+void appendExpansion(Buffer* out, const char* text, size_t len, int inDouble);
+void substitute(Shell* shell, const char* inner, int inDouble, Buffer* out);
+char* expandLine(Shell* shell, const char* command);
+int captureCommandOutput(Shell* shell, const char* command, Buffer* out);
+int captureBuiltin(Shell* shell, const char* command, Buffer* out);
+int spawnProcessSubstitution(Shell* shell, const char* command, char direction);
+void shareProcessSubstitutions(Shell* shell);
+void closeProcessSubstitutions(Shell* shell);
+int nextWord(const char** cursor, Buffer* word, Buffer* pattern);
+char* removeQuotes(const char* text);
+void addWord(WordList* list, char* word);
+void freeWords(WordList* list);
+void expandWords(Shell* shell, char* words[], WordList* out);
+int expandCommand(Shell* shell, const Command* cp, ExpandedCommand* ec);
+void freeExpandedCommand(ExpandedCommand* ec);
+void applyAssignments(const WordList* assignments, int exported);
+char* expandPattern(Shell* shell, const char* word);
+BuiltinFunction findBuiltin(const char* name);
+int builtinPrompt(Shell* shell, int argc, char* argv[]);
+int builtinCd(Shell* shell, int argc, char* argv[]);
+int builtinJump(Shell* shell, int argc, char* argv[]);
+int builtinPushd(Shell* shell, int argc, char* argv[]);
+int builtinPopd(Shell* shell, int argc, char* argv[]);
+int builtinDirs(Shell* shell, int argc, char* argv[]);
+int builtinPwd(Shell* shell, int argc, char* argv[]);
+int builtinExit(Shell* shell, int argc, char* argv[]);
+int builtinHistory(Shell* shell, int argc, char* argv[]);
+int builtinExport(Shell* shell, int argc, char* argv[]);
+int builtinUnset(Shell* shell, int argc, char* argv[]);
+int builtinJobs(Shell* shell, int argc, char* argv[]);
+int builtinBgLimit(Shell* shell, int argc, char* argv[]);
+int builtinBgPrio(Shell* shell, int argc, char* argv[]);
+int builtinLimit(Shell* shell, int argc, char* argv[]);
+int builtinJobLog(Shell* shell, int argc, char* argv[]);
+int builtinStats(Shell* shell, int argc, char* argv[]);
+int builtinMemStats(Shell* shell, int argc, char* argv[]);
+int builtinTrue(Shell* shell, int argc, char* argv[]);
+int builtinFalse(Shell* shell, int argc, char* argv[]);
+int builtinEcho(Shell* shell, int argc, char* argv[]);
+int testExpression(int argc, char* argv[]);
+int builtinTest(Shell* shell, int argc, char* argv[]);
+int builtinRead(Shell* shell, int argc, char* argv[]);
+int loopLevels(Shell* shell, int argc, char* argv[]);
+int builtinBreak(Shell* shell, int argc, char* argv[]);
+int builtinContinue(Shell* shell, int argc, char* argv[]);
+int parallelExecute(void* context, const char* line);
+int builtinParallel(Shell* shell, int argc, char* argv[]);
+int builtinDag(Shell* shell, int argc, char* argv[]);
+int openRedirection(const ExpandedCommand* ec, int i);
+int handleRedirection(const ExpandedCommand* ec, int saved[3]);
+void restoreRedirection(int saved[3]);
 void add_history(Shell* shell, const char *command);
-void execute_history_command(char *arg[]);
 char* history_by_number(Shell* shell, int num);
+void execute_history_by_number(Shell* shell, int num);
 char* history_by_string(Shell* shell, const char *str);
 void execute_history_by_string(Shell* shell, const char *str);
 void execute_history(Shell* shell);
-int execute_piped_commands(char* commands[], int num_commands);
+int waitForChild(pid_t pid);
+pid_t launchThroughServer(Shell* shell, const ExpandedCommand* ec, int in, int out, char** envp);
+void describeCommands(const Node* pipeline, char* text, size_t size);
+int launchPipeline(Shell* shell, Node* const* compound, ExpandedCommand expanded[], int num_commands, const char* jobText);
+void queueBackgroundPipeline(Shell* shell, Node* const* compound, ExpandedCommand expanded[], int num_commands, const char* text);
+int launchQueuedPipeline(void* context, void* payload, const char* command);
+int execute_piped_commands(Shell* shell, const Node* pipeline);
+int executeLoop(Shell* shell, const Node* loop);
+int executeCase(Shell* shell, const Node* node);
+int executeSubshell(Shell* shell, const Node* list);
+int executeCompound(Shell* shell, const Node* node);
+int executeAndOr(Shell* shell, const Node* entry);
+int executeBackground(Shell* shell, const Node* entry);
+int executeList(Shell* shell, const Node* list);
+int executeDelegated(Shell* shell, const char* command);
+int needsShell(char* token[], int nTokens);
+ParsedLine* parseLine(const char* line);
 int executeCommand(Shell* shell, const char* command);
 void handleSignal(Shell* shell, int signum);
-void sigchld_handler(Shell* shell, int signum);
+void sigchld_handler(int signum);
+int operatorLength(const char* p, int wordStart);
 int tokenise_command(char* input, char* tokens[]);
+int waitForEvents(const sigset_t* oldMask, int input);
+void waitForInput(void);
 void runShell(Shell* shell);
+const char* lineHistory(void* context, int back);
+void daemonSetup(void* context, const char* cwd, char** envp);
+int daemonExecute(void* context, const char* line, int* stop);
 void destroyShell(Shell* shell);
+void leaveInput(void);
+void exitForkedCopy(int status);
+void* openShellContext(void);
+void closeShellContext(void* context);
+int executeEmbedded(void* context, const char* line, int* exited);
+
+pid_t shellPid = 0;    // the shell itself, as opposed to its forked copies
 
 // ------------------------------------------------------------
 
-int main()
+int shellMain(int argc, char* argv[])
 {
-    signal(SIGCHLD, sigchld_handler);
-    Shell* myShell = createShell();
+    // "--connect PATH" sends standard input to a daemon instead of running it here
+    if (argc == 3 && strcmp(argv[1], "--connect") == 0)
+    {
+        return runDaemonClient(argv[2]);
+    }
+
+    atexit(leaveInput);
+    Shell* myShell = openShellContext();
 
     if (myShell)
     {
+        // "--serve PATH" runs batches from clients, each in its own copy of this shell
+        if (argc == 3 && strcmp(argv[1], "--serve") == 0)
+        {
+            // the copies fork for themselves, their commands must stay their children
+            stopForkServer();
+            runDaemon(argv[2], daemonSetup, daemonExecute, myShell);
+            destroyShell(myShell);
+            return 1;
+        }
+
+        int failed = 0;
+
+        // "--record FILE" keeps a trace of the lines run, "--replay FILE [SPEED]" runs one again
+        if (argc == 3 && strcmp(argv[1], "--record") == 0)
+        {
+            failed = (startRecording(argv[2], myShell->currentDirectory) == -1);
+        }
+        else if ((argc == 3 || argc == 4) && strcmp(argv[1], "--replay") == 0)
+        {
+            failed = (startReplay(argv[2], argc == 4 ? argv[3] : "1") == -1);
+        }
+
+        if (failed)
+        {
+            destroyShell(myShell);
+            return 1;
+        }
+
         runShell(myShell);
+
+        // "exit N" leaves its status as the last one
+        int status = myShell->last_status;
+
         destroyShell(myShell);
+        return status;
     }
 
-    return 0;
+    return 1;
 }
 
 // ------------------------------------------------------------
@@ -88,6 +278,52 @@ Shell* createShell()
     {
         // setting the current prompt as '%'
         strcpy(newShell->prompt, "% ");
+        newShell->total_procsub = 0;
+        newShell->last_status = 0;
+        newShell->exit_requested = 0;
+        newShell->loop_depth = 0;
+        newShell->breaking = 0;
+        newShell->continuing = 0;
+
+        // the fork server is forked now, while the shell is still small
+        const char* forkServer = getenv(FORK_SERVER_VARIABLE);
+
+        if (forkServer && strcmp(forkServer, "1") == 0)
+        {
+            startForkServer();
+        }
+
+        // AUDIT_LOG names a file where every command started and reaped is logged
+        startAudit();
+
+        // share job slots with make: join its jobserver, or serve JOBSERVER slots
+        const char* slots = getenv(JOBSERVER_VARIABLE);
+
+        if (startJobserver(getenv("MAKEFLAGS"), slots ? atoi(slots) : 0) == 0 && jobserverFlags())
+        {
+            const char* makeflags = getVariable("MAKEFLAGS");
+            Buffer flags;
+            bufferInit(&flags);
+            bufferAppendString(&flags, jobserverFlags());
+
+            if (makeflags && *makeflags)
+            {
+                bufferAppendChar(&flags, ' ');
+                bufferAppendString(&flags, makeflags);
+            }
+
+            setVariable("MAKEFLAGS", flags.data, 1);
+            bufferFree(&flags);
+        }
+
+        // background jobs run niced, the foreground keeps the shell's priority
+        initialisePriority();
+
+        // with BG_CAPTURE, background output goes into a ring per job instead of the terminal
+        initialiseCapture();
+
+        // background jobs over the limit are queued, and started by launchQueuedPipeline()
+        initialiseScheduler(launchQueuedPipeline, newShell);
 
         // setting the current directory
         if (getcwd(newShell->currentDirectory, sizeof(newShell->currentDirectory)) == NULL)
@@ -135,7 +371,7 @@ int changeDirectory(Shell* shell, const char* path)
     // changing to the home directory
     if (!path || !path[0])
     {
-        path = getenv("HOME");
+        path = getVariable("HOME");
 
         // error handling for if the directory does not exist
         if (!path)
@@ -145,10 +381,29 @@ int changeDirectory(Shell* shell, const char* path)
         }
     }
 
+    // the new directory is worked out from the cached one rather than asked for with getcwd(),
+    // unless the cached one has gone, e.g. renamed under the shell
+    char target[MAX_PATH_LENGTH];
+    int changed = (canonicalPath(shell->currentDirectory, path, target, sizeof(target)) == 0 && chdir(target) == 0);
+
+    if (changed)
+    {
+        strcpy(shell->currentDirectory, target);
+    }
+    else
+    {
+        changed = (chdir(path) == 0 && getcwd(shell->currentDirectory, sizeof(shell->currentDirectory)) != NULL);
+    }
+
     // changing to the new directory given by the user input
-    if (chdir(path) == 0 && getcwd(shell->currentDirectory, sizeof(shell->currentDirectory)) != NULL)
+    if (changed)
     {
         printf("Changed current directory to: %s\n", shell->currentDirectory);
+        setVariable("PWD", shell->currentDirectory, -1);
+
+        // jumps are counted against where the directory really is, whatever link led to it
+        char physical[PATH_MAX];
+        recordDirectory(realpath(shell->currentDirectory, physical) ? physical : shell->currentDirectory);
         return 1;
     }
 
@@ -161,654 +416,3313 @@ int changeDirectory(Shell* shell, const char* path)
 
 /*
  * wildcard characters - *.c or *.?
+ * returns the names matching the pattern, or NULL if nothing matches
  */
-char** expandWildcards(const char* command, int* numExpanded)
+char** expandWildcards(const char* pattern, int* numExpanded)
 {
-    // Initial setup and allocation
-    char** expandedCommands = NULL;
+    char** expandedWords = NULL;
     *numExpanded = 0;
 
-    // Separate command and pattern
-    char* cmdCopy = strdup(command);
-    char* spacePos = strchr(cmdCopy, ' ');
+    glob_t glob_result;
+    int result = glob(pattern, GLOB_TILDE, NULL, &glob_result);
 
-    if (!spacePos)
+    if (result == 0)
     {
-        free(cmdCopy);
-        return NULL;  // No space found, not a valid command for expansion
-    }
+        // Allocate memory for expanded words
+        expandedWords = tagMalloc(MEM_GLOB, (glob_result.gl_pathc + 1) * sizeof(char*));
 
-    *spacePos = '\0';  // Split command and arguments/pattern
+        // error handling for if the memory cannot be allocated
+        if (!expandedWords)
+        {
+            perror("Memory allocation failed");
+            globfree(&glob_result);
+            return NULL;
+        }
 
-    char* commandPart = cmdCopy;
-    char* patternPart = spacePos + 1;
+        for (size_t i = 0; i < glob_result.gl_pathc; i++)
+        {
+            expandedWords[i] = tagStrdup(MEM_GLOB, glob_result.gl_pathv[i]);
+        }
+        expandedWords[glob_result.gl_pathc] = NULL;  // Null-terminate the array
+        *numExpanded = glob_result.gl_pathc;
 
-    // Check for wildcards - *.?
-    if (strpbrk(patternPart, "*?"))
+        globfree(&glob_result);
+    }
+    else if (result != GLOB_NOMATCH)
     {
-        glob_t glob_result;
-        if (glob(patternPart, GLOB_TILDE, NULL, &glob_result) == 0)
-        {
-            // Allocate memory for expanded commands
-            expandedCommands = malloc((glob_result.gl_pathc + 1) * sizeof(char*));
+        fprintf(stderr, "Wildcard expansion failed.\n");
+    }
 
-            // error handling for if the memory cannot be allocated
-            if (!expandedCommands)
-            {
-                perror("Memory allocation failed");
-                globfree(&glob_result);
-                free(cmdCopy);
-                return NULL;
-            }
+    return expandedWords;
+}
 
-            // Reconstruct commands with expanded paths
-            for (size_t i = 0; i < glob_result.gl_pathc; i++)
-            {
-                size_t cmdLength = strlen(commandPart) + strlen(glob_result.gl_pathv[i]) + 2;
-                expandedCommands[i] = malloc(cmdLength * sizeof(char));
+// ------------------------------------------------------------
 
-                if (expandedCommands[i])
-                {
-                    snprintf(expandedCommands[i], cmdLength, "%s %s", commandPart, glob_result.gl_pathv[i]);
-                }
-            }
-            expandedCommands[glob_result.gl_pathc] = NULL;  // Null-terminate the array
-            *numExpanded = glob_result.gl_pathc;
+/*
+ * finding the ')' that closes a $( ... ), skipping quotes and nested parentheses
+ */
+const char* findClosingParen(const char* p)
+{
+    int depth = 1;
+    int inSingle = 0;
+    int inDouble = 0;
 
-            globfree(&glob_result);
+    for (; *p; p++)
+    {
+        if (*p == '\\' && !inSingle && p[1])
+        {
+            p++;
         }
-        else
+        else if (*p == '\'' && !inDouble)
+        {
+            inSingle = !inSingle;
+        }
+        else if (*p == '"' && !inSingle)
+        {
+            inDouble = !inDouble;
+        }
+        else if (!inSingle && !inDouble && *p == '(')
+        {
+            depth++;
+        }
+        else if (!inSingle && !inDouble && *p == ')' && --depth == 0)
         {
-            fprintf(stderr, "Wildcard expansion failed.\n");
+            return p;
         }
     }
 
-    // deallocate memory
-    free(cmdCopy);
-
-    return expandedCommands;
+    return NULL;
 }
 
 // ------------------------------------------------------------
 
 /*
- * sequential job execution - ;
+ * inserting substituted output or a variable's value back into the command line;
+ * the result is text, never syntax, so anything the shell would interpret is escaped
  */
-int executeSequentially(Shell* shell, const char* command)
+void appendExpansion(Buffer* out, const char* text, size_t len, int inDouble)
 {
-    char* cmdCopy = strdup(command);
-    char* token = strtok(cmdCopy, ";");
-    int exitCode = 0;
-
-    while (token != NULL)
+    for (size_t i = 0; i < len; i++)
     {
-        // Trim leading and trailing spaces from the token
-        while (*token && (*token == ' ' || *token == '\t'))
+        char c = text[i];
+
+        if (inDouble)
         {
-            token++;
+            if (strchr("\"\\$`", c))
+            {
+                bufferAppendChar(out, '\\');
+            }
         }
-
-        size_t tokenLen = strlen(token);
-
-        while (tokenLen > 0 && (token[tokenLen - 1] == ' ' || token[tokenLen - 1] == '\t'))
+        else if (c == '\n' || c == '\t')
         {
-            tokenLen--;
-            printf("%s", shell->prompt);
-            token[tokenLen] = '\0';
+            // unquoted output is split into words, not into commands
+            c = ' ';
         }
-
-        if (tokenLen > 0)
+        else if (strchr(";&|<>()'\"\\$`{}#", c))
         {
-            int code = executeCommand(shell, token);
-
-            // error handling
-            if (code == -1)
-            {
-                free(cmdCopy);
-                return -1;
-            }
-
-            exitCode = code;
+            bufferAppendChar(out, '\\');
         }
 
-        token = strtok(NULL, ";");
+        bufferAppendChar(out, c);
     }
-
-    // deallocate memory
-    free(cmdCopy);
-
-    return exitCode;
 }
 
 // ------------------------------------------------------------
 
 /*
- * redirection of the standard input, standard output and standard error <, > and 2>
+ * running one substitution and splicing its output into "out"
  */
-int handleRedirection(const char* command)
+void substitute(Shell* shell, const char* inner, int inDouble, Buffer* out)
 {
-    int stdout_backup = dup(fileno(stdout)); // Backup the original standard output
-    int stderr_backup = dup(fileno(stderr)); // Backup the original standard error
+    Buffer result;
+    bufferInit(&result);
+
+    captureCommandOutput(shell, inner, &result);
 
+    // trailing newlines are removed by shortening the buffer, not by copying
+    bufferChompNewlines(&result);
+    appendExpansion(out, result.data ? result.data : "", result.len, inDouble);
+    bufferFree(&result);
+}
+
+// ------------------------------------------------------------
 
-    // error handling - unable to back up file descriptors
-    if (stdout_backup == -1 || stderr_backup == -1)
+/*
+ * variable expansion - $NAME ${NAME} $? $$, command substitution - $(...) and `...`,
+ * process substitution - <(...) and >(...)
+ */
+char* expandLine(Shell* shell, const char* command)
+{
+    // nothing to do for the common case
+    if (!strchr(command, '$') && !strchr(command, '`') && !strstr(command, "<(") && !strstr(command, ">("))
     {
-        perror("Failed to backup file descriptors");
-        return -1;
+        return strdup(command);
     }
 
-    char* cmd = strdup(command);
-    char* token = strtok(cmd, " ");
+    Buffer out;
+    bufferInit(&out);
 
-    int output_redirect = 0;
-    int error_redirect = 0;
+    int inSingle = 0;
+    int inDouble = 0;
+    const char* p = command;
 
-    while (token)
+    while (*p)
     {
-        // redirection of the standard output
-        if (strcmp(token, ">") == 0)
+        if (*p == '\\' && !inSingle && p[1])
+        {
+            bufferAppend(&out, p, 2);
+            p += 2;
+            continue;
+        }
+
+        if (*p == '\'' && !inDouble)
+        {
+            inSingle = !inSingle;
+        }
+        else if (*p == '"' && !inSingle)
         {
-            token = strtok(NULL, " ");
+            inDouble = !inDouble;
+        }
+        else if (!inSingle && p[0] == '$' && p[1] == '(' && p[2] != '(')
+        {
+            const char* end = findClosingParen(p + 2);
 
-            if (token)
+            // unterminated - leave it for /bin/sh to report
+            if (end)
             {
-                output_redirect = 1;
+                char* inner = strndup(p + 2, end - (p + 2));
+                substitute(shell, inner, inDouble, &out);
+                free(inner);
+                p = end + 1;
+                continue;
+            }
+        }
+        else if (!inSingle && p[0] == '$' && (p[1] == '?' || p[1] == '$'))
+        {
+            char number[16];
+            snprintf(number, sizeof(number), "%d", p[1] == '?' ? shell->last_status : (int)getpid());
+            bufferAppendString(&out, number);
+            p += 2;
+            continue;
+        }
+        else if (!inSingle && p[0] == '$' && (p[1] == '{' || p[1] == '_' || isalpha((unsigned char)p[1])))
+        {
+            // variable expansion - $NAME and ${NAME}
+            const char* name = p + 1;
+            const char* end;
+            int braced = (*name == '{');
 
-                int fd = open(token, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (braced)
+            {
+                name++;
+                end = strchr(name, '}');
+            }
+            else
+            {
+                end = name;
 
-                if (fd == -1)
+                while (*end == '_' || isalnum((unsigned char)*end))
                 {
-                    perror("Error opening output file.");
-                    free(cmd);
-                    return -1;
+                    end++;
                 }
+            }
 
-                dup2(fd, fileno(stdout));
+            if (end && validVariableName(name, end - name))
+            {
+                char* key = strndup(name, end - name);
+                const char* value = getVariable(key);
+                free(key);
 
-                // error handling - unable to redirect output
-                if (dup2(fd, fileno(stdout)) == -1)
+                if (value)
                 {
-                    perror("Error redirecting output.");
-                    close(fd);
-                    free(cmd);
-                    return -1;
+                    appendExpansion(&out, value, strlen(value), inDouble);
                 }
 
-                close(fd);
+                p = braced ? end + 1 : end;
+                continue;
             }
         }
-        // redirection of the standard error
-        else if (strcmp(token, "2>") == 0)
+        else if (!inSingle && !inDouble && (p[0] == '<' || p[0] == '>') && p[1] == '('
+                 && (p == command || p[-1] == ' ' || p[-1] == '\t'))
         {
-            token = strtok(NULL, " ");
+            const char* end = findClosingParen(p + 2);
 
-            if (token)
+            if (end)
             {
-                error_redirect = 1;
-
-                int fd = open(token, O_WRONLY | O_CREAT  | O_TRUNC, 0644);
+                char* inner = strndup(p + 2, end - (p + 2));
+                int fd = spawnProcessSubstitution(shell, inner, p[0]);
+                free(inner);
 
-                if (fd == -1)
+                if (fd != -1)
                 {
-                    perror("Error opening error file");
-                    free (cmd); // daph added this (for reprintf("%s", shell->prompt);
-                    return -1;
+                    char path[32];
+                    snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+                    bufferAppendString(&out, path);
                 }
 
-                dup2(fd, fileno(stderr));
+                p = end + 1;
+                continue;
+            }
+        }
+        else if (!inSingle && *p == '`')
+        {
+            Buffer inner;
+            bufferInit(&inner);
+
+            // inside backquotes only \`, \\ and \$ are escapes
+            const char* q = p + 1;
 
-                // error handling - unable to redirect standard error
-                if (dup2(fd, fileno(stderr)) == -1)
+            while (*q && *q != '`')
+            {
+                if (*q == '\\' && q[1] && strchr("`\\$", q[1]))
                 {
-                    perror("Error redirecting error.");
-                    close(fd);
-                    free(cmd);
-                    return -1;
+                    q++;
                 }
+                bufferAppendChar(&inner, *q);
+                q++;
+            }
 
-                close(fd);
+            if (*q == '`')
+            {
+                substitute(shell, inner.data ? inner.data : "", inDouble, &out);
+                bufferFree(&inner);
+                p = q + 1;
+                continue;
             }
+
+            bufferFree(&inner);
         }
 
-        token = strtok(NULL, " ");
+        bufferAppendChar(&out, *p);
+        p++;
     }
 
-    free(cmd);
+    return bufferRelease(&out);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * in-process substitution of output-only builtins - $(pwd), $(echo ...)
+ * returns 1 if the command was handled here, without a fork
+ */
+int captureBuiltin(Shell* shell, const char* command, Buffer* out)
+{
+    ParsedLine* pl = parseLine(command);
+    int handled = 0;
 
-    // Restore the standard output and standard error
-    if (output_redirect || error_redirect)
+    if (pl == NULL)
     {
-        dup2(stdout_backup, fileno(stdout)); // Restore standard output
-        dup2(stderr_backup, fileno(stderr)); // Restore standard error
+        return 0;
     }
 
-    // error handling - unable to restore file descriptors
-    if (output_redirect || error_redirect)
+    const Node* np = pl->tree;
+    const Command* cp = np ? &np->command[0] : NULL;
+
+    // a single simple command without redirections
+    if (!pl->delegate && pl->error == 0 && np && np->next == NULL && np->nCommands == 1 &&
+        !np->background && !np->compound[0] && cp->argv[0] != NULL && !cp->stdin_file &&
+        !cp->stdout_file && !cp->stderr_file &&
+        (strcmp(cp->argv[0], "pwd") == 0 || strcmp(cp->argv[0], "echo") == 0))
     {
-        if (dup2(stdout_backup, fileno(stdout)) == -1 || dup2(stderr_backup, fileno(stderr)) == -1)
+        ExpandedCommand ec;
+
+        if (expandCommand(shell, cp, &ec) == 0)
         {
-            perror("Error restoring file descriptors");
-            return -1;
+            char** argv = ec.args.words;
+
+            if (strcmp(argv[0], "pwd") == 0)
+            {
+                bufferAppendString(out, shell->currentDirectory);
+                bufferAppendChar(out, '\n');
+            }
+            else
+            {
+                int newline = 1;
+                int i = 1;
+
+                if (argv[i] && strcmp(argv[i], "-n") == 0)
+                {
+                    newline = 0;
+                    i++;
+                }
+
+                for (int first = i; argv[i] != NULL; i++)
+                {
+                    if (i > first)
+                    {
+                        bufferAppendChar(out, ' ');
+                    }
+                    bufferAppendString(out, argv[i]);
+                }
+
+                if (newline)
+                {
+                    bufferAppendChar(out, '\n');
+                }
+            }
+
+            freeExpandedCommand(&ec);
+            handled = 1;
         }
     }
 
-    return (output_redirect || error_redirect) ? (stdout_backup | (stderr_backup << 16)) : 0;
+    releaseParsedLine(pl);
+
+    return handled;
 }
 
 // ------------------------------------------------------------
 
 /*
- * adding the commands entered into a command_history array
+ * capturing the standard output of a command into a buffer
  */
-void add_history(Shell* shell, const char *command)
+int captureCommandOutput(Shell* shell, const char* command, Buffer* out)
 {
-    if (total_history < MAX_HISTORY_LENGTH)
+    // builtins run in-process, no fork
+    if (captureBuiltin(shell, command, out))
     {
-        strcpy(shell->command_history[total_history], command);
-        total_history++;
+        return 0;
     }
-    else
-    {
-        // deallocate memory
-        free(shell->command_history[0]);
 
-        // if the history is full, overwrite the oldest command in a circular manner
-        strcpy(shell->command_history[history_index], command);
-        history_index = (history_index + 1) % MAX_HISTORY_LENGTH;
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+        perror("pipe");
+        return -1;
     }
-}
 
-// ------------------------------------------------------------
+    shareProcessSubstitutions(shell);
+    fflush(stdout);
 
-/*
- * command execution for the !12 and !string commands
- */
-void execute_history_command(char *arg[])
-{
+    PROBE2(spawn__start, "(command substitution)", 0);
     pid_t pid = fork();
 
-    if (pid<0)
+    if (pid == -1)
     {
-        perror("fork()");
-        exit(0);
+        perror("fork() error");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
     }
     else if (pid == 0)
     {
-        printf("Child process executing: %s", arg[0]);
-
-        if (execvp(arg[0],arg) < 0)
-        {
-            perror("execvp()");
-            exit(1);
-        }
-    }
-    else
-    {
-        int status;
-        waitpid(pid, &status, 0);
+        // child process - standard output goes into the pipe, the command is run
+        // by this shell's own executor rather than by exec'ing /bin/sh
+        dup2(fds[1], STDOUT_FILENO);
+        exitForkedCopy(executeCommand(shell, command));
     }
+
+    // parent process - drain the pipe straight into the buffer
+    PROBE3(spawn__end, pid, "(command substitution)", 0);
+    auditStart(pid, command);
+    close(fds[1]);
+    bufferReadFd(out, fds[0]);
+    close(fds[0]);
+
+    return waitForChild(pid);
 }
+
 // ------------------------------------------------------------
 
 /*
- * providing the nth command entered
+ * process substitution - <(...) and >(...)
  */
-char * history_by_number(Shell* shell, int num)
+int spawnProcessSubstitution(Shell* shell, const char* command, char direction)
 {
-    if (num > 0 && num <= total_history)
+    if (shell->total_procsub >= MAX_PROCESS_SUBSTITUTIONS)
     {
-        return shell->command_history[num - 1];
+        fprintf(stderr, "Too many process substitutions.\n");
+        return -1;
     }
-    return NULL;
+
+    int fds[2];
+
+    if (pipe2(fds, O_CLOEXEC) == -1)
+    {
+        perror("pipe");
+        return -1;
+    }
+
+    // <(...) is read by the command, >(...) is written by it
+    int childEnd = (direction == '<') ? fds[1] : fds[0];
+    int shellEnd = (direction == '<') ? fds[0] : fds[1];
+
+    // block SIGCHLD so the job is in the table before it can be reaped
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+    fflush(stdout);
+
+    PROBE2(spawn__start, "(process substitution)", 0);
+    pid_t pid = fork();
+
+    if (pid == -1)
+    {
+        perror("fork() error");
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    else if (pid == 0)
+    {
+        // child process
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+        dup2(childEnd, (direction == '<') ? STDOUT_FILENO : STDIN_FILENO);
+        exitForkedCopy(executeCommand(shell, command));
+    }
+
+    // parent process - the job table reaps it whenever it finishes
+    PROBE3(spawn__end, pid, "(process substitution)", 0);
+    auditStart(pid, command);
+    addJob(pid, JOB_PROCSUB, command);
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+    close(childEnd);
+
+    shell->procsub_fds[shell->total_procsub++] = shellEnd;
+
+    return shellEnd;
 }
 
 // ------------------------------------------------------------
 
 /*
- * providing output of the nth command
+ * letting the next command inherit the process substitution pipes
  */
-void execute_history_by_number(Shell* shell, int num)
+void shareProcessSubstitutions(Shell* shell)
 {
-    // finding the nth command
-    char *command_to_execute = shell->command_history[num -1];
-    char *command[MAX_ARGUMENT_LENGTH];
-
-    // getting the output of the nth command
-    int num_args = tokenise_command(command_to_execute, command);
-    execute_history_command(command);
+    for (int i = 0; i < shell->total_procsub; i++)
+    {
+        fcntl(shell->procsub_fds[i], F_SETFD, 0);
+    }
 }
 
 // ------------------------------------------------------------
 
 /*
- * providing the string command entered
+ * closing the shell's ends of the process substitution pipes once the command
+ * that used them has finished, so the substituted processes see EOF
  */
-char* history_by_string(Shell* shell, const char *str)
+void closeProcessSubstitutions(Shell* shell)
 {
-    for (int i = total_history - 1; i >= 0; --i)
+    for (int i = 0; i < shell->total_procsub; i++)
     {
-        if (strncmp(shell->command_history[i], str, strlen(str)) == 0)
-        {
-            return shell->command_history[i];
-        }
+        close(shell->procsub_fds[i]);
     }
-    return NULL;
+
+    shell->total_procsub = 0;
 }
 
 // ------------------------------------------------------------
 
 /*
- * providing output of the string command
+ * reading the next field of an expanded word, removing quotes and escapes
+ * returns 0 at the end, 1 for a field and 2 for a field with unquoted wildcards,
+ * in which case "pattern" holds it with the quoted wildcards escaped for glob()
  */
-void execute_history_by_string(Shell* shell, const char *str)
+int nextWord(const char** cursor, Buffer* word, Buffer* pattern)
 {
-    char* command_to_execute = NULL;
+    const char* p = *cursor;
 
-    // finding the string command
-    for (int i = total_history - 1; i >= 0; --i)
+    while (*p == ' ' || *p == '\t')
     {
-        if (strncmp(shell->command_history[i], str, strlen(str)) == 0)
-        {
-            command_to_execute = shell->command_history[i];
-        }
+        p++;
     }
 
-    // getting the output of the string command
+    if (*p == '\0')
+    {
+        *cursor = p;
+        return 0;
+    }
+
+    // an empty word such as "" still needs a string
+    word->len = 0;
+    bufferReserve(word, 0);
+    word->data[0] = '\0';
+
+    if (pattern)
+    {
+        pattern->len = 0;
+        bufferReserve(pattern, 0);
+        pattern->data[0] = '\0';
+    }
+
+    // tilde expansion - ~ and ~/path
+    if (*p == '~' && (p[1] == '\0' || p[1] == '/' || p[1] == ' ' || p[1] == '\t'))
+    {
+        const char* home = getVariable("HOME");
+
+        bufferAppendString(word, home ? home : "~");
+        if (pattern)
+        {
+            bufferAppendString(pattern, home ? home : "~");
+        }
+        p++;
+    }
+
+    int inSingle = 0;
+    int inDouble = 0;
+    int wildcards = 0;
+
+    while (*p && (inSingle || inDouble || (*p != ' ' && *p != '\t')))
+    {
+        int quoted = inSingle || inDouble;
+
+        if (*p == '\'' && !inDouble)
+        {
+            inSingle = !inSingle;
+            p++;
+            continue;
+        }
+
+        if (*p == '"' && !inSingle)
+        {
+            inDouble = !inDouble;
+            p++;
+            continue;
+        }
+
+        if (*p == '\\' && !inSingle && p[1] && (!inDouble || strchr("\"\\$`", p[1])))
+        {
+            p++;
+            quoted = 1;
+        }
+
+        if (pattern && strchr("*?[\\", *p))
+        {
+            if (quoted || *p == '\\')
+            {
+                bufferAppendChar(pattern, '\\');
+            }
+            else
+            {
+                wildcards = 1;
+            }
+        }
+
+        bufferAppendChar(word, *p);
+        if (pattern)
+        {
+            bufferAppendChar(pattern, *p);
+        }
+        p++;
+    }
+
+    *cursor = p;
+
+    return wildcards ? 2 : 1;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * removing quotes and escapes from a whole string, without splitting it into fields
+ */
+char* removeQuotes(const char* text)
+{
+    Buffer out;
+    bufferInit(&out);
+    bufferReserve(&out, strlen(text));
+
+    int inSingle = 0;
+    int inDouble = 0;
+
+    for (const char* p = text; *p; p++)
+    {
+        if (*p == '\'' && !inDouble)
+        {
+            inSingle = !inSingle;
+            continue;
+        }
+
+        if (*p == '"' && !inSingle)
+        {
+            inDouble = !inDouble;
+            continue;
+        }
+
+        if (*p == '\\' && !inSingle && p[1] && (!inDouble || strchr("\"\\$`", p[1])))
+        {
+            p++;
+        }
+
+        bufferAppendChar(&out, *p);
+    }
+
+    return bufferRelease(&out);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * adding a word to a word list, the list takes ownership of the word; words
+ * from plain malloc() are counted against MEM_GLOB with tagAdopt() first
+ */
+void addWord(WordList* list, char* word)
+{
+    if (list->count + 1 >= list->capacity)
+    {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->words = tagRealloc(MEM_GLOB, list->words, sizeof(char*) * list->capacity);
+
+        if (list->words == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
+    list->words[list->count++] = word;
+    list->words[list->count] = NULL;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * deallocate memory for a word list
+ */
+void freeWords(WordList* list)
+{
+    for (int i = 0; i < list->count; i++)
+    {
+        tagFree(MEM_GLOB, list->words[i]);
+    }
+
+    tagFree(MEM_GLOB, list->words);
+    list->words = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * word expansion - variables, substitutions, field splitting, wildcards and quote removal
+ */
+void expandWords(Shell* shell, char* words[], WordList* out)
+{
+    Buffer word, pattern;
+    bufferInit(&word);
+    bufferInit(&pattern);
+
+    for (int i = 0; words[i] != NULL; i++)
+    {
+        char* expanded = expandLine(shell, words[i]);
+        const char* cursor = expanded;
+        int kind;
+
+        while ((kind = nextWord(&cursor, &word, &pattern)) != 0)
+        {
+            int numExpanded = 0;
+            char** matches = (kind == 2) ? expandWildcards(pattern.data, &numExpanded) : NULL;
+
+            if (matches)
+            {
+                for (int k = 0; k < numExpanded; k++)
+                {
+                    addWord(out, matches[k]);
+                }
+                tagFree(MEM_GLOB, matches);
+            }
+            else
+            {
+                // no wildcards, or nothing matched - the word stays as it is
+                addWord(out, tagStrdup(MEM_GLOB, word.data));
+            }
+        }
+
+        free(expanded);
+    }
+
+    bufferFree(&word);
+    bufferFree(&pattern);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * expanding one command of a parsed line, ready for execution
+ */
+int expandCommand(Shell* shell, const Command* cp, ExpandedCommand* ec)
+{
+    memset(ec, 0, sizeof(*ec));
+    ec->append = cp->stdout_append;
+
+    // leading NAME=value words are assignments, not arguments
+    int first = 0;
+
+    while (cp->argv[first] != NULL)
+    {
+        const char* eq = strchr(cp->argv[first], '=');
+
+        if (!eq || !validVariableName(cp->argv[first], eq - cp->argv[first]))
+        {
+            break;
+        }
+
+        char* expanded = expandLine(shell, cp->argv[first]);
+        addWord(&ec->assignments, tagAdopt(MEM_GLOB, removeQuotes(expanded)));
+        free(expanded);
+        first++;
+    }
+
+    expandWords(shell, cp->argv + first, &ec->args);
+
+    const char* files[3] = { cp->stdin_file, cp->stdout_file, cp->stderr_file };
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (files[i] == NULL)
+        {
+            continue;
+        }
+
+        WordList target = { NULL, 0, 0 };
+        char* word[2] = { (char*)files[i], NULL };
+
+        expandWords(shell, word, &target);
+
+        // error handling - a redirection needs exactly one file name
+        if (target.count != 1)
+        {
+            fprintf(stderr, "%s: ambiguous redirect\n", files[i]);
+            freeWords(&target);
+            freeExpandedCommand(ec);
+            return -1;
+        }
+
+        ec->files[i] = target.words[0];
+        tagFree(MEM_GLOB, target.words);
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * deallocate memory for an expanded command
+ */
+void freeExpandedCommand(ExpandedCommand* ec)
+{
+    freeWords(&ec->args);
+    freeWords(&ec->assignments);
+
+    for (int i = 0; i < 3; i++)
+    {
+        tagFree(MEM_GLOB, ec->files[i]);
+        ec->files[i] = NULL;
+    }
+}
+
+// ------------------------------------------------------------
+
+/*
+ * setting the variables assigned by NAME=value words
+ */
+void applyAssignments(const WordList* assignments, int exported)
+{
+    for (int i = 0; i < assignments->count; i++)
+    {
+        char* eq = strchr(assignments->words[i], '=');
+
+        *eq = '\0';
+        setVariable(assignments->words[i], eq + 1, exported);
+        *eq = '=';
+    }
+}
+
+// ------------------------------------------------------------
+
+/*
+ * expanding a case pattern - one word, no field splitting, with the quoted wildcards
+ * escaped so that only the unquoted ones match for fnmatch()
+ */
+char* expandPattern(Shell* shell, const char* word)
+{
+    char* expanded = expandLine(shell, word);
+    Buffer out;
+    bufferInit(&out);
+    bufferReserve(&out, strlen(expanded));
+
+    int inSingle = 0;
+    int inDouble = 0;
+
+    for (const char* p = expanded; *p; p++)
+    {
+        int quoted = inSingle || inDouble;
+
+        if (*p == '\'' && !inDouble)
+        {
+            inSingle = !inSingle;
+            continue;
+        }
+
+        if (*p == '"' && !inSingle)
+        {
+            inDouble = !inDouble;
+            continue;
+        }
+
+        if (*p == '\\' && !inSingle && p[1] && (!inDouble || strchr("\"\\$`", p[1])))
+        {
+            p++;
+            quoted = 1;
+        }
+
+        if ((quoted && strchr("*?[", *p)) || *p == '\\')
+        {
+            bufferAppendChar(&out, '\\');
+        }
+
+        bufferAppendChar(&out, *p);
+    }
+
+    free(expanded);
+
+    return bufferRelease(&out);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * builtin commands, run inside the shell itself
+ */
+Builtin builtins[] =
+{
+    { "prompt",  builtinPrompt },
+    { "cd",      builtinCd },
+    { "z",       builtinJump },
+    { "pushd",   builtinPushd },
+    { "popd",    builtinPopd },
+    { "dirs",    builtinDirs },
+    { "pwd",     builtinPwd },
+    { "exit",    builtinExit },
+    { "history", builtinHistory },
+    { "export",  builtinExport },
+    { "unset",   builtinUnset },
+    { "jobs",    builtinJobs },
+    { "bglimit", builtinBgLimit },
+    { "bgprio",  builtinBgPrio },
+    { "limit",   builtinLimit },
+    { "joblog",  builtinJobLog },
+    { "stats",   builtinStats },
+    { "memstats", builtinMemStats },
+    { "true",    builtinTrue },
+    { ":",       builtinTrue },
+    { "false",   builtinFalse },
+    { "echo",    builtinEcho },
+    { "test",    builtinTest },
+    { "[",       builtinTest },
+    { "read",    builtinRead },
+    { "break",   builtinBreak },
+    { "continue", builtinContinue },
+    { "parallel", builtinParallel },
+    { "dag",     builtinDag },
+    { NULL,      NULL }
+};
+
+// ------------------------------------------------------------
+
+/*
+ * finding a builtin command by name
+ */
+BuiltinFunction findBuiltin(const char* name)
+{
+    for (int i = 0; builtins[i].name != NULL; i++)
+    {
+        if (strcmp(builtins[i].name, name) == 0)
+        {
+            return builtins[i].function;
+        }
+    }
+
+    return NULL;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * prompt change - prompt <new_prompt>
+ */
+int builtinPrompt(Shell* shell, int argc, char* argv[])
+{
+    Buffer prompt;
+    bufferInit(&prompt);
+    bufferAppendString(&prompt, "");
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i > 1)
+        {
+            bufferAppendChar(&prompt, ' ');
+        }
+        bufferAppendString(&prompt, argv[i]);
+    }
+
+    changePrompt(shell, prompt.data);
+    bufferFree(&prompt);
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * directory walk - cd [path]
+ */
+int builtinCd(Shell* shell, int argc, char* argv[])
+{
+    const char* path = argc > 1 ? argv[1] : NULL;
+    char target[MAX_PATH_LENGTH];
+
+    // "cd -j pattern" goes to the best ranked directory visited before that matches
+    if (path && strcmp(path, "-j") == 0)
+    {
+        if (argc < 3 || jumpTarget(argv[2], target, sizeof(target)) == -1)
+        {
+            fprintf(stderr, "cd: -j %s: no directory matches\n", argc < 3 ? "" : argv[2]);
+            return 1;
+        }
+        path = target;
+    }
+
+    if (!changeDirectory(shell, path))
+    {
+        printf("Directory change failed.\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * jump to a directory visited before - z pattern, the same as cd -j pattern
+ */
+int builtinJump(Shell* shell, int argc, char* argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: z pattern\n");
+        return 1;
+    }
+
+    char* args[] = { "cd", "-j", argv[1], NULL };
+    return builtinCd(shell, 3, args);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * directory stack - pushd [dir], swapping the top two directories without one
+ */
+int builtinPushd(Shell* shell, int argc, char* argv[])
+{
+    char current[MAX_PATH_LENGTH];
+    char target[MAX_PATH_LENGTH];
+
+    strcpy(current, shell->currentDirectory);
+
+    if (argc > 1)
+    {
+        if (pushDirectory(current) == -1)
+        {
+            return 1;
+        }
+
+        if (!changeDirectory(shell, argv[1]))
+        {
+            popDirectory(target, sizeof(target));
+            printf("Directory change failed.\n");
+            return 1;
+        }
+    }
+    else if (swapDirectory(current, target, sizeof(target)) == -1)
+    {
+        return 1;
+    }
+    else if (!changeDirectory(shell, target))
+    {
+        swapDirectory(target, current, sizeof(current));
+        printf("Directory change failed.\n");
+        return 1;
+    }
+
+    printDirectories(shell->currentDirectory);
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * directory stack - popd
+ */
+int builtinPopd(Shell* shell, int argc, char* argv[])
+{
+    char target[MAX_PATH_LENGTH];
+
+    if (popDirectory(target, sizeof(target)) == -1)
+    {
+        return 1;
+    }
+
+    if (!changeDirectory(shell, target))
+    {
+        printf("Directory change failed.\n");
+        return 1;
+    }
+
+    printDirectories(shell->currentDirectory);
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * directory stack - dirs
+ */
+int builtinDirs(Shell* shell, int argc, char* argv[])
+{
+    printDirectories(shell->currentDirectory);
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * print current directory - pwd
+ */
+int builtinPwd(Shell* shell, int argc, char* argv[])
+{
+    printCurrentDirectory(shell);
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * exit the program - exit [status]
+ */
+int builtinExit(Shell* shell, int argc, char* argv[])
+{
+    printf("Exiting the shell.\n");
+    shell->exit_requested = 1;
+    return argc > 1 ? atoi(argv[1]) & 0xff : shell->last_status;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * history - print out all the commands entered
+ */
+int builtinHistory(Shell* shell, int argc, char* argv[])
+{
+    execute_history(shell);
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * exporting variables to commands - export NAME=value, export NAME, export
+ */
+int builtinExport(Shell* shell, int argc, char* argv[])
+{
+    int status = 0;
+
+    // with no arguments, list the environment
+    if (argc == 1)
+    {
+        listExportedVariables();
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        char* eq = strchr(argv[i], '=');
+        int result;
+
+        if (eq)
+        {
+            *eq = '\0';
+            result = setVariable(argv[i], eq + 1, 1);
+            *eq = '=';
+        }
+        else
+        {
+            result = exportVariable(argv[i]);
+        }
+
+        // error handling - invalid name
+        if (result == -1)
+        {
+            fprintf(stderr, "export: invalid variable name: %s\n", argv[i]);
+            status = 1;
+        }
+    }
+
+    return status;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * removing variables - unset NAME...
+ */
+int builtinUnset(Shell* shell, int argc, char* argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        unsetVariable(argv[i]);
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * listing background jobs - jobs
+ */
+int builtinJobs(Shell* shell, int argc, char* argv[])
+{
+    listJobs();
+    listQueuedJobs();
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * limiting concurrent background jobs - bglimit [n]
+ */
+int builtinBgLimit(Shell* shell, int argc, char* argv[])
+{
+    if (argc > 1)
+    {
+        char* end;
+        long limit = strtol(argv[1], &end, 10);
+
+        if (*end != '\0' || limit < 0)
+        {
+            fprintf(stderr, "bglimit: %s: not a number\n", argv[1]);
+            return 1;
+        }
+
+        // 0 goes back to the number of processors
+        setSchedulerLimit((int)limit);
+        runQueuedJobs();
+    }
+
+    printf("limit %d, running %d, queued %d%s\n", schedulerLimit(), runningJobs(JOB_BACKGROUND), queuedJobs(),
+           jobserverActive() ? ", jobserver" : "");
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * priority of background jobs - bgprio [-n nice] [-c class[:level]] [-a cpus] [%job ...]
+ * without jobs the options change the policy for new background jobs
+ */
+int builtinBgPrio(Shell* shell, int argc, char* argv[])
+{
+    return changePriority(argc, argv);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * resource limits - limit [-m bytes] [-t cpu-seconds] [-n files] [-w seconds] [-g seconds] [command ...]
+ * without a command the options change the limits of every job launched from now on,
+ * with one only that command runs with them
+ */
+int builtinLimit(Shell* shell, int argc, char* argv[])
+{
+    JobLimits saved, limits;
+    getJobLimits(&saved);
+    limits = saved;
+
+    int first = parseJobLimits(argc, argv, &limits);
+
+    if (first == -1)
+    {
+        fprintf(stderr, "usage: limit [-m bytes] [-t cpu-seconds] [-n files] [-w seconds] [-g seconds] [command ...]\n");
+        return 1;
+    }
+
+    if (first == argc)
+    {
+        setJobLimits(&limits);
+        printJobLimits(&limits);
+        return 0;
+    }
+
+    ExpandedCommand ec;
+    memset(&ec, 0, sizeof(ec));
+    ec.args.words = argv + first;
+    ec.args.count = argc - first;
+
+    setJobLimits(&limits);
+    int status = launchPipeline(shell, NULL, &ec, 1, NULL);
+    setJobLimits(&saved);
+
+    return status;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * captured output of background jobs - joblog [-s size] [-o file] [%job ...]
+ */
+int builtinJobLog(Shell* shell, int argc, char* argv[])
+{
+    return showJobLog(argc, argv);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * shell statistics - stats
+ */
+int builtinStats(Shell* shell, int argc, char* argv[])
+{
+    printParseCacheStats();
+    printForkServerStats();
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * memory in use by each subsystem - memstats
+ */
+int builtinMemStats(Shell* shell, int argc, char* argv[])
+{
+    printMemStats();
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * doing nothing - true, :
+ */
+int builtinTrue(Shell* shell, int argc, char* argv[])
+{
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * failing - false
+ */
+int builtinFalse(Shell* shell, int argc, char* argv[])
+{
+    return 1;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * printing the arguments - echo [-n] [word...]
+ */
+int builtinEcho(Shell* shell, int argc, char* argv[])
+{
+    int newline = 1;
+    int i = 1;
+
+    if (i < argc && strcmp(argv[i], "-n") == 0)
+    {
+        newline = 0;
+        i++;
+    }
+
+    for (int first = i; i < argc; i++)
+    {
+        printf(i > first ? " %s" : "%s", argv[i]);
+    }
+
+    if (newline)
+    {
+        putchar('\n');
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * evaluating one test expression, -1 if it is not understood
+ */
+int testExpression(int argc, char* argv[])
+{
+    if (argc == 0)
+    {
+        return 0;
+    }
+
+    if (strcmp(argv[0], "!") == 0)
+    {
+        int result = testExpression(argc - 1, argv + 1);
+        return result == -1 ? -1 : !result;
+    }
+
+    if (argc == 1)
+    {
+        return argv[0][0] != '\0';
+    }
+
+    if (argc == 2)
+    {
+        struct stat st;
+        const char* op = argv[0];
+
+        if (strcmp(op, "-n") == 0) return argv[1][0] != '\0';
+        if (strcmp(op, "-z") == 0) return argv[1][0] == '\0';
+        if (strcmp(op, "-e") == 0) return stat(argv[1], &st) == 0;
+        if (strcmp(op, "-f") == 0) return stat(argv[1], &st) == 0 && S_ISREG(st.st_mode);
+        if (strcmp(op, "-d") == 0) return stat(argv[1], &st) == 0 && S_ISDIR(st.st_mode);
+        if (strcmp(op, "-r") == 0) return access(argv[1], R_OK) == 0;
+        if (strcmp(op, "-w") == 0) return access(argv[1], W_OK) == 0;
+        if (strcmp(op, "-x") == 0) return access(argv[1], X_OK) == 0;
+        if (strcmp(op, "-s") == 0) return stat(argv[1], &st) == 0 && st.st_size > 0;
+
+        return -1;
+    }
+
+    if (argc == 3)
+    {
+        const char* op = argv[1];
+        const char* integers[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge", NULL };
+
+        if (strcmp(op, "=") == 0) return strcmp(argv[0], argv[2]) == 0;
+        if (strcmp(op, "!=") == 0) return strcmp(argv[0], argv[2]) != 0;
+
+        for (int i = 0; integers[i] != NULL; i++)
+        {
+            if (strcmp(op, integers[i]) == 0)
+            {
+                char* end1;
+                char* end2;
+                long a = strtol(argv[0], &end1, 10);
+                long b = strtol(argv[2], &end2, 10);
+
+                // error handling - not an integer
+                if (*argv[0] == '\0' || *end1 != '\0' || *argv[2] == '\0' || *end2 != '\0')
+                {
+                    return -1;
+                }
+
+                switch (i)
+                {
+                    case 0: return a == b;
+                    case 1: return a != b;
+                    case 2: return a < b;
+                    case 3: return a <= b;
+                    case 4: return a > b;
+                    default: return a >= b;
+                }
+            }
+        }
+    }
+
+    return -1;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * conditions - test EXPRESSION, [ EXPRESSION ]
+ */
+int builtinTest(Shell* shell, int argc, char* argv[])
+{
+    if (strcmp(argv[0], "[") == 0)
+    {
+        // error handling - "[" needs its "]"
+        if (strcmp(argv[argc - 1], "]") != 0)
+        {
+            fprintf(stderr, "[: missing ]\n");
+            return 2;
+        }
+        argc--;
+    }
+
+    int result = testExpression(argc - 1, argv + 1);
+
+    if (result == -1)
+    {
+        fprintf(stderr, "%s: unsupported expression\n", argv[0]);
+        return 2;
+    }
+
+    return !result;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * reading a line into variables - read NAME...
+ * reads one byte at a time so that nothing after the line is taken from the input
+ */
+int builtinRead(Shell* shell, int argc, char* argv[])
+{
+    Buffer line;
+    bufferInit(&line);
+
+    char c;
+    ssize_t n;
+
+    while ((n = read(STDIN_FILENO, &c, 1)) == 1 || (n == -1 && errno == EINTR))
+    {
+        if (n == 1 && c == '\n')
+        {
+            break;
+        }
+        if (n == 1)
+        {
+            bufferAppendChar(&line, c);
+        }
+    }
+
+    // end of input with nothing read
+    if (n == 0 && line.len == 0)
+    {
+        bufferFree(&line);
+        return 1;
+    }
+
+    // an empty line still needs a string
+    bufferReserve(&line, 0);
+
+    // the fields go to the names in turn, the last name takes the rest of the line
+    char* p = line.data;
+
+    for (int i = 1; i < argc; i++)
+    {
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+
+        char* end = p;
+
+        if (i < argc - 1)
+        {
+            end += strcspn(p, " \t");
+        }
+        else
+        {
+            end += strlen(p);
+            while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+            {
+                end--;
+            }
+        }
+
+        char saved = *end;
+        *end = '\0';
+
+        // error handling - invalid name
+        if (setVariable(argv[i], p, -1) == -1)
+        {
+            fprintf(stderr, "read: invalid variable name: %s\n", argv[i]);
+        }
+
+        *end = saved;
+        p = end;
+    }
+
+    bufferFree(&line);
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * the loop count of break and continue, 0 if it is invalid
+ */
+int loopLevels(Shell* shell, int argc, char* argv[])
+{
+    int levels = argc > 1 ? atoi(argv[1]) : 1;
+
+    // error handling - outside a loop
+    if (shell->loop_depth == 0)
+    {
+        fprintf(stderr, "%s: only meaningful in a loop\n", argv[0]);
+        return 0;
+    }
+
+    if (levels < 1)
+    {
+        fprintf(stderr, "%s: loop count out of range\n", argv[0]);
+        return 0;
+    }
+
+    return levels < shell->loop_depth ? levels : shell->loop_depth;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * leaving loops - break [n]
+ */
+int builtinBreak(Shell* shell, int argc, char* argv[])
+{
+    int levels = loopLevels(shell, argc, argv);
+
+    shell->breaking = levels;
+
+    return levels ? 0 : 1;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * starting the next iteration of a loop - continue [n]
+ */
+int builtinContinue(Shell* shell, int argc, char* argv[])
+{
+    int levels = loopLevels(shell, argc, argv);
+
+    shell->continuing = levels;
+
+    return levels ? 0 : 1;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * running one job of the parallel builtin, in a child copy of the shell
+ */
+int parallelExecute(void* context, const char* line)
+{
+    Shell* shell = context;
+    int status = executeCommand(shell, line);
+
+    if (status == -1)
+    {
+        printf("Unknown command: %s\n", line);
+        status = 127;
+    }
+
+    return status;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * running command lines on a pool of workers - parallel [-j N] [-u] [-v] [command ...] [::: argument ...]
+ */
+int builtinParallel(Shell* shell, int argc, char* argv[])
+{
+    return runParallel(argc, argv, parallelExecute, shell);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * running a script of steps with dependencies concurrently - dag [-j N] [-k] [-v] [file]
+ */
+int builtinDag(Shell* shell, int argc, char* argv[])
+{
+    return runDag(argc, argv, parallelExecute, shell);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * opening the file of redirection "i" (0 for <, 1 for > and >>, 2 for 2>)
+ * returns the descriptor, or -1 after reporting the error
+ */
+int openRedirection(const ExpandedCommand* ec, int i)
+{
+    int flags = O_RDONLY;
+
+    if (i > 0)
+    {
+        flags = O_WRONLY | O_CREAT | ((i == 1 && ec->append) ? O_APPEND : O_TRUNC);
+    }
+
+    int fd = open(ec->files[i], flags | O_CLOEXEC, 0644);
+
+    // error handling - unable to open the file
+    if (fd == -1)
+    {
+        perror(ec->files[i]);
+    }
+
+    return fd;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * redirection of the standard input, standard output and standard error <, >, >> and 2>
+ * when "saved" is not NULL the original descriptors are kept there for restoreRedirection()
+ */
+int handleRedirection(const ExpandedCommand* ec, int saved[3])
+{
+    const int targets[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+
+    if (saved)
+    {
+        saved[0] = saved[1] = saved[2] = -1;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (ec->files[i] == NULL)
+        {
+            continue;
+        }
+
+        int fd = openRedirection(ec, i);
+
+        if (fd == -1)
+        {
+            return -1;
+        }
+
+        // Backup the original descriptor
+        if (saved)
+        {
+            fflush(i == 1 ? stdout : stderr);
+            saved[i] = fcntl(targets[i], F_DUPFD_CLOEXEC, 10);
+        }
+
+        // error handling - unable to redirect
+        if (dup2(fd, targets[i]) == -1)
+        {
+            perror("Error redirecting");
+            close(fd);
+            return -1;
+        }
+
+        close(fd);
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * restoring the descriptors saved by handleRedirection()
+ */
+void restoreRedirection(int saved[3])
+{
+    const int targets[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+
+    fflush(stdout);
+    fflush(stderr);
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (saved[i] != -1)
+        {
+            dup2(saved[i], targets[i]);
+            close(saved[i]);
+        }
+    }
+}
+
+// ------------------------------------------------------------
+
+/*
+ * adding the commands entered into a command_history array
+ */
+void add_history(Shell* shell, const char *command)
+{
+    if (total_history < MAX_HISTORY_LENGTH)
+    {
+        strcpy(shell->command_history[total_history], command);
+        total_history++;
+    }
+    else
+    {
+        // if the history is full, overwrite the oldest command in a circular manner
+        strcpy(shell->command_history[history_index], command);
+        history_index = (history_index + 1) % MAX_HISTORY_LENGTH;
+    }
+}
+
+// ------------------------------------------------------------
+
+/*
+ * providing the nth command entered
+ */
+char * history_by_number(Shell* shell, int num)
+{
+    if (num > 0 && num <= total_history)
+    {
+        return shell->command_history[num - 1];
+    }
+    return NULL;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * the line editor's view of the history - "back" 1 is the most recent command
+ */
+const char* lineHistory(void* context, int back)
+{
+    Shell* shell = context;
+
+    if (back < 1 || back > total_history)
+    {
+        return NULL;
+    }
+
+    // once the history is full, history_index is where the oldest command is
+    return shell->command_history[(history_index + total_history - back) % MAX_HISTORY_LENGTH];
+}
+
+// ------------------------------------------------------------
+
+/*
+ * providing output of the nth command
+ */
+void execute_history_by_number(Shell* shell, int num)
+{
+    // finding the nth command
+    char *command_to_execute = shell->command_history[num -1];
+
+    // getting the output of the nth command, re-run through the parse cache
+    shell->last_status = executeCommand(shell, command_to_execute);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * providing the string command entered
+ */
+char* history_by_string(Shell* shell, const char *str)
+{
+    for (int i = total_history - 1; i >= 0; --i)
+    {
+        if (strncmp(shell->command_history[i], str, strlen(str)) == 0)
+        {
+            return shell->command_history[i];
+        }
+    }
+    return NULL;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * providing output of the string command
+ */
+void execute_history_by_string(Shell* shell, const char *str)
+{
+    // finding the most recent command starting with the string
+    char* command_to_execute = history_by_string(shell, str);
+
+    // getting the output of the string command, re-run through the parse cache
     if (command_to_execute != NULL)
     {
-        char *command[MAX_ARGUMENT_LENGTH];
+        shell->last_status = executeCommand(shell, command_to_execute);
+    }
+}
+
+// ------------------------------------------------------------
+
+/*
+ * provide all the history entered
+  */
+void execute_history(Shell* shell)
+{
+    printf("Command History: \n");
+
+    for (int i = 0; i < total_history; i++)
+    {
+        printf("%d: %s \n", i + 1, shell->command_history[i]);
+    }
+}
+
+// ------------------------------------------------------------
+
+/*
+ * waiting for a foreground process, retrying when a signal interrupts the wait
+ * returns the exit status, or 128 + the signal number if it was killed
+ */
+int waitForChild(pid_t pid)
+{
+    int status = 0;
+    pid_t result = 0;
+
+    if (queuedJobs() > 0 || watchedJobs() > 0 || captureActive())
+    {
+        // queued background jobs start as the running ones finish, timeouts expire
+        // and output is captured, also while a foreground command runs; every
+        // SIGCHLD ends the wait
+        sigset_t mask, oldMask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+        while ((result = waitpid(pid, &status, WNOHANG)) == 0 && (queuedJobs() > 0 || watchedJobs() > 0 || captureActive()))
+        {
+            runQueuedJobs();
+            waitForEvents(&oldMask, 0);
+        }
+
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    }
+
+    while (result != pid)
+    {
+        result = waitpid(pid, &status, 0);
+
+        if (result == -1 && errno != EINTR)
+        {
+            return -1;
+        }
+    }
+
+    auditEnd(pid, status);
+    PROBE2(child__reap, pid, status);
+
+    if (WIFSIGNALED(status))
+    {
+        return 128 + WTERMSIG(status);
+    }
+
+    return WEXITSTATUS(status);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * launching an external command through the fork server, so that the shell's own
+ * address space is not copied; the redirection files are opened here and passed
+ * to the server with the pipe ends
+ * returns the process id, or -1 if the command has to be forked by the shell
+ */
+pid_t launchThroughServer(Shell* shell, const ExpandedCommand* ec, int in, int out, char** envp)
+{
+    // only plain external commands: builtins, NAME=value prefixes and <(...) need the
+    // shell, and resource limits are set between fork and exec
+    if (!forkServerRunning() || ec->args.count == 0 || ec->assignments.count > 0 ||
+        shell->total_procsub > 0 || findBuiltin(ec->args.words[0]) != NULL || jobLimitsActive())
+    {
+        return -1;
+    }
+
+    int fds[3] = { in, out, STDERR_FILENO };
+    int opened[3] = { -1, -1, -1 };
+    pid_t pid = -1;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (ec->files[i] != NULL && (fds[i] = opened[i] = openRedirection(ec, i)) == -1)
+        {
+            // the shell's own fork reports the error the usual way
+            for (int k = 0; k < i; k++)
+            {
+                if (opened[k] != -1)
+                {
+                    close(opened[k]);
+                }
+            }
+            return -1;
+        }
+    }
+
+    int pidfd;
+    pid = forkServerSpawn(ec->args.words, envp, fds, &pidfd);
+
+    // the job table works with process ids, which stay valid until the shell
+    // reaps the process itself
+    if (pid != -1 && pidfd != -1)
+    {
+        close(pidfd);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (opened[i] != -1)
+        {
+            close(opened[i]);
+        }
+    }
+
+    return pid;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * describing a pipeline for the job table
+ */
+void describeCommands(const Node* pipeline, char* text, size_t size)
+{
+    const char* keywords[] = { "", "for ... done", "while ... done", "until ... done", "if ... fi", "case ... esac",
+                               "", "", "", "", "{ ... }", "( ... )" };
+    size_t used = 0;
+
+    text[0] = '\0';
+
+    for (int i = 0; i < pipeline->nCommands && used < size; i++)
+    {
+        if (pipeline->compound[i])
+        {
+            used += snprintf(text + used, size - used, "%s%s", i ? " " : "", keywords[pipeline->compound[i]->type]);
+        }
+
+        for (int k = 0; pipeline->command[i].argv[k] != NULL && used < size; k++)
+        {
+            used += snprintf(text + used, size - used, "%s%s", (i || k) ? " " : "", pipeline->command[i].argv[k]);
+        }
+
+        if (i < pipeline->nCommands - 1 && used < size)
+        {
+            used += snprintf(text + used, size - used, " |");
+        }
+    }
+}
+
+// ------------------------------------------------------------
+
+/*
+ * starting the processes of a pipeline whose commands are already expanded
+ * with "jobText" the pipeline becomes a background job and its job number is
+ * returned (-1 if nothing was started), otherwise it is waited for and its exit
+ * status returned
+ */
+int launchPipeline(Shell* shell, Node* const* compound, ExpandedCommand expanded[], int num_commands, const char* jobText)
+{
+    int exitCode = 0;
+    int pipes[num_commands > 1 ? num_commands - 1 : 1][2];
+    pid_t pids[num_commands];
+    int jobId = -1;
+
+    for (int i = 0; i < num_commands - 1; i++)
+    {
+        // error handling if pipe cannot be created
+        if (pipe2(pipes[i], O_CLOEXEC) < 0)
+        {
+            perror("pipe");
+            for (int k = 0; k < i; k++)
+            {
+                close(pipes[k][0]);
+                close(pipes[k][1]);
+            }
+            num_commands = 0;
+            exitCode = 1;
+            break;
+        }
+    }
+
+    PROBE2(pipeline__create, num_commands, jobText != NULL);
+
+    // block SIGCHLD so background jobs are in the table before they can be reaped
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+    fflush(stdout);
+    fflush(stderr);
+
+    char** envp = variablesEnvironment();
+    int started = 0;
+    int output[2] = { -1, -1 };
+
+    if (jobText)
+    {
+        openCapture(output);
+    }
+
+    for (int i = 0; i < num_commands; i++)
+    {
+        ExpandedCommand* ec = &expanded[i];
+        Node* stage = compound ? compound[i] : NULL;
+        pid_t pid = -1;
+
+        PROBE2(spawn__start, ec->args.count ? ec->args.words[0] : "", i);
+
+        // the fork server only passes the terminal's stderr on
+        if (!stage && output[1] == -1)
+        {
+            pid = launchThroughServer(shell, ec, i > 0 ? pipes[i - 1][0] : STDIN_FILENO,
+                                      i < num_commands - 1 ? pipes[i][1] : STDOUT_FILENO, envp);
+
+            // the fork server's children do not inherit the job's priority
+            if (pid != -1 && jobText)
+            {
+                applyBackgroundPriority(pid);
+            }
+        }
+
+        if (pid == -1)
+        {
+            pid = fork();
+        }
+
+        if (pid == -1)
+        {
+            // error handling - forking failed
+            perror("fork");
+            exitCode = 1;
+            break;
+        }
+        else if (pid == 0)
+        {
+            // child process
+            sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+            if (jobText)
+            {
+                applyBackgroundPriority(0);
+            }
+
+            applyJobLimits();
+            redirectToCapture(output, i == num_commands - 1);
+
+            if (i > 0)
+            {
+                // set stdin from the previous pipe
+                dup2(pipes[i - 1][0], STDIN_FILENO);
+            }
+            if (i < num_commands - 1)
+            {
+                // set stdout to the next pipe
+                dup2(pipes[i][1], STDOUT_FILENO);
+            }
+
+            // a compound stage forks again without exec, so the pipe ends must not
+            // stay open behind it
+            for (int k = 0; k < num_commands - 1; k++)
+            {
+                close(pipes[k][0]);
+                close(pipes[k][1]);
+            }
+
+            if (handleRedirection(ec, NULL) == -1)
+            {
+                exitForkedCopy(1);
+            }
+
+            // NAME=value words before a command only apply to that command
+            if (ec->assignments.count)
+            {
+                applyAssignments(&ec->assignments, 1);
+                envp = variablesEnvironment();
+            }
+
+            if (stage)
+            {
+                // the stage is already a forked copy of the shell, a subshell needs no second fork
+                exitForkedCopy(stage->type == NODE_SUBSHELL ? executeList(shell, stage->body) : executeCompound(shell, stage));
+            }
+
+            if (ec->args.count == 0)
+            {
+                exitForkedCopy(0);
+            }
+
+            // builtins in a pipeline run in the forked child
+            BuiltinFunction builtin = findBuiltin(ec->args.words[0]);
+
+            if (builtin)
+            {
+                exitForkedCopy(builtin(shell, ec->args.count, ec->args.words));
+            }
+
+            // execute with the shell's exported variables
+            environ = envp;
+            execvp(ec->args.words[0], ec->args.words);
+            PROBE2(exec__fail, ec->args.words[0], errno);
+
+            // error handling - execution failed
+            if (errno == ENOENT)
+            {
+                fprintf(stderr, "Unknown command: %s\n", ec->args.words[0]);
+            }
+            else
+            {
+                perror(ec->args.words[0]);
+            }
+            exitForkedCopy(127);
+        }
+
+        pids[started++] = pid;
+        PROBE3(spawn__end, pid, ec->args.count ? ec->args.words[0] : "", i);
+
+        if (stage)
+        {
+            auditStart(pid, stage->type == NODE_SUBSHELL ? "(subshell)" : "(compound command)");
+        }
+        else
+        {
+            auditStartWords(pid, ec->args.words, ec->args.count);
+        }
+
+        if (jobText)
+        {
+            if (i == 0)
+            {
+                jobId = addJob(pid, JOB_BACKGROUND, jobText);
+            }
+            else
+            {
+                addJobProcess(jobId, pid);
+            }
+        }
+    }
+
+    // Parent process: close all pipes
+    for (int i = 0; i < num_commands - 1; i++)
+    {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+
+    // the timeout starts before any of the processes can be reaped
+    const ExpandedCommand* last = &expanded[num_commands > 0 ? num_commands - 1 : 0];
+    watchJob(pids, started, jobText ? jobId : -1,
+             jobText ? jobText : (num_commands > 0 && last->args.count > 0) ? last->args.words[0] : "command");
+
+    if (started > 0)
+    {
+        addCapture(pids[0], jobId, output, jobText);
+    }
+    else
+    {
+        discardCapture(output);
+    }
+
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+    if (jobText)
+    {
+        return jobId;
+    }
+    else
+    {
+        // Wait for all child processes, the pipeline's status is the last one's
+        for (int i = 0; i < started; i++)
+        {
+            int code = waitForChild(pids[i]);
+
+            if (i == num_commands - 1)
+            {
+                exitCode = code;
+            }
+        }
+    }
+
+
+    return exitCode;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * queueing a background pipeline while the limit of running jobs is reached
+ * plain commands wait as their expanded words; a pipeline that needs the shell
+ * (compound stages, process substitutions) waits as a stopped copy of the shell
+ */
+void queueBackgroundPipeline(Shell* shell, Node* const* compound, ExpandedCommand expanded[], int num_commands, const char* text)
+{
+    int needsCopy = shell->total_procsub > 0;
+
+    for (int i = 0; i < num_commands; i++)
+    {
+        needsCopy |= (compound[i] != NULL);
+    }
+
+    if (needsCopy)
+    {
+        shareProcessSubstitutions(shell);
+
+        int output[2];
+        openCapture(output);
+        pid_t pid = forkStoppedJob();
+
+        if (pid == 0)
+        {
+            sigset_t none;
+            sigemptyset(&none);
+            sigprocmask(SIG_SETMASK, &none, NULL);
+            applyBackgroundPriority(0);
+            applyJobLimits();
+            redirectToCapture(output, 1);
+            exitForkedCopy(launchPipeline(shell, compound, expanded, num_commands, NULL));
+        }
+
+        if (pid == -1)
+        {
+            perror("fork");
+            discardCapture(output);
+            return;
+        }
+
+        auditStart(pid, text);
+        addCapture(pid, -1, output, text);
+        queueStoppedJob(text, pid);
+    }
+    else
+    {
+        PendingPipeline* pp = tagMalloc(MEM_JOBS, sizeof(PendingPipeline) + sizeof(ExpandedCommand) * num_commands);
+
+        if (pp == NULL)
+        {
+            perror("malloc");
+            return;
+        }
+
+        // the expanded words move to the queue
+        pp->nCommands = num_commands;
+        memcpy(pp->expanded, expanded, sizeof(ExpandedCommand) * num_commands);
+        memset(expanded, 0, sizeof(ExpandedCommand) * num_commands);
+
+        queueJob(text, pp);
+    }
+
+    printf("Background job queued, %d waiting: %s\n", queuedJobs(), text);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * starting a queued pipeline once a slot is free - the scheduler's launch function
+ */
+int launchQueuedPipeline(void* context, void* payload, const char* command)
+{
+    Shell* shell = context;
+    PendingPipeline* pp = payload;
+
+    // the job may start while another command is running, it must not hold on
+    // to that command's process substitution pipes
+    for (int i = 0; i < shell->total_procsub; i++)
+    {
+        fcntl(shell->procsub_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    int jobId = launchPipeline(shell, NULL, pp->expanded, pp->nCommands, command);
+
+    shareProcessSubstitutions(shell);
+
+    for (int i = 0; i < pp->nCommands; i++)
+    {
+        freeExpandedCommand(&pp->expanded[i]);
+    }
+    tagFree(MEM_JOBS, pp);
+
+    return jobId;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * shell pipeline - '|'
+ * runs one pipeline of a parsed line; a pipeline of one builtin or one compound
+ * command runs inside the shell
+ */
+int execute_piped_commands(Shell* shell, const Node* pipeline)
+{
+    const Command* commands = pipeline->command;
+    Node* const* compound = pipeline->compound;
+    int num_commands = pipeline->nCommands;
+    int background = pipeline->background;
+    ExpandedCommand expanded[num_commands];
+    int exitCode = 0;
+
+    // expand every command before anything is started
+    for (int i = 0; i < num_commands; i++)
+    {
+        if (expandCommand(shell, &commands[i], &expanded[i]) == -1)
+        {
+            for (int k = 0; k < i; k++)
+            {
+                freeExpandedCommand(&expanded[k]);
+            }
+            closeProcessSubstitutions(shell);
+            return 1;
+        }
+    }
+
+    // a builtin, a compound command or a line of assignments on its own runs in
+    // the shell - no fork
+    if (num_commands == 1 && !background)
+    {
+        ExpandedCommand* ec = &expanded[0];
+        BuiltinFunction builtin = ec->args.count ? findBuiltin(ec->args.words[0]) : NULL;
+
+        if (ec->args.count == 0 || builtin)
+        {
+            int saved[3];
+
+            if (handleRedirection(ec, saved) == -1)
+            {
+                exitCode = 1;
+            }
+            else if (compound[0])
+            {
+                exitCode = executeCompound(shell, compound[0]);
+            }
+            else if (builtin)
+            {
+                exitCode = builtin(shell, ec->args.count, ec->args.words);
+            }
+            else
+            {
+                applyAssignments(&ec->assignments, -1);
+            }
+
+            restoreRedirection(saved);
+            freeExpandedCommand(ec);
+            closeProcessSubstitutions(shell);
+
+            return exitCode;
+        }
+    }
+
+    char text[MAX_JOB_COMMAND];
+
+    // a background job's slot is taken before it starts, SIGCHLD stays blocked
+    // until the job is in the table
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+    if (background)
+    {
+        describeCommands(pipeline, text, sizeof(text));
+    }
+
+    if (background && !backgroundSlotFree())
+    {
+        queueBackgroundPipeline(shell, compound, expanded, num_commands, text);
+        closeProcessSubstitutions(shell);
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+        return 0;
+    }
+
+    if (!background)
+    {
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    }
+
+    shareProcessSubstitutions(shell);
+    exitCode = launchPipeline(shell, compound, expanded, num_commands, background ? text : NULL);
+
+    if (background)
+    {
+        Job* job = findJob(exitCode);
+
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+        if (job)
+        {
+            printf("[%d] Background job started with PID: %d\n", job->id, job->pid);
+        }
+        exitCode = job ? 0 : 1;
+    }
+
+    for (int i = 0; i < num_commands; i++)
+    {
+        freeExpandedCommand(&expanded[i]);
+    }
+
+    closeProcessSubstitutions(shell);
+
+    return exitCode;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * loops - for, while and until
+ * the body is the tree parsed once with the line, each iteration only expands words
+ */
+int executeLoop(Shell* shell, const Node* loop)
+{
+    WordList words = { NULL, 0, 0 };
+    int exitCode = 0;
+
+    if (loop->type == NODE_FOR)
+    {
+        expandWords(shell, loop->words, &words);
+    }
+
+    shell->loop_depth++;
+
+    for (int i = 0; !shell->exit_requested; i++)
+    {
+        if (loop->type == NODE_FOR)
+        {
+            if (i == words.count)
+            {
+                break;
+            }
+            setVariable(loop->word, words.words[i], -1);
+        }
+        else
+        {
+            int condition = executeList(shell, loop->condition);
+
+            if ((condition == 0) != (loop->type == NODE_WHILE) || shell->breaking || shell->continuing)
+            {
+                // "break" in the condition ends this loop too
+                if (shell->breaking)
+                {
+                    shell->breaking--;
+                }
+                break;
+            }
+        }
+
+        exitCode = executeList(shell, loop->body);
+
+        if (shell->breaking)
+        {
+            shell->breaking--;
+            break;
+        }
+
+        if (shell->continuing)
+        {
+            // "continue n" carries on with an outer loop
+            if (--shell->continuing > 0)
+            {
+                break;
+            }
+        }
+    }
+
+    shell->loop_depth--;
+    freeWords(&words);
+
+    return exitCode;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * case WORD in PATTERN) LIST;; ... esac
+ */
+int executeCase(Shell* shell, const Node* node)
+{
+    char* expanded = expandLine(shell, node->word);
+    char* word = removeQuotes(expanded);
+    int exitCode = 0;
+
+    free(expanded);
+
+    for (const Node* item = node->otherwise; item != NULL; item = item->otherwise)
+    {
+        int matched = 0;
+
+        for (int i = 0; item->words[i] != NULL && !matched; i++)
+        {
+            char* pattern = expandPattern(shell, item->words[i]);
+            matched = (fnmatch(pattern, word, 0) == 0);
+            free(pattern);
+        }
+
+        if (matched)
+        {
+            exitCode = executeList(shell, item->body);
+            break;
+        }
+    }
+
+    free(word);
+
+    return exitCode;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * subshell - ( list )
+ * the list runs in a forked copy of the shell, so nothing it changes reaches the shell
+ */
+int executeSubshell(Shell* shell, const Node* list)
+{
+    fflush(stdout);
+    fflush(stderr);
+
+    PROBE2(spawn__start, "(subshell)", 0);
+    pid_t pid = fork();
+
+    if (pid == -1)
+    {
+        // error handling - forking failed
+        perror("fork");
+        return 1;
+    }
+    else if (pid == 0)
+    {
+        exitForkedCopy(executeList(shell, list));
+    }
+
+    PROBE3(spawn__end, pid, "(subshell)", 0);
+    auditStart(pid, "(subshell)");
+    return waitForChild(pid);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * running a compound command - for, while, until, if, case, { } and ( )
+ */
+int executeCompound(Shell* shell, const Node* node)
+{
+    switch (node->type)
+    {
+        case NODE_FOR:
+        case NODE_WHILE:
+        case NODE_UNTIL:
+            return executeLoop(shell, node);
+
+        case NODE_IF:
+            if (executeList(shell, node->condition) == 0)
+            {
+                return executeList(shell, node->body);
+            }
+            if (node->otherwise == NULL)
+            {
+                return 0;
+            }
+            // an elif is a nested if
+            if (node->otherwise->type == NODE_IF)
+            {
+                return executeCompound(shell, node->otherwise);
+            }
+            return executeList(shell, node->otherwise);
+
+        case NODE_CASE:
+            return executeCase(shell, node);
 
-        int num_args = tokenise_command(command_to_execute, command);
+        case NODE_GROUP:
+            // a brace group runs in the shell itself - no fork
+            return executeList(shell, node->body);
 
-        execute_history_command(command);
+        case NODE_SUBSHELL:
+            return executeSubshell(shell, node->body);
     }
+
+    return 0;
 }
 
 // ------------------------------------------------------------
 
 /*
- * provide all the history entered
-  */
-void execute_history(Shell* shell)
+ * conditional execution - &&, || and !
+ * the second pipeline of && and || only runs when the status of the first calls for
+ * it, so a line costs only the processes it actually runs
+ */
+int executeAndOr(Shell* shell, const Node* entry)
 {
-    printf("Command History: \n");
+    int exitCode;
 
-    for (int i = 0; i < total_history; i++)
+    switch (entry->type)
     {
-        printf("%d: %s \n", i + 1, shell->command_history[i]);
+        case NODE_AND:
+        case NODE_OR:
+            exitCode = executeAndOr(shell, entry->condition);
+
+            if ((exitCode == 0) == (entry->type == NODE_AND) && !shell->exit_requested &&
+                !shell->breaking && !shell->continuing)
+            {
+                shell->last_status = exitCode;
+                exitCode = executeAndOr(shell, entry->body);
+            }
+            return exitCode;
+
+        case NODE_NOT:
+            return executeAndOr(shell, entry->body) == 0;
+
+        default:
+            return execute_piped_commands(shell, entry);
     }
 }
 
 // ------------------------------------------------------------
 
 /*
- * shell pipeline - '|'
+ * background execution of a whole && / || / ! entry - list &
+ * the entry runs in a forked copy of the shell, recorded as one job
  */
-int execute_piped_commands(char* commands[], int num_commands)
+int executeBackground(Shell* shell, const Node* entry)
 {
-    // need more than 2 commands for shell pipeline
-    if (num_commands < 2)
+    const Node* first = entry;
+
+    while (first->type != NODE_PIPELINE)
     {
-        fprintf(stderr, "Not enough commands for piping.\n");
-        return -1;
+        first = (first->type == NODE_NOT) ? first->body : first->condition;
     }
 
-    int pipes[num_commands - 1][2];
+    char text[MAX_JOB_COMMAND];
+    describeCommands(first, text, sizeof(text));
+    strncat(text, entry->type == NODE_AND ? " && ..." : entry->type == NODE_OR ? " || ..." : "",
+            sizeof(text) - strlen(text) - 1);
 
-    for (int i = 0; i < num_commands - 1; i++)
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+    // over the limit the copy of the shell is made now, so it sees the variables
+    // as they are now, but stays stopped until its turn
+    int output[2];
+    openCapture(output);
+
+    if (!backgroundSlotFree())
     {
-        // error handling if pipe cannot be created
-        if (pipe(pipes[i]) < 0)
+        PROBE2(spawn__start, "(compound command)", 0);
+        pid_t pid = forkStoppedJob();
+
+        if (pid == 0)
         {
-            perror("pipe");
-            return -1;
+            sigprocmask(SIG_SETMASK, &oldMask, NULL);
+            applyBackgroundPriority(0);
+            applyJobLimits();
+            redirectToCapture(output, 1);
+            exitForkedCopy(executeAndOr(shell, entry));
+        }
+
+        if (pid != -1)
+        {
+            PROBE3(spawn__end, pid, "(compound command)", 0);
+            addCapture(pid, -1, output, text);
+            queueStoppedJob(text, pid);
+            printf("Background job queued, %d waiting: %s\n", queuedJobs(), text);
+        }
+        else
+        {
+            perror("fork");
+            discardCapture(output);
         }
+
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+        return pid == -1;
     }
 
-    for (int i = 0; i < num_commands; i++)
+    fflush(stdout);
+    fflush(stderr);
+
+    PROBE2(spawn__start, "(compound command)", 0);
+    pid_t pid = fork();
+
+    if (pid == -1)
+    {
+        // error handling - forking failed
+        perror("fork");
+        discardCapture(output);
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+        return 1;
+    }
+    else if (pid == 0)
     {
-        pid_t pid = fork();
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+        applyBackgroundPriority(0);
+        applyJobLimits();
+        redirectToCapture(output, 1);
+        exitForkedCopy(executeAndOr(shell, entry));
+    }
 
-        if (pid == -1)
+    PROBE3(spawn__end, pid, "(compound command)", 0);
+    auditStart(pid, text);
+    int jobId = addJob(pid, JOB_BACKGROUND, text);
+    watchJob(&pid, 1, jobId, text);
+    addCapture(pid, jobId, output, text);
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+    printf("[%d] Background job started with PID: %d\n", jobId, pid);
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * executing a list - entries separated by ; and &
+ * stops early for exit, and for break and continue inside a loop
+ */
+int executeList(Shell* shell, const Node* list)
+{
+    int exitCode = shell->last_status;
+
+    for (const Node* np = list; np != NULL; np = np->next)
+    {
+        if (shell->exit_requested || shell->breaking || shell->continuing)
         {
-            // error handling - forking failed
-            perror("fork");
-            return -1;
+            break;
         }
-        else if (pid == 0)
+
+        if (np->background && np->type != NODE_PIPELINE)
         {
-            // child process
-            if (i > 0)
-            {
-                // set stdin from the previous pipe
-                dup2(pipes[i - 1][0], 0);
-                close(pipes[i - 1][0]);
-            }
-            if (i < num_commands - 1)
-            {
-                // set stdout to the next pipe
-                dup2(pipes[i][1], 1);
-                close(pipes[i][1]);
-            }
+            exitCode = executeBackground(shell, np);
+        }
+        else
+        {
+            exitCode = executeAndOr(shell, np);
+        }
+
+        shell->last_status = exitCode;
+    }
+
+    return exitCode;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * command execution by /bin/sh, for syntax the shell does not handle itself
+ */
+int executeDelegated(Shell* shell, const char* command)
+{
+    char* expanded = expandLine(shell, command);
+    size_t len = strlen(expanded);
+    int background = 0;
+
+    while (len > 0 && (expanded[len - 1] == ' ' || expanded[len - 1] == '\t'))
+    {
+        expanded[--len] = '\0';
+    }
+
+    // Check for background execution, but not for "&&"
+    if (len > 1 && expanded[len - 1] == '&' && expanded[len - 2] != '&')
+    {
+        background = 1;
+        expanded[len - 1] = '\0';  // Remove the '&' character
+    }
+
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+    shareProcessSubstitutions(shell);
+    fflush(stdout);
+
+    char** envp = variablesEnvironment();
+    int queued = background && !backgroundSlotFree();
+    int output[2] = { -1, -1 };
+
+    if (background)
+    {
+        openCapture(output);
+    }
+
+    PROBE2(spawn__start, "sh", 0);
+    pid_t pid = queued ? forkStoppedJob() : fork();
+    int exitCode = 0;
+
+    if (pid == -1)
+    {
+        perror("fork() error");
+        discardCapture(output);
+        exitCode = -1;
+    }
+    else if (pid == 0)
+    {
+        sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+        if (background)
+        {
+            applyBackgroundPriority(0);
+        }
+
+        applyJobLimits();
+        redirectToCapture(output, 1);
+        environ = envp;
+        execlp("/bin/sh", "sh", "-c", expanded, (char*)0);
+        PROBE2(exec__fail, "sh", errno);
+        perror("execlp() error");
+        exitForkedCopy(EXIT_FAILURE);
+    }
+    else if (queued)
+    {
+        addCapture(pid, -1, output, expanded);
+        queueStoppedJob(expanded, pid);
+        printf("Background job queued, %d waiting: %s\n", queuedJobs(), expanded);
+    }
+    else if (background)
+    {
+        int jobId = addJob(pid, JOB_BACKGROUND, expanded);
+        watchJob(&pid, 1, jobId, expanded);
+        addCapture(pid, jobId, output, expanded);
+        printf("[%d] Background job started with PID: %d\n", jobId, pid);
+    }
+    else if (pid > 0)
+    {
+        watchJob(&pid, 1, -1, "sh");
+    }
+
+    if (pid > 0)
+    {
+        auditStart(pid, expanded);
+        PROBE3(spawn__end, pid, "sh", 0);
+    }
+
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+    if (pid > 0 && !background)
+    {
+        exitCode = waitForChild(pid);
+    }
+
+    closeProcessSubstitutions(shell);
+    free(expanded);
+
+    return exitCode;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * checking for syntax that is handed to /bin/sh as a whole - here documents,
+ * descriptor duplication, functions and arithmetic
+ */
+int needsShell(char* token[], int nTokens)
+{
+    const char* operators[] = { "<<", ">&", "&>", "<>", ">|", "2>>", "2>&", NULL };
+    const char* reserved[] = { "function", NULL };
+    const char* starters[] = { "do", "then", "else", "elif", "if", "while", "until", "{", "(", "!", "&&", "||", NULL };
 
-            // close all the other pipes
-            for (int j = 0; j < num_commands - 1; j++)
+    for (int i = 0; i < nTokens; i++)
+    {
+        for (int k = 0; operators[k] != NULL; k++)
+        {
+            if (strcmp(token[i], operators[k]) == 0)
             {
-                if (j != i - 1)
-                    close(pipes[j][0]);
-                if (j != i)
-                    close(pipes[j][1]);
+                return 1;
             }
+        }
+
+        // reserved words only count where a command starts
+        int start = (i == 0 || separator(token[i - 1]));
 
-            // execute the command after tokinisation
-            char* args[100];
-            int num_args = tokenise_command(commands[i], args);
+        for (int k = 0; !start && starters[k] != NULL; k++)
+        {
+            start = (strcmp(token[i - 1], starters[k]) == 0);
+        }
 
-            if (num_args < 0)
+        if (start)
+        {
+            for (int k = 0; reserved[k] != NULL; k++)
             {
-                exit(1);
+                if (strcmp(token[i], reserved[k]) == 0)
+                {
+                    return 1;
+                }
             }
+        }
+
+        if (strstr(token[i], "$(("))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * parsing a line into commands, through the parse cache
+ * a cache hit skips lexing, separator validation and building the argument vectors
+ */
+ParsedLine* parseLine(const char* line)
+{
+    ParsedLine* pl = lookupParsedLine(line);
+
+    if (pl != NULL)
+    {
+        PROBE4(line__parsed, pl->line, 1, pl->delegate, pl->error);
+        return pl;
+    }
+
+    pl = tagCalloc(MEM_PARSER, 1, sizeof(ParsedLine));
+
+    if (pl == NULL)
+    {
+        perror("calloc");
+        return NULL;
+    }
+
+    pl->line = tagStrdup(MEM_PARSER, line);
+
+    char* tokens[MAX_ARGUMENT_LENGTH + 1];
+    int nTokens = tokenise_command(pl->line, tokens);
+
+    if (nTokens < 0)
+    {
+        // unbalanced quotes and the like, /bin/sh reports them
+        pl->delegate = 1;
+    }
+    else
+    {
+        // room for the ";" separateCommands() may add, and the NULL
+        pl->token = tagMalloc(MEM_PARSER, sizeof(char*) * (nTokens + 2));
+        memcpy(pl->token, tokens, sizeof(char*) * nTokens);
+        pl->token[nTokens] = NULL;
+        pl->token[nTokens + 1] = NULL;
+        pl->nTokens = nTokens;
+
+        if (needsShell(pl->token, nTokens))
+        {
+            pl->delegate = 1;
+        }
+        else
+        {
+            pl->error = parseTree(pl->token, nTokens, &pl->tree);
+        }
+    }
+
+    insertParsedLine(pl);
+    PROBE4(line__parsed, pl->line, 0, pl->delegate, pl->error);
+
+    return pl;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * command execution for background &, redirection < > >> 2>, wildcard *.? and other commands
+ */
+int executeCommand(Shell* shell, const char* command)
+{
+    ParsedLine* pl = parseLine(command);
+    int exitCode;
+
+    if (pl == NULL)
+    {
+        return -1;
+    }
+
+    if (pl->delegate)
+    {
+        exitCode = executeDelegated(shell, pl->line);
+    }
+    else if (pl->error < 0)
+    {
+        // error handling - syntax errors found by parseTree()
+        const char* errors[] = { "too many commands", "two separators in a row", "a separator before the first command",
+                                 "a pipe with no command after it", "a redirection without a file name",
+                                 "a compound command that is not closed", "an unexpected reserved word or operator" };
+
+        fprintf(stderr, "Syntax error: %s\n", errors[-pl->error - 1]);
+        exitCode = 2;
+    }
+    else
+    {
+        exitCode = executeList(shell, pl->tree);
+    }
+
+    releaseParsedLine(pl);
+
+    return exitCode;
+}
+// ------------------------------------------------------------
+/*
+ * signal handling for CTRL-C, CTRL-Z and CTRL-\
+ */
+volatile sig_atomic_t signalReceived = 0;
+void handleSignal(Shell* shell, int signum)
+{
+    signalReceived = 1;
+    write(STDOUT_FILENO, "\nSignal caught, but continuing...\n", 35);
+}
+
+// -----------------------------------------------------------
+
+/*
+ * handling zombie processes
+ */
+void sigchld_handler(int signum)
+{
+    // only jobs in the job table are reaped here, foreground commands are
+    // waited for by whoever started them
+    reapJobs();
+    releaseJobTokens();
+}
+// ------------------------------------------------------------
+
+/*
+ * the length of the operator at "p", or 0 if there is none
+ */
+int operatorLength(const char* p, int wordStart)
+{
+    const char* operators[] = { "2>&", "2>>", "&&", "||", ";;", "<<", ">>", ">&", "&>", "<>", ">|", "|", "&", ";", "<", ">", "(", ")", NULL };
+
+    for (int i = 0; operators[i] != NULL; i++)
+    {
+        size_t len = strlen(operators[i]);
 
-            // error handling - execution failed
-            execvp(args[0], args);
-            perror("execvp");
-            exit(1);
+        // "2>" is only an operator at the start of a word
+        if (operators[i][0] == '2' && !wordStart)
+        {
+            continue;
         }
-    }
 
-    // Parent process: close all pipes
-    for (int i = 0; i < num_commands - 1; i++)
-    {
-        close(pipes[i][0]);
-        close(pipes[i][1]);
+        if (strncmp(p, operators[i], len) == 0)
+        {
+            return len;
+        }
     }
 
-    // Wait for all child processes
-    for (int i = 0; i < num_commands; i++)
+    if (wordStart && p[0] == '2' && p[1] == '>')
     {
-        wait(NULL);
+        return 2;
     }
 
     return 0;
 }
+
 // ------------------------------------------------------------
 
 /*
- * command execution for background &, redirection < > 2>, widlcard *.? and other commands
+ * tokenising - dividing the commands into words and operators
+ * quotes, escapes and $(...), `...`, ${...}, <(...) and >(...) are kept inside their
+ * word for expansion at execution time; returns the number of tokens, or -1 for an
+ * unterminated quote or substitution and -2 if there are too many tokens
  */
-int executeCommand(Shell* shell, const char* command)
+int tokenise_command(char* input, char* tokens[])
 {
-    int exitCode = 0;
-    int background = 0;
-    char* modifiedCommand = strdup(command);
-
-    // Check for background execution
-    if (modifiedCommand[strlen(modifiedCommand) - 1] == "&")
-    {
-        background = 1;
-        modifiedCommand[strlen(modifiedCommand) - 1] = '\0'; // Remove the '&' character
-    }
+    int num_arg = 0;
+    int error = 0;
+    const char* p = input;
 
-    if (background)
+    for (;;)
     {
-        pid_t pid = fork();
-        if (pid == -1)
+        while (*p == ' ' || *p == '\t' || *p == '\n')
         {
-            perror("fork() error");
-            free(modifiedCommand);
-            return -1;
+            p++;
         }
-        else if (pid == 0)
+
+        // end of the line, or a comment
+        if (*p == '\0' || *p == '#')
         {
-            execlp("/bin/sh", "sh", "-c", modifiedCommand, (char*)0);
-            perror("execlp() error");
-            exit(EXIT_FAILURE);
+            break;
         }
-        else
+
+        if (num_arg >= MAX_ARGUMENT_LENGTH - 1)
         {
-            printf("Background job started with PID: %d\n", pid);
-            free(modifiedCommand);
-            return 0; // Return immediately, do not wait for child
+            fprintf(stderr, "Too many words in the command.\n");
+            error = -2;
+            break;
         }
-    }
 
-    // Handle redirection
-    int redirection_mask = handleRedirection(modifiedCommand);
+        const char* start = p;
+        int len = 0;
+
+        // process substitution is a word, not a redirection
+        if (!((*p == '<' || *p == '>') && p[1] == '('))
+        {
+            len = operatorLength(p, 1);
+        }
 
-    // Check for wildcards and expand
-    int numExpanded;
-    char** expandedCommands = expandWildcards(modifiedCommand, &numExpanded);
+        if (len > 0)
+        {
+            tokens[num_arg++] = tagStrndup(MEM_PARSER, p, len);
+            p += len;
+            continue;
+        }
 
-    if (expandedCommands)
-    {
-        for (int i = 0; i < numExpanded; i++)
+        while (*p && *p != ' ' && *p != '\t' && *p != '\n')
         {
-            if (expandedCommands[i])
+            const char* end = NULL;
+
+            if ((*p == '<' || *p == '>') && p[1] == '(' && p == start)
             {
-                // Execute the expanded command
-                pid_t pid = fork();
-                if (pid == -1)
-                {
-                    perror("fork() error");
-                    exitCode = -1;
-                    break;
-                }
-                else if (pid == 0)
+                end = findClosingParen(p + 2);
+            }
+            else if (operatorLength(p, 0))
+            {
+                break;
+            }
+            else if (*p == '\\')
+            {
+                end = p[1] ? p + 1 : p;
+            }
+            else if (*p == '\'')
+            {
+                end = strchr(p + 1, '\'');
+            }
+            else if (*p == '"')
+            {
+                // inside double quotes only \ and substitutions need care
+                for (end = p + 1; end && *end && *end != '"'; end++)
                 {
-                    execlp("/bin/sh", "sh", "-c", expandedCommands[i], (char*)0);
-                    perror("execlp() error");
-                    exit(EXIT_FAILURE);
+                    if (*end == '\\' && end[1])
+                        end++;
+                    else if (*end == '$' && end[1] == '(')
+                        end = findClosingParen(end + 2);
+                    else if (*end == '`')
+                        end = strchr(end + 1, '`');
                 }
-                else
+                if (end && *end != '"')
+                    end = NULL;
+            }
+            else if (*p == '$' && p[1] == '(')
+            {
+                end = findClosingParen(p + 2);
+            }
+            else if (*p == '$' && p[1] == '{')
+            {
+                end = strchr(p + 2, '}');
+            }
+            else if (*p == '`')
+            {
+                for (end = p + 1; *end && *end != '`'; end++)
                 {
-                    int status;
-                    waitpid(pid, &status, 0);
-                    exitCode = WEXITSTATUS(status);
+                    if (*end == '\\' && end[1])
+                        end++;
                 }
-                free(expandedCommands[i]);
+                if (*end != '`')
+                    end = NULL;
             }
+            else
+            {
+                end = p;
+            }
+
+            // error handling - unterminated quote or substitution
+            if (end == NULL)
+            {
+                error = -1;
+                break;
+            }
+
+            p = end + 1;
         }
-        free(expandedCommands);
-    }
-    else
-    {
-        // Execute the command without wildcard expansion
-        pid_t pid = fork();
-        if (pid == -1)
-        {
-            perror("fork() error");
-            free(modifiedCommand);
-            return -1;
-        }
-        else if (pid == 0)
+
+        if (error)
         {
-            execlp("/bin/sh", "sh", "-c", modifiedCommand, (char*)0);
-            perror("execlp() error");
-            exit(EXIT_FAILURE);
+            break;
         }
-        else
+
+        tokens[num_arg++] = tagStrndup(MEM_PARSER, start, p - start);
+    }
+
+    if (error)
+    {
+        // deallocate memory
+        for (int i = 0; i < num_arg; i++)
         {
-            int status;
-            waitpid(pid, &status, 0);
-            exitCode = WEXITSTATUS(status);
+            tagFree(MEM_PARSER, tokens[i]);
         }
+        return error;
     }
 
-    free(modifiedCommand);
-    return exitCode;
-}
+    tokens[num_arg] = NULL;
 
-// -----------------------------------------------------------
-/*
- * signal handling for CTRL-C, CTRL-Z and CTRL-\
- */
-volatile sig_atomic_t signalReceived = 0;
-void handleSignal(Shell* shell, int signum)
-{
-    signalReceived = 1;
-    write(STDOUT_FILENO, "\nSignal caught, but continuing...\n", 35);
+    return num_arg;
 }
 
-// -----------------------------------------------------------
+// ------------------------------------------------------------
 
 /*
- * handling zombie processes
+ * waiting with SIGCHLD blocked for the events of the main loop: a SIGCHLD, a free
+ * jobserver token, captured output, a timeout of a job, and input if "input" is set
+ * returns 1 if input is ready
  */
-void sigchld_handler(Shell* shell, int signum)
+int waitForEvents(const sigset_t* oldMask, int input)
 {
-    int status;
+    struct pollfd fds[5 + JOB_LIMITS_MAX_WATCHED * (MAX_JOB_PROCESSES + 1)];
+    int n = 0;
+
+    if (input)
+    {
+        fds[n++] = (struct pollfd){ STDIN_FILENO, POLLIN, 0 };
+    }
+
+    if (schedulerWaitFd() != -1)
+    {
+        fds[n++] = (struct pollfd){ schedulerWaitFd(), POLLIN, 0 };
+    }
+
+    if (captureFd() != -1)
+    {
+        fds[n++] = (struct pollfd){ captureFd(), POLLIN, 0 };
+    }
+
+    // a directory listing the line editor is waiting for, or a prompt segment, counts as input
+    int editor = n;
+
+    if (input && completionFd() != -1)
+    {
+        fds[n++] = (struct pollfd){ completionFd(), POLLIN, 0 };
+    }
+
+    if (input && promptFd() != -1)
+    {
+        fds[n++] = (struct pollfd){ promptFd(), POLLIN, 0 };
+    }
 
-    while (waitpid(-1, &status, WNOHANG) > 0)
+    int editorEnd = n;
+
+    n += watchFds(fds + n, (int)(sizeof(fds) / sizeof(fds[0])) - n);
+
+    int ready = (ppoll(fds, n, NULL, oldMask) > 0 && input && fds[0].revents);
+
+    for (int i = editor; i < editorEnd; i++)
     {
-        // Reap the zombie process
+        ready = ready || fds[i].revents;
     }
+
+    drainCaptures();
+    checkTimeouts();
+
+    return ready;
 }
+
 // ------------------------------------------------------------
 
 /*
- * tokenising - dividing the commands into tokens
+ * waiting at the prompt - queued background jobs are started as running ones
+ * finish, output is captured and timeouts are handled, until there is input; a terminal delivers a
+ * line per read, so nothing can be waiting in the stdin buffer unseen by ppoll()
  */
-int tokenise_command(char* input, char* tokens[])
+void waitForInput(void)
 {
-    // copy the input
-    char *input_copy = strdup(input);
-
-    // error handling - unable to copy input
-    if(input_copy == NULL)
+    if ((queuedJobs() == 0 && watchedJobs() == 0 && !captureActive()) || !isatty(STDIN_FILENO))
     {
-        perror("strdup()");
-        exit(1);
+        return;
     }
 
-    int num_arg = 0;
-    char* token = strtok(input_copy, " ");
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+
+    fflush(stdout);
 
-    while (token != NULL && num_arg < MAX_ARGUMENT_LENGTH - 1)
+    while (queuedJobs() > 0 || watchedJobs() > 0 || captureActive())
     {
-        // dynamically allocate memory
-        tokens[num_arg] = malloc(sizeof(char)* MAX_TOKEN_LENGTH);
+        runQueuedJobs();
 
-        // error handling - dynamic memory allocation failed
-        if(tokens[num_arg] == NULL)
+        if ((queuedJobs() == 0 && watchedJobs() == 0 && !captureActive()) || waitForEvents(&oldMask, 1))
         {
-            perror("malloc()");
-            exit(1);
+            break;
         }
-
-        strncpy(tokens[num_arg], token, MAX_TOKEN_LENGTH -1);
-        tokens[num_arg][MAX_TOKEN_LENGTH -1] = '\0';
-
-        token = strtok(NULL, " ");
-        num_arg++;
     }
 
-    tokens[num_arg] = NULL;
-
-    // deallocate memory
-    free(input_copy);
-
-    return num_arg;
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
 }
 
 // ------------------------------------------------------------
@@ -847,22 +3761,66 @@ void runShell(Shell* shell)
         // Handle error
     }
 
-    int exitShell = 0;
+    // at a terminal lines are edited in raw mode, with completion and the history
+    int editing = lineEditorUsable() && !replayingSession();
 
-    while (!exitShell)
+    if (editing)
     {
+        setLineEditorHooks(lineHistory, waitForInput, shell);
+        setLinePromptHooks(promptFd, refreshPrompt);
 
-        printf("%s", shell->prompt);
+        for (int i = 0; builtins[i].name != NULL; i++)
+        {
+            addCompletionCommand(builtins[i].name);
+        }
+    }
 
-        char input[MAX_PROMPT_LENGTH];
+    while (!shell->exit_requested)
+    {
+        char input[MAX_COMMAND_LENGTH];
 
         // handling slow system calls e.g background executions and signals being caught
         int again = 1;
         char *linept; // pointer to the line buffer
 
+        if (replayingSession())
+        {
+            // a recorded session: its lines at their pace, the shell's input left alone
+            again = 0;
+            printf("%s", expandPrompt(shell->prompt));
+            fflush(stdout);
+            linept = nextReplayLine(input, sizeof(input), shell->currentDirectory, sizeof(shell->currentDirectory));
+
+            if (linept == NULL)
+            {
+                drainQueuedJobs();
+                exit(shell->last_status);
+            }
+        }
+        else if (editing)
+        {
+            again = 0;
+            linept = (editLine(expandPrompt(shell->prompt), input, sizeof(input)) == 0) ? input : NULL;
+
+            if (linept == NULL)
+            {
+                printf("Invalid input entered. \n");
+                drainQueuedJobs();
+                exit(1);
+            }
+        }
+        else
+        {
+            printf("%s", expandPrompt(shell->prompt));
+        }
+
         while (again)
         {
             again = 0;
+            waitForInput();
+
+            // a stale EINTR, e.g. from waiting for a job's timeout, is not an interrupted read
+            errno = 0;
             linept = fgets(input, sizeof(input), stdin);
 
             if (linept == NULL)
@@ -870,11 +3828,12 @@ void runShell(Shell* shell)
                 if(errno == EINTR)
                 {
                     again = 1; // signal interruption, read again;
-                    printf("%s", shell->prompt);
+                    printf("%s", expandPrompt(shell->prompt));
                 }
                 else
                 {
                     printf("Invalid input entered. \n");
+                    drainQueuedJobs();
                     exit(1);
                 }
             }
@@ -882,65 +3841,28 @@ void runShell(Shell* shell)
 
         // removing the new line
         input[strcspn(input, "\n")] = '\0';
+        PROBE2(line__read, input, strlen(input));
 
-        // adding the commands into a command_history array if '!' and 'history' is not entered
-        if (input[0] != '!' && (strcmp(input, "history") != 0))
-        {
-            add_history(shell, input);
-        }
-
-        // tokenising the commands
-        char *tokenise[100];
-        int token_num = 0;
+        // timed for the \D prompt segment
+        struct timespec started, finished;
+        clock_gettime(CLOCK_MONOTONIC, &started);
 
-        token_num = tokenise_command(input, tokenise);
+        // "!" followed by a blank is the negation operator, not a history reference
+        int historyReference = (input[0] == '!' && input[1] != '\0' && input[1] != ' ' && input[1] != '\t');
 
-        // prompt change
-        if (strncmp(input, "prompt", 6) == 0)
-        {
-            changePrompt(shell, input + 6);
-        }
-        // directory walk
-        else if (strncmp(input, "cd", 2) == 0)
+        // adding the commands into a command_history array if '!' and 'history' is not entered
+        if (!historyReference && (strcmp(input, "history") != 0))
         {
-            // Find the start of the path argument
-            const char* path = input + 2;
-
-            while (*path == ' ')
-            {
-                // Skip leading spaces
-                path++;
-            }
-
-            // If there's no path argument, path will point to '\0' (end of string)
-            if (*path == '\0' || strcmp(path, " ") == 0)
-            {
-                path = NULL;  // Handle 'cd' with no arguments to go to HOME
-            }
+            add_history(shell, input);
 
-            if (!changeDirectory(shell, path))
+            // lines typed at the terminal are kept in the history file for ^R
+            if (editing)
             {
-                printf("Directory change failed.\n");
+                recordHistory(input);
             }
         }
-        // print current directory
-        else if (strcmp(input, "pwd") == 0)
-        {
-            printCurrentDirectory(shell);
 
-        }
-        // exit the program
-        else if (strcmp(input, "exit") == 0)
-        {
-            printf("Exiting the shell.\n");
-            exitShell = 1;
-        }
-        // history - print out all the commands entered
-        else if (strcmp(input, "history") == 0)
-        {
-            execute_history(shell);
-        }
-        else if (input[0] == '!')
+        if (historyReference)
         {
             // if the input is a digit
             if (isdigit(input[1]))
@@ -963,7 +3885,6 @@ void runShell(Shell* shell)
             }
             // if the input is a string
             else
-                // if (strncmp(command_history[i], str, strlen(str)) == 0)
             {
                 // get the string entered
                 char *commands = history_by_string(shell, input + 1);
@@ -980,34 +3901,175 @@ void runShell(Shell* shell)
                 }
             }
         }
-        // shell pipeline
-        else if (strcmp(input, "|") == 0)
-        {
-            int num_commands = 0;
-
-            while (input[num_commands] != NULL && strcmp(input[num_commands], "|") == 0)
-            {
-                num_commands++;
-            }
-
-            // allocate memory for the commands array
-            char* commands[num_commands];
-            execute_piped_commands(commands, num_commands);
-        }
-        // executing other commands e.g ls, ps, who
+        // executing commands - builtins such as cd, pwd, prompt and exit run in the shell,
+        // others e.g ls, ps, who are started as processes
         else
         {
-            if (executeCommand(shell, input) == -1)
+            shell->last_status = executeCommand(shell, input);
+
+            if (shell->last_status == -1)
             {
                 printf("Unknown command: %s\n", input);
-
+                shell->last_status = 127;
             }
         }
+
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        setPromptStatus(shell->last_status, (finished.tv_sec - started.tv_sec) * 1000L +
+                        (finished.tv_nsec - started.tv_nsec) / 1000000L);
+        recordSessionLine(input, shell->last_status, &started, &finished, shell->currentDirectory);
+        replayLineDone(shell->last_status, &started, &finished);
+
+        runQueuedJobs();
+        drainCaptures();
+        checkTimeouts();
+        reportJobs();
     } // end of exitShell loop
 }
 
 // ------------------------------------------------------------
 
+/*
+ * a forked copy of the shell exiting must not move the input offset it shares
+ * with the shell back to where the copy's stdin buffer stood - the shell would
+ * read those lines again; the unread buffer is dropped before exit() syncs it
+ */
+void leaveInput(void)
+{
+    if (getpid() != shellPid)
+    {
+        __fpurge(stdin);
+    }
+}
+
+// ------------------------------------------------------------
+
+/*
+ * the end of a forked copy of the shell that did not exec - its output is flushed,
+ * but the atexit handlers and destructors are the shell's, or those of the program
+ * embedding it, and must not run a second time in the copy
+ */
+void exitForkedCopy(int status)
+{
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status & 0xff);
+}
+
+// ------------------------------------------------------------
+
+/*
+ * daemon mode - give a client's copy of the shell the client's directory and environment
+ */
+void daemonSetup(void* context, const char* cwd, char** envp)
+{
+    Shell* shell = context;
+
+    clearVariables();
+    initialiseVariables(envp);
+
+    if (chdir(cwd) == 0 && getcwd(shell->currentDirectory, sizeof(shell->currentDirectory)) != NULL)
+    {
+        setVariable("PWD", shell->currentDirectory, 1);
+    }
+    else
+    {
+        perror(cwd);
+    }
+}
+
+// ------------------------------------------------------------
+
+/*
+ * daemon mode - run one line of a client's batch
+ */
+int daemonExecute(void* context, const char* line, int* stop)
+{
+    Shell* shell = context;
+
+    shell->last_status = executeCommand(shell, line);
+
+    if (shell->last_status == -1)
+    {
+        printf("Unknown command: %s\n", line);
+        shell->last_status = 127;
+    }
+
+    reportJobs();
+    *stop = shell->exit_requested;
+
+    return shell->last_status;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * embedding - a shell for shellMain() or for a program using libshell.h, the
+ * variables imported from the environment
+ */
+void* openShellContext(void)
+{
+    shellPid = getpid();
+    signal(SIGCHLD, sigchld_handler);
+    initialiseVariables(environ);
+    Shell* shell = createShell();
+
+    if (shell == NULL)
+    {
+        clearVariables();
+    }
+
+    return shell;
+}
+
+// ------------------------------------------------------------
+
+/*
+ * embedding - close a shell from openShellContext()
+ */
+void closeShellContext(void* context)
+{
+    destroyShell(context);
+
+    // what createShell() started, so that the next one starts afresh
+    clearJobs();
+    forgetJobTokens();
+    stopAudit();
+    stopJobserver();
+    clearVariables();
+}
+
+// ------------------------------------------------------------
+
+/*
+ * embedding - run one line as the prompt loop does; "*exited" is set when it
+ * ran exit, which does not end the program
+ */
+int executeEmbedded(void* context, const char* line, int* exited)
+{
+    Shell* shell = context;
+
+    shell->last_status = executeCommand(shell, line);
+
+    if (shell->last_status == -1)
+    {
+        printf("Unknown command: %s\n", line);
+        shell->last_status = 127;
+    }
+
+    runQueuedJobs();
+    drainCaptures();
+    checkTimeouts();
+    reportJobs();
+
+    *exited = shell->exit_requested;
+    shell->exit_requested = 0;
+
+    return shell->last_status;
+}
+
+// ------------------------------------------------------------
+
 /*
  * deallocate memory for the 'Shell' struct
  */
@@ -1016,6 +4078,8 @@ void destroyShell(Shell* shell)
 
     if (shell)
     {
+        drainQueuedJobs();
+        stopForkServer();
         free(shell);
     }
 }
@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+
+const char *snapshotMap = NULL;     // the snapshot, mapped for good; NULL if there is none
+size_t snapshotLength = 0;
+int snapshotTried = 0;              // the snapshot has been looked for
+
+FILE *snapshotStream = NULL;        // the new snapshot while a section is written
+char snapshotTemporary[4096 + 8];   // its name until it is renamed over the old one
+SnapshotHeader snapshotHeader;      // its header, written last
+SnapshotSection *snapshotWriting = NULL;
+
+// the snapshot file: SNAPSHOT, else a file in HOME; NULL if there is neither or it is off
+//
+const char *snapshotFile(void)
+{
+    static char path[4096];
+    const char *file = getenv(SNAPSHOT_VARIABLE);
+    const char *home = getenv("HOME");
+
+    if (file != NULL && *file != '\0')
+    {
+        return strcmp(file, "0") == 0 ? NULL : file;
+    }
+
+    if (home == NULL || snprintf(path, sizeof(path), "%s/%s", home, SNAPSHOT_FILE_NAME) >= (int)sizeof(path))
+    {
+        return NULL;
+    }
+
+    return path;
+}
+
+void snapshotSource(const struct stat *st, SnapshotSource *source)
+{
+    source->device = (uint64_t)st->st_dev;
+    source->inode = (uint64_t)st->st_ino;
+    source->size = (uint64_t)st->st_size;
+    source->mtime = (int64_t)st->st_mtim.tv_sec;
+    source->mtimeNanoseconds = (int64_t)st->st_mtim.tv_nsec;
+}
+
+// map the snapshot "path" if it is whole and of this version
+//
+// return: the mapping with its length in "length", or NULL
+//
+const char *mapSnapshot(const char *path, size_t *length)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(SnapshotHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    const char *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    const SnapshotHeader *hp = (const SnapshotHeader *)map;
+    int valid = (memcmp(hp->magic, SNAPSHOT_MAGIC, sizeof(hp->magic)) == 0 && hp->version == SNAPSHOT_VERSION &&
+                 hp->length == (uint64_t)st.st_size && hp->nSections <= SNAPSHOT_MAX_SECTIONS);
+
+    for (uint32_t i = 0; valid && i < hp->nSections; i++)
+    {
+        const SnapshotSection *sp = &hp->sections[i];
+
+        valid = (sp->offset % SNAPSHOT_ALIGN == 0 && sp->offset >= sizeof(SnapshotHeader) &&
+                 sp->offset <= hp->length && sp->length <= hp->length - sp->offset);
+    }
+
+    if (!valid)
+    {
+        munmap((void *)map, (size_t)st.st_size);
+        return NULL;
+    }
+
+    *length = (size_t)st.st_size;
+    return map;
+}
+
+const void *findSnapshotSection(uint32_t type, size_t *length, SnapshotSource *source)
+{
+    const char *path = snapshotFile();
+
+    if (!snapshotTried && path != NULL)
+    {
+        snapshotMap = mapSnapshot(path, &snapshotLength);
+    }
+
+    snapshotTried = 1;
+
+    if (snapshotMap == NULL)
+    {
+        return NULL;
+    }
+
+    const SnapshotHeader *hp = (const SnapshotHeader *)snapshotMap;
+
+    for (uint32_t i = 0; i < hp->nSections; i++)
+    {
+        if (hp->sections[i].type == type)
+        {
+            *length = (size_t)hp->sections[i].length;
+            *source = hp->sections[i].source;
+            return snapshotMap + hp->sections[i].offset;
+        }
+    }
+
+    return NULL;
+}
+
+// start the next section on a multiple of SNAPSHOT_ALIGN
+//
+void alignSnapshot(FILE *fp)
+{
+    for (long at = ftell(fp); at % SNAPSHOT_ALIGN != 0; at++)
+    {
+        fputc(0, fp);
+    }
+}
+
+FILE *beginSnapshotSection(uint32_t type, const SnapshotSource *source)
+{
+    const char *path = snapshotFile();
+
+    if (path == NULL || snapshotStream != NULL ||
+        snprintf(snapshotTemporary, sizeof(snapshotTemporary), "%s.XXXXXX", path) >= (int)sizeof(snapshotTemporary))
+    {
+        return NULL;
+    }
+
+    int fd = mkostemp(snapshotTemporary, O_CLOEXEC);
+    FILE *fp = (fd == -1) ? NULL : fdopen(fd, "w");
+
+    if (fp == NULL)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            unlink(snapshotTemporary);
+        }
+        return NULL;
+    }
+
+    memset(&snapshotHeader, 0, sizeof(snapshotHeader));
+    memcpy(snapshotHeader.magic, SNAPSHOT_MAGIC, sizeof(snapshotHeader.magic));
+    snapshotHeader.version = SNAPSHOT_VERSION;
+    fwrite(&snapshotHeader, sizeof(snapshotHeader), 1, fp);
+
+    // the other sections are copied from the snapshot as it is now, which
+    // another shell may have replaced since this one mapped it
+    size_t length;
+    const char *old = mapSnapshot(path, &length);
+
+    if (old != NULL)
+    {
+        const SnapshotHeader *hp = (const SnapshotHeader *)old;
+
+        for (uint32_t i = 0; i < hp->nSections && snapshotHeader.nSections < SNAPSHOT_MAX_SECTIONS - 1; i++)
+        {
+            if (hp->sections[i].type != type)
+            {
+                SnapshotSection *sp = &snapshotHeader.sections[snapshotHeader.nSections++];
+
+                alignSnapshot(fp);
+                *sp = hp->sections[i];
+                sp->offset = (uint64_t)ftell(fp);
+                fwrite(old + hp->sections[i].offset, 1, (size_t)hp->sections[i].length, fp);
+            }
+        }
+
+        munmap((void *)old, length);
+    }
+
+    alignSnapshot(fp);
+    snapshotWriting = &snapshotHeader.sections[snapshotHeader.nSections++];
+    snapshotWriting->type = type;
+    snapshotWriting->source = *source;
+    snapshotWriting->offset = (uint64_t)ftell(fp);
+    snapshotStream = fp;
+
+    return fp;
+}
+
+int saveSnapshotSection(FILE *fp)
+{
+    const char *path = snapshotFile();
+
+    snapshotWriting->length = (uint64_t)ftell(fp) - snapshotWriting->offset;
+    alignSnapshot(fp);
+    snapshotHeader.length = (uint64_t)ftell(fp);
+
+    // the header goes in last, a snapshot cut short before it is not valid
+    int failed = (ferror(fp) || fseek(fp, 0, SEEK_SET) == -1 || fwrite(&snapshotHeader, sizeof(snapshotHeader), 1, fp) != 1);
+
+    failed |= (fclose(fp) == EOF);
+    failed = failed || path == NULL || rename(snapshotTemporary, path) == -1;
+
+    if (failed)
+    {
+        unlink(snapshotTemporary);
+    }
+
+    snapshotStream = NULL;
+    snapshotWriting = NULL;
+
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,89 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_VARIABLE "SNAPSHOT"            // the snapshot file, else SNAPSHOT_FILE_NAME in HOME; 0 for none
+#define SNAPSHOT_FILE_NAME ".simpleShell_snapshot"
+#define SNAPSHOT_MAGIC "SSHSNAP1"               // the first 8 bytes of the file
+#define SNAPSHOT_VERSION 1                      // changes with the layout of any section
+#define SNAPSHOT_MAX_SECTIONS 8
+#define SNAPSHOT_ALIGN 8                        // sections start on a multiple of this
+
+// section types
+#define SNAPSHOT_HISTORY 1                      // the history index, built from the history file
+
+// the state of the file a section was built from, when it was built
+struct SnapshotSourceStruct
+{
+    uint64_t device;
+    uint64_t inode;
+    uint64_t size;
+    int64_t mtime;              // seconds
+    int64_t mtimeNanoseconds;
+};
+
+typedef struct SnapshotSourceStruct SnapshotSource;  // section source file type
+
+struct SnapshotSectionStruct
+{
+    uint32_t type;              // one of the section types above, 0 for an unused entry
+    uint32_t reserved;
+    uint64_t offset;            // from the start of the file
+    uint64_t length;
+    SnapshotSource source;
+};
+
+typedef struct SnapshotSectionStruct SnapshotSection;  // section table entry type
+
+struct SnapshotHeaderStruct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t nSections;
+    uint64_t length;            // of the whole file, a shorter file is torn
+    SnapshotSection sections[SNAPSHOT_MAX_SECTIONS];
+};
+
+typedef struct SnapshotHeaderStruct SnapshotHeader;  // snapshot file header type
+
+
+// purpose:
+//		the source state recorded for the file "st" describes
+//
+void snapshotSource(const struct stat *st, SnapshotSource *source);
+
+// purpose:
+//		find a section of the snapshot, mapping the file on the first call
+//
+// note:
+//		the file stays mapped, read only, for the life of the shell, so what
+//		is in it can be pointed to rather than copied; everything in a section
+//		is found by offsets, which do not depend on where it is mapped. A
+//		snapshot of another version, or torn, is as good as none.
+//
+// return:
+//		the section with its length in "length" and its source in "source",
+//		or NULL if there is none
+//
+const void *findSnapshotSection(uint32_t type, size_t *length, SnapshotSource *source);
+
+// purpose:
+//		replace a section of the snapshot: its contents are written to the
+//		stream returned, then saveSnapshotSection() puts the file in place
+//
+// note:
+//		the other sections are kept as they are. The file is written under a
+//		temporary name and renamed over the old one, so another shell reads
+//		either snapshot whole, and a mapping of the old one stays valid.
+//
+// return:
+//		the stream, or NULL if there is no snapshot file or it cannot be written;
+//		saveSnapshotSection() returns 0 if successful, -1 otherwise
+//
+FILE *beginSnapshotSection(uint32_t type, const SnapshotSource *source);
+int saveSnapshotSection(FILE *fp);
+
+#endif
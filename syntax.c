@@ -0,0 +1,671 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "syntax.h"
+#include "variables.h"
+#include "memtags.h"
+
+// the state of one parse
+typedef struct
+{
+    char **token;       // the tokens of the line
+    int nTokens;        // number of tokens
+    int pos;            // index of the next token
+    int error;          // the first error found, 0 if none
+} Parser;
+
+Node *parseList(Parser *p, const char *terminators[]);
+
+// words that start or continue a compound command
+const char *compoundWords[] = { "for", "while", "until", "if", "case", "{", "(", NULL };
+const char *reservedWords[] = { "then", "elif", "else", "fi", "do", "done", "in", "esac", "}", NULL };
+
+// the terminators of the lists inside compound commands
+const char *doTerminators[] = { "do", NULL };
+const char *doneTerminators[] = { "done", NULL };
+const char *thenTerminators[] = { "then", NULL };
+const char *ifTerminators[] = { "elif", "else", "fi", NULL };
+const char *fiTerminators[] = { "fi", NULL };
+const char *caseTerminators[] = { ";;", "esac", NULL };
+const char *groupTerminators[] = { "}", NULL };
+const char *subshellTerminators[] = { ")", NULL };
+
+int inList(const char *word, const char *list[])
+{
+    for (int i = 0; list[i] != NULL; ++i)
+    {
+        if (strcmp(word, list[i]) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// return 1 if the next token is "word"
+//
+int nextIs(Parser *p, const char *word)
+{
+    return p->pos < p->nTokens && strcmp(p->token[p->pos], word) == 0;
+}
+
+// return 1 if the token is an operator that ends a simple command
+//
+int controlOperator(char *token)
+{
+    return separator(token) || strcmp(token, andSep) == 0 || strcmp(token, orSep) == 0 ||
+           strcmp(token, ";;") == 0 || strcmp(token, "(") == 0 || strcmp(token, ")") == 0;
+}
+
+// return 1 if the next token ends a simple command
+//
+int endOfCommand(Parser *p)
+{
+    return p->pos >= p->nTokens || controlOperator(p->token[p->pos]);
+}
+
+void fail(Parser *p, int error)
+{
+    if (p->error == 0)
+    {
+        p->error = error;
+    }
+}
+
+// the next token is not what the grammar needs, or there is none left
+//
+void unexpected(Parser *p)
+{
+    fail(p, p->pos >= p->nTokens ? SYNTAX_UNCLOSED : SYNTAX_UNEXPECTED);
+}
+
+// consume the reserved word that must come next
+//
+void expect(Parser *p, const char *word)
+{
+    if (nextIs(p, word))
+    {
+        p->pos++;
+    }
+    else
+    {
+        unexpected(p);
+    }
+}
+
+// skip the ";" separators allowed before "do" and between case items
+//
+void skipSequence(Parser *p)
+{
+    while (nextIs(p, seqSep))
+    {
+        p->pos++;
+    }
+}
+
+Node *newNode(int type)
+{
+    Node *np = tagCalloc(MEM_PARSER, 1, sizeof(Node));
+
+    if (np == NULL)
+    {
+        perror("calloc");
+        exit(1);
+    }
+
+    np->type = type;
+
+    return np;
+}
+
+// collect words up to the end of a simple command into a NULL terminated vector,
+// which points into the tokens
+//
+char **collectWords(Parser *p)
+{
+    int first = p->pos;
+
+    while (!endOfCommand(p))
+    {
+        p->pos++;
+    }
+
+    char **words = tagMalloc(MEM_PARSER, sizeof(char *) * (p->pos - first + 1));
+
+    if (words == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+
+    for (int i = first; i < p->pos; ++i)
+    {
+        words[i - first] = p->token[i];
+    }
+    words[p->pos - first] = NULL;
+
+    return words;
+}
+
+// a non-empty list ending at one of "terminators"
+//
+Node *parseBody(Parser *p, const char *terminators[])
+{
+    Node *list = parseList(p, terminators);
+
+    if (list == NULL)
+    {
+        unexpected(p);
+    }
+
+    return list;
+}
+
+// for NAME [in WORDS] ; do LIST done
+//
+Node *parseFor(Parser *p)
+{
+    Node *np = newNode(NODE_FOR);
+
+    p->pos++;
+
+    if (p->pos >= p->nTokens || !validVariableName(p->token[p->pos], strlen(p->token[p->pos])))
+    {
+        unexpected(p);
+        return np;
+    }
+
+    np->word = p->token[p->pos++];
+
+    if (nextIs(p, "in"))
+    {
+        p->pos++;
+        np->words = collectWords(p);
+
+        if (!nextIs(p, seqSep))
+        {
+            unexpected(p);
+            return np;
+        }
+    }
+    else
+    {
+        // without "in" there are no words, the shell has no positional parameters
+        np->words = tagCalloc(MEM_PARSER, 1, sizeof(char *));
+    }
+
+    skipSequence(p);
+    expect(p, "do");
+
+    if (p->error == 0)
+    {
+        np->body = parseBody(p, doneTerminators);
+        expect(p, "done");
+    }
+
+    return np;
+}
+
+// while LIST do LIST done, until LIST do LIST done
+//
+Node *parseLoop(Parser *p, int type)
+{
+    Node *np = newNode(type);
+
+    p->pos++;
+    np->condition = parseBody(p, doTerminators);
+    expect(p, "do");
+
+    if (p->error == 0)
+    {
+        np->body = parseBody(p, doneTerminators);
+        expect(p, "done");
+    }
+
+    return np;
+}
+
+// the rest of an if or elif: LIST then LIST [elif ...] [else LIST] fi
+//
+Node *parseIf(Parser *p)
+{
+    Node *np = newNode(NODE_IF);
+
+    p->pos++;
+    np->condition = parseBody(p, thenTerminators);
+    expect(p, "then");
+
+    if (p->error)
+    {
+        return np;
+    }
+
+    np->body = parseBody(p, ifTerminators);
+
+    if (p->error)
+    {
+        return np;
+    }
+
+    if (nextIs(p, "elif"))
+    {
+        // the nested if consumes the "fi"
+        np->otherwise = parseIf(p);
+        return np;
+    }
+
+    if (nextIs(p, "else"))
+    {
+        p->pos++;
+        np->otherwise = parseBody(p, fiTerminators);
+    }
+
+    expect(p, "fi");
+
+    return np;
+}
+
+// case WORD in [(] PATTERN [| PATTERN]... ) LIST ;; ... esac
+//
+Node *parseCase(Parser *p)
+{
+    Node *np = newNode(NODE_CASE);
+    Node **item = &np->otherwise;
+
+    p->pos++;
+
+    if (endOfCommand(p))
+    {
+        unexpected(p);
+        return np;
+    }
+
+    np->word = p->token[p->pos++];
+    expect(p, "in");
+    skipSequence(p);
+
+    while (p->error == 0 && !nextIs(p, "esac"))
+    {
+        Node *ip = newNode(NODE_CASE_ITEM);
+
+        *item = ip;
+        item = &ip->otherwise;
+
+        if (nextIs(p, "("))
+        {
+            p->pos++;
+        }
+
+        // patterns separated by "|"
+        int n = 0;
+        int first = p->pos;
+
+        while (p->pos < p->nTokens && !controlOperator(p->token[p->pos]))
+        {
+            n++;
+            p->pos++;
+
+            if (!nextIs(p, pipeSep))
+            {
+                break;
+            }
+            p->pos++;
+        }
+
+        if (n == 0 || !nextIs(p, ")"))
+        {
+            unexpected(p);
+            break;
+        }
+
+        ip->words = tagMalloc(MEM_PARSER, sizeof(char *) * (n + 1));
+
+        if (ip->words == NULL)
+        {
+            perror("malloc");
+            exit(1);
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            ip->words[i] = p->token[first + 2 * i];
+        }
+        ip->words[n] = NULL;
+
+        p->pos++;
+
+        // an item may have an empty list
+        ip->body = parseList(p, caseTerminators);
+
+        if (nextIs(p, ";;"))
+        {
+            p->pos++;
+            skipSequence(p);
+        }
+        else if (!nextIs(p, "esac"))
+        {
+            unexpected(p);
+        }
+    }
+
+    expect(p, "esac");
+
+    return np;
+}
+
+// { LIST; } and ( LIST )
+//
+Node *parseGroup(Parser *p, int type)
+{
+    Node *np = newNode(type);
+
+    p->pos++;
+
+    if (type == NODE_GROUP)
+    {
+        np->body = parseBody(p, groupTerminators);
+        expect(p, "}");
+    }
+    else
+    {
+        np->body = parseBody(p, subshellTerminators);
+        expect(p, ")");
+    }
+
+    return np;
+}
+
+// a compound command, followed by its redirections
+//
+Node *parseCompound(Parser *p, Command *cp)
+{
+    const char *keyword = p->token[p->pos];
+    Node *np;
+
+    if (strcmp(keyword, "for") == 0)
+        np = parseFor(p);
+    else if (strcmp(keyword, "while") == 0)
+        np = parseLoop(p, NODE_WHILE);
+    else if (strcmp(keyword, "until") == 0)
+        np = parseLoop(p, NODE_UNTIL);
+    else if (strcmp(keyword, "if") == 0)
+        np = parseIf(p);
+    else if (strcmp(keyword, "case") == 0)
+        np = parseCase(p);
+    else
+        np = parseGroup(p, strcmp(keyword, "{") == 0 ? NODE_GROUP : NODE_SUBSHELL);
+
+    if (p->error)
+    {
+        return np;
+    }
+
+    // only redirections may follow, e.g. "done < file"
+    int first = p->pos;
+
+    while (p->pos < p->nTokens && redirection(p->token[p->pos]))
+    {
+        // redirection without a file name
+        if (p->pos + 1 >= p->nTokens || controlOperator(p->token[p->pos + 1]))
+        {
+            fail(p, -5);
+            return np;
+        }
+
+        p->pos += 2;
+    }
+
+    if (!endOfCommand(p))
+    {
+        fail(p, SYNTAX_UNEXPECTED);
+        return np;
+    }
+
+    buildCommand(p->token, first, p->pos, p->pos < p->nTokens ? p->token[p->pos] : seqSep, cp);
+
+    return np;
+}
+
+// one stage of a pipeline: a compound command or a simple command
+//
+Node *parseStage(Parser *p, Command *cp)
+{
+    if (inList(p->token[p->pos], compoundWords))
+    {
+        return parseCompound(p, cp);
+    }
+
+    if (inList(p->token[p->pos], reservedWords) && strcmp(p->token[p->pos], "in") != 0)
+    {
+        fail(p, SYNTAX_UNEXPECTED);
+        return NULL;
+    }
+
+    int first = p->pos;
+
+    while (!endOfCommand(p))
+    {
+        p->pos++;
+    }
+
+    if (p->pos == first || nextIs(p, "("))
+    {
+        fail(p, SYNTAX_UNEXPECTED);
+        return NULL;
+    }
+
+    // redirection without a file name
+    if (redirection(p->token[p->pos - 1]))
+    {
+        fail(p, -5);
+        return NULL;
+    }
+
+    buildCommand(p->token, first, p->pos, p->pos < p->nTokens ? p->token[p->pos] : seqSep, cp);
+
+    return NULL;
+}
+
+// commands joined by "|"
+//
+Node *parsePipeline(Parser *p)
+{
+    Node *np = newNode(NODE_PIPELINE);
+    int capacity = 0;
+
+    for (;;)
+    {
+        if (np->nCommands == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4;
+            np->command = tagRealloc(MEM_PARSER, np->command, sizeof(Command) * capacity);
+            np->compound = tagRealloc(MEM_PARSER, np->compound, sizeof(Node *) * capacity);
+
+            if (np->command == NULL || np->compound == NULL)
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+
+        Command *cp = &np->command[np->nCommands];
+
+        memset(cp, 0, sizeof(Command));
+        np->compound[np->nCommands] = NULL;
+        np->nCommands++;
+
+        np->compound[np->nCommands - 1] = parseStage(p, cp);
+
+        if (p->error || !nextIs(p, pipeSep))
+        {
+            return np;
+        }
+
+        p->pos++;
+
+        // check the command after the pipe
+        if (p->pos >= p->nTokens)
+        {
+            fail(p, -4);
+            return np;
+        }
+
+        if (separator(p->token[p->pos]))
+        {
+            fail(p, -2);
+            return np;
+        }
+    }
+}
+
+// [!] PIPELINE
+//
+Node *parseNot(Parser *p)
+{
+    if (!nextIs(p, "!"))
+    {
+        return parsePipeline(p);
+    }
+
+    Node *np = newNode(NODE_NOT);
+
+    p->pos++;
+
+    if (p->pos >= p->nTokens)
+    {
+        unexpected(p);
+        return np;
+    }
+
+    np->body = parseNot(p);
+
+    return np;
+}
+
+// pipelines joined by "&&" and "||", which bind from the left with equal precedence
+//
+Node *parseAndOr(Parser *p)
+{
+    Node *left = parseNot(p);
+
+    while (p->error == 0 && (nextIs(p, andSep) || nextIs(p, orSep)))
+    {
+        Node *np = newNode(nextIs(p, andSep) ? NODE_AND : NODE_OR);
+
+        np->condition = left;
+        left = np;
+        p->pos++;
+
+        // check the command after the operator
+        if (p->pos >= p->nTokens)
+        {
+            fail(p, SYNTAX_UNCLOSED);
+            break;
+        }
+
+        if (separator(p->token[p->pos]))
+        {
+            fail(p, -2);
+            break;
+        }
+
+        np->body = parseNot(p);
+    }
+
+    return left;
+}
+
+// entries separated by ";" and "&", up to one of "terminators" at the start of a
+// command or the end of the tokens
+//
+Node *parseList(Parser *p, const char *terminators[])
+{
+    Node *list = NULL;
+    Node **tail = &list;
+
+    while (p->error == 0 && p->pos < p->nTokens)
+    {
+        char *word = p->token[p->pos];
+
+        if (terminators && inList(word, terminators))
+        {
+            break;
+        }
+
+        if (separator(word))
+        {
+            fail(p, p->pos == 0 ? -3 : -2);
+            break;
+        }
+
+        if (strcmp(word, ";;") == 0 || strcmp(word, ")") == 0)
+        {
+            fail(p, SYNTAX_UNEXPECTED);
+            break;
+        }
+
+        Node *np = parseAndOr(p);
+
+        *tail = np;
+        tail = &np->next;
+
+        if (p->error || p->pos >= p->nTokens)
+        {
+            break;
+        }
+
+        // the entry ends with ";" or "&", or directly with a terminator
+        if (nextIs(p, conSep))
+        {
+            np->background = 1;
+            p->pos++;
+        }
+        else if (nextIs(p, seqSep))
+        {
+            p->pos++;
+        }
+        else if (!terminators || !inList(p->token[p->pos], terminators))
+        {
+            fail(p, SYNTAX_UNEXPECTED);
+        }
+    }
+
+    return list;
+}
+
+int parseTree(char *token[], int nTokens, Node **tree)
+{
+    Parser parser = { token, nTokens, 0, 0 };
+
+    *tree = parseList(&parser, NULL);
+
+    return parser.error;
+}
+
+void freeTree(Node *tree)
+{
+    while (tree != NULL)
+    {
+        Node *next = tree->next;
+
+        for (int i = 0; i < tree->nCommands; ++i)
+        {
+            tagFree(MEM_PARSER, tree->command[i].argv);
+            freeTree(tree->compound[i]);
+        }
+
+        tagFree(MEM_PARSER, tree->command);
+        tagFree(MEM_PARSER, tree->compound);
+        tagFree(MEM_PARSER, tree->words);
+        freeTree(tree->condition);
+        freeTree(tree->body);
+        freeTree(tree->otherwise);
+        tagFree(MEM_PARSER, tree);
+
+        tree = next;
+    }
+}
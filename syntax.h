@@ -0,0 +1,66 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include "command.h"
+
+// node types
+#define NODE_PIPELINE  0                        // commands joined by "|", an entry of a list
+#define NODE_FOR       1                        // for NAME [in WORDS]; do BODY; done
+#define NODE_WHILE     2                        // while CONDITION; do BODY; done
+#define NODE_UNTIL     3                        // until CONDITION; do BODY; done
+#define NODE_IF        4                        // if CONDITION; then BODY; [elif ...] [else OTHERWISE;] fi
+#define NODE_CASE      5                        // case WORD in ITEMS esac
+#define NODE_CASE_ITEM 6                        // PATTERNS) BODY ;;
+#define NODE_AND       7                        // CONDITION && BODY, an entry of a list
+#define NODE_OR        8                        // CONDITION || BODY, an entry of a list
+#define NODE_NOT       9                        // ! BODY, an entry of a list
+#define NODE_GROUP     10                       // { BODY; }, run by the shell itself
+#define NODE_SUBSHELL  11                       // ( BODY ), run in a forked copy of the shell
+
+// syntax errors, in addition to those of separateCommands()
+#define SYNTAX_UNCLOSED    -6                   // the line ends inside a compound command
+#define SYNTAX_UNEXPECTED  -7                   // a reserved word or operator out of place
+
+struct NodeStruct
+{
+    int type;                       // one of the node types above
+    int background;                 // an entry of a list followed by "&"
+    Command *command;               // NODE_PIPELINE: one command per stage, a compound stage keeps only its redirections
+    struct NodeStruct **compound;   // NODE_PIPELINE: the compound command of each stage, NULL for a simple command
+    int nCommands;                  // NODE_PIPELINE: number of stages
+    char *word;                     // NODE_FOR: the loop variable, NODE_CASE: the word to match
+    char **words;                   // NODE_FOR: the words to loop over, NODE_CASE_ITEM: the patterns, NULL terminated
+    struct NodeStruct *condition;   // NODE_WHILE, NODE_UNTIL and NODE_IF: the list deciding what runs,
+                                    // NODE_AND and NODE_OR: the entry run first
+    struct NodeStruct *body;        // the list run by a compound command or a case item, NODE_AND and
+                                    // NODE_OR: the pipeline that may run second, NODE_NOT: the pipeline
+    struct NodeStruct *otherwise;   // NODE_IF: the else list or an elif NODE_IF, NODE_CASE and NODE_CASE_ITEM: the next item
+    struct NodeStruct *next;        // the next entry of the same list
+};
+
+typedef struct NodeStruct Node;  // syntax tree node type
+
+
+// purpose:
+//		parse the list of tokens into a syntax tree: a list of pipelines, possibly
+//		joined by "&&" and "||", whose stages are simple commands or compound
+//		commands with their own lists
+//
+// return:
+//		0 if successful, or one of the negative error codes of separateCommands()
+//		and SYNTAX_UNCLOSED or SYNTAX_UNEXPECTED
+//
+// note:
+//		1) the tree is built once and can be run any number of times; loop bodies
+//		   are never lexed or parsed again
+//		2) argument vectors and words point into "token", which must outlive the tree
+//		3) "*tree" is set even on an error, and must be freed with freeTree()
+//
+int parseTree(char *token[], int nTokens, Node **tree);
+
+// purpose:
+//		free a syntax tree, but not the tokens it points into
+//
+void freeTree(Node *tree);
+
+#endif
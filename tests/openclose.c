@@ -0,0 +1,118 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "../libshell.h"
+
+// openclose - open and close a libshell context many times, with auditing and a
+// jobserver started by each open, and check that no descriptor, thread or job is
+// left behind, and that the shell's forked copies do not run the program's atexit
+// handlers; exits 1 if one is
+//
+// usage: openclose [cycles]
+
+pid_t testPid;
+
+// the program's exit handler, which only the program itself should run
+//
+void hostExit(void)
+{
+    if (getpid() != testPid)
+    {
+        fprintf(stderr, "openclose: exit handler ran in %d\n", (int)getpid());
+    }
+}
+
+// the entries of the directory "path", "." and ".." aside
+//
+int countEntries(const char *path)
+{
+    DIR *dir = opendir(path);
+    int n = 0;
+
+    if (dir == NULL)
+    {
+        perror(path);
+        exit(2);
+    }
+
+    for (struct dirent *ep; (ep = readdir(dir)) != NULL; )
+    {
+        n += (ep->d_name[0] != '.');
+    }
+
+    closedir(dir);
+
+    // opendir()'s own descriptor is among them, every time
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    int cycles = (argc > 1) ? atoi(argv[1]) : 50;
+    char log[] = "/tmp/openclose.XXXXXX";
+    int failed = 0;
+
+    close(mkstemp(log));
+    remove(log);
+    setenv("AUDIT_LOG", log, 1);
+    setenv("JOBSERVER", "4", 1);
+
+    testPid = getpid();
+    atexit(hostExit);
+
+    int fds = countEntries("/proc/self/fd");
+    int threads = countEntries("/proc/self/task");
+
+    for (int i = 0; i < cycles && !failed; i++)
+    {
+        LibShell *sh = shellOpen();
+        ShellResult result;
+
+        if (sh == NULL)
+        {
+            perror("shellOpen");
+            return 1;
+        }
+
+        if (shellRun(sh, "/bin/true\necho $MAKEFLAGS\n(true)\nsleep 1 &\njobs", &result) != 0 || result.nStatuses != 5)
+        {
+            fprintf(stderr, "cycle %d: status %d, %d lines\n", i, result.status, result.nStatuses);
+            failed = 1;
+        }
+
+        if (result.errors != NULL && strstr(result.errors, "exit handler ran") != NULL)
+        {
+            fprintf(stderr, "cycle %d: %s", i, result.errors);
+            failed = 1;
+        }
+
+        // the job of the last cycle, still running, is not this context's
+        if (result.output != NULL && strstr(result.output, "[2]") != NULL)
+        {
+            fprintf(stderr, "cycle %d: jobs of an earlier context\n%s", i, result.output);
+            failed = 1;
+        }
+
+        shellFreeResult(&result);
+        shellClose(sh);
+
+        int nowFds = countEntries("/proc/self/fd");
+        int nowThreads = countEntries("/proc/self/task");
+
+        if (nowFds != fds || nowThreads != threads)
+        {
+            fprintf(stderr, "cycle %d: %d descriptors and %d threads, %d and %d before\n", i, nowFds, nowThreads, fds, threads);
+            failed = 1;
+        }
+    }
+
+    remove(log);
+    printf("openclose: %d cycles, %s\n", cycles, failed ? "FAILED" : "ok");
+
+    return failed;
+}
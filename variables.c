@@ -0,0 +1,354 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "variables.h"
+
+Variable *varTable = NULL;
+size_t varTableSize = 0;      // number of slots, a power of two
+size_t varTableUsed = 0;      // number of VAR_USED slots
+size_t varTableDeleted = 0;   // number of VAR_DELETED slots
+
+char **envCache = NULL;       // cached envp, valid while envDirty is 0
+int envDirty = 1;
+
+// FNV-1a over the first "len" bytes of the name
+//
+unsigned int hashName(const char *name, size_t len)
+{
+    unsigned int h = 2166136261u;
+
+    for (size_t i = 0; i < len; ++i)
+    {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+int validVariableName(const char *name, size_t len)
+{
+    if (len == 0 || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+    {
+        return 0;
+    }
+
+    for (size_t i = 1; i < len; ++i)
+    {
+        if (!(isalnum((unsigned char)name[i]) || name[i] == '_'))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// find the slot holding "name", or the slot where it should be inserted
+//
+Variable *findSlot(const char *name, size_t len, unsigned int hash)
+{
+    size_t mask = varTableSize - 1;
+    size_t i = hash & mask;
+    Variable *tombstone = NULL;
+
+    for (;;)
+    {
+        Variable *vp = &varTable[i];
+
+        if (vp->state == VAR_EMPTY)
+        {
+            return tombstone ? tombstone : vp;
+        }
+
+        if (vp->state == VAR_DELETED)
+        {
+            if (!tombstone)
+            {
+                tombstone = vp;
+            }
+        }
+        else if (vp->hash == hash && vp->nameLen == len && memcmp(vp->entry, name, len) == 0)
+        {
+            return vp;
+        }
+
+        i = (i + 1) & mask;
+    }
+}
+
+// double the table (or just drop the tombstones) and re-insert every variable
+//
+int growTable(size_t newSize)
+{
+    Variable *old = varTable;
+    size_t oldSize = varTableSize;
+
+    varTable = calloc(newSize, sizeof(Variable));
+
+    if (varTable == NULL)
+    {
+        varTable = old;
+        return -1;
+    }
+
+    varTableSize = newSize;
+    varTableDeleted = 0;
+
+    for (size_t i = 0; i < oldSize; ++i)
+    {
+        if (old[i].state == VAR_USED)
+        {
+            *findSlot(old[i].entry, old[i].nameLen, old[i].hash) = old[i];
+        }
+    }
+
+    free(old);
+
+    return 0;
+}
+
+void initialiseVariables(char **envp)
+{
+    varTable = calloc(VAR_TABLE_INITIAL_SIZE, sizeof(Variable));
+    varTableSize = varTable ? VAR_TABLE_INITIAL_SIZE : 0;
+
+    for (int i = 0; envp && envp[i]; ++i)
+    {
+        char *eq = strchr(envp[i], '=');
+
+        if (eq && validVariableName(envp[i], eq - envp[i]))
+        {
+            char *name = strndup(envp[i], eq - envp[i]);
+            setVariable(name, eq + 1, 1);
+            free(name);
+        }
+    }
+}
+
+const char *getVariable(const char *name)
+{
+    size_t len = strlen(name);
+
+    if (varTableSize == 0)
+    {
+        return NULL;
+    }
+
+    Variable *vp = findSlot(name, len, hashName(name, len));
+
+    return (vp->state == VAR_USED) ? vp->entry + len + 1 : NULL;
+}
+
+int setVariable(const char *name, const char *value, int exported)
+{
+    size_t len = strlen(name);
+
+    if (!validVariableName(name, len) || varTableSize == 0)
+    {
+        return -1;
+    }
+
+    // keep the load factor, tombstones included, under the limit
+    if ((varTableUsed + varTableDeleted + 1) * 100 > varTableSize * VAR_TABLE_MAX_LOAD)
+    {
+        size_t newSize = (varTableUsed + 1) * 100 > varTableSize * VAR_TABLE_MAX_LOAD / 2 ? varTableSize * 2 : varTableSize;
+
+        if (growTable(newSize) == -1)
+        {
+            return -1;
+        }
+    }
+
+    unsigned int hash = hashName(name, len);
+    Variable *vp = findSlot(name, len, hash);
+
+    // build the new "NAME=value" string before touching the table
+    size_t valueLen = strlen(value);
+    char *entry = malloc(len + valueLen + 2);
+
+    if (entry == NULL)
+    {
+        return -1;
+    }
+
+    memcpy(entry, name, len);
+    entry[len] = '=';
+    memcpy(entry + len + 1, value, valueLen + 1);
+
+    if (vp->state == VAR_USED)
+    {
+        free(vp->entry);
+
+        if (exported != -1)
+        {
+            envDirty |= (vp->exported != exported);
+            vp->exported = exported;
+        }
+    }
+    else
+    {
+        if (vp->state == VAR_DELETED)
+        {
+            varTableDeleted--;
+        }
+
+        vp->state = VAR_USED;
+        vp->nameLen = len;
+        vp->hash = hash;
+        vp->exported = (exported == 1);
+        varTableUsed++;
+    }
+
+    vp->entry = entry;
+
+    // the cached envp points at the old string
+    if (vp->exported)
+    {
+        envDirty = 1;
+    }
+
+    return 0;
+}
+
+int exportVariable(const char *name)
+{
+    const char *value = getVariable(name);
+
+    return setVariable(name, value ? value : "", 1);
+}
+
+int unsetVariable(const char *name)
+{
+    size_t len = strlen(name);
+
+    if (varTableSize == 0)
+    {
+        return 0;
+    }
+
+    Variable *vp = findSlot(name, len, hashName(name, len));
+
+    if (vp->state != VAR_USED)
+    {
+        return 0;
+    }
+
+    if (vp->exported)
+    {
+        envDirty = 1;
+    }
+
+    free(vp->entry);
+    vp->entry = NULL;
+    vp->state = VAR_DELETED;
+    varTableUsed--;
+    varTableDeleted++;
+
+    return 0;
+}
+
+char **variablesEnvironment(void)
+{
+    if (!envDirty && envCache)
+    {
+        return envCache;
+    }
+
+    size_t n = 0;
+
+    for (size_t i = 0; i < varTableSize; ++i)
+    {
+        if (varTable[i].state == VAR_USED && varTable[i].exported)
+        {
+            n++;
+        }
+    }
+
+    char **envp = malloc(sizeof(char *) * (n + 1));
+
+    if (envp == NULL)
+    {
+        // keep using the previous snapshot rather than failing the exec
+        return envCache;
+    }
+
+    n = 0;
+
+    for (size_t i = 0; i < varTableSize; ++i)
+    {
+        if (varTable[i].state == VAR_USED && varTable[i].exported)
+        {
+            envp[n++] = varTable[i].entry;
+        }
+    }
+
+    envp[n] = NULL;
+
+    free(envCache);
+    envCache = envp;
+    envDirty = 0;
+
+    return envCache;
+}
+
+int compareEntries(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+void listExportedVariables(void)
+{
+    char **envp = variablesEnvironment();
+    size_t n = 0;
+
+    while (envp && envp[n])
+    {
+        n++;
+    }
+
+    // sort a copy, the cached array is shared with exec
+    char **sorted = malloc(sizeof(char *) * (n + 1));
+
+    if (sorted == NULL)
+    {
+        perror("malloc()");
+        return;
+    }
+
+    memcpy(sorted, envp, sizeof(char *) * (n + 1));
+    qsort(sorted, n, sizeof(char *), compareEntries);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        char *eq = strchr(sorted[i], '=');
+        printf("export %.*s=\"%s\"\n", (int)(eq - sorted[i]), sorted[i], eq + 1);
+    }
+
+    free(sorted);
+}
+
+void clearVariables(void)
+{
+    for (size_t i = 0; i < varTableSize; ++i)
+    {
+        if (varTable[i].state == VAR_USED)
+        {
+            free(varTable[i].entry);
+        }
+    }
+
+    free(varTable);
+    free(envCache);
+
+    varTable = NULL;
+    varTableSize = 0;
+    varTableUsed = 0;
+    varTableDeleted = 0;
+    envCache = NULL;
+    envDirty = 1;
+}
@@ -0,0 +1,91 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include <stddef.h>
+
+#define VAR_TABLE_INITIAL_SIZE 64               // must be a power of two
+#define VAR_TABLE_MAX_LOAD 70                   // percentage of used + deleted slots before growing
+
+// slot states
+#define VAR_EMPTY   0
+#define VAR_USED    1
+#define VAR_DELETED 2                           // tombstone, keeps probe chains intact
+
+struct VariableStruct
+{
+    char *entry;            // "NAME=value" in a single allocation, pointed to directly by the envp cache
+    size_t nameLen;         // length of NAME, the value starts at entry + nameLen + 1
+    unsigned int hash;      // hash of NAME
+    int exported;           // 1 if the variable is passed to commands in their environment
+    int state;              // one of the slot states above
+};
+
+typedef struct VariableStruct Variable;  // variable type
+
+
+// purpose:
+//		create the variable table and import "envp" as exported variables
+//
+void initialiseVariables(char **envp);
+
+// purpose:
+//		look up a variable
+//
+// return:
+//		the value, or NULL if the variable is not set; the pointer stays valid
+//		until the variable is next changed
+//
+const char *getVariable(const char *name);
+
+// purpose:
+//		set a variable, creating it if necessary
+//
+// note:
+//		"exported" is 1 to export the variable, 0 to keep it local to the shell,
+//		and -1 to leave an existing variable's export flag as it is
+//
+// return:
+//		0 if successful, -1 if the name is invalid or memory cannot be allocated
+//
+int setVariable(const char *name, const char *value, int exported);
+
+// purpose:
+//		mark a variable as exported, creating it empty if it does not exist
+//
+int exportVariable(const char *name);
+
+// purpose:
+//		remove a variable
+//
+// return:
+//		0 if the variable was removed or did not exist
+//
+int unsetVariable(const char *name);
+
+// purpose:
+//		check that the first "len" characters of "name" form a valid variable name
+//
+int validVariableName(const char *name, size_t len);
+
+// purpose:
+//		the environment for execve(), as an envp array
+//
+// note:
+//		the array is cached and only rebuilt after the set of exported variables
+//		or one of their values has changed, so each exec costs O(1) here. The
+//		strings are shared with the table, the caller must not modify them.
+//
+char **variablesEnvironment(void);
+
+// purpose:
+//		print the exported variables, sorted, in a form that can be re-entered
+//
+void listExportedVariables(void);
+
+// purpose:
+//		remove every variable and release the table, initialiseVariables() can
+//		then start again from a new environment
+//
+void clearVariables(void);
+
+#endif